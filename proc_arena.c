@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+#include "proc_arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define ARENA_TRIM_MIN (1024 * 1024)        // Tails smaller than this are not worth a madvise
+#define INTERN_ARENA_SIZE (64 * 1024 * 1024)
+#define INTERN_COMPACT_MIN (64 * 1024)      // Never compact arenas smaller than this
+
+// Reserve size bytes of address space
+int proc_arena_init(struct proc_arena *arena, size_t size) {
+    memset(arena, 0, sizeof(*arena));
+
+    // Only reserved: pages get memory when they are first written
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+    arena->base = base;
+    arena->reserved = size;
+    return 0;
+}
+
+// Release the reserved range
+void proc_arena_destroy(struct proc_arena *arena) {
+    if (arena->base != NULL) {
+        munmap(arena->base, arena->reserved);
+    }
+    memset(arena, 0, sizeof(*arena));
+}
+
+// Carve size bytes aligned to align
+void *proc_arena_alloc(struct proc_arena *arena, size_t size, size_t align) {
+    size_t start = (arena->used + align - 1) & ~(align - 1);
+    if (start > arena->reserved || size > arena->reserved - start) {
+        return NULL;
+    }
+
+    arena->used = start + size;
+    if (arena->used > arena->touched) {
+        arena->touched = arena->used;
+    }
+    return arena->base + start;
+}
+
+// Start over, giving a large unused tail back to the kernel
+void proc_arena_reset(struct proc_arena *arena) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t keep = (arena->used + page - 1) & ~(page - 1);
+
+    if (arena->touched > keep * 2 + ARENA_TRIM_MIN) {
+        madvise(arena->base + keep, arena->touched - keep, MADV_DONTNEED);
+        arena->touched = keep;
+    }
+    arena->used = 0;
+}
+
+// FNV-1a over a NUL-terminated string
+static uint32_t hash_string(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h = (h ^ (unsigned char) *s++) * 16777619u;
+    }
+    return h;
+}
+
+// Allocate both slot arrays with the given power-of-two capacity
+static int alloc_slots(struct proc_intern *tab, size_t capacity) {
+    struct proc_intern_slot *slots = calloc(capacity, sizeof(*slots));
+    struct proc_intern_slot *spare = calloc(capacity, sizeof(*spare));
+    if (slots == NULL || spare == NULL) {
+        free(slots);
+        free(spare);
+        return -1;
+    }
+
+    free(tab->slots);
+    free(tab->spare);
+    tab->slots = slots;
+    tab->spare = spare;
+    tab->mask = capacity - 1;
+    return 0;
+}
+
+// Reserve both string arenas and the slot arrays
+int proc_intern_init(struct proc_intern *tab) {
+    memset(tab, 0, sizeof(*tab));
+    if (proc_arena_init(&tab->arenas[0], INTERN_ARENA_SIZE) < 0 ||
+        proc_arena_init(&tab->arenas[1], INTERN_ARENA_SIZE) < 0 || alloc_slots(tab, 1024) < 0) {
+        proc_intern_destroy(tab);
+        return -1;
+    }
+    return 0;
+}
+
+// Free the table
+void proc_intern_destroy(struct proc_intern *tab) {
+    proc_arena_destroy(&tab->arenas[0]);
+    proc_arena_destroy(&tab->arenas[1]);
+    free(tab->slots);
+    free(tab->spare);
+    memset(tab, 0, sizeof(*tab));
+}
+
+// Place a slot into an array during a rehash
+static void place_slot(struct proc_intern *tab, struct proc_intern_slot *slots, const struct proc_intern_slot *slot) {
+    size_t i = slot->hash & tab->mask;
+    while (slots[i].offset != 0) {
+        i = (i + 1) & tab->mask;
+    }
+    slots[i] = *slot;
+}
+
+// Double the capacity, keeping every string
+static int grow(struct proc_intern *tab) {
+    size_t old_capacity = tab->mask + 1;
+    struct proc_intern_slot *old = tab->slots;
+
+    tab->slots = NULL;
+    if (alloc_slots(tab, old_capacity * 2) < 0) {
+        tab->slots = old;
+        return -1;
+    }
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].offset != 0) {
+            place_slot(tab, tab->slots, &old[i]);
+        }
+    }
+    free(old);
+    return 0;
+}
+
+// Copy the strings seen in the previous generation into the other arena and drop the rest
+static void compact(struct proc_intern *tab) {
+    size_t capacity = tab->mask + 1;
+    const char *old = tab->arenas[tab->active].base;
+    struct proc_arena *to = &tab->arenas[1 - tab->active];
+    size_t used = 0;
+
+    // The other arena was last read by columns from before the previous generation
+    proc_arena_reset(to);
+    memset(tab->spare, 0, capacity * sizeof(*tab->spare));
+    for (size_t i = 0; i < capacity; i++) {
+        struct proc_intern_slot slot = tab->slots[i];
+        if (slot.offset == 0 || slot.seen + 1 < tab->generation) {
+            continue;
+        }
+
+        // The live strings are a subset of the old arena, so they always fit
+        size_t len = strlen(old + slot.offset - 1) + 1;
+        char *copy = proc_arena_alloc(to, len, 1);
+        memcpy(copy, old + slot.offset - 1, len);
+        slot.offset = (uint32_t) (copy - to->base) + 1;
+        place_slot(tab, tab->spare, &slot);
+        used++;
+    }
+
+    struct proc_intern_slot *tmp = tab->slots;
+    tab->slots = tab->spare;
+    tab->spare = tmp;
+    tab->used = used;
+    tab->active = 1 - tab->active;
+    tab->compacted = tab->generation;
+}
+
+// Start a generation, compacting when most of the active arena is garbage
+void proc_intern_begin(struct proc_intern *tab) {
+    const struct proc_arena *arena = &tab->arenas[tab->active];
+
+    tab->generation++;
+    tab->last_live_bytes = tab->live_bytes;
+    tab->live_bytes = 0;
+
+    // Two generations apart, so nothing still reads the arena that compact() reuses
+    if (arena->used > INTERN_COMPACT_MIN && arena->used > tab->last_live_bytes * 2 &&
+        tab->generation - tab->compacted > 1) {
+        compact(tab);
+    }
+}
+
+// Return the offset of s, adding it if it is new
+long proc_intern_string(struct proc_intern *tab, const char *s) {
+    // Keep the load factor at or below one half so probe chains stay short
+    if ((tab->used + 1) * 2 > tab->mask + 1 && grow(tab) < 0) {
+        return -1;
+    }
+
+    struct proc_arena *arena = &tab->arenas[tab->active];
+    uint32_t hash = hash_string(s);
+    size_t i = hash & tab->mask;
+    while (tab->slots[i].offset != 0) {
+        struct proc_intern_slot *slot = &tab->slots[i];
+        const char *str = arena->base + slot->offset - 1;
+        if (slot->hash == hash && strcmp(str, s) == 0) {
+            if (slot->seen != tab->generation) {
+                slot->seen = tab->generation;
+                tab->live_bytes += strlen(str) + 1;
+            }
+            return slot->offset - 1;
+        }
+        i = (i + 1) & tab->mask;
+    }
+
+    size_t len = strlen(s) + 1;
+    char *copy = proc_arena_alloc(arena, len, 1);
+    if (copy == NULL) {
+        return -1;
+    }
+    memcpy(copy, s, len);
+
+    struct proc_intern_slot *slot = &tab->slots[i];
+    slot->offset = (uint32_t) (copy - arena->base) + 1;
+    slot->hash = hash;
+    slot->seen = tab->generation;
+    tab->used++;
+    tab->live_bytes += len;
+    return slot->offset - 1;
+}
+
+// Base that offsets from this generation are relative to
+const char *proc_intern_base(const struct proc_intern *tab) {
+    return tab->arenas[tab->active].base;
+}
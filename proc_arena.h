@@ -0,0 +1,72 @@
+#ifndef PROC_ARENA_H
+#define PROC_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A bump allocator over one reserved range of address space. Pages are only
+// backed by memory once they are touched, and the range never moves, so another
+// thread may keep reading what was allocated while more is carved off the end.
+// A reset is O(1): it just rewinds to the start.
+struct proc_arena {
+    char *base;
+    size_t reserved;        // Size of the reserved range
+    size_t used;            // Bytes handed out since the last reset
+    size_t touched;         // Highest used since the tail was last given back
+};
+
+// Reserve size bytes of address space; returns 0 or -1
+int proc_arena_init(struct proc_arena *arena, size_t size);
+
+// Release the reserved range
+void proc_arena_destroy(struct proc_arena *arena);
+
+// Carve size bytes aligned to align (a power of two); NULL once the reserved range is used up
+void *proc_arena_alloc(struct proc_arena *arena, size_t size, size_t align);
+
+// Start over. When the round that just ended used much less than the rounds before
+// it, the unused tail is given back to the kernel, so memory follows the process count.
+void proc_arena_reset(struct proc_arena *arena);
+
+// One interned string
+struct proc_intern_slot {
+    uint32_t offset;        // Offset in the active arena + 1; 0 is empty
+    uint32_t hash;
+    unsigned int seen;      // Generation in which the string was last interned
+};
+
+// Hash-consed strings (command and user names) that persist across generations,
+// so a refresh only copies names it has never seen. Strings live in one of two
+// arenas. Once most of the active arena holds names that are no longer in use,
+// the live ones are copied to the other arena and the old one is retired until
+// nobody can still be reading it.
+struct proc_intern {
+    struct proc_arena arenas[2];
+    int active;
+    struct proc_intern_slot *slots;
+    struct proc_intern_slot *spare;     // Same size as slots, for compaction
+    size_t mask;                        // Capacity - 1; the capacity is a power of two
+    size_t used;
+    unsigned int generation;
+    unsigned int compacted;             // Generation of the last compaction
+    size_t live_bytes;                  // Bytes of the strings interned in this generation
+    size_t last_live_bytes;             // The same for the previous generation
+};
+
+// Reserve both string arenas and the slot arrays; returns 0 or -1
+int proc_intern_init(struct proc_intern *tab);
+
+// Free the table
+void proc_intern_destroy(struct proc_intern *tab);
+
+// Start a generation. This may move every string still in use to the other arena,
+// so the caller must be done with offsets and bases from before the previous call.
+void proc_intern_begin(struct proc_intern *tab);
+
+// Return the offset of s from proc_intern_base, adding it if it is new; -1 on failure
+long proc_intern_string(struct proc_intern *tab, const char *s);
+
+// Base that offsets from this generation are relative to
+const char *proc_intern_base(const struct proc_intern *tab);
+
+#endif
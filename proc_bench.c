@@ -0,0 +1,285 @@
+#define _GNU_SOURCE
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "proc_scan.h"
+#include "proc_diff.h"
+#include "proc_cpu.h"
+#include "proc_columns.h"
+#include "proc_rollup.h"
+#include "proc_filter.h"
+
+// Times each stage of a refresh against a proc tree (normally one written by
+// proc_fixture) and counts the heap allocations it makes. The first WARMUP
+// refreshes size every buffer and are not counted, so the numbers show
+// steady-state refreshes.
+
+#define STAGE_COUNT 8
+#define WARMUP 2        // One refresh into each of the two snapshot buffers
+
+enum { STAGE_SCAN, STAGE_MODULE, STAGE_DIFF, STAGE_CPU, STAGE_COLUMNS, STAGE_ROLLUP, STAGE_FILTER_INDEX,
+       STAGE_FILTER_MATCH };
+static const char *const stage_names[STAGE_COUNT] = { "scan /proc", "module table", "diff", "cpu table",
+                                                     "columns", "rollups", "filter index", "filter match" };
+
+// Allocation counters, bumped by the malloc wrappers below
+static _Atomic unsigned long alloc_calls;
+static _Atomic unsigned long long alloc_bytes;
+
+// glibc's own allocator entry points, so the wrappers need no dlsym
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+// Function to count malloc calls
+void *malloc(size_t size) {
+    atomic_fetch_add(&alloc_calls, 1);
+    atomic_fetch_add(&alloc_bytes, size);
+    return __libc_malloc(size);
+}
+
+// Function to count calloc calls
+void *calloc(size_t nmemb, size_t size) {
+    atomic_fetch_add(&alloc_calls, 1);
+    atomic_fetch_add(&alloc_bytes, nmemb * size);
+    return __libc_calloc(nmemb, size);
+}
+
+// Function to count realloc calls
+void *realloc(void *ptr, size_t size) {
+    atomic_fetch_add(&alloc_calls, 1);
+    atomic_fetch_add(&alloc_bytes, size);
+    return __libc_realloc(ptr, size);
+}
+
+// Totals for one stage over all measured refreshes
+struct stage_stats {
+    double total_ms;
+    double min_ms;
+    double max_ms;
+    unsigned long allocs;
+    unsigned long long bytes;
+    size_t runs;
+};
+
+// Function to return a monotonic timestamp in milliseconds
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// Snapshot of the counters taken when a stage starts
+struct stage_mark {
+    double start_ms;
+    unsigned long allocs;
+    unsigned long long bytes;
+};
+
+// Function to start timing a stage
+static void stage_begin(struct stage_mark *mark) {
+    mark->allocs = atomic_load(&alloc_calls);
+    mark->bytes = atomic_load(&alloc_bytes);
+    mark->start_ms = now_ms();
+}
+
+// Function to add the time and allocations since stage_begin to a stage
+static void stage_end(struct stage_stats *stats, const struct stage_mark *mark, int record) {
+    double ms = now_ms() - mark->start_ms;
+    if (!record) {
+        return;
+    }
+    stats->total_ms += ms;
+    if (stats->runs == 0 || ms < stats->min_ms) {
+        stats->min_ms = ms;
+    }
+    if (ms > stats->max_ms) {
+        stats->max_ms = ms;
+    }
+    stats->allocs += atomic_load(&alloc_calls) - mark->allocs;
+    stats->bytes += atomic_load(&alloc_bytes) - mark->bytes;
+    stats->runs++;
+}
+
+// Main function
+int main(int argc, char *argv[]) {
+    const char *root = NULL;
+    size_t threads = 1;
+    int iterations = 10;
+    const char *filter_text = "bash uid=1000 minrss=1024";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = (size_t) atoi(argv[++i]);  // 0 = one per online CPU
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter_text = argv[++i];  // Timed once per refresh against the index
+        } else if (root == NULL && argv[i][0] != '-') {
+            root = argv[i];
+        } else {
+            root = NULL;
+            break;
+        }
+    }
+    if (root == NULL || iterations < 1) {
+        fprintf(stderr, "Usage: %s [--threads N] [--iterations N] [--filter EXPR] PROC_ROOT\n", argv[0]);
+        return 1;
+    }
+
+    char module_path[4096];
+    snprintf(module_path, sizeof(module_path), "%s/proc_info", root);
+
+    struct proc_scanner scanner;
+    if (proc_scanner_init(&scanner, root) < 0) {
+        perror(root);
+        return 1;
+    }
+    proc_scanner_set_threads(&scanner, threads);
+
+    struct proc_snapshot bufs[2];
+    struct proc_snapshot module_snap;
+    struct proc_diff diff;
+    struct proc_cpu_table table;
+    struct proc_columns cols[2];
+    struct proc_intern strings;
+    struct proc_users users;
+    struct proc_rollup rollups[3];
+    struct proc_filter_index index;
+    struct proc_filter filter;
+    uint64_t *matched = NULL;          // The matched bitmap, then the shown one
+    size_t matched_words = 0;
+    size_t matches = 0;
+    char error[128];
+    struct stage_stats stats[STAGE_COUNT];
+    struct stage_mark mark;
+    int current = 0;
+    int have_module = 1;
+
+    memset(bufs, 0, sizeof(bufs));
+    memset(&module_snap, 0, sizeof(module_snap));
+    memset(&diff, 0, sizeof(diff));
+    memset(cols, 0, sizeof(cols));
+    memset(stats, 0, sizeof(stats));
+    if (proc_cpu_table_init(&table, 4096) < 0 || proc_intern_init(&strings) < 0 || proc_users_init(&users, 0) < 0 ||
+        proc_rollup_init(&rollups[PROC_ROLLUP_USER], PROC_ROLLUP_USER) < 0 ||
+        proc_rollup_init(&rollups[PROC_ROLLUP_COMM], PROC_ROLLUP_COMM) < 0 ||
+        proc_rollup_init(&rollups[PROC_ROLLUP_TREE], PROC_ROLLUP_TREE) < 0) {
+        perror("Error allocating tables");
+        return 1;
+    }
+    if (proc_filter_parse(&filter, filter_text, error, sizeof(error)) < 0) {
+        fprintf(stderr, "--filter: %s\n", error);
+        return 1;
+    }
+    proc_filter_index_init(&index);
+
+    for (int iter = 0; iter < WARMUP + iterations; iter++) {
+        int record = iter >= WARMUP;
+        int next = 1 - current;
+
+        stage_begin(&mark);
+        if (proc_scan_snapshot(&scanner, &bufs[next]) < 0) {
+            perror("proc_scan_snapshot");
+            return 1;
+        }
+        stage_end(&stats[STAGE_SCAN], &mark, record);
+
+        if (have_module) {
+            stage_begin(&mark);
+            have_module = proc_scan_module(&scanner, module_path, NULL, &module_snap) == 0;
+            stage_end(&stats[STAGE_MODULE], &mark, record && have_module);
+        }
+
+        stage_begin(&mark);
+        if (proc_diff_snapshots(&bufs[current], &bufs[next], &diff) < 0) {
+            perror("proc_diff_snapshots");
+            return 1;
+        }
+        stage_end(&stats[STAGE_DIFF], &mark, record);
+
+        stage_begin(&mark);
+        proc_cpu_table_begin(&table);
+        for (size_t i = 0; i < bufs[next].count; i++) {
+            proc_cpu_table_update(&table, &bufs[next].entries[i]);
+        }
+        proc_cpu_table_sweep(&table);
+        stage_end(&stats[STAGE_CPU], &mark, record);
+
+        stage_begin(&mark);
+        if (proc_columns_build(&cols[next], &bufs[next], &strings, &users) < 0) {
+            perror("proc_columns_build");
+            return 1;
+        }
+        stage_end(&stats[STAGE_COLUMNS], &mark, record);
+
+        // All three kinds, from the diff above
+        stage_begin(&mark);
+        for (int k = 0; k < 3; k++) {
+            if (proc_rollup_apply(&rollups[k], &bufs[current], &bufs[next], &diff) < 0) {
+                perror("proc_rollup_apply");
+                return 1;
+            }
+        }
+        stage_end(&stats[STAGE_ROLLUP], &mark, record);
+
+        // The fixture writes no command lines, so the index holds the names
+        stage_begin(&mark);
+        if (proc_filter_index_update(&index, &scanner, &bufs[next], NULL, 0) < 0) {
+            perror("proc_filter_index_update");
+            return 1;
+        }
+        stage_end(&stats[STAGE_FILTER_INDEX], &mark, record);
+
+        size_t words = PROC_FILTER_WORDS(bufs[next].count);
+        if (words > matched_words) {
+            uint64_t *bigger = realloc(matched, 2 * words * sizeof(*matched));
+            if (bigger == NULL) {
+                perror("Error allocating bitmaps");
+                return 1;
+            }
+            matched = bigger;
+            matched_words = words;
+        }
+        stage_begin(&mark);
+        matches = proc_filter_match(&index, &filter, matched, matched + words);
+        stage_end(&stats[STAGE_FILTER_MATCH], &mark, record);
+
+        current = next;
+    }
+
+    printf("%s: %zu processes, %zu scan thread%s, %d refreshes\n", root, bufs[current].count,
+           scanner.threads, scanner.threads == 1 ? "" : "s", iterations);
+    printf("%-14s %10s %10s %10s %12s %14s\n", "stage", "mean ms", "min ms", "max ms", "allocs/ref", "bytes/ref");
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        if (stats[s].runs == 0) {
+            printf("%-14s %10s\n", stage_names[s], "skipped");
+            continue;
+        }
+        printf("%-14s %10.3f %10.3f %10.3f %12.1f %14.1f\n", stage_names[s], stats[s].total_ms / stats[s].runs,
+               stats[s].min_ms, stats[s].max_ms, (double) stats[s].allocs / stats[s].runs,
+               (double) stats[s].bytes / stats[s].runs);
+    }
+    printf("user name lookups: %lu\n", users.lookups);
+    printf("filter \"%s\": %zu matches\n", filter_text, matches);
+
+    for (int k = 0; k < 3; k++) {
+        proc_rollup_destroy(&rollups[k]);
+    }
+    proc_filter_index_destroy(&index);
+    proc_filter_free(&filter);
+    free(matched);
+    proc_cpu_table_destroy(&table);
+    proc_columns_free(&cols[0]);
+    proc_columns_free(&cols[1]);
+    proc_intern_destroy(&strings);
+    proc_users_destroy(&users);
+    proc_diff_free(&diff);
+    proc_snapshot_free(&module_snap);
+    proc_snapshot_free(&bufs[0]);
+    proc_snapshot_free(&bufs[1]);
+    proc_scanner_destroy(&scanner);
+    return 0;
+}
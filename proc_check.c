@@ -0,0 +1,495 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "proc_scan.h"
+#include "proc_diff.h"
+#include "proc_history.h"
+
+// Checks the parts whose answer is exact against what they should give: diffs of
+// hand-built snapshots, history files read back what was recorded, and given a proc tree (normally one written
+// by proc_fixture), scans on several threads find what one thread finds.
+// `make check` runs it; every failure is printed and the exit status is 1 if
+// there was any.
+
+#define SAMPLES 48              // Recorded in the first run
+#define MORE_SAMPLES 16         // Appended after the cut
+#define PROCESSES 300           // Roughly, at the start
+#define KEYFRAME_INTERVAL 7
+#define BASE_MS 1700000000000ULL
+
+// Thread counts whose scans are compared with a scan on one thread; 0 is one per online CPU
+static const size_t scan_threads[] = { 2, 3, 8, 0 };
+
+static int failures;
+
+// Function to report a check that failed
+static int check(int ok, const char *format, ...) {
+    if (!ok) {
+        va_list ap;
+        va_start(ap, format);
+        fputs("FAIL: ", stdout);
+        vprintf(format, ap);
+        putchar('\n');
+        va_end(ap);
+        failures++;
+    }
+    return ok;
+}
+
+// Function to return the next number of a fixed pseudo-random sequence, so every run checks the same samples
+static unsigned int next_random(void) {
+    static unsigned int state = 12345;
+    state = state * 1103515245u + 12345u;
+    return state >> 8;
+}
+
+// Function to check whether two snapshots hold the same processes
+static int same_snapshot(const struct proc_snapshot *a, const struct proc_snapshot *b) {
+    if (a->count != b->count) {
+        return 0;
+    }
+    for (size_t i = 0; i < a->count; i++) {
+        const struct proc_entry *x = &a->entries[i], *y = &b->entries[i];
+        if (x->pid != y->pid || x->ppid != y->ppid || x->uid != y->uid || x->prio != y->prio ||
+            x->state != y->state || x->threads != y->threads || x->rss_kb != y->rss_kb || x->utime != y->utime ||
+            x->stime != y->stime || x->start_time != y->start_time || strcmp(x->comm, y->comm) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Function to copy a snapshot into one the caller owns; returns 0 or -1
+static int copy_snapshot(struct proc_snapshot *dst, const struct proc_snapshot *src) {
+    if (proc_snapshot_reserve(dst, src->count) < 0) {
+        return -1;
+    }
+    memcpy(dst->entries, src->entries, src->count * sizeof(*src->entries));
+    dst->count = src->count;
+    return 0;
+}
+
+// A process of a hand-built snapshot; a pid of 0 ends the list
+struct diff_row {
+    pid_t pid;
+    pid_t ppid;
+    unsigned long long start_time;
+    unsigned long utime;
+    const char *comm;
+};
+
+// Two snapshots and the changes between them, in PID order; a pid of 0 ends the list
+struct diff_case {
+    const char *name;
+    struct diff_row old_rows[6];
+    struct diff_row new_rows[6];
+    struct proc_change changes[8];
+};
+
+#define NONE PROC_NO_INDEX
+
+static const struct diff_case diff_cases[] = {
+    { "nothing changed",
+      { { 1, 0, 10, 5, "init" }, { 7, 1, 20, 0, "sh" } },
+      { { 1, 0, 10, 5, "init" }, { 7, 1, 20, 0, "sh" } },
+      { { 0 } } },
+    { "first snapshot",
+      { { 0 } },
+      { { 1, 0, 10, 5, "init" }, { 7, 1, 20, 0, "sh" } },
+      { { 1, PROC_CHANGE_ADDED, NONE, 0 }, { 7, PROC_CHANGE_ADDED, NONE, 1 } } },
+    { "everything exited",
+      { { 1, 0, 10, 5, "init" }, { 7, 1, 20, 0, "sh" } },
+      { { 0 } },
+      { { 1, PROC_CHANGE_REMOVED, 0, NONE }, { 7, PROC_CHANGE_REMOVED, 1, NONE } } },
+    { "added before, between and after",
+      { { 5, 1, 10, 0, "a" }, { 9, 1, 11, 0, "b" } },
+      { { 2, 1, 30, 0, "x" }, { 5, 1, 10, 0, "a" }, { 7, 5, 31, 0, "y" }, { 9, 1, 11, 0, "b" },
+        { 12, 9, 32, 0, "z" } },
+      { { 2, PROC_CHANGE_ADDED, NONE, 0 }, { 7, PROC_CHANGE_ADDED, NONE, 2 }, { 12, PROC_CHANGE_ADDED, NONE, 4 } } },
+    { "removed before, between and after",
+      { { 2, 1, 30, 0, "x" }, { 5, 1, 10, 0, "a" }, { 7, 5, 31, 0, "y" }, { 9, 1, 11, 0, "b" },
+        { 12, 9, 32, 0, "z" } },
+      { { 5, 1, 10, 0, "a" }, { 9, 1, 11, 0, "b" } },
+      { { 2, PROC_CHANGE_REMOVED, 0, NONE }, { 7, PROC_CHANGE_REMOVED, 2, NONE },
+        { 12, PROC_CHANGE_REMOVED, 4, NONE } } },
+    { "updated CPU time and name",
+      { { 1, 0, 10, 5, "init" }, { 7, 1, 20, 0, "sh" }, { 8, 1, 21, 3, "cc" } },
+      { { 1, 0, 10, 6, "init" }, { 7, 1, 20, 0, "bash" }, { 8, 1, 21, 3, "cc" } },
+      { { 1, PROC_CHANGE_UPDATED, 0, 0 }, { 7, PROC_CHANGE_UPDATED, 1, 1 } } },
+    { "reparented, alone and with an update",
+      { { 1, 0, 10, 5, "init" }, { 7, 1, 20, 0, "sh" }, { 8, 7, 21, 3, "cc" }, { 9, 7, 22, 0, "ld" } },
+      { { 1, 0, 10, 5, "init" }, { 7, 1, 20, 0, "sh" }, { 8, 1, 21, 3, "cc" }, { 9, 1, 22, 1, "ld" } },
+      { { 8, PROC_CHANGE_REPARENTED, 2, 2 }, { 9, PROC_CHANGE_REPARENTED | PROC_CHANGE_UPDATED, 3, 3 } } },
+    { "PID reused by another process",
+      { { 1, 0, 10, 5, "init" }, { 7, 1, 20, 0, "sh" }, { 8, 1, 21, 3, "cc" } },
+      { { 1, 0, 10, 5, "init" }, { 7, 1, 90, 0, "sh" }, { 8, 1, 21, 3, "cc" } },
+      { { 7, PROC_CHANGE_REMOVED, 1, NONE }, { 7, PROC_CHANGE_ADDED, NONE, 1 } } },
+    { "PID reused at the end, next to an exit and a start",
+      { { 1, 0, 10, 5, "init" }, { 3, 1, 11, 0, "old" }, { 9, 1, 20, 0, "sh" } },
+      { { 1, 0, 10, 5, "init" }, { 4, 1, 50, 0, "new" }, { 9, 4, 60, 0, "sh" } },
+      { { 3, PROC_CHANGE_REMOVED, 1, NONE }, { 4, PROC_CHANGE_ADDED, NONE, 1 }, { 9, PROC_CHANGE_REMOVED, 2, NONE },
+        { 9, PROC_CHANGE_ADDED, NONE, 2 } } },
+};
+
+// Function to build a snapshot from a list of hand-built rows; returns 0 or -1
+static int build_snapshot(struct proc_snapshot *snap, const struct diff_row *rows, size_t max) {
+    snap->count = 0;
+    if (proc_snapshot_reserve(snap, max) < 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < max && rows[i].pid != 0; i++) {
+        struct proc_entry *entry = &snap->entries[snap->count++];
+        memset(entry, 0, sizeof(*entry));
+        entry->pid = rows[i].pid;
+        entry->ppid = rows[i].ppid;
+        entry->start_time = rows[i].start_time;
+        entry->utime = rows[i].utime;
+        entry->state = 'S';
+        snprintf(entry->comm, sizeof(entry->comm), "%s", rows[i].comm);
+    }
+    return 0;
+}
+
+// Function to check the diff of every hand-built case, reusing one diff as the GUI does
+static void check_diff(void) {
+    struct proc_snapshot old_snap, new_snap;
+    struct proc_diff diff;
+    memset(&old_snap, 0, sizeof(old_snap));
+    memset(&new_snap, 0, sizeof(new_snap));
+    memset(&diff, 0, sizeof(diff));
+
+    for (size_t c = 0; c < sizeof(diff_cases) / sizeof(diff_cases[0]); c++) {
+        const struct diff_case *test = &diff_cases[c];
+        size_t expected = 0;
+        while (expected < 8 && test->changes[expected].pid != 0) {
+            expected++;
+        }
+        if (!check(build_snapshot(&old_snap, test->old_rows, 6) == 0 &&
+                   build_snapshot(&new_snap, test->new_rows, 6) == 0, "diff: out of memory") ||
+            !check(proc_diff_snapshots(&old_snap, &new_snap, &diff) == 0, "diff %s: failed", test->name) ||
+            !check(diff.count == expected, "diff %s: %zu changes instead of %zu", test->name, diff.count, expected)) {
+            continue;
+        }
+        for (size_t i = 0; i < expected; i++) {
+            const struct proc_change *got = &diff.changes[i], *want = &test->changes[i];
+            if (!check(got->pid == want->pid && got->flags == want->flags && got->old_index == want->old_index &&
+                       got->new_index == want->new_index, "diff %s: change %zu is pid %d flags %#x, not pid %d flags %#x",
+                       test->name, i, got->pid, got->flags, want->pid, want->flags)) {
+                break;
+            }
+        }
+    }
+    proc_snapshot_free(&old_snap);
+    proc_snapshot_free(&new_snap);
+    proc_diff_free(&diff);
+}
+
+// Function to fill in a new process
+static void new_process(struct proc_entry *entry, pid_t pid, unsigned long long start_time) {
+    memset(entry, 0, sizeof(*entry));
+    entry->pid = pid;
+    entry->ppid = pid > 1 ? 1 + (pid_t) (next_random() % (unsigned int) (pid - 1)) : 0;
+    entry->uid = next_random() % 4 == 0 ? (uid_t) -1 : 1000 + next_random() % 3;
+    entry->prio = 20;
+    entry->state = 'S';
+    entry->threads = 1 + (int) (next_random() % 8);
+    entry->rss_kb = next_random() % 100000;
+    entry->start_time = start_time;
+    snprintf(entry->comm, sizeof(entry->comm), "proc%u", next_random() % 40);
+}
+
+// Function to turn one sample into the next: processes exit and start, some
+// reusing the PID of one that exited, and the rest change some of their fields
+static int next_sample(struct proc_snapshot *snap, unsigned long long tick) {
+    if (proc_snapshot_reserve(snap, snap->count + 16) < 0) {
+        return -1;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < snap->count; i++) {
+        struct proc_entry *entry = &snap->entries[i];
+        unsigned int r = next_random() % 100;
+        if (r < 2 && entry->pid != 1) {
+            continue;
+        }
+        if (r < 40) {
+            entry->utime += next_random() % 50;
+            entry->stime += next_random() % 5;
+        }
+        if (r < 10) {
+            entry->rss_kb += next_random() % 1000;
+            entry->state = "RSDZ"[next_random() % 4];
+        }
+        if (r == 10) {
+            entry->ppid = 1;
+            entry->prio = 39;
+            entry->threads++;
+        }
+        if (r == 11) {
+            entry->uid = 0;
+            snprintf(entry->comm, sizeof(entry->comm), "renamed%u", next_random() % 10);
+        }
+        snap->entries[kept++] = *entry;
+    }
+    snap->count = kept;
+
+    // New processes take free PIDs anywhere, as the kernel does once PIDs wrap
+    for (unsigned int n = next_random() % 8; n > 0; n--) {
+        pid_t pid = 1 + (pid_t) (next_random() % (PROCESSES * 2));
+        size_t i = 0;
+        while (i < snap->count && snap->entries[i].pid < pid) {
+            i++;
+        }
+        if (i < snap->count && snap->entries[i].pid == pid) {
+            continue;
+        }
+        memmove(&snap->entries[i + 1], &snap->entries[i], (snap->count - i) * sizeof(*snap->entries));
+        new_process(&snap->entries[i], pid, tick);
+        snap->count++;
+    }
+    return 0;
+}
+
+// Function to return the recorded time of a sample; the gaps vary so that time deltas do too
+static uint64_t sample_ms(size_t i) {
+    return BASE_MS + i * 1000 + (i % 3) * 170;
+}
+
+// Function to return the CPU totals recorded with a sample
+static struct proc_cpu_totals sample_totals(size_t i) {
+    struct proc_cpu_totals totals = { 1000000 + i * 400, 900000 + i * 300 };
+    return totals;
+}
+
+// Function to make every sample, each a copy the checks compare against
+static int make_samples(struct proc_snapshot *samples, size_t count) {
+    struct proc_snapshot snap;
+    memset(&snap, 0, sizeof(snap));
+    if (proc_snapshot_reserve(&snap, PROCESSES) < 0) {
+        return -1;
+    }
+    for (pid_t pid = 1; pid <= PROCESSES; pid++) {
+        if (next_random() % 4 != 0) {
+            new_process(&snap.entries[snap.count++], pid, (unsigned long long) pid);
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        if ((i > 0 && next_sample(&snap, 1000 + i) < 0) || copy_snapshot(&samples[i], &snap) < 0) {
+            proc_snapshot_free(&snap);
+            return -1;
+        }
+    }
+    proc_snapshot_free(&snap);
+    return 0;
+}
+
+// Function to append samples first .. first + count - 1 to a history file
+static int record(const char *path, const struct proc_snapshot *samples, size_t first, size_t count) {
+    struct proc_recorder rec;
+    if (proc_recorder_open(&rec, path, KEYFRAME_INTERVAL) < 0) {
+        return -1;
+    }
+    for (size_t i = first; i < first + count; i++) {
+        struct proc_cpu_totals totals = sample_totals(i);
+        if (proc_recorder_append(&rec, &samples[i], sample_ms(i) * 1000000ULL, &totals) < 0) {
+            proc_recorder_close(&rec);
+            return -1;
+        }
+    }
+    proc_recorder_close(&rec);
+    return 0;
+}
+
+// Function to check that the current frame of a replay is sample i
+static int check_frame(const struct proc_replay *replay, const struct proc_snapshot *samples, size_t i,
+                       const char *what) {
+    struct proc_cpu_totals totals = sample_totals(i);
+    return check(same_snapshot(proc_replay_snapshot(replay), &samples[i]), "%s: frame of sample %zu differs", what, i) &&
+           check(replay->time_ms == sample_ms(i), "%s: sample %zu replayed at %llu ms, recorded at %llu ms", what, i,
+                 (unsigned long long) replay->time_ms, (unsigned long long) sample_ms(i)) &&
+           check(replay->totals.total == totals.total && replay->totals.idle == totals.idle,
+                 "%s: CPU totals of sample %zu differ", what, i);
+}
+
+// Function to replay a whole file and check it holds exactly the listed samples, in order
+static void check_replay(const char *path, const struct proc_snapshot *samples, const size_t *order, size_t count,
+                         const char *what) {
+    struct proc_replay replay;
+    if (!check(proc_replay_open(&replay, path) == 0, "%s: cannot open the recording: %s", what, strerror(errno))) {
+        return;
+    }
+    size_t n = 0;
+    int rc;
+    while ((rc = proc_replay_next(&replay)) == 1) {
+        if (!check(n < count, "%s: more than the %zu recorded frames", what, count) ||
+            !check_frame(&replay, samples, order[n], what)) {
+            break;
+        }
+        n++;
+    }
+    check(rc != -1, "%s: frame %zu is corrupt", what, n);
+    check(rc != 0 || n == count, "%s: replayed %zu of %zu frames", what, n, count);
+    check(replay.first_ms == sample_ms(order[0]) && replay.last_ms == sample_ms(order[count - 1]),
+          "%s: recording spans the wrong times", what);
+    proc_replay_close(&replay);
+}
+
+// Function to seek to the time of each listed sample, just after it, and then step
+// on to the next frame, checking that each lands on the sample it should
+static void check_seeks(const char *path, const struct proc_snapshot *samples, const size_t *order, size_t count,
+                        const char *what) {
+    struct proc_replay replay;
+    if (!check(proc_replay_open(&replay, path) == 0, "%s: cannot open the recording: %s", what, strerror(errno))) {
+        return;
+    }
+    check(replay.first_ms == sample_ms(order[0]) && replay.last_ms == sample_ms(order[count - 1]),
+          "%s: recording spans the wrong times", what);
+
+    // Backwards, so that every seek has to go back to a keyframe
+    for (size_t n = count; n-- > 0;) {
+        size_t i = order[n];
+        if (!check(proc_replay_seek(&replay, sample_ms(i)) == 0, "%s: seek to sample %zu failed", what, i) ||
+            !check_frame(&replay, samples, i, what) ||
+            !check(proc_replay_seek(&replay, sample_ms(i) + 1) == 0, "%s: seek after sample %zu failed", what, i) ||
+            !check_frame(&replay, samples, i, what)) {
+            break;
+        }
+        if (n + 1 < count &&
+            (!check(proc_replay_next(&replay) == 1, "%s: no frame after seeking to sample %zu", what, i) ||
+             !check_frame(&replay, samples, order[n + 1], what))) {
+            break;
+        }
+    }
+    if (check(proc_replay_seek(&replay, 0) == 0, "%s: seek before the first frame failed", what)) {
+        check_frame(&replay, samples, order[0], what);
+    }
+    proc_replay_close(&replay);
+}
+
+// Function to write an index file by hand
+static int write_index(const char *path, const struct proc_history_index_entry *entries, size_t count) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+    size_t written = fwrite(entries, sizeof(*entries), count, file);
+    return fclose(file) == 0 && written == count ? 0 : -1;
+}
+
+// Function to check recording, replay, seeking, appending after a cut frame and stale indexes
+static void check_history(const char *dir) {
+    static struct proc_snapshot samples[SAMPLES + MORE_SAMPLES];
+    size_t order[SAMPLES + MORE_SAMPLES];
+    char path[4096], index_path[4096 + 4];
+
+    snprintf(path, sizeof(path), "%s/history", dir);
+    snprintf(index_path, sizeof(index_path), "%s.idx", path);
+    if (!check(make_samples(samples, SAMPLES + MORE_SAMPLES) == 0, "history: out of memory") ||
+        !check(record(path, samples, 0, SAMPLES) == 0, "history: recording failed: %s", strerror(errno))) {
+        goto out;
+    }
+    for (size_t i = 0; i < SAMPLES; i++) {
+        order[i] = i;
+    }
+    check_replay(path, samples, order, SAMPLES, "history");
+    check_seeks(path, samples, order, SAMPLES, "history seek");
+
+    // An index that is missing, does not match the frames, or stops early is rebuilt or finished from the frames
+    unlink(index_path);
+    check_seeks(path, samples, order, SAMPLES, "missing index");
+    struct proc_history_index_entry first = { sample_ms(0), sizeof(struct proc_history_header) };
+    struct proc_history_index_entry wrong_time[1] = { { sample_ms(0) + 1, first.offset } };
+    struct proc_history_index_entry past_end[2] = { first, { sample_ms(SAMPLES + 1), 1 << 30 } };
+    check(write_index(index_path, wrong_time, 1) == 0, "stale index: cannot write it");
+    check_seeks(path, samples, order, SAMPLES, "stale index");
+    check(write_index(index_path, past_end, 2) == 0, "index of a longer recording: cannot write it");
+    check_seeks(path, samples, order, SAMPLES, "index of a longer recording");
+    check(write_index(index_path, &first, 1) == 0, "short index: cannot write it");
+    check_seeks(path, samples, order, SAMPLES, "short index");
+
+    // A crash in the middle of the last frame: the recorder drops it and goes on with a keyframe
+    FILE *file = fopen(path, "r+");
+    if (!check(file != NULL && fseek(file, 0, SEEK_END) == 0, "cut frame: cannot open the recording")) {
+        goto out;
+    }
+    long size = ftell(file);
+    fclose(file);
+    if (!check(truncate(path, size - 3) == 0, "cut frame: cannot truncate the recording") ||
+        !check(record(path, samples, SAMPLES, MORE_SAMPLES) == 0, "cut frame: appending failed: %s", strerror(errno))) {
+        goto out;
+    }
+    for (size_t i = 0; i < MORE_SAMPLES; i++) {
+        order[SAMPLES - 1 + i] = SAMPLES + i;
+    }
+    check_replay(path, samples, order, SAMPLES - 1 + MORE_SAMPLES, "cut frame");
+    check_seeks(path, samples, order, SAMPLES - 1 + MORE_SAMPLES, "cut frame seek");
+
+out:
+    unlink(path);
+    unlink(index_path);
+    for (size_t i = 0; i < SAMPLES + MORE_SAMPLES; i++) {
+        proc_snapshot_free(&samples[i]);
+    }
+}
+
+// Function to scan a proc tree on the given number of threads; returns 0 or -1
+static int scan_tree(const char *root, size_t threads, int skip_status, struct proc_snapshot *snap) {
+    struct proc_scanner scanner;
+    if (proc_scanner_init(&scanner, root) < 0) {
+        return -1;
+    }
+    proc_scanner_set_threads(&scanner, threads);
+    scanner.skip_status = skip_status;
+    int rc = proc_scan_snapshot(&scanner, snap);
+    proc_scanner_destroy(&scanner);
+    return rc;
+}
+
+// Function to check that scans on several threads give the snapshot one thread gives,
+// with and without the status files
+static void check_scan(const char *root) {
+    struct proc_snapshot single, parallel;
+    memset(&single, 0, sizeof(single));
+    memset(&parallel, 0, sizeof(parallel));
+
+    for (int skip_status = 0; skip_status <= 1; skip_status++) {
+        if (!check(scan_tree(root, 1, skip_status, &single) == 0, "scan: %s: %s", root, strerror(errno)) ||
+            !check(single.count > 0, "scan: %s holds no processes", root)) {
+            break;
+        }
+        for (size_t i = 0; i < sizeof(scan_threads) / sizeof(scan_threads[0]); i++) {
+            if (check(scan_tree(root, scan_threads[i], skip_status, &parallel) == 0, "scan on %zu threads: %s",
+                      scan_threads[i], strerror(errno))) {
+                check(same_snapshot(&single, &parallel), "scan on %zu threads%s differs from one thread",
+                      scan_threads[i], skip_status ? " without status" : "");
+            }
+        }
+    }
+    proc_snapshot_free(&single);
+    proc_snapshot_free(&parallel);
+}
+
+int main(int argc, char *argv[]) {
+    char dir[] = "/tmp/proc_check.XXXXXX";
+
+    if (argc > 2 || (argc == 2 && argv[1][0] == '-')) {
+        fprintf(stderr, "Usage: %s [PROC_ROOT]\n", argv[0]);
+        return 1;
+    }
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    check_diff();
+    check_history(dir);
+    rmdir(dir);
+    if (argc == 2) {
+        check_scan(argv[1]);
+    }
+
+    printf("%s\n", failures ? "Some checks failed" : "All checks passed");
+    return failures ? 1 : 0;
+}
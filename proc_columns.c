@@ -0,0 +1,298 @@
+#include "proc_columns.h"
+#include "proc_stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Largest table the arena is reserved for: the kernel's PID_MAX_LIMIT
+#define MAX_ROWS (4 * 1024 * 1024)
+#define ROW_BYTES 96            // Every per-row array, plus alignment slack
+
+// One cached user name
+struct proc_uid_name {
+    uid_t uid;
+    uint32_t name;      // Offset in the interned strings
+};
+
+// Carve every per-row array for count rows out of the freshly reset arena
+static int carve_columns(struct proc_columns *cols, size_t count) {
+    if (cols->arena.base == NULL && proc_arena_init(&cols->arena, (MAX_ROWS + 2) * ROW_BYTES) < 0) {
+        return -1;
+    }
+    proc_arena_reset(&cols->arena);
+
+    uint32_t **arrays[] = {
+        (uint32_t **) &cols->pids, (uint32_t **) &cols->ppids, (uint32_t **) &cols->uids, &cols->rss_kb,
+        &cols->cpu_ticks, &cols->comm, &cols->user, &cols->parent, &cols->sibling_index, &cols->children,
+    };
+    for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++) {
+        // Every array has 4-byte elements
+        if ((*arrays[i] = proc_arena_alloc(&cols->arena, count * sizeof(uint32_t), 16)) == NULL) {
+            return -1;
+        }
+    }
+    cols->subtree_rss_kb = cols->subtree_cpu_ticks = NULL;
+    cols->extra_flags = cols->pss_kb = cols->swap_kb = cols->fds = cols->extra_age_s = NULL;
+    cols->start_times = proc_arena_alloc(&cols->arena, count * sizeof(*cols->start_times), 16);
+    cols->child_start = proc_arena_alloc(&cols->arena, (count + 2) * sizeof(*cols->child_start), 16);
+    return cols->start_times != NULL && cols->child_start != NULL ? 0 : -1;
+}
+
+// Return the interned user name of a uid, asking the resolver once per build
+static long user_name(struct proc_columns *cols, struct proc_intern *strings, struct proc_users *users, uid_t uid) {
+    for (size_t i = 0; i < cols->uid_name_count; i++) {
+        if (cols->uid_names[i].uid == uid) {
+            return cols->uid_names[i].name;
+        }
+    }
+
+    char name[PROC_USER_LEN];
+    proc_users_name(users, uid, name, sizeof(name));
+    long offset = proc_intern_string(strings, name);
+    if (offset < 0) {
+        return -1;
+    }
+
+    if (cols->uid_name_count == cols->uid_name_capacity) {
+        size_t capacity = cols->uid_name_capacity ? cols->uid_name_capacity * 2 : 16;
+        struct proc_uid_name *names = realloc(cols->uid_names, capacity * sizeof(*names));
+        if (names == NULL) {
+            return offset;  // Just not cached
+        }
+        cols->uid_names = names;
+        cols->uid_name_capacity = capacity;
+        proc_stats_count(PROC_STATS_COLUMNS, PROC_STATS_ALLOCS, 1);
+    }
+    cols->uid_names[cols->uid_name_count].uid = uid;
+    cols->uid_names[cols->uid_name_count].name = (uint32_t) offset;
+    cols->uid_name_count++;
+    return offset;
+}
+
+// Move rows whose parent chain loops back on itself to the top level.
+// sibling_index serves as the visit state: 0 new, 1 on the current walk, 2 done.
+static void break_parent_cycles(struct proc_columns *cols) {
+    uint32_t root = (uint32_t) cols->count;
+    uint32_t *state = cols->sibling_index;
+    memset(state, 0, cols->count * sizeof(*state));
+
+    for (uint32_t row = 0; row < root; row++) {
+        uint32_t cur = row;
+        while (cur != root && state[cur] == 0) {
+            state[cur] = 1;
+            cur = cols->parent[cur];
+        }
+        if (cur != root && state[cur] == 1) {
+            cols->parent[cur] = root;   // cur closes a cycle
+        }
+        for (cur = row; cur != root && state[cur] == 1; cur = cols->parent[cur]) {
+            state[cur] = 2;
+        }
+    }
+}
+
+// Build the columns from a snapshot
+int proc_columns_build(struct proc_columns *cols, const struct proc_snapshot *snap, struct proc_intern *strings,
+                       struct proc_users *users) {
+    unsigned long long build = proc_stats_start();
+    if (snap->count > MAX_ROWS || carve_columns(cols, snap->count) < 0) {
+        return -1;
+    }
+    cols->count = snap->count;
+    cols->uid_name_count = 0;
+    proc_intern_begin(strings);
+
+    uint32_t root = (uint32_t) snap->count;
+    for (size_t i = 0; i < snap->count; i++) {
+        const struct proc_entry *entry = &snap->entries[i];
+        long comm = proc_intern_string(strings, entry->comm);
+        long user = user_name(cols, strings, users, entry->uid);
+        if (comm < 0 || user < 0) {
+            return -1;
+        }
+
+        cols->pids[i] = entry->pid;
+        cols->ppids[i] = entry->ppid;
+        cols->uids[i] = entry->uid;
+        cols->rss_kb[i] = (uint32_t) entry->rss_kb;
+        cols->cpu_ticks[i] = (uint32_t) (entry->utime + entry->stime);
+        cols->start_times[i] = entry->start_time;
+        cols->comm[i] = (uint32_t) comm;
+        cols->user[i] = (uint32_t) user;
+
+        // No parent (e.g., PID 1) or a parent that has already exited puts the row at the top
+        const struct proc_entry *parent = entry->ppid > 0 ? proc_snapshot_find(snap, entry->ppid) : NULL;
+        cols->parent[i] = parent != NULL && parent != entry ? (uint32_t) (parent - snap->entries) : root;
+    }
+    cols->strings = proc_intern_base(strings);
+    break_parent_cycles(cols);
+
+    // Group the rows by parent: count each group, prefix-sum into group starts,
+    // place the rows using the starts as cursors, then shift the starts back
+    uint32_t *start = cols->child_start;
+    memset(start, 0, (snap->count + 2) * sizeof(*start));
+    for (uint32_t i = 0; i < root; i++) {
+        start[cols->parent[i] + 1]++;
+    }
+    for (uint32_t p = 1; p <= root + 1; p++) {
+        start[p] += start[p - 1];
+    }
+    for (uint32_t i = 0; i < root; i++) {
+        cols->children[start[cols->parent[i]]++] = i;
+    }
+    for (uint32_t p = root + 1; p > 0; p--) {
+        start[p] = start[p - 1];
+    }
+    start[0] = 0;
+
+    for (uint32_t p = 0; p <= root; p++) {
+        for (uint32_t k = start[p]; k < start[p + 1]; k++) {
+            cols->sibling_index[cols->children[k]] = k - start[p];
+        }
+    }
+    proc_stats_count(PROC_STATS_COLUMNS, PROC_STATS_ROWS, snap->count);
+    proc_stats_stop(PROC_STATS_COLUMNS, build);
+    return 0;
+}
+
+// Clamp a total to the 32 bits of a column
+static uint32_t clamp32(unsigned long long value) {
+    return value > UINT32_MAX ? UINT32_MAX : (uint32_t) value;
+}
+
+// Fill in the subtree totals; each row is one lookup, nothing is summed here
+int proc_columns_set_subtrees(struct proc_columns *cols, const struct proc_rollup *rollup) {
+    uint32_t *rss_kb = proc_arena_alloc(&cols->arena, cols->count * sizeof(uint32_t), 16);
+    uint32_t *cpu_ticks = proc_arena_alloc(&cols->arena, cols->count * sizeof(uint32_t), 16);
+    if (rss_kb == NULL || cpu_ticks == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < cols->count; i++) {
+        struct proc_rollup_totals totals;
+        if (proc_rollup_subtree(rollup, cols->pids[i], &totals) == 0) {
+            rss_kb[i] = clamp32(totals.rss_kb);
+            cpu_ticks[i] = clamp32(totals.cpu_ticks);
+        } else {
+            rss_kb[i] = cols->rss_kb[i];
+            cpu_ticks[i] = cols->cpu_ticks[i];
+        }
+    }
+    cols->subtree_rss_kb = rss_kb;
+    cols->subtree_cpu_ticks = cpu_ticks;
+    return 0;
+}
+
+// Copy the budgeted metrics; their rows are in the same PID order as ours
+int proc_columns_set_extra(struct proc_columns *cols, const struct proc_extra_table *extra, uint64_t now_ms) {
+    uint32_t **arrays[] = { &cols->extra_flags, &cols->pss_kb, &cols->swap_kb, &cols->fds, &cols->extra_age_s };
+    for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++) {
+        if ((*arrays[i] = proc_arena_alloc(&cols->arena, cols->count * sizeof(uint32_t), 16)) == NULL) {
+            cols->extra_flags = NULL;
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < cols->count; i++) {
+        const struct proc_extra *row = i < extra->count ? &extra->rows[i] : NULL;
+        if (row == NULL || row->pid != cols->pids[i]) {
+            cols->extra_flags[i] = 0;
+            continue;
+        }
+        cols->extra_flags[i] = row->flags;
+        cols->pss_kb[i] = clamp32(row->pss_kb);
+        cols->swap_kb[i] = clamp32(row->swap_kb);
+        cols->fds[i] = row->fds;
+        cols->extra_age_s[i] = clamp32((now_ms - row->sampled_ms) / 1000);
+    }
+    return 0;
+}
+
+// Free the column storage
+void proc_columns_free(struct proc_columns *cols) {
+    proc_arena_destroy(&cols->arena);
+    free(cols->uid_names);
+    memset(cols, 0, sizeof(*cols));
+}
+
+// Whether a row's bit is set
+#define ROW_SHOWN(shown, row) (((shown)[(row) / 64] >> ((row) % 64)) & 1)
+
+// Lay out the kept rows the way proc_columns_build does all of them
+int proc_columns_filter(const struct proc_columns *cols, const uint64_t *shown, struct proc_columns_tree *tree) {
+    unsigned long long build = proc_stats_start();
+    uint32_t root = (uint32_t) cols->count;
+
+    if (tree->capacity < cols->count || tree->parent == NULL) {
+        size_t capacity = cols->count > 1024 ? cols->count : 1024;
+        uint32_t **arrays[] = { &tree->parent, &tree->sibling_index, &tree->children, &tree->child_start };
+        for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++) {
+            uint32_t *grown = realloc(*arrays[i], (capacity + 2) * sizeof(uint32_t));
+            if (grown == NULL) {
+                return -1;
+            }
+            *arrays[i] = grown;
+        }
+        tree->capacity = capacity;
+        proc_stats_count(PROC_STATS_COLUMNS, PROC_STATS_ALLOCS, 4);
+    }
+
+    uint32_t *start = tree->child_start;
+    memset(start, 0, (cols->count + 2) * sizeof(*start));
+    tree->shown = 0;
+    for (uint32_t i = 0; i < root; i++) {
+        if (!ROW_SHOWN(shown, i)) {
+            tree->sibling_index[i] = UINT32_MAX;
+            continue;
+        }
+        uint32_t parent = cols->parent[i];
+        tree->parent[i] = parent != root && ROW_SHOWN(shown, parent) ? parent : root;
+        start[tree->parent[i] + 1]++;
+        tree->shown++;
+    }
+    for (uint32_t p = 1; p <= root + 1; p++) {
+        start[p] += start[p - 1];
+    }
+    for (uint32_t i = 0; i < root; i++) {
+        if (tree->sibling_index[i] != UINT32_MAX) {
+            uint32_t k = start[tree->parent[i]]++;
+            tree->children[k] = i;
+        }
+    }
+    for (uint32_t p = root + 1; p > 0; p--) {
+        start[p] = start[p - 1];
+    }
+    start[0] = 0;
+
+    // Rows are placed in order within each group, so the position is the distance from its start
+    for (uint32_t k = 0; k < tree->shown; k++) {
+        uint32_t row = tree->children[k];
+        tree->sibling_index[row] = k - start[tree->parent[row]];
+    }
+    proc_stats_count(PROC_STATS_COLUMNS, PROC_STATS_ROWS, tree->shown);
+    proc_stats_stop(PROC_STATS_COLUMNS, build);
+    return 0;
+}
+
+// Free a filtered tree
+void proc_columns_tree_free(struct proc_columns_tree *tree) {
+    free(tree->parent);
+    free(tree->sibling_index);
+    free(tree->child_start);
+    free(tree->children);
+    memset(tree, 0, sizeof(*tree));
+}
+
+// Row of a PID
+long proc_columns_find(const struct proc_columns *cols, pid_t pid) {
+    size_t lo = 0, hi = cols->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cols->pids[mid] < pid) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < cols->count && cols->pids[lo] == pid ? (long) lo : -1;
+}
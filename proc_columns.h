@@ -0,0 +1,92 @@
+#ifndef PROC_COLUMNS_H
+#define PROC_COLUMNS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "proc_scan.h"
+#include "proc_arena.h"
+#include "proc_users.h"
+#include "proc_rollup.h"
+#include "proc_extra.h"
+
+// A snapshot in struct-of-arrays form, laid out for the tree view. Row i is the
+// i-th process in PID order. The children of every row are stored as one range
+// of children[] (child_start[row] .. child_start[row + 1]), and the top level is
+// the range of the virtual row `count`. Command and user names are offsets into
+// a struct proc_intern shared by every build. That is about 56 bytes per process.
+//
+// All per-row arrays are carved from one arena that is reset on every build,
+// so steady-state builds make no heap allocations.
+struct proc_columns {
+    size_t count;
+    pid_t *pids;
+    pid_t *ppids;
+    uid_t *uids;
+    uint32_t *rss_kb;
+    uint32_t *cpu_ticks;
+    unsigned long long *start_times;    // Tells a reused PID apart for the fetcher
+    uint32_t *comm;             // Offset of the command name in strings
+    uint32_t *user;             // Offset of the user name in strings
+    uint32_t *parent;           // Parent row, or count for top-level rows
+    uint32_t *sibling_index;    // Position among the parent's children
+    uint32_t *child_start;      // count + 2 entries
+    uint32_t *children;
+    uint32_t *subtree_rss_kb;   // Totals of each row and its descendants, or NULL
+    uint32_t *subtree_cpu_ticks;
+    uint32_t *extra_flags;      // PROC_EXTRA_* of the budgeted metrics, or NULL without them
+    uint32_t *pss_kb;
+    uint32_t *swap_kb;
+    uint32_t *fds;
+    uint32_t *extra_age_s;      // Seconds since they were read, at build time
+
+    const char *strings;        // Base of the interned strings for this build
+    struct proc_arena arena;    // Backs the arrays above
+    struct proc_uid_name *uid_names;    // Small uid -> user name cache for one build
+    size_t uid_name_count;
+    size_t uid_name_capacity;
+};
+
+// The rows a filter keeps, laid out like the whole tree in struct proc_columns.
+// Every kept row's parent is kept too (or it is at the top level), so the rows
+// form a tree of their own. Hidden rows have sibling_index UINT32_MAX.
+struct proc_columns_tree {
+    size_t shown;               // Rows kept
+    size_t capacity;            // Rows the arrays hold
+    uint32_t *parent;
+    uint32_t *sibling_index;
+    uint32_t *child_start;      // capacity + 2 entries
+    uint32_t *children;
+};
+
+// Build the columns from a snapshot, reusing their storage; returns 0 or -1.
+// Every build starts a generation of strings, so the columns built before the
+// previous call with the same strings must no longer be read. User names come
+// from the shared resolver cache. Runs on the sampler thread.
+int proc_columns_build(struct proc_columns *cols, const struct proc_snapshot *snap, struct proc_intern *strings,
+                       struct proc_users *users);
+
+// Fill in the subtree totals from a PROC_ROLLUP_TREE rollup that is up to date
+// with the snapshot the columns were built from; returns 0 or -1. Totals beyond
+// 32 bits are clamped.
+int proc_columns_set_subtrees(struct proc_columns *cols, const struct proc_rollup *rollup);
+
+// Copy the budgeted metrics from a table that was just updated with the snapshot
+// the columns were built from; returns 0 or -1. Values beyond 32 bits are clamped.
+int proc_columns_set_extra(struct proc_columns *cols, const struct proc_extra_table *extra, uint64_t now_ms);
+
+// Free the column storage
+void proc_columns_free(struct proc_columns *cols);
+
+// Lay out the rows whose bit is set in shown (a bitmap with one bit per row, as
+// proc_filter_match produces), reusing the tree's storage; returns 0 or -1. A
+// row whose parent is not kept moves to the top level.
+int proc_columns_filter(const struct proc_columns *cols, const uint64_t *shown, struct proc_columns_tree *tree);
+
+// Free a filtered tree
+void proc_columns_tree_free(struct proc_columns_tree *tree);
+
+// Row of a PID (binary search), or -1
+long proc_columns_find(const struct proc_columns *cols, pid_t pid);
+
+#endif
@@ -0,0 +1,169 @@
+#include "proc_cpu.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Hash a PID into the table (Fibonacci hashing spreads sequential PIDs)
+static size_t slot_of(const struct proc_cpu_table *table, pid_t pid) {
+    return (size_t) (((unsigned int) pid * 2654435769u) >> 7) & table->mask;
+}
+
+// Allocate both slot arrays with the given power-of-two capacity
+static int alloc_slots(struct proc_cpu_table *table, size_t capacity) {
+    struct proc_cpu_slot *slots = calloc(capacity, sizeof(*slots));
+    struct proc_cpu_slot *spare = calloc(capacity, sizeof(*spare));
+    if (slots == NULL || spare == NULL) {
+        free(slots);
+        free(spare);
+        return -1;
+    }
+
+    free(table->slots);
+    free(table->spare);
+    table->slots = slots;
+    table->spare = spare;
+    table->mask = capacity - 1;
+    return 0;
+}
+
+// Allocate a table sized for about expected processes
+int proc_cpu_table_init(struct proc_cpu_table *table, size_t expected) {
+    size_t capacity = 1024;
+
+    memset(table, 0, sizeof(*table));
+    while (capacity < expected * 2) {
+        capacity *= 2;
+    }
+    return alloc_slots(table, capacity);
+}
+
+// Free the table
+void proc_cpu_table_destroy(struct proc_cpu_table *table) {
+    free(table->slots);
+    free(table->spare);
+    memset(table, 0, sizeof(*table));
+}
+
+// Start a new sample
+void proc_cpu_table_begin(struct proc_cpu_table *table) {
+    table->sample++;
+}
+
+// Place a slot into an array during a rehash
+static void place_slot(struct proc_cpu_table *table, struct proc_cpu_slot *slots, const struct proc_cpu_slot *slot) {
+    size_t i = slot_of(table, slot->pid);
+    while (slots[i].pid != 0) {
+        i = (i + 1) & table->mask;
+    }
+    slots[i] = *slot;
+}
+
+// Rehash every slot seen in sample min_seen or later into the spare array and swap the two
+static void rehash(struct proc_cpu_table *table, unsigned int min_seen) {
+    size_t capacity = table->mask + 1;
+    size_t used = 0;
+
+    memset(table->spare, 0, capacity * sizeof(*table->spare));
+    for (size_t i = 0; i < capacity; i++) {
+        const struct proc_cpu_slot *slot = &table->slots[i];
+        if (slot->pid != 0 && slot->seen >= min_seen) {
+            place_slot(table, table->spare, slot);
+            used++;
+        }
+    }
+
+    struct proc_cpu_slot *tmp = table->slots;
+    table->slots = table->spare;
+    table->spare = tmp;
+    table->used = used;
+}
+
+// Double the capacity, keeping every slot
+static int grow(struct proc_cpu_table *table) {
+    size_t old_capacity = table->mask + 1;
+    struct proc_cpu_slot *old = table->slots;
+
+    table->slots = NULL;
+    if (alloc_slots(table, old_capacity * 2) < 0) {
+        table->slots = old;
+        return -1;
+    }
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].pid != 0) {
+            place_slot(table, table->slots, &old[i]);
+        }
+    }
+    free(old);
+    return 0;
+}
+
+// Record a process and return the ticks it used since the previous sample
+long long proc_cpu_table_update(struct proc_cpu_table *table, const struct proc_entry *entry) {
+    unsigned long long ticks = (unsigned long long) entry->utime + entry->stime;
+
+    // Keep the load factor at or below one half so probe chains stay short
+    if ((table->used + 1) * 2 > table->mask + 1 && grow(table) < 0) {
+        return -1;
+    }
+
+    size_t i = slot_of(table, entry->pid);
+    while (table->slots[i].pid != 0 && table->slots[i].pid != entry->pid) {
+        i = (i + 1) & table->mask;
+    }
+
+    struct proc_cpu_slot *slot = &table->slots[i];
+    long long delta = 0;
+    if (slot->pid == 0) {
+        slot->pid = entry->pid;
+        table->used++;
+    } else if (slot->start_time == entry->start_time && ticks >= slot->ticks) {
+        delta = (long long) (ticks - slot->ticks);
+    }
+
+    slot->start_time = entry->start_time;
+    slot->ticks = ticks;
+    slot->seen = table->sample;
+    return delta;
+}
+
+// Drop processes that were not updated in the current sample
+void proc_cpu_table_sweep(struct proc_cpu_table *table) {
+    rehash(table, table->sample);
+}
+
+// Read the machine-wide CPU totals from <proc root>/stat
+int proc_read_cpu_totals(struct proc_scanner *scanner, struct proc_cpu_totals *totals) {
+    int fd = openat(scanner->proc_fd, "stat", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    ssize_t len = pread(fd, scanner->buf, scanner->buf_size - 1, 0);
+    close(fd);
+    if (len < 5 || memcmp(scanner->buf, "cpu ", 4) != 0) {
+        return -1;
+    }
+    scanner->buf[len] = '\0';
+
+    // cpu  user nice system idle iowait irq softirq steal (guest is already part of user)
+    unsigned long long fields[8] = {0};
+    const char *p = scanner->buf + 4;
+    for (int i = 0; i < 8; i++) {
+        while (*p == ' ') {
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') {
+            fields[i] = fields[i] * 10 + (unsigned long long) (*p - '0');
+            p++;
+        }
+    }
+
+    totals->total = 0;
+    for (int i = 0; i < 8; i++) {
+        totals->total += fields[i];
+    }
+    totals->idle = fields[3] + fields[4];
+    return 0;
+}
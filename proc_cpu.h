@@ -0,0 +1,52 @@
+#ifndef PROC_CPU_H
+#define PROC_CPU_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "proc_scan.h"
+
+// Last CPU time seen for one process
+struct proc_cpu_slot {
+    pid_t pid;                      // 0 marks an empty slot
+    unsigned int seen;              // Sample in which the process was last updated
+    unsigned long long start_time;  // Tells a reused PID apart from the old process
+    unsigned long long ticks;       // utime + stime at that sample
+};
+
+// Open-addressing (linear probing) table of per-PID CPU times. Exited processes
+// are dropped by rehashing the live slots into a spare array of the same size,
+// so steady-state sampling does not allocate.
+struct proc_cpu_table {
+    struct proc_cpu_slot *slots;
+    struct proc_cpu_slot *spare;
+    size_t mask;                    // Capacity - 1; the capacity is a power of two
+    size_t used;
+    unsigned int sample;
+};
+
+// Whole-machine CPU time from the first line of /proc/stat, in clock ticks
+struct proc_cpu_totals {
+    unsigned long long total;
+    unsigned long long idle;        // idle + iowait
+};
+
+// Allocate a table sized for about expected processes; returns 0 or -1
+int proc_cpu_table_init(struct proc_cpu_table *table, size_t expected);
+
+// Free the table
+void proc_cpu_table_destroy(struct proc_cpu_table *table);
+
+// Start a new sample; call before the updates for one snapshot
+void proc_cpu_table_begin(struct proc_cpu_table *table);
+
+// Record a process and return the ticks it used since the previous sample
+// (a process seen for the first time reports 0); returns -1 on allocation failure
+long long proc_cpu_table_update(struct proc_cpu_table *table, const struct proc_entry *entry);
+
+// Drop processes that were not updated in the current sample
+void proc_cpu_table_sweep(struct proc_cpu_table *table);
+
+// Read the machine-wide CPU totals from <proc root>/stat; returns 0 or -1
+int proc_read_cpu_totals(struct proc_scanner *scanner, struct proc_cpu_totals *totals);
+
+#endif
@@ -0,0 +1,88 @@
+#include "proc_diff.h"
+#include "proc_stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Append one change, growing the array when needed
+static int add_change(struct proc_diff *diff, pid_t pid, unsigned int flags, size_t old_index, size_t new_index) {
+    if (diff->count == diff->capacity) {
+        size_t capacity = diff->capacity ? diff->capacity * 2 : 256;
+        struct proc_change *changes = realloc(diff->changes, capacity * sizeof(*changes));
+        if (changes == NULL) {
+            return -1;
+        }
+        diff->changes = changes;
+        diff->capacity = capacity;
+        proc_stats_count(PROC_STATS_DIFF, PROC_STATS_ALLOCS, 1);
+    }
+
+    struct proc_change *change = &diff->changes[diff->count++];
+    change->pid = pid;
+    change->flags = flags;
+    change->old_index = old_index;
+    change->new_index = new_index;
+    return 0;
+}
+
+// Work out which displayed fields of a surviving process changed
+static unsigned int compare_entries(const struct proc_entry *a, const struct proc_entry *b) {
+    unsigned int flags = 0;
+
+    if (a->ppid != b->ppid) {
+        flags |= PROC_CHANGE_REPARENTED;
+    }
+    if (a->uid != b->uid || a->prio != b->prio || a->state != b->state || a->threads != b->threads ||
+        a->rss_kb != b->rss_kb || a->utime != b->utime || a->stime != b->stime ||
+        strcmp(a->comm, b->comm) != 0) {
+        flags |= PROC_CHANGE_UPDATED;
+    }
+    return flags;
+}
+
+// Compare two PID-sorted snapshots with a single merge pass
+int proc_diff_snapshots(const struct proc_snapshot *old_snap, const struct proc_snapshot *new_snap,
+                        struct proc_diff *diff) {
+    size_t i = 0;
+    size_t j = 0;
+    unsigned long long start = proc_stats_start();
+
+    diff->count = 0;
+    while (i < old_snap->count || j < new_snap->count) {
+        const struct proc_entry *a = i < old_snap->count ? &old_snap->entries[i] : NULL;
+        const struct proc_entry *b = j < new_snap->count ? &new_snap->entries[j] : NULL;
+        int rc = 0;
+
+        if (b == NULL || (a != NULL && a->pid < b->pid)) {
+            rc = add_change(diff, a->pid, PROC_CHANGE_REMOVED, i++, PROC_NO_INDEX);
+        } else if (a == NULL || b->pid < a->pid) {
+            rc = add_change(diff, b->pid, PROC_CHANGE_ADDED, PROC_NO_INDEX, j++);
+        } else if (a->start_time != b->start_time) {
+            // Same PID, different process
+            rc = add_change(diff, a->pid, PROC_CHANGE_REMOVED, i++, PROC_NO_INDEX);
+            if (rc == 0) {
+                rc = add_change(diff, b->pid, PROC_CHANGE_ADDED, PROC_NO_INDEX, j++);
+            }
+        } else {
+            unsigned int flags = compare_entries(a, b);
+            if (flags) {
+                rc = add_change(diff, a->pid, flags, i, j);
+            }
+            i++;
+            j++;
+        }
+
+        if (rc < 0) {
+            return -1;
+        }
+    }
+    proc_stats_count(PROC_STATS_DIFF, PROC_STATS_ROWS, diff->count);
+    proc_stats_stop(PROC_STATS_DIFF, start);
+    return 0;
+}
+
+// Free the diff storage
+void proc_diff_free(struct proc_diff *diff) {
+    free(diff->changes);
+    memset(diff, 0, sizeof(*diff));
+}
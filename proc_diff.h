@@ -0,0 +1,39 @@
+#ifndef PROC_DIFF_H
+#define PROC_DIFF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "proc_scan.h"
+
+// What happened to a process between two snapshots; UPDATED and REPARENTED may be combined
+#define PROC_CHANGE_ADDED       0x1
+#define PROC_CHANGE_REMOVED     0x2
+#define PROC_CHANGE_UPDATED     0x4     // uid, comm, memory, CPU time, state, ...
+#define PROC_CHANGE_REPARENTED  0x8     // ppid changed
+
+#define PROC_NO_INDEX SIZE_MAX
+
+// One changed process; the indexes point into the old and new snapshots
+struct proc_change {
+    pid_t pid;
+    unsigned int flags;
+    size_t old_index;       // PROC_NO_INDEX for added processes
+    size_t new_index;       // PROC_NO_INDEX for removed processes
+};
+
+// The changes between two snapshots, in PID order; storage is reused between diffs
+struct proc_diff {
+    struct proc_change *changes;
+    size_t count;
+    size_t capacity;
+};
+
+// Compare two PID-sorted snapshots. A PID whose start time differs is a new
+// process that reused the PID and shows up as REMOVED followed by ADDED.
+int proc_diff_snapshots(const struct proc_snapshot *old_snap, const struct proc_snapshot *new_snap,
+                        struct proc_diff *diff);
+
+// Free the diff storage
+void proc_diff_free(struct proc_diff *diff);
+
+#endif
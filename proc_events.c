@@ -0,0 +1,307 @@
+#define _GNU_SOURCE
+#include "proc_events.h"
+#include "proc_stats.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+#define EVENT_BUF_SIZE 16384
+#define MAX_LOGGED_EVENTS 65536     // Beyond this, a rescan is cheaper than replaying the log
+
+// Send PROC_CN_MCAST_LISTEN or PROC_CN_MCAST_IGNORE to the connector
+static int send_mcast_op(int fd, enum proc_cn_mcast_op op) {
+    char buf[NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(op))];
+    struct nlmsghdr *nlh = (struct nlmsghdr *) buf;
+    struct cn_msg *msg = NLMSG_DATA(nlh);
+
+    memset(buf, 0, sizeof(buf));
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(*msg) + sizeof(op));
+    nlh->nlmsg_type = NLMSG_DONE;
+    nlh->nlmsg_pid = (__u32) getpid();
+    msg->id.idx = CN_IDX_PROC;
+    msg->id.val = CN_VAL_PROC;
+    msg->len = sizeof(op);
+    memcpy(msg->data, &op, sizeof(op));
+
+    return send(fd, buf, nlh->nlmsg_len, 0) < 0 ? -1 : 0;
+}
+
+// Subscribe to process events
+int proc_events_open(struct proc_events *ev, unsigned int resample_every) {
+    memset(ev, 0, sizeof(*ev));
+    ev->resample_every = resample_every ? resample_every : 1;
+    ev->overflow = 1;   // Nothing to apply events to until the first full scan
+
+    ev->fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_CONNECTOR);
+    if (ev->fd < 0) {
+        return -1;
+    }
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = CN_IDX_PROC;
+    addr.nl_pid = 0;    // Let the kernel pick a unique port
+    if (bind(ev->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        send_mcast_op(ev->fd, PROC_CN_MCAST_LISTEN) < 0) {
+        int saved = errno;
+        close(ev->fd);
+        ev->fd = -1;
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+// Unsubscribe and free the event buffers
+void proc_events_close(struct proc_events *ev) {
+    if (ev->fd >= 0) {
+        send_mcast_op(ev->fd, PROC_CN_MCAST_IGNORE);
+        close(ev->fd);
+        ev->fd = -1;
+    }
+    free(ev->log);
+    free(ev->short_lived);
+    ev->log = NULL;
+    ev->short_lived = NULL;
+    ev->log_count = ev->log_capacity = 0;
+    ev->short_lived_count = ev->short_lived_capacity = 0;
+}
+
+// Append one event to the log, reading the process now if asked to; returns the record or NULL
+static struct proc_event_rec *log_event(struct proc_events *ev, struct proc_scanner *scanner, pid_t pid,
+                                        unsigned int what, int read_now) {
+    if (ev->overflow) {
+        return NULL;    // The next refresh rescans anyway
+    }
+    if (ev->log_count == ev->log_capacity) {
+        size_t capacity = ev->log_capacity ? ev->log_capacity * 2 : 256;
+        struct proc_event_rec *log = capacity <= MAX_LOGGED_EVENTS ? realloc(ev->log, capacity * sizeof(*log)) : NULL;
+        if (log == NULL) {
+            ev->overflow = 1;
+            return NULL;
+        }
+        ev->log = log;
+        ev->log_capacity = capacity;
+    }
+
+    struct proc_event_rec *rec = &ev->log[ev->log_count++];
+    rec->pid = pid;
+    rec->what = what;
+    rec->seq = (unsigned int) (ev->log_count - 1);
+    rec->have_entry = read_now && proc_scan_pid(scanner, pid, &rec->entry) == 0;
+    return rec;
+}
+
+// Record the events in one netlink datagram
+static int handle_datagram(struct proc_events *ev, struct proc_scanner *scanner, const char *buf, size_t len) {
+    int count = 0;
+
+    for (const struct nlmsghdr *nlh = (const struct nlmsghdr *) buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+        if (nlh->nlmsg_type == NLMSG_ERROR || nlh->nlmsg_type == NLMSG_NOOP) {
+            continue;
+        }
+
+        const struct cn_msg *msg = NLMSG_DATA(nlh);
+        if (msg->id.idx != CN_IDX_PROC || msg->id.val != CN_VAL_PROC) {
+            continue;
+        }
+        const struct proc_event *pe = (const struct proc_event *) msg->data;
+
+        switch (pe->what) {
+        case PROC_EVENT_FORK:
+            // A new thread only changes its process's thread count
+            if (pe->event_data.fork.child_pid == pe->event_data.fork.child_tgid) {
+                struct proc_event_rec *rec = log_event(ev, scanner, pe->event_data.fork.child_tgid, PROC_EVENT_FORK, 1);
+                if (rec != NULL && !rec->have_entry) {
+                    // Already gone: keep what the event itself says, so it still counts as short-lived
+                    memset(&rec->entry, 0, sizeof(rec->entry));
+                    rec->entry.pid = pe->event_data.fork.child_tgid;
+                    rec->entry.ppid = pe->event_data.fork.parent_tgid;
+                    rec->entry.uid = (uid_t) -1;
+                    rec->entry.state = 'X';
+                    rec->have_entry = 1;
+                }
+            } else {
+                log_event(ev, scanner, pe->event_data.fork.child_tgid, PROC_EVENT_COMM, 0);
+            }
+            break;
+        case PROC_EVENT_EXEC:
+            log_event(ev, scanner, pe->event_data.exec.process_tgid, PROC_EVENT_EXEC, 1);
+            break;
+        case PROC_EVENT_UID:
+            log_event(ev, scanner, pe->event_data.id.process_tgid, PROC_EVENT_UID, 0);
+            break;
+        case PROC_EVENT_COMM:
+            log_event(ev, scanner, pe->event_data.comm.process_tgid, PROC_EVENT_COMM, 0);
+            break;
+        case PROC_EVENT_EXIT:
+            if (pe->event_data.exit.process_pid == pe->event_data.exit.process_tgid) {
+                log_event(ev, scanner, pe->event_data.exit.process_tgid, PROC_EVENT_EXIT, 0);
+            } else {
+                log_event(ev, scanner, pe->event_data.exit.process_tgid, PROC_EVENT_COMM, 0);
+            }
+            break;
+        default:
+            continue;
+        }
+        count++;
+    }
+    return count;
+}
+
+// Wait for events and record them
+int proc_events_wait(struct proc_events *ev, struct proc_scanner *scanner, int timeout_ms) {
+    char buf[EVENT_BUF_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+    struct pollfd pfd = { ev->fd, POLLIN, 0 };
+    int count = 0;
+
+    if (poll(&pfd, 1, timeout_ms) < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    // Drain everything that is queued, not just one datagram
+    for (;;) {
+        ssize_t len = recv(ev->fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                break;
+            }
+            if (errno == ENOBUFS) {
+                ev->overflow = 1;   // The socket buffer overran and events were dropped
+                continue;
+            }
+            return -1;
+        }
+        count += handle_datagram(ev, scanner, buf, (size_t) len);
+    }
+    return count;
+}
+
+// Order the log by PID, keeping arrival order within one PID
+static int compare_events(const void *a, const void *b) {
+    const struct proc_event_rec *x = a;
+    const struct proc_event_rec *y = b;
+    if (x->pid != y->pid) {
+        return x->pid < y->pid ? -1 : 1;
+    }
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// Remember a process that forked and exited between two refreshes
+static void add_short_lived(struct proc_events *ev, const struct proc_entry *entry) {
+    if (ev->short_lived_count == ev->short_lived_capacity) {
+        size_t capacity = ev->short_lived_capacity ? ev->short_lived_capacity * 2 : 64;
+        struct proc_entry *entries = realloc(ev->short_lived, capacity * sizeof(*entries));
+        if (entries == NULL) {
+            return;
+        }
+        ev->short_lived = entries;
+        ev->short_lived_capacity = capacity;
+    }
+    ev->short_lived[ev->short_lived_count++] = *entry;
+}
+
+// Apply the events of one PID (log[first..last)); old is its previous entry or NULL.
+// Appends the process to next unless it is gone.
+static void apply_pid_events(struct proc_events *ev, struct proc_scanner *scanner, const struct proc_event_rec *log,
+                             size_t first, size_t last, const struct proc_entry *old, struct proc_snapshot *next) {
+    const struct proc_entry *seen = NULL;   // Latest entry read since the fork
+    int forked = 0;
+
+    for (size_t i = first; i < last; i++) {
+        if (log[i].what == PROC_EVENT_FORK) {
+            forked = 1;     // A new process; whatever was read before belonged to the old one
+            seen = NULL;
+        }
+        if (log[i].have_entry) {
+            seen = &log[i].entry;
+        }
+        if (log[i].what == PROC_EVENT_EXIT) {
+            if (forked && seen != NULL) {
+                add_short_lived(ev, seen);
+            }
+            forked = 0;
+            seen = NULL;
+        }
+    }
+
+    if (log[last - 1].what == PROC_EVENT_EXIT) {
+        return;
+    }
+    struct proc_entry *entry = &next->entries[next->count];
+    if (proc_scan_pid(scanner, log[first].pid, entry) == 0) {
+        next->count++;
+    } else if (old != NULL && log[last - 1].what != PROC_EVENT_FORK) {
+        // Unreadable but no exit seen yet (e.g. hidepid); keep what we had
+        *entry = *old;
+        next->count++;
+    }
+}
+
+// Build next from prev and the recorded events
+int proc_events_refresh(struct proc_events *ev, struct proc_scanner *scanner,
+                        const struct proc_snapshot *prev, struct proc_snapshot *next) {
+    ev->short_lived_count = 0;
+
+    if (ev->overflow || prev == NULL) {
+        ev->log_count = 0;
+        ev->overflow = 0;
+        return proc_scan_snapshot(scanner, next);
+    }
+
+    unsigned long long start = proc_stats_start();
+    qsort(ev->log, ev->log_count, sizeof(*ev->log), compare_events);
+
+    next->count = 0;
+    next->generation = prev->generation + 1;
+    if (proc_snapshot_reserve(next, prev->count + ev->log_count) < 0) {
+        return -1;
+    }
+
+    // Merge the previous snapshot with the PID-sorted log
+    unsigned int resample_every = ev->resample_every;
+    unsigned int phase = ev->phase;
+    size_t i = 0, e = 0;
+    while (i < prev->count || e < ev->log_count) {
+        pid_t old_pid = i < prev->count ? prev->entries[i].pid : 0;
+        pid_t event_pid = e < ev->log_count ? ev->log[e].pid : 0;
+
+        if (e == ev->log_count || (i < prev->count && old_pid < event_pid)) {
+            // No events: keep the old entry, re-reading one slice of the table per refresh
+            const struct proc_entry *old = &prev->entries[i++];
+            struct proc_entry *entry = &next->entries[next->count];
+            if ((unsigned int) old->pid % resample_every != phase) {
+                *entry = *old;
+                next->count++;
+            } else if (proc_scan_pid(scanner, old->pid, entry) == 0) {
+                next->count++;
+            }
+            continue;
+        }
+
+        size_t last = e;
+        while (last < ev->log_count && ev->log[last].pid == event_pid) {
+            last++;
+        }
+        const struct proc_entry *old = NULL;
+        if (i < prev->count && old_pid == event_pid) {
+            old = &prev->entries[i++];
+        }
+        apply_pid_events(ev, scanner, ev->log, e, last, old, next);
+        e = last;
+    }
+
+    ev->phase = (phase + 1) % resample_every;
+    ev->log_count = 0;
+    proc_stats_count(PROC_STATS_SCAN, PROC_STATS_ROWS, next->count);
+    proc_stats_stop(PROC_STATS_SCAN, start);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef PROC_EVENTS_H
+#define PROC_EVENTS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "proc_scan.h"
+
+// One process event, in arrival order
+struct proc_event_rec {
+    pid_t pid;                  // Thread group ID the event is about
+    unsigned int what;          // PROC_EVENT_FORK, _EXEC, _UID, _COMM or _EXIT
+    unsigned int seq;           // Arrival order, kept when the log is sorted by PID
+    int have_entry;             // entry was read when the event arrived
+    struct proc_entry entry;
+};
+
+// Subscription to the kernel proc connector plus the events received since the
+// last refresh. A refresh applies them to the previous snapshot, so only
+// processes that forked, exec'd, changed uid or exited are read again, plus a
+// slice of the rest for fresh CPU and memory figures.
+struct proc_events {
+    int fd;                             // NETLINK_CONNECTOR socket
+    int overflow;                       // Events were lost; the next refresh rescans /proc
+    struct proc_event_rec *log;
+    size_t log_count;
+    size_t log_capacity;
+    struct proc_entry *short_lived;     // Started and exited between the last two refreshes
+    size_t short_lived_count;
+    size_t short_lived_capacity;
+    unsigned int resample_every;        // Re-read every process once per this many refreshes
+    unsigned int phase;                 // Which slice of the table is resampled next
+};
+
+// Subscribe to process events; returns 0, or -1 with errno set (EPERM without
+// CAP_NET_ADMIN, EPROTONOSUPPORT without the connector). Callers fall back to
+// proc_scan_snapshot when this fails.
+int proc_events_open(struct proc_events *ev, unsigned int resample_every);
+
+// Unsubscribe and free the event buffers
+void proc_events_close(struct proc_events *ev);
+
+// Wait up to timeout_ms for events and record them. Forked and exec'd processes
+// are read right away, so even ones that exit before the next refresh are seen.
+// Returns the number of events recorded, or -1 on error.
+int proc_events_wait(struct proc_events *ev, struct proc_scanner *scanner, int timeout_ms);
+
+// Build next from prev and the recorded events; returns 0 or -1. Falls back to a
+// full scan on the first refresh and after lost events.
+int proc_events_refresh(struct proc_events *ev, struct proc_scanner *scanner,
+                        const struct proc_snapshot *prev, struct proc_snapshot *next);
+
+#endif
@@ -0,0 +1,287 @@
+#include "proc_extra.h"
+#include "proc_stats.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NEVER_READ_AGE_MS (1ULL << 40)  // Age of a value that was never read: older than any real one
+#define INITIAL_COST_US 50.0            // Guess at the cost of one process until it is measured
+#define MEM_SYSCALLS 3                  // open + read + close of smaps_rollup
+#define FDS_SYSCALLS 1                  // fstat of the fd directory, on Linux 6.2 and later
+
+// Monotonic clock in milliseconds
+uint64_t proc_extra_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+// Monotonic clock in microseconds, for the budget
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+// Set up an empty table
+int proc_extra_init(struct proc_extra_table *table, unsigned int want, unsigned int budget_us,
+                    unsigned int max_age_ms) {
+    memset(table, 0, sizeof(*table));
+    table->want = want & (PROC_EXTRA_MEM | PROC_EXTRA_FDS);
+    table->budget_us = budget_us;
+    table->budget_syscalls = budget_us / 2;     // A /proc syscall rarely costs less than 2 us
+    table->max_age_ms = max_age_ms;
+    table->cost_us = INITIAL_COST_US;
+    return 0;
+}
+
+// Free the table
+void proc_extra_destroy(struct proc_extra_table *table) {
+    free(table->rows);
+    free(table->spare);
+    free(table->picked);
+    free(table->scores);
+    memset(table, 0, sizeof(*table));
+}
+
+// Make room for count rows in both arrays
+static int reserve_rows(struct proc_extra_table *table, size_t count) {
+    if (table->capacity >= count) {
+        return 0;
+    }
+    size_t capacity = table->capacity ? table->capacity : 1024;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    struct proc_extra *rows = realloc(table->rows, capacity * sizeof(*rows));
+    if (rows == NULL) {
+        return -1;
+    }
+    table->rows = rows;
+    struct proc_extra *spare = realloc(table->spare, capacity * sizeof(*spare));
+    if (spare == NULL) {
+        return -1;
+    }
+    table->spare = spare;
+    table->capacity = capacity;
+    proc_stats_count(PROC_STATS_EXTRA, PROC_STATS_ALLOCS, 2);
+    return 0;
+}
+
+// Carry the rows of processes that are still in snap over, in snap's order
+static void merge_rows(struct proc_extra_table *table, const struct proc_snapshot *snap, uint64_t now_ms) {
+    size_t i = 0;
+
+    for (size_t j = 0; j < snap->count; j++) {
+        const struct proc_entry *entry = &snap->entries[j];
+        struct proc_extra *row = &table->spare[j];
+
+        while (i < table->count && table->rows[i].pid < entry->pid) {
+            i++;
+        }
+        if (i < table->count && table->rows[i].pid == entry->pid && table->rows[i].start_time == entry->start_time) {
+            *row = table->rows[i++];
+            if (row->flags != 0 && now_ms - row->sampled_ms > table->max_age_ms) {
+                row->flags = 0;     // Too old to show; sampled_ms stays, so it is first in line
+            }
+        } else {
+            memset(row, 0, sizeof(*row));
+            row->pid = entry->pid;
+            row->start_time = entry->start_time;
+        }
+    }
+
+    struct proc_extra *tmp = table->rows;
+    table->rows = table->spare;
+    table->spare = tmp;
+    table->count = snap->count;
+}
+
+// How much a process deserves a read now; 0 if it does not need one
+static uint64_t score_row(const struct proc_extra_table *table, const struct proc_extra *row,
+                          const struct proc_entry *entry, uint64_t now_ms) {
+    uint64_t age = row->sampled_ms ? now_ms - row->sampled_ms : NEVER_READ_AGE_MS;
+    if (age == 0 || ((row->flags & PROC_EXTRA_DENIED) && age <= table->max_age_ms)) {
+        return 0;
+    }
+
+    // Bigger processes matter more, by orders of magnitude rather than linearly
+    uint64_t weight = 1 + (entry->rss_kb ? 64 - (uint64_t) __builtin_clzll(entry->rss_kb) : 0);
+    if (row->sampled_ms && (entry->rss_kb != row->rss_kb || entry->utime + entry->stime != row->cpu_ticks)) {
+        weight *= 4;
+    }
+    return age * weight;
+}
+
+// Swap two picked rows
+static void swap_picked(struct proc_extra_table *table, size_t a, size_t b) {
+    uint32_t row = table->picked[a];
+    uint64_t score = table->scores[a];
+    table->picked[a] = table->picked[b];
+    table->scores[a] = table->scores[b];
+    table->picked[b] = row;
+    table->scores[b] = score;
+}
+
+// Restore the min-heap below position i of a heap of size n
+static void sift_down(struct proc_extra_table *table, size_t i, size_t n) {
+    for (;;) {
+        size_t smallest = i;
+        size_t l = 2 * i + 1, r = l + 1;
+        if (l < n && table->scores[l] < table->scores[smallest]) {
+            smallest = l;
+        }
+        if (r < n && table->scores[r] < table->scores[smallest]) {
+            smallest = r;
+        }
+        if (smallest == i) {
+            return;
+        }
+        swap_picked(table, i, smallest);
+        i = smallest;
+    }
+}
+
+// Keep the k highest-scoring rows in the min-heap; returns the heap size
+static size_t pick_rows(struct proc_extra_table *table, const struct proc_snapshot *snap, uint64_t now_ms, size_t k) {
+    size_t n = 0;
+
+    for (size_t i = 0; i < table->count; i++) {
+        struct proc_extra *row = &table->rows[i];
+        const struct proc_entry *entry = &snap->entries[i];
+
+        // Kernel threads and zombies have no memory or descriptors to read, so they stay fresh for free
+        if (entry->rss_kb == 0 && entry->threads <= 1) {
+            row->flags = table->want;
+            row->sampled_ms = now_ms;
+            row->pss_kb = row->uss_kb = row->swap_kb = 0;
+            row->fds = 0;
+            continue;
+        }
+
+        uint64_t score = score_row(table, row, entry, now_ms);
+        if (score == 0) {
+            continue;
+        }
+        if (n < k) {
+            table->picked[n] = (uint32_t) i;
+            table->scores[n] = score;
+            for (size_t c = n++; c > 0 && table->scores[(c - 1) / 2] > table->scores[c]; c = (c - 1) / 2) {
+                swap_picked(table, c, (c - 1) / 2);
+            }
+        } else if (score > table->scores[0]) {
+            table->picked[0] = (uint32_t) i;
+            table->scores[0] = score;
+            sift_down(table, 0, n);
+        }
+    }
+    return n;
+}
+
+// Read the wanted metrics of one process; returns the syscalls it took
+static unsigned int read_row(struct proc_extra_table *table, struct proc_scanner *scanner, struct proc_extra *row,
+                             const struct proc_entry *entry, uint64_t now_ms) {
+    unsigned int syscalls = 0;
+    unsigned int flags = 0;
+
+    if (table->want & PROC_EXTRA_MEM) {
+        struct proc_mem mem;
+        syscalls += MEM_SYSCALLS;
+        if (proc_read_mem(scanner, row->pid, &mem) == 0) {
+            row->pss_kb = mem.pss_kb;
+            row->uss_kb = mem.uss_kb;
+            row->swap_kb = mem.swap_kb;
+            flags |= PROC_EXTRA_MEM;
+        } else if (errno == EACCES || errno == EPERM) {
+            flags |= PROC_EXTRA_DENIED;
+        }
+    }
+    if (table->want & PROC_EXTRA_FDS) {
+        syscalls += FDS_SYSCALLS;
+        long fds = proc_count_fds(scanner, row->pid);
+        if (fds >= 0) {
+            row->fds = (unsigned int) fds;
+            flags |= PROC_EXTRA_FDS;
+        } else if (errno == EACCES || errno == EPERM) {
+            flags |= PROC_EXTRA_DENIED;
+        }
+    }
+
+    // A process that has gone is simply dropped by the next merge
+    row->flags = flags;
+    row->sampled_ms = now_ms;
+    row->rss_kb = entry->rss_kb;
+    row->cpu_ticks = entry->utime + entry->stime;
+    return syscalls;
+}
+
+// Line the rows up with snap and spend the budget on the most deserving processes
+int proc_extra_update(struct proc_extra_table *table, struct proc_scanner *scanner, const struct proc_snapshot *snap,
+                      uint64_t now_ms) {
+    unsigned long long stats_start = proc_stats_start();
+
+    if (reserve_rows(table, snap->count) < 0) {
+        return -1;
+    }
+    merge_rows(table, snap, now_ms);
+    table->last_read = 0;
+    if (table->want == 0 || snap->count == 0) {
+        table->last_valid = 0;
+        return 0;
+    }
+
+    // As many processes as the budget pays for at the measured cost, and never none
+    unsigned int per_process = ((table->want & PROC_EXTRA_MEM) ? MEM_SYSCALLS : 0) +
+                               ((table->want & PROC_EXTRA_FDS) ? FDS_SYSCALLS : 0);
+    size_t k = (size_t) (table->budget_us / table->cost_us);
+    if (k > table->budget_syscalls / per_process) {
+        k = table->budget_syscalls / per_process;
+    }
+    k = k < 1 ? 1 : k > snap->count ? snap->count : k;
+    if (table->picked_capacity < k) {
+        uint32_t *picked = realloc(table->picked, k * sizeof(*picked));
+        uint64_t *scores = picked != NULL ? realloc(table->scores, k * sizeof(*scores)) : NULL;
+        if (picked != NULL) {
+            table->picked = picked;
+        }
+        if (scores == NULL) {
+            return -1;
+        }
+        table->scores = scores;
+        table->picked_capacity = k;
+        proc_stats_count(PROC_STATS_EXTRA, PROC_STATS_ALLOCS, 2);
+    }
+    size_t n = pick_rows(table, snap, now_ms, k);
+
+    // Heap sort: popping the smallest to the back leaves the best in front
+    for (size_t end = n; end > 1; end--) {
+        swap_picked(table, 0, end - 1);
+        sift_down(table, 0, end - 1);
+    }
+
+    // The estimate may be off, so the clock has the last word
+    uint64_t start = now_us();
+    uint64_t spent = 0;
+    unsigned int syscalls = 0;
+    for (size_t i = 0; i < n && spent < table->budget_us && syscalls < table->budget_syscalls; i++) {
+        uint32_t r = table->picked[i];
+        syscalls += read_row(table, scanner, &table->rows[r], &snap->entries[r], now_ms);
+        table->last_read++;
+        spent = now_us() - start;
+    }
+    if (table->last_read > 0) {
+        double cost = (double) spent / (double) table->last_read;
+        table->cost_us = 0.7 * table->cost_us + 0.3 * (cost > 1 ? cost : 1);
+    }
+
+    size_t valid = 0;
+    for (size_t i = 0; i < table->count; i++) {
+        valid += (table->rows[i].flags & table->want) != 0;
+    }
+    table->last_valid = valid;
+    proc_stats_count(PROC_STATS_EXTRA, PROC_STATS_ROWS, table->last_read);
+    proc_stats_stop(PROC_STATS_EXTRA, stats_start);
+    return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef PROC_EXTRA_H
+#define PROC_EXTRA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "proc_scan.h"
+
+// Metrics that are too expensive to read for every process on every refresh:
+// PSS, USS and swap from smaps_rollup (the kernel walks the page tables) and the
+// open descriptor count. Each refresh reads them for as many processes as fit in
+// a time and syscall budget, the most deserving first, and carries the older
+// values over. Values that have not been refreshed within max_age are dropped.
+#define PROC_EXTRA_MEM      0x1     // pss_kb, uss_kb, swap_kb
+#define PROC_EXTRA_FDS      0x2     // fds
+#define PROC_EXTRA_DENIED   0x4     // Not readable (another user's process); retried once aged out
+
+// The extra metrics of one process
+struct proc_extra {
+    pid_t pid;
+    unsigned long long start_time;  // Tells a reused PID apart
+    unsigned int flags;             // PROC_EXTRA_* of the values that are valid
+    unsigned int fds;
+    unsigned long pss_kb;
+    unsigned long uss_kb;
+    unsigned long swap_kb;
+    uint64_t sampled_ms;            // CLOCK_MONOTONIC time of the last read, 0 if never
+    unsigned long rss_kb;           // RSS and CPU time at that read, to notice a change since
+    unsigned long long cpu_ticks;
+};
+
+// Scheduler state; rows[i] belongs to entry i of the last snapshot passed to proc_extra_update
+struct proc_extra_table {
+    unsigned int want;              // PROC_EXTRA_MEM | PROC_EXTRA_FDS
+    unsigned int budget_us;         // Time one refresh may spend reading
+    unsigned int budget_syscalls;   // And how many syscalls
+    unsigned int max_age_ms;        // Values older than this are dropped
+    struct proc_extra *rows;
+    struct proc_extra *spare;       // The next rows while merging
+    size_t count;
+    size_t capacity;
+    uint32_t *picked;               // Scratch: rows chosen for this refresh, as a min-heap
+    uint64_t *scores;
+    size_t picked_capacity;
+    double cost_us;                 // Smoothed cost of reading one process
+    size_t last_read;               // Processes read by the last refresh
+    size_t last_valid;              // Rows with some valid value after it
+};
+
+// Set up an empty table; returns 0 or -1
+int proc_extra_init(struct proc_extra_table *table, unsigned int want, unsigned int budget_us,
+                    unsigned int max_age_ms);
+
+// Free the table
+void proc_extra_destroy(struct proc_extra_table *table);
+
+// Line the rows up with snap, keeping what is known about processes that are
+// still there, then spend the budget. Processes that were never read come
+// first, then the longest unread, weighted by their size and by whether their
+// memory or CPU time changed since. Returns 0 or -1.
+int proc_extra_update(struct proc_extra_table *table, struct proc_scanner *scanner, const struct proc_snapshot *snap,
+                      uint64_t now_ms);
+
+// Monotonic clock in milliseconds, the time base of sampled_ms
+uint64_t proc_extra_now_ms(void);
+
+#endif
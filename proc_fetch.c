@@ -0,0 +1,248 @@
+#include "proc_fetch.h"
+
+#include <string.h>
+
+#define MAX_PREFETCH_QUEUE 4096     // Prefetches beyond this are dropped; visible rows are always queued
+
+// One cached process
+struct fetch_slot {
+    struct proc_details details;
+    gboolean ready;             // details holds fetched values
+    gboolean queued;            // A request for this slot is in the queue
+    int queued_priority;
+    guint64 fetched_sample;     // fetcher->sample when details were fetched
+};
+
+// One queued fetch
+struct fetch_request {
+    pid_t pid;
+    unsigned long long start_time;
+    int priority;
+    guint64 seq;
+};
+
+// Whether request a is served before b: by priority, then the newest first
+static gboolean request_before(const struct fetch_request *a, const struct fetch_request *b) {
+    return a->priority != b->priority ? a->priority < b->priority : a->seq > b->seq;
+}
+
+// Add a request to the heap
+static void queue_push(GArray *queue, const struct fetch_request *req) {
+    g_array_append_val(queue, *req);
+    struct fetch_request *heap = (struct fetch_request *) queue->data;
+    guint i = queue->len - 1;
+    while (i > 0 && request_before(&heap[i], &heap[(i - 1) / 2])) {
+        struct fetch_request tmp = heap[i];
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = tmp;
+        i = (i - 1) / 2;
+    }
+}
+
+// Take the most urgent request off the heap
+static struct fetch_request queue_pop(GArray *queue) {
+    struct fetch_request *heap = (struct fetch_request *) queue->data;
+    struct fetch_request top = heap[0];
+    heap[0] = heap[queue->len - 1];
+    g_array_set_size(queue, queue->len - 1);
+
+    guint i = 0;
+    for (;;) {
+        guint best = i;
+        guint left = 2 * i + 1, right = 2 * i + 2;
+        if (left < queue->len && request_before(&heap[left], &heap[best])) {
+            best = left;
+        }
+        if (right < queue->len && request_before(&heap[right], &heap[best])) {
+            best = right;
+        }
+        if (best == i) {
+            break;
+        }
+        struct fetch_request tmp = heap[i];
+        heap[i] = heap[best];
+        heap[best] = tmp;
+        i = best;
+    }
+    return top;
+}
+
+// Find the slot of a process, creating it if asked; a reused PID starts over. Lock held.
+static struct fetch_slot *lookup_slot(struct proc_fetcher *fetcher, pid_t pid, unsigned long long start_time,
+                                      gboolean create) {
+    struct fetch_slot *slot = g_hash_table_lookup(fetcher->cache, GINT_TO_POINTER(pid));
+    if (slot != NULL && slot->details.start_time != start_time) {
+        if (!create) {
+            return NULL;
+        }
+        memset(slot, 0, sizeof(*slot));
+    } else if (slot == NULL) {
+        if (!create) {
+            return NULL;
+        }
+        slot = g_new0(struct fetch_slot, 1);
+        g_hash_table_insert(fetcher->cache, GINT_TO_POINTER(pid), slot);
+    }
+    slot->details.pid = pid;
+    slot->details.start_time = start_time;
+    return slot;
+}
+
+// Queue a fetch for a slot that is missing or stale. Lock held.
+static void request_locked(struct proc_fetcher *fetcher, struct fetch_slot *slot, int priority) {
+    if (slot->ready && fetcher->sample - slot->fetched_sample < PROC_FETCH_TTL) {
+        return;
+    }
+    if (slot->queued && slot->queued_priority <= priority) {
+        return;
+    }
+    if (priority != PROC_FETCH_VISIBLE && fetcher->queue->len >= MAX_PREFETCH_QUEUE) {
+        return;
+    }
+
+    // A more urgent request for a queued slot is added alongside the old one,
+    // which is skipped later because the slot is no longer queued by then
+    struct fetch_request req = { slot->details.pid, slot->details.start_time, priority, fetcher->next_seq++ };
+    queue_push(fetcher->queue, &req);
+    slot->queued = TRUE;
+    slot->queued_priority = priority;
+    g_cond_signal(&fetcher->cond);
+}
+
+// Read the details of one process. Runs on the fetch thread without the lock.
+static void fetch_details(struct proc_fetcher *fetcher, pid_t pid, unsigned long long start_time,
+                          struct proc_details *details) {
+    memset(details, 0, sizeof(*details));
+    details->pid = pid;
+    details->start_time = start_time;
+    details->uid = (uid_t) -1;
+    g_strlcpy(details->user, "Unknown", sizeof(details->user));
+
+    if (proc_read_uid(&fetcher->scanner, pid, &details->uid) < 0) {
+        return;     // Gone; the slot is dropped with the next sample
+    }
+    proc_users_name(fetcher->users, details->uid, details->user, sizeof(details->user));
+    proc_read_cmdline(&fetcher->scanner, pid, details->cmdline, sizeof(details->cmdline));
+}
+
+// Runs on the main loop: tell the owner that new details are cached
+static gboolean notify_fetched(gpointer data) {
+    struct proc_fetcher *fetcher = data;
+
+    g_mutex_lock(&fetcher->lock);
+    fetcher->notify_pending = FALSE;
+    g_mutex_unlock(&fetcher->lock);
+
+    fetcher->on_fetched(fetcher->on_fetched_data);
+    return G_SOURCE_REMOVE;
+}
+
+// Fetch thread: serve the queue, most urgent request first
+static gpointer fetch_thread(gpointer data) {
+    struct proc_fetcher *fetcher = data;
+    struct proc_details details;
+
+    g_mutex_lock(&fetcher->lock);
+    while (!fetcher->stop) {
+        if (fetcher->queue->len == 0) {
+            g_cond_wait(&fetcher->cond, &fetcher->lock);
+            continue;
+        }
+
+        struct fetch_request req = queue_pop(fetcher->queue);
+        struct fetch_slot *slot = lookup_slot(fetcher, req.pid, req.start_time, FALSE);
+        if (slot == NULL || !slot->queued || slot->queued_priority != req.priority) {
+            continue;   // Gone, already fetched, or superseded by a more urgent request
+        }
+        g_mutex_unlock(&fetcher->lock);
+
+        fetch_details(fetcher, req.pid, req.start_time, &details);
+
+        g_mutex_lock(&fetcher->lock);
+        slot = lookup_slot(fetcher, req.pid, req.start_time, FALSE);
+        if (slot == NULL) {
+            continue;   // Pruned while we were reading
+        }
+        slot->details = details;
+        slot->ready = TRUE;
+        slot->queued = FALSE;
+        slot->fetched_sample = fetcher->sample;
+
+        if (!fetcher->notify_pending) {
+            fetcher->notify_pending = TRUE;
+            g_idle_add(notify_fetched, fetcher);
+        }
+    }
+    g_mutex_unlock(&fetcher->lock);
+    return NULL;
+}
+
+// Start the fetch thread
+int proc_fetch_start(struct proc_fetcher *fetcher, const char *proc_root, struct proc_users *users,
+                     void (*on_fetched)(gpointer data), gpointer data) {
+    memset(fetcher, 0, sizeof(*fetcher));
+    if (proc_scanner_init(&fetcher->scanner, proc_root) < 0) {
+        return -1;
+    }
+
+    g_mutex_init(&fetcher->lock);
+    g_cond_init(&fetcher->cond);
+    fetcher->cache = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    fetcher->queue = g_array_new(FALSE, FALSE, sizeof(struct fetch_request));
+    fetcher->users = users;
+    fetcher->on_fetched = on_fetched;
+    fetcher->on_fetched_data = data;
+    fetcher->thread = g_thread_new("fetcher", fetch_thread, fetcher);
+    return 0;
+}
+
+// Stop the fetch thread and free the cache
+void proc_fetch_stop(struct proc_fetcher *fetcher) {
+    g_mutex_lock(&fetcher->lock);
+    fetcher->stop = TRUE;
+    g_cond_signal(&fetcher->cond);
+    g_mutex_unlock(&fetcher->lock);
+    g_thread_join(fetcher->thread);
+
+    g_mutex_clear(&fetcher->lock);
+    g_cond_clear(&fetcher->cond);
+    g_hash_table_destroy(fetcher->cache);
+    g_array_free(fetcher->queue, TRUE);
+    proc_scanner_destroy(&fetcher->scanner);
+}
+
+// Copy the cached details of a process, queueing a fetch if they are missing or stale
+gboolean proc_fetch_get(struct proc_fetcher *fetcher, pid_t pid, unsigned long long start_time, int priority,
+                        struct proc_details *out) {
+    g_mutex_lock(&fetcher->lock);
+    struct fetch_slot *slot = lookup_slot(fetcher, pid, start_time, TRUE);
+    request_locked(fetcher, slot, priority);
+    gboolean ready = slot->ready;
+    if (ready) {
+        *out = slot->details;
+    }
+    g_mutex_unlock(&fetcher->lock);
+    return ready;
+}
+
+// Queue a fetch unless fresh details are cached or one is already queued
+void proc_fetch_request(struct proc_fetcher *fetcher, pid_t pid, unsigned long long start_time, int priority) {
+    g_mutex_lock(&fetcher->lock);
+    request_locked(fetcher, lookup_slot(fetcher, pid, start_time, TRUE), priority);
+    g_mutex_unlock(&fetcher->lock);
+}
+
+// Whether a cached process is no longer in the snapshot
+static gboolean slot_is_gone(gpointer key, gpointer value, gpointer data) {
+    const struct fetch_slot *slot = value;
+    const struct proc_entry *entry = proc_snapshot_find(data, slot->details.pid);
+    return entry == NULL || entry->start_time != slot->details.start_time;
+}
+
+// A new sample is shown: age the cache and drop processes that are gone
+void proc_fetch_new_sample(struct proc_fetcher *fetcher, const struct proc_snapshot *snap) {
+    g_mutex_lock(&fetcher->lock);
+    fetcher->sample++;
+    g_hash_table_foreach_remove(fetcher->cache, slot_is_gone, (gpointer) snap);
+    g_mutex_unlock(&fetcher->lock);
+}
@@ -0,0 +1,69 @@
+#ifndef PROC_FETCH_H
+#define PROC_FETCH_H
+
+#include <glib.h>
+#include <sys/types.h>
+#include "proc_scan.h"
+#include "proc_users.h"
+
+#define PROC_CMDLINE_LEN 256
+
+// Cached details are fetched again once they are this many samples old
+#define PROC_FETCH_TTL 5
+
+// Fetch priorities, most urgent first
+enum {
+    PROC_FETCH_VISIBLE,         // The row is on screen
+    PROC_FETCH_EXPANDED,        // The row is inside an expanded subtree
+};
+
+// Per-process values that cost extra reads, so they are only fetched for the
+// rows someone is looking at instead of for every process on every sample
+struct proc_details {
+    pid_t pid;
+    unsigned long long start_time;  // Tells a reused PID apart
+    uid_t uid;                      // Real UID, (uid_t) -1 if unreadable
+    char user[PROC_USER_LEN];
+    char cmdline[PROC_CMDLINE_LEN]; // Arguments joined by spaces, "" for kernel threads
+};
+
+// Background fetcher: a thread that serves a priority queue of fetch requests
+// and caches the results by PID
+struct proc_fetcher {
+    GThread *thread;
+    GMutex lock;
+    GCond cond;
+    gboolean stop;
+    GHashTable *cache;              // PID -> struct fetch_slot
+    GArray *queue;                  // Binary heap of struct fetch_request
+    guint64 next_seq;               // Newer requests of one priority go first
+    guint64 sample;                 // Samples shown so far, the clock for PROC_FETCH_TTL
+    struct proc_scanner scanner;    // Only used by the fetch thread
+    struct proc_users *users;       // Shared uid -> user name cache
+    void (*on_fetched)(gpointer data);  // Runs on the main loop after new details arrive
+    gpointer on_fetched_data;
+    gboolean notify_pending;
+};
+
+// Start the fetch thread; on_fetched is called on the main loop, at most once
+// per main loop iteration, when fetched details are ready. User names come
+// from users. Returns 0 or -1.
+int proc_fetch_start(struct proc_fetcher *fetcher, const char *proc_root, struct proc_users *users,
+                     void (*on_fetched)(gpointer data), gpointer data);
+
+// Stop the fetch thread and free the cache
+void proc_fetch_stop(struct proc_fetcher *fetcher);
+
+// Copy the cached details of a process into out. Queues a fetch if there are
+// none or they are stale; returns FALSE while nothing is known yet. Never
+// waits for I/O, so views can call it while drawing.
+gboolean proc_fetch_get(struct proc_fetcher *fetcher, pid_t pid, unsigned long long start_time, int priority,
+                        struct proc_details *out);
+
+// Queue a fetch unless fresh details are cached or one is already queued
+void proc_fetch_request(struct proc_fetcher *fetcher, pid_t pid, unsigned long long start_time, int priority);
+
+// A new sample is shown: age the cache and drop processes that are gone
+void proc_fetch_new_sample(struct proc_fetcher *fetcher, const struct proc_snapshot *snap);
+
+#endif
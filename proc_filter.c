@@ -0,0 +1,673 @@
+#define _GNU_SOURCE
+#include "proc_filter.h"
+#include "proc_stats.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CMDLINE_LEN 4096        // Longest command line read into the index
+#define COMPACT_MIN 1024        // Strings worth keeping around before any are thrown out
+
+// Longest run of plain characters a regex requires, or "". Only runs outside
+// groups and not made optional by a quantifier count, and a regex with an
+// alternation has none, so every match of the regex contains the run.
+static void regex_literal(const char *re, char *out, size_t size) {
+    char best[64] = "", cur[64];
+    size_t best_len = 0, cur_len = 0;
+    int depth = 0;
+
+    out[0] = '\0';
+    if (strchr(re, '|') != NULL) {
+        return;
+    }
+    for (const char *p = re;; p++) {
+        char c = *p;
+        int plain = c != '\0' && depth == 0 && strchr(".[]()*+?{}|^$\\", c) == NULL &&
+                    p[1] != '*' && p[1] != '?' && p[1] != '{';
+        if (plain && cur_len < sizeof(cur) - 1) {
+            cur[cur_len++] = c;
+            continue;
+        }
+        if (cur_len > best_len) {
+            memcpy(best, cur, cur_len);
+            best_len = cur_len;
+        }
+        cur_len = 0;
+        if (c == '\0') {
+            break;
+        } else if (c == '(') {
+            depth++;
+        } else if (c == ')' && depth > 0) {
+            depth--;
+        } else if (c == '\\' && p[1] != '\0') {
+            p++;
+        } else if (c == '[') {
+            // A bracket expression may start with ] or ^]
+            p += p[1] == '^' ? 2 : 1;
+            p += *p == ']';
+            while (*p != '\0' && *p != ']') {
+                p++;
+            }
+            if (*p == '\0') {
+                break;
+            }
+        }
+    }
+    if (best_len < size) {
+        memcpy(out, best, best_len);
+        out[best_len] = '\0';
+    }
+}
+
+// Parse an unsigned number that must be all of value
+static int parse_number(const char *value, unsigned long *out) {
+    char *end;
+    errno = 0;
+    *out = strtoul(value, &end, 10);
+    return value[0] != '\0' && value[0] != '-' && *end == '\0' && errno == 0 ? 0 : -1;
+}
+
+// Parse a filter
+int proc_filter_parse(struct proc_filter *filter, const char *text, char *error, size_t error_size) {
+    char buf[PROC_FILTER_LEN];
+    char *save = NULL;
+
+    memset(filter, 0, sizeof(*filter));
+    filter->empty = 1;
+    filter->max_rss_kb = ULONG_MAX;
+    filter->min_cpu = -1;
+    if (strlen(text) >= sizeof(buf)) {
+        snprintf(error, error_size, "filter longer than %d characters", PROC_FILTER_LEN - 1);
+        return -1;
+    }
+    strcpy(buf, text);
+
+    for (char *term = strtok_r(buf, " \t", &save); term != NULL; term = strtok_r(NULL, " \t", &save)) {
+        char *value = strchr(term, '=');
+        unsigned long number;
+        if (value != NULL) {
+            *value++ = '\0';
+        }
+        filter->empty = 0;
+
+        if (value == NULL || strcmp(term, "comm") == 0) {
+            const char *word = value != NULL ? value : term;
+            if (filter->comm[0] != '\0' || strlen(word) >= sizeof(filter->comm) || word[0] == '\0') {
+                snprintf(error, error_size, filter->comm[0] != '\0' ? "only one command name can be searched for"
+                         : "a command name has 1 to %d characters", PROC_COMM_LEN - 1);
+                goto fail;
+            }
+            strcpy(filter->comm, word);
+        } else if (strcmp(term, "cmd") == 0) {
+            if (filter->has_cmdline) {
+                snprintf(error, error_size, "only one cmd= regex");
+                goto fail;
+            }
+            int rc = regcomp(&filter->cmdline, value, REG_EXTENDED | REG_NOSUB);
+            if (rc != 0) {
+                char message[128];
+                regerror(rc, &filter->cmdline, message, sizeof(message));
+                snprintf(error, error_size, "cmd=%s: %s", value, message);
+                goto fail;
+            }
+            filter->has_cmdline = 1;
+            regex_literal(value, filter->literal, sizeof(filter->literal));
+        } else if (strcmp(term, "uid") == 0 || strcmp(term, "minrss") == 0 || strcmp(term, "maxrss") == 0) {
+            if (parse_number(value, &number) < 0 || (term[0] == 'u' && number >= (uid_t) -1)) {
+                snprintf(error, error_size, "%s= needs a number", term);
+                goto fail;
+            }
+            if (term[0] == 'u') {
+                filter->has_uid = 1;
+                filter->uid = (uid_t) number;
+            } else if (term[1] == 'i') {
+                filter->min_rss_kb = number;
+            } else {
+                filter->max_rss_kb = number;
+            }
+        } else if (strcmp(term, "user") == 0) {
+            struct passwd pw, *found = NULL;
+            char pw_buf[1024];
+            if (getpwnam_r(value, &pw, pw_buf, sizeof(pw_buf), &found) != 0 || found == NULL) {
+                snprintf(error, error_size, "no user %s", value);
+                goto fail;
+            }
+            filter->has_uid = 1;
+            filter->uid = found->pw_uid;
+        } else if (strcmp(term, "mincpu") == 0) {
+            char *end;
+            filter->min_cpu = strtod(value, &end);
+            if (value[0] == '\0' || *end != '\0' || !(filter->min_cpu >= 0)) {
+                snprintf(error, error_size, "mincpu= needs a percentage");
+                goto fail;
+            }
+        } else {
+            snprintf(error, error_size, "unknown term %s=%s", term, value);
+            goto fail;
+        }
+    }
+    return 0;
+
+fail:
+    proc_filter_free(filter);
+    return -1;
+}
+
+// Free a parsed filter
+void proc_filter_free(struct proc_filter *filter) {
+    if (filter->has_cmdline) {
+        regfree(&filter->cmdline);
+    }
+    filter->has_cmdline = 0;
+}
+
+// Set up an empty index
+void proc_filter_index_init(struct proc_filter_index *index) {
+    memset(index, 0, sizeof(*index));
+}
+
+// Free the strings and their trigrams
+static void free_strings(struct proc_filter_index *index) {
+    for (size_t i = 0; i < index->trigram_slot_count; i++) {
+        free(index->trigrams[i].ids);
+    }
+    free(index->trigrams);
+    free(index->string_slots);
+    free(index->strings);
+    free(index->pool);
+    index->trigrams = NULL;
+    index->trigram_count = index->trigram_slot_count = 0;
+    index->string_slots = NULL;
+    index->string_slot_count = 0;
+    index->strings = NULL;
+    index->string_count = index->string_capacity = 0;
+    index->pool = NULL;
+    index->pool_used = index->pool_size = 0;
+}
+
+// Free an index
+void proc_filter_index_destroy(struct proc_filter_index *index) {
+    free_strings(index);
+    void *arrays[] = {
+        index->pids, index->start_times, index->comm_ids, index->cmd_ids, index->parents,
+        index->by_comm.keys, index->by_comm.rows, index->by_cmd.keys, index->by_cmd.rows,
+        index->by_uid.keys, index->by_uid.rows, index->by_rss.keys, index->by_rss.rows,
+        index->by_cpu.keys, index->by_cpu.rows, index->old_pids, index->old_start_times,
+        index->old_cmd_ids, index->keys, index->scratch, index->cmdline,
+    };
+    for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++) {
+        free(arrays[i]);
+    }
+    memset(index, 0, sizeof(*index));
+}
+
+// FNV-1a
+static uint32_t hash_bytes(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char) s[i]) * 16777619u;
+    }
+    return h;
+}
+
+// Trigram key of three bytes, case folded
+static uint32_t trigram_key(const char *s) {
+    return (uint32_t) tolower((unsigned char) s[0]) << 16 | (uint32_t) tolower((unsigned char) s[1]) << 8 |
+           (uint32_t) tolower((unsigned char) s[2]);
+}
+
+// Slot of a trigram in the table: its own, or the free one it would take
+static struct proc_filter_trigram *trigram_slot(const struct proc_filter_index *index, uint32_t key) {
+    size_t mask = index->trigram_slot_count - 1;
+    size_t i = (key * 2654435761u) & mask;
+    while (index->trigrams[i].key != 0 && index->trigrams[i].key != key) {
+        i = (i + 1) & mask;
+    }
+    return &index->trigrams[i];
+}
+
+// Postings of a trigram, or NULL if no string has it
+static const struct proc_filter_trigram *find_trigram(const struct proc_filter_index *index, uint32_t key) {
+    if (index->trigram_slot_count == 0) {
+        return NULL;
+    }
+    const struct proc_filter_trigram *t = trigram_slot(index, key);
+    return t->key != 0 ? t : NULL;
+}
+
+// Add a string's trigrams; ids come in ascending order, so each posting list stays sorted
+static int add_trigrams(struct proc_filter_index *index, uint32_t id, const char *s, size_t len) {
+    for (size_t i = 0; i + 3 <= len; i++) {
+        if (index->trigram_count * 2 >= index->trigram_slot_count) {
+            size_t slots = index->trigram_slot_count ? index->trigram_slot_count * 2 : 1024;
+            struct proc_filter_trigram *old = index->trigrams;
+            size_t old_slots = index->trigram_slot_count;
+            index->trigrams = calloc(slots, sizeof(*index->trigrams));
+            if (index->trigrams == NULL) {
+                index->trigrams = old;
+                return -1;
+            }
+            index->trigram_slot_count = slots;
+            for (size_t k = 0; k < old_slots; k++) {
+                if (old[k].key != 0) {
+                    *trigram_slot(index, old[k].key) = old[k];
+                }
+            }
+            free(old);
+            proc_stats_count(PROC_STATS_FILTER, PROC_STATS_ALLOCS, 1);
+        }
+
+        uint32_t key = trigram_key(s + i);
+        struct proc_filter_trigram *t = trigram_slot(index, key);
+        if (t->key == 0) {
+            t->key = key;
+            index->trigram_count++;
+        }
+        if (t->count > 0 && t->ids[t->count - 1] == id) {
+            continue;
+        }
+        if (t->count == t->capacity) {
+            uint32_t capacity = t->capacity ? t->capacity * 2 : 4;
+            uint32_t *ids = realloc(t->ids, capacity * sizeof(*ids));
+            if (ids == NULL) {
+                return -1;
+            }
+            t->ids = ids;
+            t->capacity = capacity;
+        }
+        t->ids[t->count++] = id;
+    }
+    return 0;
+}
+
+// Id of a string, added if new; PROC_FILTER_NONE if out of memory
+static uint32_t intern(struct proc_filter_index *index, const char *s, size_t len) {
+    if ((index->string_count + 1) * 2 > index->string_slot_count) {
+        size_t slots = index->string_slot_count ? index->string_slot_count * 2 : 1024;
+        uint32_t *table = calloc(slots, sizeof(*table));
+        if (table == NULL) {
+            return PROC_FILTER_NONE;
+        }
+        for (size_t id = 0; id < index->string_count; id++) {
+            size_t k = index->strings[id].hash & (slots - 1);
+            while (table[k] != 0) {
+                k = (k + 1) & (slots - 1);
+            }
+            table[k] = (uint32_t) id + 1;
+        }
+        free(index->string_slots);
+        index->string_slots = table;
+        index->string_slot_count = slots;
+        proc_stats_count(PROC_STATS_FILTER, PROC_STATS_ALLOCS, 1);
+    }
+
+    uint32_t hash = hash_bytes(s, len);
+    size_t mask = index->string_slot_count - 1;
+    size_t k = hash & mask;
+    for (; index->string_slots[k] != 0; k = (k + 1) & mask) {
+        uint32_t id = index->string_slots[k] - 1;
+        const char *known = index->pool + index->strings[id].offset;
+        if (index->strings[id].hash == hash && strncmp(known, s, len) == 0 && known[len] == '\0') {
+            return id;
+        }
+    }
+
+    if (index->pool_used + len + 1 > index->pool_size) {
+        size_t size = index->pool_size ? index->pool_size : 65536;
+        while (index->pool_used + len + 1 > size) {
+            size *= 2;
+        }
+        char *pool = realloc(index->pool, size);
+        if (pool == NULL || size > UINT32_MAX) {
+            return PROC_FILTER_NONE;
+        }
+        index->pool = pool;
+        index->pool_size = size;
+        proc_stats_count(PROC_STATS_FILTER, PROC_STATS_ALLOCS, 1);
+    }
+    if (index->string_count == index->string_capacity) {
+        size_t capacity = index->string_capacity ? index->string_capacity * 2 : 1024;
+        struct proc_filter_string *strings = realloc(index->strings, capacity * sizeof(*strings));
+        if (strings == NULL) {
+            return PROC_FILTER_NONE;
+        }
+        index->strings = strings;
+        index->string_capacity = capacity;
+        proc_stats_count(PROC_STATS_FILTER, PROC_STATS_ALLOCS, 1);
+    }
+
+    uint32_t id = (uint32_t) index->string_count++;
+    struct proc_filter_string *str = &index->strings[id];
+    str->offset = (uint32_t) index->pool_used;
+    str->hash = hash;
+    str->comm_seen = str->cmd_seen = 0;
+    memcpy(index->pool + index->pool_used, s, len);
+    index->pool[index->pool_used + len] = '\0';
+    index->pool_used += len + 1;
+    index->string_slots[k] = id + 1;
+    return add_trigrams(index, id, s, len) == 0 ? id : PROC_FILTER_NONE;
+}
+
+// Sort the rows by their keys (stable LSD radix sort, a byte per pass). Passes in
+// which every key has the same byte are skipped, so small values cost one or two.
+static void sort_rows(const uint32_t *keys, size_t count, struct proc_filter_sorted *out, uint32_t *scratch) {
+    uint32_t *src_keys = out->keys, *src_rows = out->rows;
+    uint32_t *dst_keys = scratch, *dst_rows = scratch + count;
+
+    for (size_t i = 0; i < count; i++) {
+        src_keys[i] = keys[i];
+        src_rows[i] = (uint32_t) i;
+    }
+    for (int shift = 0; shift < 32; shift += 8) {
+        size_t counts[256] = {0};
+        for (size_t i = 0; i < count; i++) {
+            counts[(src_keys[i] >> shift) & 0xff]++;
+        }
+        if (count == 0 || counts[(src_keys[0] >> shift) & 0xff] == count) {
+            continue;
+        }
+        size_t sum = 0;
+        for (int b = 0; b < 256; b++) {
+            size_t c = counts[b];
+            counts[b] = sum;
+            sum += c;
+        }
+        for (size_t i = 0; i < count; i++) {
+            size_t to = counts[(src_keys[i] >> shift) & 0xff]++;
+            dst_keys[to] = src_keys[i];
+            dst_rows[to] = src_rows[i];
+        }
+        uint32_t *t = src_keys;
+        src_keys = dst_keys;
+        dst_keys = t;
+        t = src_rows;
+        src_rows = dst_rows;
+        dst_rows = t;
+    }
+    if (src_keys != out->keys) {
+        memcpy(out->keys, src_keys, count * sizeof(*src_keys));
+        memcpy(out->rows, src_rows, count * sizeof(*src_rows));
+    }
+}
+
+// Grow every per-row array to hold count rows
+static int reserve_rows(struct proc_filter_index *index, size_t count) {
+    if (count <= index->capacity && index->cmdline != NULL) {
+        return 0;
+    }
+    size_t capacity = index->capacity ? index->capacity : 1024;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    struct { void **array; size_t size; } arrays[] = {
+        { (void **) &index->pids, sizeof(pid_t) }, { (void **) &index->old_pids, sizeof(pid_t) },
+        { (void **) &index->start_times, sizeof(unsigned long long) },
+        { (void **) &index->old_start_times, sizeof(unsigned long long) },
+        { (void **) &index->comm_ids, 4 }, { (void **) &index->cmd_ids, 4 }, { (void **) &index->old_cmd_ids, 4 },
+        { (void **) &index->parents, 4 }, { (void **) &index->keys, 4 }, { (void **) &index->scratch, 8 },
+        { (void **) &index->by_comm.keys, 4 }, { (void **) &index->by_comm.rows, 4 },
+        { (void **) &index->by_cmd.keys, 4 }, { (void **) &index->by_cmd.rows, 4 },
+        { (void **) &index->by_uid.keys, 4 }, { (void **) &index->by_uid.rows, 4 },
+        { (void **) &index->by_rss.keys, 4 }, { (void **) &index->by_rss.rows, 4 },
+        { (void **) &index->by_cpu.keys, 4 }, { (void **) &index->by_cpu.rows, 4 },
+    };
+    for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++) {
+        void *grown = realloc(*arrays[i].array, capacity * arrays[i].size);
+        if (grown == NULL) {
+            return -1;
+        }
+        *arrays[i].array = grown;
+    }
+    if (index->cmdline == NULL && (index->cmdline = malloc(CMDLINE_LEN)) == NULL) {
+        return -1;
+    }
+    index->capacity = capacity;
+    proc_stats_count(PROC_STATS_FILTER, PROC_STATS_ALLOCS, sizeof(arrays) / sizeof(arrays[0]));
+    return 0;
+}
+
+// Start the strings over once most of them belong to processes that are gone. The
+// command lines carried over from the last update are added again from the old pool.
+static int compact_strings(struct proc_filter_index *index, size_t old_count) {
+    size_t live = 0;
+    for (size_t id = 0; id < index->string_count; id++) {
+        live += index->strings[id].comm_seen == index->update || index->strings[id].cmd_seen == index->update;
+    }
+    if (index->string_count < COMPACT_MIN || index->string_count < live * 2) {
+        return 0;
+    }
+
+    struct proc_filter_index old = *index;
+    index->trigrams = NULL;
+    index->string_slots = NULL;
+    index->strings = NULL;
+    index->pool = NULL;
+    index->trigram_count = index->trigram_slot_count = 0;
+    index->string_slot_count = index->string_count = index->string_capacity = 0;
+    index->pool_used = index->pool_size = 0;
+
+    int rc = 0;
+    for (size_t i = 0; i < old_count; i++) {
+        uint32_t id = index->old_cmd_ids[i];
+        if (id != PROC_FILTER_NONE && rc == 0) {
+            const char *s = old.pool + old.strings[id].offset;
+            id = intern(index, s, strlen(s));
+            rc = id == PROC_FILTER_NONE ? -1 : 0;
+        }
+        index->old_cmd_ids[i] = id;
+    }
+    free_strings(&old);
+    return rc;
+}
+
+// Bring the index up to date with a snapshot
+int proc_filter_index_update(struct proc_filter_index *index, struct proc_scanner *scanner,
+                             const struct proc_snapshot *snap, const double *cpu_pct, int want_cmdlines) {
+    unsigned long long start = proc_stats_start();
+    size_t count = snap->count;
+    if (count >= PROC_FILTER_NONE || reserve_rows(index, count) < 0) {
+        return -1;
+    }
+
+    // The last update's rows become the old ones, for carrying the command lines over
+    pid_t *pids = index->old_pids;
+    index->old_pids = index->pids;
+    index->pids = pids;
+    unsigned long long *start_times = index->old_start_times;
+    index->old_start_times = index->start_times;
+    index->start_times = start_times;
+    uint32_t *cmd_ids = index->old_cmd_ids;
+    index->old_cmd_ids = index->cmd_ids;
+    index->cmd_ids = cmd_ids;
+    size_t old_count = index->count;
+    index->count = 0;
+    if (compact_strings(index, old_count) < 0) {
+        return -1;
+    }
+    uint64_t update = ++index->update;
+
+    size_t j = 0;
+    for (size_t i = 0; i < count; i++) {
+        const struct proc_entry *entry = &snap->entries[i];
+        uint32_t comm = intern(index, entry->comm, strlen(entry->comm));
+        if (comm == PROC_FILTER_NONE) {
+            return -1;
+        }
+        index->strings[comm].comm_seen = update;
+        index->pids[i] = entry->pid;
+        index->start_times[i] = entry->start_time;
+        index->comm_ids[i] = comm;
+
+        // Both lists are sorted by PID; a reused PID is another process with another command line
+        while (j < old_count && index->old_pids[j] < entry->pid) {
+            j++;
+        }
+        uint32_t cmd = PROC_FILTER_NONE;
+        if (j < old_count && index->old_pids[j] == entry->pid && index->old_start_times[j] == entry->start_time) {
+            cmd = index->old_cmd_ids[j];
+        }
+        if (cmd == PROC_FILTER_NONE && want_cmdlines && scanner != NULL) {
+            ssize_t len = proc_read_cmdline(scanner, entry->pid, index->cmdline, CMDLINE_LEN);
+            if (len >= 0 && (cmd = intern(index, index->cmdline, (size_t) len)) == PROC_FILTER_NONE) {
+                return -1;
+            }
+        }
+        if (cmd != PROC_FILTER_NONE) {
+            index->strings[cmd].cmd_seen = update;
+        }
+        index->cmd_ids[i] = cmd;
+
+        const struct proc_entry *parent = entry->ppid > 0 ? proc_snapshot_find(snap, entry->ppid) : NULL;
+        index->parents[i] = parent != NULL && parent != entry ? (uint32_t) (parent - snap->entries) : PROC_FILTER_NONE;
+    }
+    index->count = count;
+    index->have_cmdlines = want_cmdlines && scanner != NULL;
+
+    sort_rows(index->comm_ids, count, &index->by_comm, index->scratch);
+    sort_rows(index->cmd_ids, count, &index->by_cmd, index->scratch);
+    for (size_t i = 0; i < count; i++) {
+        index->keys[i] = snap->entries[i].uid;
+    }
+    sort_rows(index->keys, count, &index->by_uid, index->scratch);
+    for (size_t i = 0; i < count; i++) {
+        unsigned long rss_kb = snap->entries[i].rss_kb;
+        index->keys[i] = rss_kb > UINT32_MAX ? UINT32_MAX : (uint32_t) rss_kb;
+    }
+    sort_rows(index->keys, count, &index->by_rss, index->scratch);
+    for (size_t i = 0; i < count; i++) {
+        double hundredths = cpu_pct != NULL ? cpu_pct[i] * 100 : 0;
+        index->keys[i] = hundredths >= UINT32_MAX ? UINT32_MAX : hundredths > 0 ? (uint32_t) hundredths : 0;
+    }
+    sort_rows(index->keys, count, &index->by_cpu, index->scratch);
+
+    proc_stats_count(PROC_STATS_FILTER, PROC_STATS_ROWS, count);
+    proc_stats_stop(PROC_STATS_FILTER, start);
+    return 0;
+}
+
+// Set the bits of the rows whose sorted key lies in lo..hi
+static void mark_range(const struct proc_filter_sorted *sorted, size_t count, uint32_t lo, uint32_t hi,
+                       uint64_t *bits) {
+    size_t a = 0, b = count;
+    while (a < b) {
+        size_t mid = a + (b - a) / 2;
+        if (sorted->keys[mid] < lo) {
+            a = mid + 1;
+        } else {
+            b = mid;
+        }
+    }
+    for (size_t k = a; k < count && sorted->keys[k] <= hi; k++) {
+        bits[sorted->rows[k] / 64] |= 1ULL << (sorted->rows[k] % 64);
+    }
+}
+
+// Postings of the rarest trigram of text, or NULL with *none set if some trigram is in no string
+static const struct proc_filter_trigram *rarest_trigram(const struct proc_filter_index *index, const char *text,
+                                                        int *none) {
+    const struct proc_filter_trigram *best = NULL;
+    size_t len = strlen(text);
+
+    *none = 0;
+    for (size_t i = 0; i + 3 <= len; i++) {
+        const struct proc_filter_trigram *t = find_trigram(index, trigram_key(text + i));
+        if (t == NULL) {
+            *none = 1;
+            return NULL;
+        }
+        if (best == NULL || t->count < best->count) {
+            best = t;
+        }
+    }
+    return best;
+}
+
+// Mark the rows whose command name or command line matches. The candidates are
+// the strings that have the rarest trigram of the needed text, or every string
+// in use when the text is shorter than a trigram.
+static void mark_strings(const struct proc_filter_index *index, const struct proc_filter *filter, int cmdline,
+                         uint64_t *bits) {
+    const char *text = cmdline ? filter->literal : filter->comm;
+    int none;
+    const struct proc_filter_trigram *t = rarest_trigram(index, text, &none);
+    size_t candidates = t != NULL ? t->count : index->string_count;
+
+    if (none) {
+        return;
+    }
+    for (size_t k = 0; k < candidates; k++) {
+        uint32_t id = t != NULL ? t->ids[k] : (uint32_t) k;
+        const struct proc_filter_string *str = &index->strings[id];
+        const char *s = index->pool + str->offset;
+        if (cmdline) {
+            if (str->cmd_seen == index->update && regexec(&filter->cmdline, s, 0, NULL, 0) == 0) {
+                mark_range(&index->by_cmd, index->count, id, id, bits);
+            }
+        } else if (str->comm_seen == index->update && strcasestr(s, text) != NULL) {
+            mark_range(&index->by_comm, index->count, id, id, bits);
+        }
+    }
+}
+
+// Clamp a threshold to the 32 bits of the sorted keys
+static uint32_t clamp_key(unsigned long long value) {
+    return value > UINT32_MAX ? UINT32_MAX : (uint32_t) value;
+}
+
+// Match a filter against the indexed snapshot
+size_t proc_filter_match(const struct proc_filter_index *index, const struct proc_filter *filter, uint64_t *matched,
+                         uint64_t *shown) {
+    unsigned long long start = proc_stats_start();
+    size_t count = index->count;
+    size_t words = PROC_FILTER_WORDS(count);
+
+    memset(matched, 0xff, words * sizeof(*matched));
+    if (count % 64 != 0) {
+        matched[words - 1] = (1ULL << (count % 64)) - 1;
+    }
+
+    // Each term marks its rows in shown, which the matches are then cut down to
+    for (int term = 0; term < 5 && !filter->empty; term++) {
+        memset(shown, 0, words * sizeof(*shown));
+        if (term == 0 && filter->comm[0] != '\0') {
+            mark_strings(index, filter, 0, shown);
+        } else if (term == 1 && filter->has_cmdline) {
+            mark_strings(index, filter, 1, shown);
+        } else if (term == 2 && filter->has_uid) {
+            mark_range(&index->by_uid, count, filter->uid, filter->uid, shown);
+        } else if (term == 3 && (filter->min_rss_kb > 0 || filter->max_rss_kb != ULONG_MAX)) {
+            mark_range(&index->by_rss, count, clamp_key(filter->min_rss_kb), clamp_key(filter->max_rss_kb), shown);
+        } else if (term == 4 && filter->min_cpu >= 0) {
+            mark_range(&index->by_cpu, count, clamp_key((unsigned long long) ceil(filter->min_cpu * 100)), UINT32_MAX,
+                       shown);
+        } else {
+            continue;
+        }
+        for (size_t w = 0; w < words; w++) {
+            matched[w] &= shown[w];
+        }
+    }
+
+    // Every match brings its ancestors along, each of them once
+    size_t matches = 0;
+    memcpy(shown, matched, words * sizeof(*shown));
+    for (size_t w = 0; w < words; w++) {
+        for (uint64_t bits = matched[w]; bits != 0; bits &= bits - 1) {
+            size_t row = w * 64 + (size_t) __builtin_ctzll(bits);
+            matches++;
+            for (uint32_t p = index->parents[row]; p != PROC_FILTER_NONE && !PROC_FILTER_TEST(shown, p);
+                 p = index->parents[p]) {
+                shown[p / 64] |= 1ULL << (p % 64);
+            }
+        }
+    }
+    proc_stats_count(PROC_STATS_FILTER, PROC_STATS_ROWS, matches);
+    proc_stats_stop(PROC_STATS_FILTER, start);
+    return matches;
+}
@@ -0,0 +1,133 @@
+#ifndef PROC_FILTER_H
+#define PROC_FILTER_H
+
+#include <regex.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "proc_scan.h"
+
+// Search over a snapshot. A filter is a space-separated list of terms, and a
+// process must match all of them:
+//
+//   WORD or comm=WORD  the command name contains WORD, ignoring case
+//   cmd=REGEX          the command line matches the POSIX extended regex
+//   uid=N, user=NAME   the process belongs to that user
+//   minrss=KB, maxrss=KB
+//   mincpu=PCT         CPU% at least PCT, as the caller measures it
+//
+// Queries run against an index that is brought up to date with every snapshot,
+// so one costs a few passes over bitmaps instead of a walk over the processes:
+// a trigram index over the distinct command names and command lines, and the
+// rows sorted by command, command line, uid, RSS and CPU%. Results are bitmaps
+// with one bit per snapshot row, which is also a proc_columns row.
+#define PROC_FILTER_WORDS(count) (((count) + 63) / 64)
+#define PROC_FILTER_TEST(bits, row) (((bits)[(row) / 64] >> ((row) % 64)) & 1)
+
+#define PROC_FILTER_LEN 256     // Longest filter text
+
+// A parsed filter
+struct proc_filter {
+    int empty;                      // No terms: everything matches
+    char comm[PROC_COMM_LEN];       // Substring of the command name, or ""
+    int has_cmdline;
+    regex_t cmdline;
+    char literal[64];               // Text every command line the regex matches contains, or ""
+    int has_uid;
+    uid_t uid;
+    unsigned long min_rss_kb;
+    unsigned long max_rss_kb;
+    double min_cpu;                 // Negative for no CPU% term
+};
+
+// One distinct command name or command line
+struct proc_filter_string {
+    uint32_t offset;                // In the pool
+    uint32_t hash;
+    uint64_t comm_seen;             // Last update in which a process had it as its name
+    uint64_t cmd_seen;              // ... or as its command line
+};
+
+// The ids of the strings that contain one trigram, in ascending order
+struct proc_filter_trigram {
+    uint32_t key;                   // Three lowercase bytes; 0 marks a free slot
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *ids;
+};
+
+// Rows sorted by one value
+struct proc_filter_sorted {
+    uint32_t *keys;                 // Ascending
+    uint32_t *rows;
+};
+
+// The index of one snapshot
+struct proc_filter_index {
+    // Distinct strings, only added to until most of them are no longer used
+    char *pool;
+    size_t pool_used;
+    size_t pool_size;
+    struct proc_filter_string *strings;
+    size_t string_count;
+    size_t string_capacity;
+    uint32_t *string_slots;         // Hash table of string id + 1
+    size_t string_slot_count;
+    struct proc_filter_trigram *trigrams;   // Hash table
+    size_t trigram_count;
+    size_t trigram_slot_count;
+    uint64_t update;                // Counts updates; string *_seen fields compare against it
+
+    // Per row of the snapshot
+    size_t count;
+    size_t capacity;
+    pid_t *pids;
+    unsigned long long *start_times;
+    uint32_t *comm_ids;
+    uint32_t *cmd_ids;              // PROC_FILTER_NONE until the command line is read
+    uint32_t *parents;              // Row of the parent, or PROC_FILTER_NONE
+    struct proc_filter_sorted by_comm;
+    struct proc_filter_sorted by_cmd;
+    struct proc_filter_sorted by_uid;
+    struct proc_filter_sorted by_rss;   // kB
+    struct proc_filter_sorted by_cpu;   // Hundredths of a percent
+    int have_cmdlines;              // Every row's command line was read
+
+    // Scratch of an update
+    pid_t *old_pids;
+    unsigned long long *old_start_times;
+    uint32_t *old_cmd_ids;
+    uint32_t *keys;
+    uint32_t *scratch;
+    char *cmdline;                  // Read buffer
+};
+
+#define PROC_FILTER_NONE UINT32_MAX
+
+// Parse a filter; returns 0, or -1 with a message in error. A parsed filter
+// must be freed with proc_filter_free.
+int proc_filter_parse(struct proc_filter *filter, const char *text, char *error, size_t error_size);
+
+// Free a parsed filter
+void proc_filter_free(struct proc_filter *filter);
+
+// Set up an empty index
+void proc_filter_index_init(struct proc_filter_index *index);
+
+// Free an index
+void proc_filter_index_destroy(struct proc_filter_index *index);
+
+// Bring the index up to date with a snapshot; returns 0 or -1. cpu_pct holds the
+// CPU% of each row (NULL for all 0). With want_cmdlines, the command lines of
+// processes not seen before are read through the scanner, once per process; a
+// NULL scanner reads none.
+int proc_filter_index_update(struct proc_filter_index *index, struct proc_scanner *scanner,
+                             const struct proc_snapshot *snap, const double *cpu_pct, int want_cmdlines);
+
+// Match a filter against the indexed snapshot. matched and shown hold
+// PROC_FILTER_WORDS(index->count) words each. matched gets the processes that
+// match; shown gets them and all of their ancestors. Returns the match count.
+size_t proc_filter_match(const struct proc_filter_index *index, const struct proc_filter *filter, uint64_t *matched,
+                         uint64_t *shown);
+
+#endif
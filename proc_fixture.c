@@ -0,0 +1,293 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "proc_info_abi.h"
+
+// Writes a fake proc tree for benchmarking the scanner without touching the real
+// /proc: <dir>/<pid>/stat, status, smaps_rollup and fd/ for every process, the machine-wide stat,
+// meminfo and uptime files, and the proc_info and proc_info_bin tables the module
+// would export for the same processes. The readers take it with --proc-root.
+
+// Command names, including the awkward ones the stat parser has to cope with
+static const char *const comms[] = {
+    "systemd", "bash", "sshd", "kworker/0:1", "python3", "(sd-pam)", "Web Content", "a) b (c", "postgres", "nginx",
+};
+static const unsigned int uids[] = { 0, 0, 1000, 1000, 1001, 33, 65534 };
+static const char states[] = { 'S', 'S', 'S', 'R', 'D', 'I' };
+
+// Small deterministic generator so every run produces the same tree
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ULL;
+
+// Function to return the next pseudo-random number (xorshift64)
+static unsigned long long next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// One generated process
+struct fixture_proc {
+    int pid;
+    int ppid;
+    unsigned int uid;
+    int prio;
+    int threads;
+    char state;
+    unsigned long rss_pages;
+    unsigned long utime;
+    unsigned long stime;
+    unsigned long long start_time;
+    const char *comm;
+};
+
+// Function to write a whole file below dir_fd
+static int write_file(int dir_fd, const char *name, const char *data, size_t len) {
+    int fd = openat(dir_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror(name);
+        return -1;
+    }
+    ssize_t n = write(fd, data, len);
+    close(fd);
+    if (n != (ssize_t) len) {
+        perror(name);
+        return -1;
+    }
+    return 0;
+}
+
+// Function to fill in process i. With depth > 0 the processes form chains of that
+// length below PID 1, otherwise each one hangs off a random earlier process.
+static void make_proc(struct fixture_proc *procs, size_t i, int depth) {
+    struct fixture_proc *p = &procs[i];
+
+    p->pid = (int) i + 1;
+    if (i == 0) {
+        p->ppid = 0;
+    } else if (depth > 0) {
+        p->ppid = (i - 1) % (size_t) depth == 0 ? 1 : p->pid - 1;
+    } else {
+        p->ppid = procs[next_random() % i].pid;
+    }
+    p->uid = uids[next_random() % (sizeof(uids) / sizeof(uids[0]))];
+    p->prio = 20 - (int) (next_random() % 3);
+    p->threads = 1 + (int) (next_random() % 8 == 0 ? next_random() % 64 : 0);
+    p->state = states[next_random() % sizeof(states)];
+    p->rss_pages = next_random() % 65536;
+    p->utime = next_random() % 100000;
+    p->stime = next_random() % 20000;
+    p->start_time = i * 7 + next_random() % 7;
+    p->comm = comms[next_random() % (sizeof(comms) / sizeof(comms[0]))];
+}
+
+// Function to write <pid>/fd with a few descriptors, as empty files
+static int write_fd_dir(int dir_fd, const struct fixture_proc *p) {
+    char name[16];
+
+    if (mkdirat(dir_fd, "fd", 0755) < 0 && errno != EEXIST) {
+        perror("fd");
+        return -1;
+    }
+    for (int fd = 0; fd < 3 + p->pid % 5; fd++) {
+        snprintf(name, sizeof(name), "fd/%d", fd);
+        int file = openat(dir_fd, name, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (file < 0) {
+            perror(name);
+            return -1;
+        }
+        close(file);
+    }
+    return 0;
+}
+
+// Function to write <pid>/stat, status, smaps_rollup and fd for one process
+static int write_proc_dir(int root_fd, const struct fixture_proc *p, long page_kb) {
+    char name[32];
+    char buf[1024];
+    int len;
+
+    snprintf(name, sizeof(name), "%d", p->pid);
+    if (mkdirat(root_fd, name, 0755) < 0 && errno != EEXIST) {
+        perror(name);
+        return -1;
+    }
+    int dir_fd = openat(root_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        perror(name);
+        return -1;
+    }
+
+    // Same field layout as the kernel's /proc/[pid]/stat
+    len = snprintf(buf, sizeof(buf),
+                   "%d (%s) %c %d %d %d 0 -1 4194560 100 0 0 0 %lu %lu 0 0 %d 0 %d 0 %llu %lu %lu "
+                   "18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n",
+                   p->pid, p->comm, p->state, p->ppid, p->pid, p->pid, p->utime, p->stime, p->prio,
+                   p->threads, p->start_time, p->rss_pages * 4096 * 4, p->rss_pages);
+    int ret = write_file(dir_fd, "stat", buf, (size_t) len);
+
+    len = snprintf(buf, sizeof(buf),
+                   "Name:\t%s\nUmask:\t0022\nState:\t%c\nTgid:\t%d\nNgid:\t0\nPid:\t%d\nPPid:\t%d\n"
+                   "TracerPid:\t0\nUid:\t%u\t%u\t%u\t%u\nGid:\t%u\t%u\t%u\t%u\nFDSize:\t64\n"
+                   "VmRSS:\t%8lu kB\nThreads:\t%d\n",
+                   p->comm, p->state, p->pid, p->pid, p->ppid, p->uid, p->uid, p->uid, p->uid,
+                   p->uid, p->uid, p->uid, p->uid, p->rss_pages * (unsigned long) page_kb, p->threads);
+    if (ret == 0) {
+        ret = write_file(dir_fd, "status", buf, (size_t) len);
+    }
+
+    // Derived from the RSS rather than drawn at random, so the rest of the tree stays as it was
+    unsigned long rss_kb = p->rss_pages * (unsigned long) page_kb;
+    len = snprintf(buf, sizeof(buf),
+                   "00400000-7ffc00000000 ---p 00000000 00:00 0                          [rollup]\n"
+                   "Rss:            %8lu kB\nPss:            %8lu kB\nShared_Clean:   %8lu kB\n"
+                   "Shared_Dirty:          0 kB\nPrivate_Clean:  %8lu kB\nPrivate_Dirty:  %8lu kB\n"
+                   "Referenced:     %8lu kB\nAnonymous:      %8lu kB\nSwap:           %8lu kB\nSwapPss:        %8lu kB\n",
+                   rss_kb, rss_kb * 3 / 4, rss_kb / 2, rss_kb / 8, rss_kb * 3 / 8, rss_kb, rss_kb * 3 / 8,
+                   rss_kb / 16, rss_kb / 16);
+    if (ret == 0 && p->rss_pages > 0) {
+        ret = write_file(dir_fd, "smaps_rollup", buf, (size_t) len);
+    }
+    if (ret == 0 && p->rss_pages > 0) {
+        ret = write_fd_dir(dir_fd, p);
+    }
+
+    close(dir_fd);
+    return ret;
+}
+
+// Function to write the proc_info text table and the proc_info_bin records
+static int write_module_tables(int root_fd, const struct fixture_proc *procs, size_t count, long page_kb) {
+    unsigned long long ns_per_tick = 1000000000ULL / (unsigned long long) sysconf(_SC_CLK_TCK);
+    FILE *text = NULL;
+    FILE *bin = NULL;
+    int fd;
+
+    if ((fd = openat(root_fd, "proc_info", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) >= 0) {
+        text = fdopen(fd, "w");
+    }
+    if ((fd = openat(root_fd, PROC_INFO_BIN_NAME, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) >= 0) {
+        bin = fdopen(fd, "w");
+    }
+    if (text == NULL || bin == NULL) {
+        perror("proc_info");
+        if (text) {
+            fclose(text);
+        }
+        if (bin) {
+            fclose(bin);
+        }
+        return -1;
+    }
+
+    fprintf(text, "# generation 1\n");
+    for (size_t i = 0; i < count; i++) {
+        const struct fixture_proc *p = &procs[i];
+        fprintf(text, "| %-8d | %-8d | %-8u | %-4d | %c | %-6d | %-10lu | %-16llu | %-16llu | %-18llu | %-16s |\n",
+                p->pid, p->ppid, p->uid, p->prio + PROC_INFO_PRIO_OFFSET, p->state, p->threads,
+                p->rss_pages * (unsigned long) page_kb, p->utime * ns_per_tick, p->stime * ns_per_tick,
+                p->start_time * ns_per_tick, p->comm);
+
+        struct proc_info_record rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.version = PROC_INFO_BIN_VERSION;
+        rec.size = sizeof(rec);
+        rec.pid = p->pid;
+        rec.ppid = p->ppid;
+        rec.uid = p->uid;
+        rec.prio = p->prio + PROC_INFO_PRIO_OFFSET;
+        rec.threads = p->threads;
+        rec.rss_pages = p->rss_pages;
+        rec.utime_ns = p->utime * ns_per_tick;
+        rec.stime_ns = p->stime * ns_per_tick;
+        rec.start_time_ns = p->start_time * ns_per_tick;
+        strncpy(rec.comm, p->comm, sizeof(rec.comm) - 1);
+        rec.state = p->state;
+        fwrite(&rec, sizeof(rec), 1, bin);
+    }
+
+    int ret = 0;
+    if (fclose(text) != 0 || fclose(bin) != 0) {
+        perror("proc_info");
+        ret = -1;
+    }
+    return ret;
+}
+
+// Function to write the machine-wide files the readers look at
+static int write_system_files(int root_fd, size_t count) {
+    char buf[256];
+    int len;
+
+    len = snprintf(buf, sizeof(buf), "cpu  %zu 0 %zu 1000000 0 0 0 0 0 0\nprocesses %zu\n",
+                   count * 10, count * 2, count);
+    if (write_file(root_fd, "stat", buf, (size_t) len) < 0) {
+        return -1;
+    }
+    len = snprintf(buf, sizeof(buf), "MemTotal:       16384000 kB\nMemFree:         8192000 kB\n");
+    if (write_file(root_fd, "meminfo", buf, (size_t) len) < 0) {
+        return -1;
+    }
+    len = snprintf(buf, sizeof(buf), "%zu.00 %zu.00\n", count * 7 / 100 + 1000, count * 7 / 100);
+    return write_file(root_fd, "uptime", buf, (size_t) len);
+}
+
+// Main function
+int main(int argc, char *argv[]) {
+    int depth = 0;
+    int argi = 1;
+
+    if (argi + 1 < argc && strcmp(argv[argi], "--depth") == 0) {
+        depth = atoi(argv[argi + 1]);  // Parent chains of this length instead of a random tree
+        argi += 2;
+    }
+    if (argc - argi != 2) {
+        fprintf(stderr, "Usage: %s [--depth D] DIR COUNT\n", argv[0]);
+        return 1;
+    }
+
+    const char *dir = argv[argi];
+    size_t count = strtoull(argv[argi + 1], NULL, 10);
+    if (count == 0) {
+        fprintf(stderr, "COUNT must be at least 1\n");
+        return 1;
+    }
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        perror(dir);
+        return 1;
+    }
+    int root_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd < 0) {
+        perror(dir);
+        return 1;
+    }
+
+    struct fixture_proc *procs = malloc(count * sizeof(*procs));
+    if (procs == NULL) {
+        perror("malloc");
+        return 1;
+    }
+
+    long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    int ret = 0;
+    for (size_t i = 0; i < count && ret == 0; i++) {
+        make_proc(procs, i, depth);
+        ret = write_proc_dir(root_fd, &procs[i], page_kb);
+    }
+    if (ret == 0) {
+        ret = write_module_tables(root_fd, procs, count, page_kb);
+    }
+    if (ret == 0) {
+        ret = write_system_files(root_fd, count);
+    }
+
+    free(procs);
+    close(root_fd);
+    return ret == 0 ? 0 : 1;
+}
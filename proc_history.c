@@ -0,0 +1,876 @@
+#include "proc_history.h"
+#include "proc_stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Frame layout: varint length of the rest, a flags byte, the time and CPU totals
+// (absolute in keyframes, zigzag deltas otherwise), then three sections, each
+// starting with a row count:
+//   removed  previous-snapshot row indexes, gap-encoded
+//   changed  previous-snapshot row indexes, gap-encoded; a field mask per row;
+//            then one column per field holding the new values of the rows with
+//            that bit set
+//   added    new rows in PID order, one column per field. Command names go
+//            through a dictionary built up within the frame.
+// A keyframe is a frame against an empty snapshot: only added rows.
+
+#define FRAME_KEYFRAME 0x1
+
+// Fields of the changed section, most frequently changing first so that the mask fits a byte
+enum {
+    FIELD_UTIME,
+    FIELD_STIME,
+    FIELD_RSS,
+    FIELD_STATE,
+    FIELD_THREADS,
+    FIELD_PRIO,
+    FIELD_PPID,
+    FIELD_UID,
+    FIELD_COMM,
+    FIELD_COUNT,
+};
+
+#define MAX_FRAME_HEADER 64
+#define MAX_ROW_BYTES 160           // Longest encoding of one row in any section
+
+// Write all of len bytes, retrying short writes
+static int write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        proc_stats_count(PROC_STATS_OUTPUT, PROC_STATS_SYSCALLS, 1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        proc_stats_count(PROC_STATS_OUTPUT, PROC_STATS_BYTES, (unsigned long long) n);
+        p += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+// Append a varint: 7 bits per byte, least significant first
+static unsigned char *put_varint(unsigned char *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (unsigned char) (v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char) v;
+    return p;
+}
+
+// Read a varint; returns 0, or -1 if it runs past end
+static int get_varint(const unsigned char **pp, const unsigned char *end, uint64_t *v) {
+    const unsigned char *p = *pp;
+    uint64_t value = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        value |= (uint64_t) (*p & 0x7f) << shift;
+        if ((*p++ & 0x80) == 0) {
+            *pp = p;
+            *v = value;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Map signed deltas to unsigned so that small negative numbers stay short
+static uint64_t zigzag(int64_t v) {
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+// Append a command name: its length, then its bytes
+static unsigned char *put_comm(unsigned char *p, const char *comm) {
+    size_t len = strnlen(comm, PROC_COMM_LEN - 1);
+    *p++ = (unsigned char) len;
+    memcpy(p, comm, len);
+    return p + len;
+}
+
+// Read a command name; returns 0 or -1
+static int get_comm(const unsigned char **pp, const unsigned char *end, char *comm) {
+    const unsigned char *p = *pp;
+    if (p >= end || *p >= PROC_COMM_LEN || (size_t) (end - p - 1) < *p) {
+        return -1;
+    }
+    memcpy(comm, p + 1, *p);
+    comm[*p] = '\0';
+    *pp = p + 1 + *p;
+    return 0;
+}
+
+// Grow a scratch row list to at least count entries; returns 0 or -1
+static int reserve_rows(uint32_t **rows, size_t *capacity, size_t count) {
+    if (*capacity >= count) {
+        return 0;
+    }
+    size_t bigger = *capacity ? *capacity : 4096;
+    while (bigger < count) {
+        bigger *= 2;
+    }
+    uint32_t *grown = realloc(*rows, bigger * sizeof(*grown));
+    if (grown == NULL) {
+        return -1;
+    }
+    *rows = grown;
+    *capacity = bigger;
+    return 0;
+}
+
+// Bits of the fields that differ between two entries of the same process
+static unsigned int changed_fields(const struct proc_entry *a, const struct proc_entry *b) {
+    return (a->utime != b->utime) << FIELD_UTIME | (a->stime != b->stime) << FIELD_STIME |
+           (a->rss_kb != b->rss_kb) << FIELD_RSS | (a->state != b->state) << FIELD_STATE |
+           (a->threads != b->threads) << FIELD_THREADS | (a->prio != b->prio) << FIELD_PRIO |
+           (a->ppid != b->ppid) << FIELD_PPID | (a->uid != b->uid) << FIELD_UID |
+           (strcmp(a->comm, b->comm) != 0) << FIELD_COMM;
+}
+
+// Hash of a command name for the frame dictionary
+static uint32_t hash_comm(const char *comm) {
+    uint32_t h = 2166136261u;
+    for (; *comm; comm++) {
+        h = (h ^ (unsigned char) *comm) * 16777619u;
+    }
+    return h;
+}
+
+// Encode the added rows of cur listed in added, column by column
+static unsigned char *encode_added(unsigned char *p, const struct proc_snapshot *cur, const uint32_t *added,
+                                   size_t count, uint32_t *dict_rows, uint32_t *dict_slots, size_t dict_mask) {
+    const struct proc_entry *e;
+    const struct proc_entry zero = {0};
+    const struct proc_entry *last;
+
+    // Columns whose neighbouring rows tend to be alike are deltas from the row before
+    last = &zero;
+    for (size_t i = 0; i < count; last = e, i++) {
+        e = &cur->entries[added[i]];
+        p = put_varint(p, (uint64_t) (e->pid - last->pid));
+    }
+    last = &zero;
+    for (size_t i = 0; i < count; last = e, i++) {
+        e = &cur->entries[added[i]];
+        p = put_varint(p, zigzag((int64_t) e->ppid - last->ppid));
+    }
+    last = &zero;
+    for (size_t i = 0; i < count; last = e, i++) {
+        e = &cur->entries[added[i]];
+        p = put_varint(p, zigzag((int32_t) (e->uid - last->uid)));
+    }
+    last = &zero;
+    for (size_t i = 0; i < count; last = e, i++) {
+        e = &cur->entries[added[i]];
+        p = put_varint(p, zigzag((int64_t) e->prio - last->prio));
+    }
+    for (size_t i = 0; i < count; i++) {
+        *p++ = (unsigned char) cur->entries[added[i]].state;
+    }
+    last = &zero;
+    for (size_t i = 0; i < count; last = e, i++) {
+        e = &cur->entries[added[i]];
+        p = put_varint(p, zigzag((int64_t) e->threads - last->threads));
+    }
+    for (size_t i = 0; i < count; i++) {
+        p = put_varint(p, cur->entries[added[i]].rss_kb);
+    }
+    for (size_t i = 0; i < count; i++) {
+        p = put_varint(p, cur->entries[added[i]].utime);
+    }
+    for (size_t i = 0; i < count; i++) {
+        p = put_varint(p, cur->entries[added[i]].stime);
+    }
+    last = &zero;
+    for (size_t i = 0; i < count; last = e, i++) {
+        e = &cur->entries[added[i]];
+        p = put_varint(p, zigzag((int64_t) (e->start_time - last->start_time)));
+    }
+
+    // Names repeat a lot (kworker, bash, ...): each is spelled out once per frame
+    size_t dict_count = 0;
+    memset(dict_slots, 0, (dict_mask + 1) * sizeof(*dict_slots));
+    for (size_t i = 0; i < count; i++) {
+        const char *comm = cur->entries[added[i]].comm;
+        size_t slot = hash_comm(comm) & dict_mask;
+        while (dict_slots[slot] != 0 && strcmp(cur->entries[dict_rows[dict_slots[slot] - 1]].comm, comm) != 0) {
+            slot = (slot + 1) & dict_mask;
+        }
+        if (dict_slots[slot] != 0) {
+            p = put_varint(p, dict_slots[slot] - 1);
+        } else {
+            dict_rows[dict_count] = added[i];
+            dict_slots[slot] = (uint32_t) ++dict_count;
+            p = put_varint(p, dict_count - 1);
+            p = put_comm(p, comm);
+        }
+    }
+    return p;
+}
+
+// Encode snap as a frame against rec->prev (or against nothing, for a keyframe)
+// into rec->buf; returns the frame length or -1
+static ssize_t encode_frame(struct proc_recorder *rec, const struct proc_snapshot *snap, uint64_t time_ms,
+                            const struct proc_cpu_totals *totals, int keyframe) {
+    static const struct proc_snapshot empty;
+    const struct proc_snapshot *prev = keyframe ? &empty : &rec->prev;
+
+    size_t dict_size = 16;
+    while (dict_size < snap->count * 2) {
+        dict_size *= 2;
+    }
+    size_t needed = MAX_FRAME_HEADER + (prev->count + snap->count) * MAX_ROW_BYTES;
+    if (needed > rec->size) {
+        unsigned char *buf = realloc(rec->buf, needed);
+        if (buf == NULL) {
+            return -1;
+        }
+        rec->buf = buf;
+        rec->size = needed;
+    }
+    if (reserve_rows(&rec->rows, &rec->rows_capacity, 4 * prev->count + 2 * snap->count + dict_size) < 0) {
+        return -1;
+    }
+    uint32_t *removed = rec->rows;
+    uint32_t *old_rows = removed + prev->count;
+    uint32_t *new_rows = old_rows + prev->count;
+    uint32_t *masks = new_rows + prev->count;
+    uint32_t *added = masks + prev->count;
+    uint32_t *dict_rows = added + snap->count;
+    uint32_t *dict_slots = dict_rows + snap->count;
+    size_t removed_count = 0, changed_count = 0, added_count = 0;
+
+    // One merge pass by PID sorts every row into its section
+    size_t i = 0, j = 0;
+    while (i < prev->count || j < snap->count) {
+        const struct proc_entry *a = i < prev->count ? &prev->entries[i] : NULL;
+        const struct proc_entry *b = j < snap->count ? &snap->entries[j] : NULL;
+        if (b == NULL || (a != NULL && a->pid < b->pid)) {
+            removed[removed_count++] = (uint32_t) i++;
+        } else if (a == NULL || b->pid < a->pid) {
+            added[added_count++] = (uint32_t) j++;
+        } else if (a->start_time != b->start_time) {
+            // The PID was reused by a new process
+            removed[removed_count++] = (uint32_t) i++;
+            added[added_count++] = (uint32_t) j++;
+        } else {
+            unsigned int mask = changed_fields(a, b);
+            if (mask != 0) {
+                old_rows[changed_count] = (uint32_t) i;
+                new_rows[changed_count] = (uint32_t) j;
+                masks[changed_count++] = mask;
+            }
+            i++;
+            j++;
+        }
+    }
+
+    // Leave room in front for the length, which is only known at the end
+    unsigned char *start = rec->buf + 10;
+    unsigned char *p = start;
+    *p++ = keyframe ? FRAME_KEYFRAME : 0;
+    if (keyframe) {
+        p = put_varint(p, time_ms);
+        p = put_varint(p, totals->total);
+        p = put_varint(p, totals->idle);
+    } else {
+        p = put_varint(p, zigzag((int64_t) (time_ms - rec->time_ms)));
+        p = put_varint(p, zigzag((int64_t) (totals->total - rec->totals.total)));
+        p = put_varint(p, zigzag((int64_t) (totals->idle - rec->totals.idle)));
+    }
+
+    p = put_varint(p, removed_count);
+    for (size_t k = 0; k < removed_count; k++) {
+        p = put_varint(p, removed[k] - (k ? removed[k - 1] + 1 : 0));
+    }
+
+    p = put_varint(p, changed_count);
+    for (size_t k = 0; k < changed_count; k++) {
+        p = put_varint(p, old_rows[k] - (k ? old_rows[k - 1] + 1 : 0));
+    }
+    for (size_t k = 0; k < changed_count; k++) {
+        p = put_varint(p, masks[k]);
+    }
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        for (size_t k = 0; k < changed_count; k++) {
+            if ((masks[k] & (1u << field)) == 0) {
+                continue;
+            }
+            const struct proc_entry *a = &prev->entries[old_rows[k]];
+            const struct proc_entry *b = &snap->entries[new_rows[k]];
+            switch (field) {
+            case FIELD_UTIME:   p = put_varint(p, zigzag((int64_t) (b->utime - a->utime))); break;
+            case FIELD_STIME:   p = put_varint(p, zigzag((int64_t) (b->stime - a->stime))); break;
+            case FIELD_RSS:     p = put_varint(p, zigzag((int64_t) (b->rss_kb - a->rss_kb))); break;
+            case FIELD_STATE:   *p++ = (unsigned char) b->state; break;
+            case FIELD_THREADS: p = put_varint(p, zigzag((int64_t) b->threads - a->threads)); break;
+            case FIELD_PRIO:    p = put_varint(p, zigzag((int64_t) b->prio - a->prio)); break;
+            case FIELD_PPID:    p = put_varint(p, (uint64_t) b->ppid); break;
+            case FIELD_UID:     p = put_varint(p, (uint32_t) (b->uid + 1)); break;
+            case FIELD_COMM:    p = put_comm(p, b->comm); break;
+            }
+        }
+    }
+
+    p = put_varint(p, added_count);
+    p = encode_added(p, snap, added, added_count, dict_rows, dict_slots, dict_size - 1);
+
+    // Put the length right before the body
+    unsigned char len[10];
+    size_t len_size = (size_t) (put_varint(len, (uint64_t) (p - start)) - len);
+    memcpy(start - len_size, len, len_size);
+    rec->used = (size_t) (start - len_size - rec->buf);
+    return p - start + (ssize_t) len_size;
+}
+
+// Open path for recording, creating it or appending to it
+int proc_recorder_open(struct proc_recorder *rec, const char *path, unsigned int keyframe_interval) {
+    struct stat st;
+    struct proc_replay replay;
+    char index_path[4096];
+
+    memset(rec, 0, sizeof(*rec));
+    rec->index_fd = -1;
+    rec->keyframe_interval = keyframe_interval ? keyframe_interval : PROC_HISTORY_DEFAULT_KEYFRAME;
+    if (snprintf(index_path, sizeof(index_path), "%s.idx", path) >= (int) sizeof(index_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    rec->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (rec->fd < 0 || fstat(rec->fd, &st) < 0) {
+        proc_recorder_close(rec);
+        return -1;
+    }
+
+    if (st.st_size == 0) {
+        struct proc_history_header header = {
+            .magic = PROC_HISTORY_MAGIC,
+            .version = PROC_HISTORY_VERSION,
+            .ticks_per_sec = (uint32_t) sysconf(_SC_CLK_TCK),
+            .keyframe_interval = rec->keyframe_interval,
+        };
+        rec->index_fd = open(index_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        if (rec->index_fd < 0 || write_all(rec->fd, &header, sizeof(header)) < 0) {
+            proc_recorder_close(rec);
+            return -1;
+        }
+        rec->offset = sizeof(header);
+        return 0;
+    }
+
+    // Appending: cut off a frame a crash left half written, and rewrite the
+    // index from the keyframes the replay side found valid
+    if (proc_replay_open(&replay, path) < 0) {
+        proc_recorder_close(rec);
+        return -1;
+    }
+    rec->offset = replay.end;
+    rec->index_fd = open(index_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    int rc = rec->index_fd < 0 || ftruncate(rec->fd, (off_t) replay.end) < 0 ? -1 : 0;
+    if (rc == 0 && replay.index_count > 0) {
+        rc = write_all(rec->index_fd, replay.index, replay.index_count * sizeof(*replay.index));
+    }
+    proc_replay_close(&replay);
+    if (rc < 0) {
+        proc_recorder_close(rec);
+        return -1;
+    }
+    return 0;
+}
+
+// Append a sample
+int proc_recorder_append(struct proc_recorder *rec, const struct proc_snapshot *snap, unsigned long long time_ns,
+                         const struct proc_cpu_totals *totals) {
+    uint64_t time_ms = time_ns / 1000000ULL;
+    int keyframe = rec->since_keyframe == 0 || rec->since_keyframe >= rec->keyframe_interval;
+    unsigned long long start = proc_stats_start();
+
+    ssize_t len = encode_frame(rec, snap, time_ms, totals, keyframe);
+    if (len < 0) {
+        return -1;
+    }
+    if (write_all(rec->fd, rec->buf + rec->used, (size_t) len) < 0) {
+        // Leave no partial frame behind for the next one to follow; should even
+        // that fail, replay stops at the torn frame
+        int saved = errno;
+        if (ftruncate(rec->fd, (off_t) rec->offset) < 0) {
+            errno = saved;
+        }
+        return -1;
+    }
+    uint64_t offset = rec->offset;
+    rec->offset += (uint64_t) len;
+    rec->since_keyframe = keyframe ? 1 : rec->since_keyframe + 1;
+    rec->time_ms = time_ms;
+    rec->totals = *totals;
+
+    // A keyframe missing from the index only makes seeks start at an earlier one
+    if (keyframe) {
+        struct proc_history_index_entry entry = { time_ms, offset };
+        write_all(rec->index_fd, &entry, sizeof(entry));
+    }
+
+    // Keep a copy to diff the next sample against
+    if (proc_snapshot_reserve(&rec->prev, snap->count) < 0) {
+        rec->since_keyframe = 0;    // The next frame cannot be a delta
+        return -1;
+    }
+    memcpy(rec->prev.entries, snap->entries, snap->count * sizeof(*snap->entries));
+    rec->prev.count = snap->count;
+    proc_stats_count(PROC_STATS_OUTPUT, PROC_STATS_ROWS, snap->count);
+    proc_stats_stop(PROC_STATS_OUTPUT, start);
+    return 0;
+}
+
+// Close the files and free the buffers
+void proc_recorder_close(struct proc_recorder *rec) {
+    if (rec->fd >= 0) {
+        close(rec->fd);
+    }
+    if (rec->index_fd >= 0) {
+        close(rec->index_fd);
+    }
+    proc_snapshot_free(&rec->prev);
+    free(rec->rows);
+    free(rec->buf);
+    memset(rec, 0, sizeof(*rec));
+    rec->fd = rec->index_fd = -1;
+}
+
+// Read the length, flags and time of the frame at offset, given the time of the
+// frame before it; returns the offset of the next frame, or 0 if the frame is cut short
+static size_t peek_frame(const struct proc_replay *replay, size_t offset, uint64_t prev_ms, int *flags,
+                         uint64_t *time_ms) {
+    const unsigned char *p = replay->data + offset;
+    const unsigned char *end = replay->data + replay->size;
+    uint64_t len, t;
+
+    if (get_varint(&p, end, &len) < 0 || len < 2 || len > (uint64_t) (end - p)) {
+        return 0;
+    }
+    const unsigned char *next = p + len;
+    *flags = *p++;
+    if (get_varint(&p, next, &t) < 0) {
+        return 0;
+    }
+    *time_ms = *flags & FRAME_KEYFRAME ? t : prev_ms + (uint64_t) unzigzag(t);
+    return (size_t) (next - replay->data);
+}
+
+// Add a keyframe to the in-memory index; returns 0 or -1
+static int add_keyframe(struct proc_replay *replay, uint64_t time_ms, size_t offset) {
+    if (replay->index_count == replay->index_capacity) {
+        size_t capacity = replay->index_capacity ? replay->index_capacity * 2 : 256;
+        struct proc_history_index_entry *index = realloc(replay->index, capacity * sizeof(*index));
+        if (index == NULL) {
+            return -1;
+        }
+        replay->index = index;
+        replay->index_capacity = capacity;
+    }
+    replay->index[replay->index_count].time_ms = time_ms;
+    replay->index[replay->index_count].offset = offset;
+    replay->index_count++;
+    return 0;
+}
+
+// Walk the frames from replay->end (whose predecessor is at last_ms) to the end
+// of the mapping, indexing the keyframes found on the way
+static int walk_frames(struct proc_replay *replay) {
+    while (replay->end < replay->size) {
+        int flags;
+        uint64_t time_ms;
+        size_t next = peek_frame(replay, replay->end, replay->last_ms, &flags, &time_ms);
+        if (next == 0) {
+            break;      // Cut short, or still being written
+        }
+        if ((flags & FRAME_KEYFRAME) &&
+            (replay->index_count == 0 || replay->index[replay->index_count - 1].offset < replay->end) &&
+            add_keyframe(replay, time_ms, replay->end) < 0) {
+            return -1;
+        }
+        if (replay->end == sizeof(struct proc_history_header)) {
+            replay->first_ms = time_ms;
+        }
+        replay->last_ms = time_ms;
+        replay->end = next;
+    }
+    return 0;
+}
+
+// Load the keyframes of the index file that still match the history file
+static void load_index(struct proc_replay *replay) {
+    struct proc_history_index_entry entry;
+    int fd = open(replay->index_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    while (read(fd, &entry, sizeof(entry)) == (ssize_t) sizeof(entry)) {
+        int flags;
+        uint64_t time_ms;
+        size_t prev = replay->index_count ? replay->index[replay->index_count - 1].offset : 0;
+        // Every entry must name a keyframe with the recorded time, after the one before
+        if (entry.offset <= prev || entry.offset >= replay->size ||
+            peek_frame(replay, entry.offset, 0, &flags, &time_ms) == 0 || !(flags & FRAME_KEYFRAME) ||
+            time_ms != entry.time_ms || add_keyframe(replay, entry.time_ms, entry.offset) < 0) {
+            break;
+        }
+    }
+    close(fd);
+
+    // The frames after the last indexed keyframe are walked from there
+    if (replay->index_count > 0) {
+        const struct proc_history_index_entry *last = &replay->index[replay->index_count - 1];
+        int flags;
+        replay->first_ms = replay->index[0].time_ms;
+        replay->last_ms = last->time_ms;
+        replay->end = peek_frame(replay, last->offset, 0, &flags, &replay->last_ms);
+    }
+}
+
+// Map whatever the file has grown to; returns 0 or -1
+static int map_file(struct proc_replay *replay) {
+    struct stat st;
+    if (fstat(replay->fd, &st) < 0) {
+        return -1;
+    }
+    if ((size_t) st.st_size == replay->size) {
+        return 0;
+    }
+    void *data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, replay->fd, 0);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    if (replay->data != NULL) {
+        munmap((void *) replay->data, replay->size);
+    }
+    replay->data = data;
+    replay->size = (size_t) st.st_size;
+    return 0;
+}
+
+// Map a history file for replay
+int proc_replay_open(struct proc_replay *replay, const char *path) {
+    memset(replay, 0, sizeof(*replay));
+    replay->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (replay->fd < 0) {
+        return -1;
+    }
+    replay->index_path = malloc(strlen(path) + 5);
+    if (replay->index_path == NULL || map_file(replay) < 0) {
+        proc_replay_close(replay);
+        return -1;
+    }
+    sprintf(replay->index_path, "%s.idx", path);
+
+    const struct proc_history_header *header = (const void *) replay->data;
+    if (replay->size < sizeof(*header) || header->magic != PROC_HISTORY_MAGIC ||
+        header->version != PROC_HISTORY_VERSION) {
+        proc_replay_close(replay);
+        errno = EINVAL;
+        return -1;
+    }
+    replay->ticks_per_sec = header->ticks_per_sec;
+    replay->end = sizeof(*header);
+    replay->offset = sizeof(*header);
+
+    load_index(replay);
+    if (replay->end == 0) {
+        // The index names a keyframe the file does not hold in full
+        replay->index_count = 0;
+        replay->end = sizeof(*header);
+    }
+    if (walk_frames(replay) < 0) {
+        proc_replay_close(replay);
+        return -1;
+    }
+    return 0;
+}
+
+// Unmap the file and free the snapshots
+void proc_replay_close(struct proc_replay *replay) {
+    if (replay->data != NULL) {
+        munmap((void *) replay->data, replay->size);
+    }
+    if (replay->fd >= 0) {
+        close(replay->fd);
+    }
+    proc_snapshot_free(&replay->snaps[0]);
+    proc_snapshot_free(&replay->snaps[1]);
+    free(replay->index);
+    free(replay->index_path);
+    free(replay->rows);
+    memset(replay, 0, sizeof(*replay));
+    replay->fd = -1;
+}
+
+// Decode the added rows column by column into entries
+static int decode_added(const unsigned char **pp, const unsigned char *end, struct proc_entry *entries,
+                        size_t count, uint32_t *dict_rows) {
+    const unsigned char *p = *pp;
+    uint64_t v;
+    int64_t last;
+
+#define COLUMN(expr)                                            \
+    for (size_t i = 0; i < count; i++) {                        \
+        if (get_varint(&p, end, &v) < 0) {                      \
+            return -1;                                          \
+        }                                                       \
+        struct proc_entry *e = &entries[i];                     \
+        expr;                                                   \
+    }
+
+    last = 0;
+    COLUMN(last = e->pid = (pid_t) (last + (int64_t) v))
+    last = 0;
+    COLUMN(last = e->ppid = (pid_t) (last + unzigzag(v)))
+    last = 0;
+    COLUMN(last = e->uid = (uid_t) (last + unzigzag(v)))
+    last = 0;
+    COLUMN(last = e->prio = (int) (last + unzigzag(v)))
+    if ((size_t) (end - p) < count) {
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        entries[i].state = (char) *p++;
+    }
+    last = 0;
+    COLUMN(last = e->threads = (int) (last + unzigzag(v)))
+    COLUMN(e->rss_kb = (unsigned long) v)
+    COLUMN(e->utime = (unsigned long) v)
+    COLUMN(e->stime = (unsigned long) v)
+    uint64_t start = 0;
+    COLUMN(e->start_time = start = start + (uint64_t) unzigzag(v))
+#undef COLUMN
+
+    size_t dict_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (get_varint(&p, end, &v) < 0 || v > dict_count) {
+            return -1;
+        }
+        if (v < dict_count) {
+            memcpy(entries[i].comm, entries[dict_rows[v]].comm, PROC_COMM_LEN);
+        } else {
+            memset(entries[i].comm, 0, PROC_COMM_LEN);
+            if (get_comm(&p, end, entries[i].comm) < 0) {
+                return -1;
+            }
+            dict_rows[dict_count++] = (uint32_t) i;
+        }
+    }
+    *pp = p;
+    return 0;
+}
+
+// Read count gap-encoded row indexes below limit into rows; returns 0 or -1
+static int get_rows(const unsigned char **pp, const unsigned char *end, uint32_t *rows, size_t count, size_t limit) {
+    uint64_t next = 0, v;
+    for (size_t k = 0; k < count; k++) {
+        if (get_varint(pp, end, &v) < 0 || v >= limit - next) {
+            return -1;
+        }
+        rows[k] = (uint32_t) (next + v);
+        next = rows[k] + 1;
+    }
+    return 0;
+}
+
+// Decode the frame at replay->offset on top of the current snapshot; returns 0 or -1
+static int decode_frame(struct proc_replay *replay) {
+    const unsigned char *p = replay->data + replay->offset;
+    const unsigned char *frame_end = replay->data + replay->end;
+    uint64_t len, t, total, idle, removed_count, changed_count, added_count, v;
+
+    if (get_varint(&p, frame_end, &len) < 0 || len > (uint64_t) (frame_end - p)) {
+        return -1;
+    }
+    const unsigned char *end = p + len;
+    int keyframe = *p++ & FRAME_KEYFRAME;
+    if (get_varint(&p, end, &t) < 0 || get_varint(&p, end, &total) < 0 || get_varint(&p, end, &idle) < 0) {
+        return -1;
+    }
+
+    struct proc_snapshot *prev = &replay->snaps[replay->current];
+    struct proc_snapshot *next = &replay->snaps[1 - replay->current];
+    if (keyframe) {
+        prev->count = 0;
+        replay->time_ms = t;
+        replay->totals.total = total;
+        replay->totals.idle = idle;
+    } else {
+        replay->time_ms += (uint64_t) unzigzag(t);
+        replay->totals.total += (uint64_t) unzigzag(total);
+        replay->totals.idle += (uint64_t) unzigzag(idle);
+    }
+
+    // Removed and changed rows index the previous snapshot
+    if (get_varint(&p, end, &removed_count) < 0 || removed_count > prev->count ||
+        reserve_rows(&replay->rows, &replay->rows_capacity, 3 * prev->count + 1) < 0) {
+        return -1;
+    }
+    uint32_t *removed = replay->rows;
+    uint32_t *changed = removed + prev->count;
+    uint32_t *masks = changed + prev->count;
+    if (get_rows(&p, end, removed, removed_count, prev->count) < 0 ||
+        get_varint(&p, end, &changed_count) < 0 || changed_count > prev->count ||
+        get_rows(&p, end, changed, changed_count, prev->count) < 0) {
+        return -1;
+    }
+    for (size_t k = 0; k < changed_count; k++) {
+        if (get_varint(&p, end, &v) < 0) {
+            return -1;
+        }
+        masks[k] = (uint32_t) v;
+    }
+
+    // The previous snapshot is given up at this point, so the changes go straight into it
+    for (int field = 0; field < FIELD_COUNT; field++) {
+        for (size_t k = 0; k < changed_count; k++) {
+            if ((masks[k] & (1u << field)) == 0) {
+                continue;
+            }
+            struct proc_entry *e = &prev->entries[changed[k]];
+            if (field == FIELD_STATE) {
+                if (p >= end) {
+                    return -1;
+                }
+                e->state = (char) *p++;
+                continue;
+            }
+            if (field == FIELD_COMM) {
+                if (get_comm(&p, end, e->comm) < 0) {
+                    return -1;
+                }
+                continue;
+            }
+            if (get_varint(&p, end, &v) < 0) {
+                return -1;
+            }
+            switch (field) {
+            case FIELD_UTIME:   e->utime += (unsigned long) unzigzag(v); break;
+            case FIELD_STIME:   e->stime += (unsigned long) unzigzag(v); break;
+            case FIELD_RSS:     e->rss_kb += (unsigned long) unzigzag(v); break;
+            case FIELD_THREADS: e->threads += (int) unzigzag(v); break;
+            case FIELD_PRIO:    e->prio += (int) unzigzag(v); break;
+            case FIELD_PPID:    e->ppid = (pid_t) v; break;
+            case FIELD_UID:     e->uid = (uid_t) v - 1; break;
+            }
+        }
+    }
+
+    if (get_varint(&p, end, &added_count) < 0 || added_count > (uint64_t) (end - p)) {
+        return -1;
+    }
+    if (removed_count == 0 && added_count == 0) {
+        replay->offset = (size_t) (end - replay->data);
+        return 0;
+    }
+
+    // Decode the new rows behind the space the merged snapshot needs, then merge in PID order
+    size_t count = prev->count - removed_count + added_count;
+    if (proc_snapshot_reserve(next, count + added_count) < 0 ||
+        reserve_rows(&replay->rows, &replay->rows_capacity, 3 * prev->count + added_count) < 0) {
+        return -1;
+    }
+    removed = replay->rows;
+    struct proc_entry *added = next->entries + count;
+    if (decode_added(&p, end, added, added_count, replay->rows + 3 * prev->count) < 0) {
+        return -1;
+    }
+
+    size_t i = 0, j = 0, r = 0, out = 0;
+    while (i < prev->count || j < added_count) {
+        if (r < removed_count && i == removed[r]) {
+            i++;
+            r++;
+        } else if (j == added_count || (i < prev->count && prev->entries[i].pid < added[j].pid)) {
+            next->entries[out++] = prev->entries[i++];
+        } else if (out < count) {
+            next->entries[out++] = added[j++];
+        } else {
+            return -1;
+        }
+    }
+    if (out != count) {
+        return -1;
+    }
+    next->count = count;
+    replay->current = 1 - replay->current;
+    replay->offset = (size_t) (end - replay->data);
+    return 0;
+}
+
+// Decode the next frame
+int proc_replay_next(struct proc_replay *replay) {
+    if (replay->offset >= replay->end) {
+        // Pick up frames the recorder appended meanwhile
+        if (map_file(replay) < 0 || walk_frames(replay) < 0) {
+            return -1;
+        }
+        if (replay->offset >= replay->end) {
+            return 0;
+        }
+    }
+    if (decode_frame(replay) < 0) {
+        replay->end = replay->offset;   // Stop here instead of returning garbage
+        errno = EINVAL;
+        return -1;
+    }
+    struct proc_snapshot *snap = &replay->snaps[replay->current];
+    snap->generation = ++replay->frames;
+    return 1;
+}
+
+// Make the last frame at or before time_ms the current snapshot
+int proc_replay_seek(struct proc_replay *replay, uint64_t time_ms) {
+    if (replay->index_count == 0) {
+        return 0;
+    }
+
+    // Last keyframe at or before time_ms
+    size_t lo = 0, hi = replay->index_count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (replay->index[mid].time_ms <= time_ms) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    replay->offset = replay->index[lo].offset;
+    if (proc_replay_next(replay) < 0) {
+        return -1;
+    }
+
+    while (replay->offset < replay->end) {
+        int flags;
+        uint64_t next_ms;
+        if (peek_frame(replay, replay->offset, replay->time_ms, &flags, &next_ms) == 0 || next_ms > time_ms) {
+            break;
+        }
+        if (proc_replay_next(replay) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// The current snapshot
+const struct proc_snapshot *proc_replay_snapshot(const struct proc_replay *replay) {
+    return &replay->snaps[replay->current];
+}
@@ -0,0 +1,108 @@
+#ifndef PROC_HISTORY_H
+#define PROC_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "proc_cpu.h"
+#include "proc_scan.h"
+
+// History files record one snapshot per sample. Each frame only stores what
+// changed since the previous one, column by column and varint-encoded: the rows
+// that went away, the fields that changed in the rows that stayed, and the new
+// rows in full. Every keyframe_interval frames a keyframe stores every row, so
+// replay can start there instead of at the beginning. Keyframes are listed in a
+// small index next to the file (path + ".idx") for seeking by time.
+
+#define PROC_HISTORY_MAGIC 0x52484950u      // "PIHR" in little-endian byte order
+#define PROC_HISTORY_VERSION 1
+#define PROC_HISTORY_DEFAULT_KEYFRAME 1800  // Samples between keyframes: 30 minutes at 1 s
+
+// Start of a history file; frames follow
+struct proc_history_header {
+    uint32_t magic;                 // PROC_HISTORY_MAGIC
+    uint16_t version;               // PROC_HISTORY_VERSION
+    uint16_t reserved;
+    uint32_t ticks_per_sec;         // Unit of utime, stime and start_time
+    uint32_t keyframe_interval;
+};
+
+// One keyframe in the index file
+struct proc_history_index_entry {
+    uint64_t time_ms;               // Sample time, ms since the epoch
+    uint64_t offset;                // Of the frame in the history file
+};
+
+// Appends samples to a history file
+struct proc_recorder {
+    int fd;
+    int index_fd;
+    uint64_t offset;                // End of the file
+    unsigned int keyframe_interval;
+    unsigned int since_keyframe;    // Frames written since the last keyframe
+    uint64_t time_ms;               // Of the last frame
+    struct proc_cpu_totals totals;
+    struct proc_snapshot prev;      // Copy of the last recorded snapshot
+    uint32_t *rows;                 // Scratch row lists for the encoder
+    size_t rows_capacity;
+    unsigned char *buf;             // The frame being encoded
+    size_t size;
+    size_t used;
+};
+
+// Replays a history file through a read-only mapping
+struct proc_replay {
+    int fd;
+    char *index_path;
+    const unsigned char *data;
+    size_t size;                    // Mapped bytes
+    size_t end;                     // End of the last complete frame
+    uint32_t ticks_per_sec;
+    struct proc_history_index_entry *index;    // Keyframes, in file order
+    size_t index_count;
+    size_t index_capacity;
+    uint64_t first_ms;              // Time of the first and the last complete frame
+    uint64_t last_ms;
+    size_t offset;                  // Next frame to decode
+    uint64_t time_ms;               // Of the current snapshot
+    struct proc_cpu_totals totals;
+    struct proc_snapshot snaps[2];  // The current snapshot and the one being built
+    int current;
+    uint32_t *rows;                 // Scratch row lists for the decoder
+    size_t rows_capacity;
+    unsigned long long frames;      // Frames decoded, the generation of the current snapshot
+};
+
+// Open path for recording, creating it or appending to it. A frame cut short
+// by a crash is dropped, and the first frame written is a keyframe.
+// keyframe_interval 0 means PROC_HISTORY_DEFAULT_KEYFRAME. Returns 0 or -1.
+int proc_recorder_open(struct proc_recorder *rec, const char *path, unsigned int keyframe_interval);
+
+// Append a sample taken at time_ns (CLOCK_REALTIME) with the machine-wide CPU
+// totals read alongside it; returns 0 or -1
+int proc_recorder_append(struct proc_recorder *rec, const struct proc_snapshot *snap, unsigned long long time_ns,
+                         const struct proc_cpu_totals *totals);
+
+// Close the files and free the buffers
+void proc_recorder_close(struct proc_recorder *rec);
+
+// Map a history file for replay, positioned before its first frame. A missing
+// or stale index is rebuilt from the frames. Returns 0 or -1.
+int proc_replay_open(struct proc_replay *replay, const char *path);
+
+// Unmap the file and free the snapshots
+void proc_replay_close(struct proc_replay *replay);
+
+// Decode the next frame. Picks up frames appended since the file was mapped, so
+// a recording can be followed while it is written. Returns 1 with a new current
+// snapshot, 0 at the end of the file, -1 if the file is corrupt.
+int proc_replay_next(struct proc_replay *replay);
+
+// Make the last frame at or before time_ms (or the first frame, if time_ms is
+// earlier) the current snapshot, starting from the nearest keyframe; returns 0 or -1
+int proc_replay_seek(struct proc_replay *replay, uint64_t time_ms);
+
+// The current snapshot. It stays valid until the next proc_replay_next or
+// proc_replay_seek; its entries use the units of struct proc_entry.
+const struct proc_snapshot *proc_replay_snapshot(const struct proc_replay *replay);
+
+#endif
@@ -6,70 +6,655 @@
 #include <linux/proc_fs.h>    // Defines the functions for interacting with the /proc file system.
 #include <linux/uidgid.h>     // Defines kuid_t, used to handle user IDs (UIDs).
 #include <linux/seq_file.h>   // Defines functions like seq_printf for printing formatted output to a sequence file (used for /proc).
+#include <linux/sched/signal.h>  // for_each_thread and the signal_struct CPU time totals.
+#include <linux/mm.h>         // get_mm_rss() for the resident set size.
+#include <linux/cred.h>       // task_uid() and from_kuid_munged().
+#include <linux/capability.h> // file_ns_capable() for filter writes.
+#include <linux/rcupdate.h>   // rcu_read_lock() around the task list walk.
+#include <linux/rculist.h>    // list_next_or_null_rcu() along a thread list.
+#include <linux/pid.h>        // find_ge_pid() and pid_task() for the PID cursor.
+#include <linux/pid_namespace.h>  // init_pid_ns.
+#include <linux/string.h>     // strscpy() for the command name.
+#include <linux/hashtable.h>  // Per-PID CPU tracking for the delta filters.
+#include <linux/slab.h>       // kmalloc()/kfree() for the tracking entries, kvzalloc() for their table.
+#include <linux/uaccess.h>    // memdup_user_nul() for filter writes.
+#include <linux/threads.h>    // PID_MAX_LIMIT.
+#include <linux/ktime.h>      // ktime_get_ns() for the cost of a pass.
+#include <linux/log2.h>       // ilog2() for the pass histogram.
+#include <linux/math64.h>     // div64_u64() for the mean pass time.
+#include "proc_info_abi.h"    // Binary record layout shared with user space.
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Your Name");
-MODULE_DESCRIPTION("A kernel module to display process info like user, priority, CPU usage");
+MODULE_DESCRIPTION("A kernel module to display process info like user, priority, memory and CPU time");
 
 #define PROC_NAME "proc_info"
+#define PROC_BIN_NAME PROC_INFO_BIN_NAME
+#define PROC_STATS_NAME PROC_INFO_STATS_NAME
+#define PROC_TRACK_BITS 10
+#define PROC_TRACK_MAX 262144   // Tracked processes per open file; tasks past it are always reported
+#define PROC_STATS_BUCKETS 64
 
-// Function to get the username by UID (you might need to replace this with something more efficient)
-const char* get_username_by_uid(kuid_t uid) {
-    // In kernel space, there is no simple function like getpwuid() to get the username.
-    // However, you can directly map the UID to "root" or use a placeholder like "Unknown" if needed.
-    // UID 0 corresponds to "root" in Linux.
-    if (uid.val == 0) {
-        return "root";  // UID 0 is always root
+// Filter written to /proc/proc_info, e.g. "uid=1000 pid=100-200 mincpu=5000000 since=42", or "tgid=N"
+struct proc_info_filter {
+    pid_t tgid;         // Every thread of this process instead of processes, or 0
+    bool has_uid;
+    uid_t uid;
+    pid_t pid_min;
+    pid_t pid_max;
+    bool track;         // A delta filter is set, so CPU time has to be tracked per task
+    bool has_since;
+    u64 since;          // Only tasks that changed in a generation after this one
+    u64 min_cpu_ns;     // Only tasks that used at least this much CPU since the last pass
+};
+
+// What the previous pass of one open file saw of its processes, for the delta filters
+struct proc_info_tracks {
+    DECLARE_HASHTABLE(table, PROC_TRACK_BITS);
+    unsigned long count;
+};
+
+// Per-open state of /proc/proc_info. seq_read and the filter write both hold the
+// seq_file mutex, so nothing here needs a lock of its own.
+struct proc_info_state {
+    struct proc_info_filter filter;
+    struct proc_info_tracks *tracks;    // Set by the first delta filter and kept across filter writes
+    u64 generation;     // Generation of the pass in progress
+    pid_t tid;          // tgid= mode: TID of the thread at position tid_pos, where the next chunk resumes
+    loff_t tid_pos;
+    bool prune;         // The pass covered its whole range, so entries it did not visit can go
+    bool done;          // The pass reached the last PID, so its cost can be published
+    u64 pass_start;     // When the pass started (ktime_get_ns)
+    u64 chunk_start;    // When the current chunk took the RCU read lock
+    u64 held_ns;        // Time spent walking tasks under the RCU read lock so far
+    u64 longest_hold_ns;    // Longest single chunk of the pass
+    unsigned long tasks;    // Tasks visited
+    unsigned long shown;    // Tasks that passed the filters
+};
+
+// What complete passes cost, for /proc/proc_info_stats
+struct proc_info_stats {
+    u64 passes;
+    u64 generation;     // Of the last complete pass
+    unsigned long tasks;
+    unsigned long shown;
+    u64 pass_ns;        // Last pass, first chunk to last, including time spent in the reader
+    u64 held_ns;        // Last pass, only the time spent walking tasks
+    u64 longest_hold_ns;
+    u64 max_held_ns;    // Over every pass
+    u64 total_held_ns;
+    u64 held_buckets[PROC_STATS_BUCKETS];   // held_ns of every pass, by power of two
+};
+
+// What the previous pass saw of a process, for the delta filters
+struct proc_info_track {
+    struct hlist_node node;
+    pid_t pid;
+    u64 start_time;
+    u64 cpu_ns;
+    u64 changed_gen;    // Last generation in which its CPU time moved
+    u64 seen_gen;       // Last generation whose pass visited it
+};
+
+// Every full pass over the task list starts a new generation
+static atomic64_t proc_info_generation = ATOMIC64_INIT(0);
+static struct proc_info_stats proc_info_stats;
+static DEFINE_SPINLOCK(proc_info_stats_lock);
+
+// Function to find the first process with a PID >= *pos and move the cursor onto it (caller holds rcu_read_lock)
+static struct task_struct *proc_info_find_task(struct proc_info_state *state, loff_t *pos) {
+    struct pid *pid;
+    struct task_struct *task;
+    int nr = max_t(loff_t, *pos, state->filter.pid_min);
+
+    // Walk the PID allocator in order, the same way /proc itself lists processes
+    while ((pid = find_ge_pid(nr, &init_pid_ns)) != NULL) {
+        nr = pid_nr(pid);
+        if (nr > state->filter.pid_max) {
+            break;  // Past the requested PID range
+        }
+        task = pid_task(pid, PIDTYPE_TGID);  // NULL for plain threads
+        if (task) {
+            *pos = nr;
+            return task;
+        }
+        nr++;
     }
-    
-    return "Unknown";  // For simplicity, return "Unknown" for other UIDs
+    return NULL;
 }
 
-// Function to display the information about processes
-static int proc_info_show(struct seq_file *m, void *v) {
+// Function to find the thread at position *pos (1 for the first) of the tgid= process. The
+// TID the last chunk stopped at is tried first; if that thread has exited, the position is
+// counted along the thread list, as /proc/[pid]/task does (caller holds rcu_read_lock)
+static struct task_struct *proc_info_find_thread(struct proc_info_state *state, loff_t *pos) {
+    struct task_struct *leader, *t;
+    loff_t skip = *pos - 1;
+
+    leader = pid_task(find_pid_ns(state->filter.tgid, &init_pid_ns), PIDTYPE_TGID);
+    if (!leader || !pid_alive(leader)) {
+        return NULL;
+    }
+    if (state->tid && state->tid_pos == *pos) {
+        t = pid_task(find_pid_ns(state->tid, &init_pid_ns), PIDTYPE_PID);
+        if (t && same_thread_group(t, leader)) {
+            return t;
+        }
+    }
+    for_each_thread(leader, t) {
+        if (skip-- == 0) {
+            return t;
+        }
+    }
+    return NULL;
+}
+
+// Function to step to the next thread of the same process (caller holds rcu_read_lock)
+static struct task_struct *proc_info_next_thread(struct task_struct *t) {
+    return list_next_or_null_rcu(&t->signal->thread_head, &t->thread_node, struct task_struct, thread_node);
+}
+
+// Function to drop the tracking entries a complete pass did not visit: in its PID range
+// they have exited or no longer match, outside it they go once their process has exited.
+// The table belongs to the open file, so this runs outside rcu_read_lock and only takes it
+// to look a process up; it can sleep between entries.
+static void proc_info_prune_tracks(struct proc_info_state *state) {
+    struct proc_info_tracks *tracks = state->tracks;
+    struct proc_info_track *t;
+    struct hlist_node *tmp;
+    struct task_struct *task;
+    unsigned int visited = 0;
+    bool alive;
+    int bkt;
+
+    hash_for_each_safe(tracks->table, bkt, tmp, t, node) {
+        if (++visited % 1024 == 0) {
+            cond_resched();
+        }
+        if (t->seen_gen == state->generation) {
+            continue;
+        }
+        if (t->pid < state->filter.pid_min || t->pid > state->filter.pid_max) {
+            rcu_read_lock();
+            task = pid_task(find_pid_ns(t->pid, &init_pid_ns), PIDTYPE_TGID);
+            alive = task && task->start_boottime == t->start_time;
+            rcu_read_unlock();
+            if (alive) {
+                continue;
+            }
+        }
+        hash_del(&t->node);
+        kfree(t);
+        tracks->count--;
+    }
+}
+
+// Function to free an open file's tracking entries and their table
+static void proc_info_free_tracks(struct proc_info_tracks *tracks) {
+    struct proc_info_track *t;
+    struct hlist_node *tmp;
+    int bkt;
+
+    if (!tracks) {
+        return;
+    }
+    hash_for_each_safe(tracks->table, bkt, tmp, t, node) {
+        hash_del(&t->node);
+        kfree(t);
+    }
+    kvfree(tracks);
+}
+
+// Function to record a task's CPU time and check it against the delta filters of this open file
+static bool proc_info_track_matches(struct proc_info_state *state, struct task_struct *task, u64 cpu_ns) {
+    struct proc_info_tracks *tracks = state->tracks;
+    struct proc_info_track *t;
+    u64 delta;
+    bool match;
+
+    hash_for_each_possible(tracks->table, t, node, task->pid) {
+        if (t->pid == task->pid) {
+            break;
+        }
+    }
+
+    // A reused PID starts over as a new process
+    if (t && t->start_time != task->start_boottime) {
+        t->start_time = task->start_boottime;
+        t->cpu_ns = 0;
+    }
+    if (!t) {
+        // Under the RCU read lock, so the allocation cannot sleep; the table is capped
+        t = tracks->count < PROC_TRACK_MAX ? kmalloc(sizeof(*t), GFP_NOWAIT | __GFP_NOWARN) : NULL;
+        if (!t) {
+            return true;  // Without tracking, err on the side of reporting the task
+        }
+        t->pid = task->pid;
+        t->start_time = task->start_boottime;
+        t->cpu_ns = 0;
+        t->changed_gen = 0;
+        hash_add(tracks->table, &t->node, t->pid);
+        tracks->count++;
+    }
+    t->seen_gen = state->generation;
+
+    delta = cpu_ns > t->cpu_ns ? cpu_ns - t->cpu_ns : 0;
+    if (delta || t->changed_gen == 0) {
+        t->changed_gen = state->generation;
+    }
+    t->cpu_ns = cpu_ns;
+
+    match = delta >= state->filter.min_cpu_ns;
+    if (state->filter.has_since && t->changed_gen <= state->filter.since) {
+        match = false;
+    }
+    return match;
+}
+
+// Function to publish the cost of a pass that has just finished
+static void proc_info_publish_stats(struct proc_info_state *state, u64 now) {
+    u64 held = state->held_ns;
+
+    spin_lock(&proc_info_stats_lock);
+    proc_info_stats.passes++;
+    proc_info_stats.generation = state->generation;
+    proc_info_stats.tasks = state->tasks;
+    proc_info_stats.shown = state->shown;
+    proc_info_stats.pass_ns = now - state->pass_start;
+    proc_info_stats.held_ns = held;
+    proc_info_stats.longest_hold_ns = state->longest_hold_ns;
+    proc_info_stats.max_held_ns = max(proc_info_stats.max_held_ns, held);
+    proc_info_stats.total_held_ns += held;
+    proc_info_stats.held_buckets[held ? ilog2(held) : 0]++;
+    spin_unlock(&proc_info_stats_lock);
+}
+
+// seq_file start: position 0 is the generation header, after that *pos is a PID cursor,
+// or with tgid= the position along the process's thread list
+static void *proc_info_start(struct seq_file *m, loff_t *pos) {
+    struct proc_info_state *state = m->private;
+
+    rcu_read_lock();
+    state->chunk_start = ktime_get_ns();
+    if (*pos == 0) {
+        state->generation = atomic64_inc_return(&proc_info_generation);
+        state->done = false;
+        state->pass_start = state->chunk_start;
+        state->held_ns = 0;
+        state->longest_hold_ns = 0;
+        state->tasks = 0;
+        state->shown = 0;
+        state->tid = 0;
+        return SEQ_START_TOKEN;
+    }
+    return state->filter.tgid ? proc_info_find_thread(state, pos) : proc_info_find_task(state, pos);
+}
+
+// seq_file next: step past the current PID, or to the next thread
+static void *proc_info_next(struct seq_file *m, void *v, loff_t *pos) {
+    struct proc_info_state *state = m->private;
     struct task_struct *task;
-    unsigned long utime, stime;
-    
-    // Iterate through all tasks (processes)
-    for_each_process(task) {
-        // Get user info, priority, etc.
-        const char *user = get_username_by_uid(task->real_cred->uid);
-        int pr = task->prio;
-        unsigned long mem_usage = task->mm ? task->mm->total_vm : 0;  // Use total_vm for memory usage
-        
-        utime = task->utime;  // User time
-        stime = task->stime;  // System time
-
-        unsigned long total_time = utime + stime;
-
-        // Print the process info in a table format
-        seq_printf(m, "| %-10d | %-20s | %-13d | %-8lu | %-10lu | %-20s |\n",
-                   task->pid, user, pr, mem_usage, total_time, task->comm);
+
+    if (state->filter.tgid) {
+        // The TID is the cursor a chunk that stops here resumes from
+        (*pos)++;
+        task = v == SEQ_START_TOKEN ? proc_info_find_thread(state, pos) : proc_info_next_thread(v);
+        state->tid = task ? task->pid : 0;
+        state->tid_pos = *pos;
+    } else {
+        *pos = v == SEQ_START_TOKEN ? 1 : ((struct task_struct *) v)->pid + 1;
+        task = proc_info_find_task(state, pos);
     }
+    if (!task) {
+        state->done = true;
+    }
+
+    // A pass that reached the end of its range has visited every tracked process still in it
+    if (!task && state->filter.track) {
+        state->prune = true;
+    }
+    return task;
+}
+
+// seq_file stop: drop the RCU lock between chunks; the cursor is just a PID, so nothing else is held
+static void proc_info_stop(struct seq_file *m, void *v) {
+    struct proc_info_state *state = m->private;
+    u64 now;
+
+    rcu_read_unlock();
+
+    // How long this chunk kept the CPU in the task walk
+    now = ktime_get_ns();
+    state->held_ns += now - state->chunk_start;
+    state->longest_hold_ns = max(state->longest_hold_ns, now - state->chunk_start);
+    if (state->done) {
+        proc_info_publish_stats(state, now);
+        state->done = false;
+    }
+
+    // The seq_file lock keeps the tracking table to this reader, so the prune needs no RCU
+    if (state->prune) {
+        proc_info_prune_tracks(state);
+        state->prune = false;
+    }
+}
+
+// Function to get the CPU time of a whole thread group in nanoseconds (caller holds rcu_read_lock)
+static void proc_info_cputime(struct task_struct *task, u64 *utime, u64 *stime) {
+    struct task_struct *t;
+
+    // Start from the time of threads that have already exited
+    *utime = task->signal->utime;
+    *stime = task->signal->stime;
+    for_each_thread(task, t) {
+        *utime += t->utime;
+        *stime += t->stime;
+    }
+}
+
+// Function to get the resident set size of a task in pages
+static unsigned long proc_info_rss_pages(struct task_struct *task) {
+    unsigned long rss = 0;
+
+    // task_lock keeps task->mm from going away while we read its counters
+    task_lock(task);
+    if (task->mm) {
+        rss = get_mm_rss(task->mm);
+    }
+    task_unlock(task);
+    return rss;
+}
+
+// Function to display one thread of the tgid= process: the pid column is the thread ID and
+// the ppid column the process (caller holds rcu_read_lock). One thread per record keeps
+// the output streaming a page at a time however many threads there are.
+static void proc_info_show_thread(struct seq_file *m, struct task_struct *t, uid_t uid) {
+    struct proc_info_state *state = m->private;
+    unsigned long rss_kb = proc_info_rss_pages(t) << (PAGE_SHIFT - 10);
+
+    seq_printf(m, "| %-8d | %-8d | %-8u | %-4d | %c | %-6d | %-10lu | %-16llu | %-16llu | %-18llu | %-16s |\n",
+               t->pid, task_tgid_nr(t), uid, t->prio, task_state_to_char(t), get_nr_threads(t), rss_kb,
+               t->utime, t->stime, t->start_boottime, t->comm);
+    state->shown++;
+}
+
+// Function to display the information about one process
+static int proc_info_show(struct seq_file *m, void *v) {
+    struct proc_info_state *state = m->private;
+    struct task_struct *task = v;
+    u64 utime, stime;
+
+    if (v == SEQ_START_TOKEN) {
+        // Readers pass this back as "since=N" to get only what changed after this pass
+        seq_printf(m, "# generation %llu\n", state->generation);
+        return 0;
+    }
+
+    // Everything the readers need, so they never have to open /proc/[pid] themselves
+    state->tasks++;
+    uid_t uid = from_kuid_munged(current_user_ns(), task_uid(task));
+    if (state->filter.has_uid && uid != state->filter.uid) {
+        return 0;
+    }
+    if (state->filter.tgid) {
+        proc_info_show_thread(m, task, uid);
+        return 0;
+    }
+
+    proc_info_cputime(task, &utime, &stime);
+    if (state->filter.track && !proc_info_track_matches(state, task, utime + stime)) {
+        return 0;
+    }
+
+    pid_t ppid = task_tgid_nr(rcu_dereference(task->real_parent));
+    unsigned long rss_kb = proc_info_rss_pages(task) << (PAGE_SHIFT - 10);
+
+    // Print the process info in a table format; the command is always the last column
+    seq_printf(m, "| %-8d | %-8d | %-8u | %-4d | %c | %-6d | %-10lu | %-16llu | %-16llu | %-18llu | %-16s |\n",
+               task->pid, ppid, uid, task->prio, task_state_to_char(task),
+               get_nr_threads(task), rss_kb, utime, stime, task->start_boottime, task->comm);
+    state->shown++;
+    return 0;
+}
+
+// Function to emit one fixed-size binary record for a process
+static int proc_info_bin_show(struct seq_file *m, void *v) {
+    struct proc_info_state *state = m->private;
+    struct task_struct *task = v;
+    struct proc_info_record rec;
+
+    // The binary stream has no header record
+    if (v == SEQ_START_TOKEN) {
+        return 0;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.version = PROC_INFO_BIN_VERSION;
+    rec.size = sizeof(rec);
+    rec.pid = task->pid;
+    rec.ppid = task_tgid_nr(rcu_dereference(task->real_parent));
+    rec.uid = from_kuid_munged(current_user_ns(), task_uid(task));
+    rec.prio = task->prio;
+    rec.threads = get_nr_threads(task);
+    rec.state = task_state_to_char(task);
+    rec.start_time_ns = task->start_boottime;
+    rec.rss_pages = proc_info_rss_pages(task);
+    proc_info_cputime(task, &rec.utime_ns, &rec.stime_ns);
+    strscpy(rec.comm, task->comm, sizeof(rec.comm));
+
+    seq_write(m, &rec, sizeof(rec));
+    state->tasks++;
+    state->shown++;
+    return 0;
+}
+
+// Both entries stream one task per record, so output is produced a page at a time
+static const struct seq_operations proc_info_seq_ops = {
+    .start = proc_info_start,
+    .next = proc_info_next,
+    .stop = proc_info_stop,
+    .show = proc_info_show,
+};
+
+static const struct seq_operations proc_info_bin_seq_ops = {
+    .start = proc_info_start,
+    .next = proc_info_next,
+    .stop = proc_info_stop,
+    .show = proc_info_bin_show,
+};
+
+// Function to set up the per-open filter state; by default every task is shown
+static int proc_info_open_state(struct file *file, const struct seq_operations *ops) {
+    struct proc_info_state *state = __seq_open_private(file, ops, sizeof(*state));
+    if (!state) {
+        return -ENOMEM;
+    }
+    state->filter.pid_max = PID_MAX_LIMIT;
     return 0;
 }
 
 static int proc_info_open(struct inode *inode, struct file *file) {
-    return single_open(file, proc_info_show, NULL);
+    return proc_info_open_state(file, &proc_info_seq_ops);
+}
+
+static int proc_info_bin_open(struct inode *inode, struct file *file) {
+    return proc_info_open_state(file, &proc_info_bin_seq_ops);
+}
+
+// Function to free the per-open state, with the CPU baseline of its delta filters
+static int proc_info_release(struct inode *inode, struct file *file) {
+    struct seq_file *m = file->private_data;
+    struct proc_info_state *state = m->private;
+
+    proc_info_free_tracks(state->tracks);
+    return seq_release_private(inode, file);
+}
+
+// Function to parse a filter written to the proc file. Each write replaces the
+// filter of that open file; an empty write or "all" clears it. The CPU baseline of
+// the delta filters belongs to the open file and outlives the writes, so a collector
+// can move since= forward every pass.
+static ssize_t proc_info_write(struct file *file, const char __user *ubuf, size_t count, loff_t *ppos) {
+    struct seq_file *m = file->private_data;
+    struct proc_info_state *state = m->private;
+    struct proc_info_filter filter = { .pid_max = PID_MAX_LIMIT };
+    char *buf, *cur, *tok, *dash;
+    int err = 0;
+
+    // Delta filters cost kernel memory per process, so only root may set filters
+    if (!uid_eq(file->f_cred->euid, GLOBAL_ROOT_UID) && !file_ns_capable(file, &init_user_ns, CAP_SYS_ADMIN)) {
+        return -EPERM;
+    }
+    if (count > PAGE_SIZE) {
+        return -EINVAL;
+    }
+    buf = memdup_user_nul(ubuf, count);
+    if (IS_ERR(buf)) {
+        return PTR_ERR(buf);
+    }
+
+    cur = buf;
+    while (!err && (tok = strsep(&cur, " ,\t\n")) != NULL) {
+        if (*tok == '\0' || strcmp(tok, "all") == 0) {
+            continue;
+        } else if (strncmp(tok, "uid=", 4) == 0) {
+            filter.has_uid = true;
+            err = kstrtouint(tok + 4, 10, &filter.uid);
+        } else if (strncmp(tok, "pid=", 4) == 0) {
+            // Either a single PID or an inclusive range "a-b"
+            dash = strchr(tok + 4, '-');
+            if (dash) {
+                *dash = '\0';
+                err = kstrtoint(tok + 4, 10, &filter.pid_min) ?: kstrtoint(dash + 1, 10, &filter.pid_max);
+            } else {
+                err = kstrtoint(tok + 4, 10, &filter.pid_min);
+                filter.pid_max = filter.pid_min;
+            }
+        } else if (strncmp(tok, "tgid=", 5) == 0) {
+            err = kstrtoint(tok + 5, 10, &filter.tgid);
+        } else if (strncmp(tok, "mincpu=", 7) == 0) {
+            filter.track = true;
+            err = kstrtou64(tok + 7, 10, &filter.min_cpu_ns);
+        } else if (strncmp(tok, "since=", 6) == 0) {
+            filter.track = true;
+            filter.has_since = true;
+            err = kstrtou64(tok + 6, 10, &filter.since);
+        } else {
+            err = -EINVAL;
+        }
+    }
+    kfree(buf);
+
+    if (err) {
+        return err;
+    }
+    if (filter.pid_min < 0 || filter.pid_max < filter.pid_min) {
+        return -EINVAL;
+    }
+
+    // One process's threads: the walk visits only that PID. The delta filters track
+    // whole processes, so they do not combine with it.
+    if (filter.tgid) {
+        if (filter.tgid < 0 || filter.track) {
+            return -EINVAL;
+        }
+        filter.pid_min = filter.pid_max = filter.tgid;
+    }
+
+    mutex_lock(&m->lock);
+    if (filter.track && !state->tracks) {
+        state->tracks = kvzalloc(sizeof(*state->tracks), GFP_KERNEL);
+        if (!state->tracks) {
+            mutex_unlock(&m->lock);
+            return -ENOMEM;
+        }
+    }
+    state->filter = filter;
+    mutex_unlock(&m->lock);
+    return count;
 }
 
 static const struct proc_ops proc_info_fops = {
     .proc_open = proc_info_open, //Called when the file is opened
     .proc_read = seq_read, //Reads data from the file
-    .proc_release = single_release, //Handles cleanup when the file is closed.
+    .proc_write = proc_info_write, //Sets the filter for this open file
+    .proc_lseek = seq_lseek, //Lets readers rewind and read again
+    .proc_release = proc_info_release, //Handles cleanup when the file is closed.
+};
+
+// Function to estimate a percentile of the per-pass walk time; a bucket reports its upper bound
+static u64 proc_info_held_percentile(const u64 *buckets, u64 passes, unsigned int pct) {
+    u64 seen = 0;
+    int b;
+
+    for (b = 0; b < PROC_STATS_BUCKETS; b++) {
+        seen += buckets[b];
+        if (seen * 100 >= passes * pct) {
+            return b == PROC_STATS_BUCKETS - 1 ? U64_MAX : (2ULL << b) - 1;
+        }
+    }
+    return 0;
+}
+
+// Function to show what reading the process table costs the kernel
+static int proc_info_stats_show(struct seq_file *m, void *v) {
+    struct proc_info_stats stats;
+
+    spin_lock(&proc_info_stats_lock);
+    stats = proc_info_stats;
+    spin_unlock(&proc_info_stats_lock);
+
+    // One "name value" pair per line, times in nanoseconds
+    seq_printf(m, "generation %llu\n", (u64) atomic64_read(&proc_info_generation));
+    seq_printf(m, "passes %llu\n", stats.passes);
+    seq_printf(m, "last_generation %llu\n", stats.generation);
+    seq_printf(m, "tasks %lu\n", stats.tasks);
+    seq_printf(m, "shown %lu\n", stats.shown);
+    seq_printf(m, "pass_ns %llu\n", stats.pass_ns);
+    seq_printf(m, "walk_ns %llu\n", stats.held_ns);
+    seq_printf(m, "longest_hold_ns %llu\n", stats.longest_hold_ns);
+    seq_printf(m, "walk_mean_ns %llu\n", stats.passes ? div64_u64(stats.total_held_ns, stats.passes) : 0);
+    seq_printf(m, "walk_p50_ns %llu\n", proc_info_held_percentile(stats.held_buckets, stats.passes, 50));
+    seq_printf(m, "walk_p99_ns %llu\n", proc_info_held_percentile(stats.held_buckets, stats.passes, 99));
+    seq_printf(m, "walk_max_ns %llu\n", stats.max_held_ns);
+    return 0;
+}
+
+static int proc_info_stats_open(struct inode *inode, struct file *file) {
+    return single_open(file, proc_info_stats_show, NULL);
+}
+
+static const struct proc_ops proc_info_stats_fops = {
+    .proc_open = proc_info_stats_open,
+    .proc_read = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = single_release,
+};
+
+static const struct proc_ops proc_info_bin_fops = {
+    .proc_open = proc_info_bin_open,
+    .proc_read = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = proc_info_release,
 };
 
 // Module initialization
 static int __init proc_info_init(void) {
-    // Create a /proc entry for our module
-    proc_create(PROC_NAME, 0, NULL, &proc_info_fops);
+    // Create a /proc entry for our module; everyone may read it, root may write filters
+    proc_create(PROC_NAME, 0644, NULL, &proc_info_fops);
+    // And a second one that exports the same tasks as binary records
+    proc_create(PROC_BIN_NAME, 0, NULL, &proc_info_bin_fops);
+    // And one that tells what producing them costs
+    proc_create(PROC_STATS_NAME, 0444, NULL, &proc_info_stats_fops);
     printk(KERN_INFO "Kernel Module for Process Info Loaded\n");
     return 0;
 }
 
 // Module cleanup
 static void __exit proc_info_exit(void) {
-    // Remove the /proc entry when the module is unloaded
+    // Remove the /proc entry when the module is unloaded; files still open are released
+    // first, and with them their tracking tables
+    remove_proc_entry(PROC_STATS_NAME, NULL);
+    remove_proc_entry(PROC_BIN_NAME, NULL);
     remove_proc_entry(PROC_NAME, NULL);
     printk(KERN_INFO "Kernel Module for Process Info Unloaded\n");
 }
@@ -0,0 +1,38 @@
+#ifndef PROC_INFO_ABI_H
+#define PROC_INFO_ABI_H
+
+// Binary record format shared by the proc_info module and its readers.
+// The header is included from both kernel and user space, so it only uses
+// the fixed-width types from <linux/types.h>.
+
+#include <linux/types.h>
+
+#define PROC_INFO_BIN_NAME "proc_info_bin"
+#define PROC_INFO_STATS_NAME "proc_info_stats"
+
+#define PROC_INFO_BIN_VERSION 2
+#define PROC_INFO_COMM_LEN 16
+
+// task->prio is offset by MAX_RT_PRIO compared to the priority in /proc/[pid]/stat
+#define PROC_INFO_PRIO_OFFSET 100
+
+// One task as emitted by /proc/proc_info_bin. Every record starts with its
+// version and size so a reader can reject a module it does not understand.
+struct proc_info_record {
+    __u16 version;          // PROC_INFO_BIN_VERSION
+    __u16 size;             // sizeof(struct proc_info_record)
+    __s32 pid;
+    __s32 ppid;
+    __u32 uid;
+    __s32 prio;             // task->prio
+    __s32 threads;
+    __u64 rss_pages;
+    __u64 utime_ns;         // Whole thread group, including exited threads
+    __u64 stime_ns;
+    __u64 start_time_ns;    // Since boot
+    char comm[PROC_INFO_COMM_LEN];
+    char state;             // R, S, D, Z, ...
+    char reserved[7];
+};
+
+#endif
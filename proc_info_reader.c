@@ -1,45 +1,123 @@
+#define _GNU_SOURCE
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <pwd.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include "proc_scan.h"
+#include "proc_cpu.h"
+#include "proc_events.h"
+#include "proc_info_abi.h"
+#include "proc_users.h"
+#include "proc_output.h"
+#include "proc_shm.h"
+#include "proc_history.h"
+#include "proc_rollup.h"
+#include "proc_stats.h"
+#include "proc_extra.h"
+#include "proc_threads.h"
+#include "proc_screen.h"
+#include "proc_filter.h"
 
 // Global variable to control the program flow
 volatile sig_atomic_t keep_running = 1;
 
+// Directory to read instead of /proc, e.g. a tree written by proc_fixture
+const char *proc_root = "/proc";
+
+// Number of threads used to scan /proc when the module is not loaded (0 = one per CPU)
+size_t scan_threads = 1;
+
+// uid -> user name cache, so a refresh only asks NSS about uids it has not seen
+struct proc_users users;
+
+// Control socket of a proc_snapd to take snapshots from instead of scanning (--attach)
+const char *attach_socket = NULL;
+
+// History file to show instead of the present (--replay), and where to start in it (--at)
+const char *replay_file = NULL;
+const char *replay_at = NULL;
+int rollup_kind = -1;  // --rollup: show a PROC_ROLLUP_* summary instead of processes
+int show_stats = 0;    // --stats: time every stage and report what the reader itself cost
+
+// --extra: PROC_EXTRA_* columns to add, read within a budget per refresh
+unsigned int extra_want = 0;
+unsigned int extra_budget_us = 20000;
+unsigned int extra_max_age_ms = 60000;
+
+// --expand PID lists the threads of these processes under them; in --live, --hot-threads PCT
+// also lists them for every process above that CPU%
+#define MAX_EXPANDED 32
+pid_t expand_pids[MAX_EXPANDED];
+size_t expand_count = 0;
+double hot_threads_pct = -1;
+#define HOT_THREAD_ROWS 8       // Busiest threads shown per process in --live
+
+// Order of the process rows at a terminal: 'c' CPU, 'm' memory, 'p' PID, 't' CPU time.
+// The keys of the same letters change it without reading /proc again.
+int sort_by = 'c';
+
+// --filter, or what was typed after '/' at a terminal. The last text that parsed is the
+// active filter (of two, so the next is parsed before the last is freed).
+char filter_text[PROC_FILTER_LEN];
+struct proc_filter filters[2];
+int filter_slot = -1;           // Index of the active filter, or -1
+int filter_editing = 0;         // Keys go to filter_text until Enter or Esc
+char filter_error[128];         // Why filter_text does not parse, or ""
+unsigned int filter_changes;    // Bumped whenever the active filter changes
+
+// What the active filter keeps of one snapshot
+struct filter_view {
+    struct proc_filter_index index;
+    uint64_t *matched;          // The processes that match
+    uint64_t *shown;            // They and their ancestors
+    size_t words;
+    size_t matches;
+    double *cpu;                // CPU% of each process, for mincpu=
+    size_t capacity;
+};
+
 // Function to handle Ctrl+C (SIGINT) and stop the loop
 void handle_sigint(int sig) {
+    (void) sig;
     keep_running = 0;
 }
 
-// Function to get the terminal size
+// Function to get the terminal size; 24x80 when stdout is not a terminal
 void get_terminal_size(int *rows, int *cols) {
     struct winsize ws;
-    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1) {
-        perror("ioctl");
-        exit(1);
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_row == 0) {
+        *rows = 24;
+        *cols = 80;
+        return;
     }
     *rows = ws.ws_row;
     *cols = ws.ws_col;
 }
 
-// Function to get the username by UID
+// Function to tell whether a person is at the terminal, so keys can be read and the screen redrawn
+int at_terminal(void) {
+    return isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
+}
+
+// Function to get the username by UID; the name stays valid until the next call
 const char* get_username_by_uid(uid_t uid) {
-    struct passwd *pw = getpwuid(uid);
-    if (pw) {
-        return pw->pw_name;
-    } else {
-        return "Unknown";
-    }
+    static char name[PROC_USER_LEN];
+    proc_users_name(&users, uid, name, sizeof(name));
+    return name;
 }
 
 // Function to get total system memory from /proc/meminfo
 unsigned long get_total_memory() {
-    FILE *file = fopen("/proc/meminfo", "r");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/meminfo", proc_root);
+    FILE *file = fopen(path, "r");
     if (file == NULL) {
-        perror("Failed to open /proc/meminfo");
+        perror("Failed to open meminfo");
         return 0;
     }
 
@@ -56,81 +134,100 @@ unsigned long get_total_memory() {
     return total_mem;
 }
 
-// Function to get the memory usage of a process from /proc/[pid]/status
-unsigned long get_process_memory(pid_t pid) {
-    char path[256];
-    snprintf(path, sizeof(path), "/proc/%d/status", pid);
-
+// Function to get the system uptime in seconds from /proc/uptime
+double get_uptime() {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/uptime", proc_root);
     FILE *file = fopen(path, "r");
     if (file == NULL) {
         return 0;
     }
 
-    unsigned long mem_usage = 0;
-    char buffer[256];
-    while (fgets(buffer, sizeof(buffer), file)) {
-        if (strncmp(buffer, "VmRSS:", 6) == 0) {
-            sscanf(buffer, "VmRSS: %lu kB", &mem_usage);
-            break;
-        }
+    double uptime = 0;
+    if (fscanf(file, "%lf", &uptime) != 1) {
+        uptime = 0;
     }
 
     fclose(file);
-    return mem_usage;
+    return uptime;
 }
 
-// Function to get the UID of a process from /proc/[pid]/status
-uid_t get_process_uid(pid_t pid) {
-    char path[256];
-    snprintf(path, sizeof(path), "/proc/%d/status", pid);
-
-    FILE *file = fopen(path, "r");
-    if (file == NULL) {
-        return (uid_t) -1;  // Return -1 if the file cannot be opened
+// Function to print the table header, with the --extra columns after the command
+void print_table_header(FILE *out) {
+    const char *extra_border = extra_want ? "------------+------------+------------+-------+-------+" : "";
+    fprintf(out, "\n+--------------+------------------------+-----------------+---------------+------------+------------------------+---------------------------+%s\n",
+           extra_border);
+    fprintf(out, "| %-12s | %-22s | %-15s | %-13s | %-10s | %-22s | %-25s |", 
+           "PID", "User", "Priority", "CPU Usage", "Mem(kB)", "Time", "Command");
+    if (extra_want) {
+        fprintf(out, " %-10s | %-10s | %-10s | %-5s | %-5s |", "PSS(kB)", "USS(kB)", "Swap(kB)", "FDs", "Age");
     }
+    fprintf(out, "\n+--------------+------------------------+-----------------+---------------+------------+------------------------+---------------------------+%s\n",
+           extra_border);
+}
 
-    uid_t uid = (uid_t) -1;
-    char buffer[256];
-    while (fgets(buffer, sizeof(buffer), file)) {
-        if (strncmp(buffer, "Uid:", 4) == 0) {
-            sscanf(buffer, "Uid:\t%u", &uid);  // Extract the UID
-            break;
+// Function to end a table row, with the --extra values and how old they are.
+// "-" means not read yet, "n/a" not readable without privileges.
+void print_extra_cells(FILE *out, const struct proc_extra *extra, uint64_t now_ms) {
+    char pss[16] = "-", uss[16] = "-", swap[16] = "-", fds[16] = "-", age[16] = "-";
+
+    if (extra_want && extra != NULL) {
+        if (extra->flags & PROC_EXTRA_MEM) {
+            snprintf(pss, sizeof(pss), "%lu", extra->pss_kb);
+            snprintf(uss, sizeof(uss), "%lu", extra->uss_kb);
+            snprintf(swap, sizeof(swap), "%lu", extra->swap_kb);
+        } else if (extra->flags & PROC_EXTRA_DENIED) {
+            strcpy(pss, "n/a");
+            strcpy(uss, "n/a");
+            strcpy(swap, "n/a");
+        }
+        if (extra->flags & PROC_EXTRA_FDS) {
+            snprintf(fds, sizeof(fds), "%u", extra->fds);
+        } else if (extra->flags & PROC_EXTRA_DENIED) {
+            strcpy(fds, "n/a");
+        }
+        if (extra->flags != 0) {
+            uint64_t age_s = (now_ms - extra->sampled_ms) / 1000;
+            if (age_s < 100) {
+                snprintf(age, sizeof(age), "%us", (unsigned int) age_s);
+            } else {
+                snprintf(age, sizeof(age), "%um", (unsigned int) (age_s / 60));
+            }
         }
     }
-
-    fclose(file);
-    return uid;
+    if (extra_want) {
+        fprintf(out, " %-10s | %-10s | %-10s | %-5s | %-5s |", pss, uss, swap, fds, age);
+    }
+    fputc('\n', out);
 }
 
-// Function to get the total CPU time (user + system) for a process from /proc/[pid]/stat
-unsigned long get_process_time(pid_t pid) {
-    char path[256];
-    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+// Function to print what every stage of the reader cost, then the module's own figures
+void print_self_stats(void) {
+    char path[4096];
+    char line[256];
+
+    fprintf(stderr, "\n");
+    proc_stats_print(stderr);
 
+    snprintf(path, sizeof(path), "%s/" PROC_INFO_STATS_NAME, proc_root);
     FILE *file = fopen(path, "r");
     if (file == NULL) {
-        return 0;
+        return;
+    }
+    fprintf(stderr, "\n" PROC_INFO_STATS_NAME ":\n");
+    while (fgets(line, sizeof(line), file) != NULL) {
+        fputs(line, stderr);
     }
-
-    unsigned long utime, stime;
-    char buffer[256];
-    fgets(buffer, sizeof(buffer), file);  // Read the whole line
-
-    // Extract the utime (user time) and stime (system time) fields
-    sscanf(buffer, "%*d %*s %*c %*d %*d %*d %*d %*d %*d %*d %lu %lu", &utime, &stime);
-
     fclose(file);
-
-    // Return the total time (user + system time) in clock ticks
-    return utime + stime;
 }
 
-// Function to print the table header
-void print_table_header() {
-    printf("\n+--------------+------------------------+-----------------+---------------+------------+------------------------+---------------------------+\n");
-    printf("| %-12s | %-22s | %-15s | %-13s | %-10s | %-22s | %-25s |\n", 
-           "PID", "User", "Priority", "CPU Usage", "Mem(kB)", "Time", "Command");
-    printf("+--------------+------------------------+-----------------+---------------+------------+------------------------+---------------------------+\n");
+// Function to print the header of the --rollup summary
+void print_rollup_header(FILE *out, int kind) {
+    fprintf(out, "\n+---------------------------------+-----------+----------+---------------+--------------+------------------------+\n");
+    fprintf(out, "| %-31s | %-9s | %-8s | %-13s | %-12s | %-22s |\n",
+           kind == PROC_ROLLUP_USER ? "User" : kind == PROC_ROLLUP_COMM ? "Command" : "Subtree",
+           "Processes", "Threads", "CPU Usage", "Mem(kB)", "Time");
+    fprintf(out, "+---------------------------------+-----------+----------+---------------+--------------+------------------------+\n");
 }
 
 // Function to format the time (limit to two decimal places and add a unit)
@@ -144,95 +241,1965 @@ void format_time(double cpu_time_seconds, char *formatted_time) {
     }
 }
 
-// Function to print the table rows from the file
-void print_file_with_header(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
+// Function to format the average CPU usage over a process lifetime, like ps %CPU
+void format_cpu_usage(double cpu_time_seconds, double elapsed_seconds, char *formatted_usage) {
+    if (elapsed_seconds <= 0) {
+        snprintf(formatted_usage, 20, "-");
+    } else {
+        snprintf(formatted_usage, 20, "%.1f %%", 100.0 * cpu_time_seconds / elapsed_seconds);
+    }
+}
+
+// Function to print the columns of one process up to the command; print_extra_cells ends the row.
+// An ancestor is only shown because a filter matched one of its descendants, so its PID is in
+// parentheses.
+void print_process_row(FILE *out, const struct proc_entry *entry, const char *cpu_usage, long ticks_per_sec,
+                       int ancestor) {
+    char pid[24];
+    char formatted_time[20];
+    snprintf(pid, sizeof(pid), ancestor ? "(%d)" : "%d", entry->pid);
+    format_time((double) (entry->utime + entry->stime) / ticks_per_sec, formatted_time);
+    fprintf(out, "| %-12s | %-22s | %-15d | %-13s | %-10lu | %-22s | %-25s |",
+            pid, get_username_by_uid(entry->uid), entry->prio, cpu_usage,
+            entry->rss_kb, formatted_time, entry->comm);
+}
+
+// Function to tell whether a filter with any terms is active
+int filtering(void) {
+    return filter_slot >= 0 && !filters[filter_slot].empty;
+}
+
+// Function to make filter_text the active filter; if it does not parse, the last one stays
+// and filter_error says why. Returns 0 or -1.
+int set_filter(void) {
+    int slot = filter_slot == 0 ? 1 : 0;
+    if (proc_filter_parse(&filters[slot], filter_text, filter_error, sizeof(filter_error)) < 0) {
+        return -1;
+    }
+    filter_error[0] = '\0';
+    if (filter_slot >= 0) {
+        proc_filter_free(&filters[filter_slot]);
+    }
+    filter_slot = slot;
+    filter_changes++;
+    return 0;
+}
+
+// Function to apply a key to the filter typed at the status line: it is matched again at
+// every keystroke, Enter keeps it and Esc clears it. Returns 1 if the view changed, 0 if not.
+int edit_filter(int key) {
+    size_t len = strlen(filter_text);
+
+    if (key == '\n' || key == '\r') {
+        filter_editing = 0;
+        return 1;
+    }
+    if (key == 27) {
+        filter_text[0] = '\0';
+        filter_editing = 0;
+        set_filter();
+        return 1;
+    }
+    if (key == 127 || key == 8) {
+        if (len == 0) {
+            return 0;
+        }
+        filter_text[len - 1] = '\0';
+    } else if (key >= 0x20 && key < 0x7f && len + 1 < sizeof(filter_text)) {
+        filter_text[len] = (char) key;
+        filter_text[len + 1] = '\0';
+    } else {
+        return key == PROC_KEY_RESIZE;
+    }
+    set_filter();
+    return 1;
+}
+
+// Function to match the active filter against a snapshot. A fresh snapshot is indexed first,
+// as is one whose command lines the filter needs but the index has not read; a NULL scanner
+// reads none. CPU% is the last interval's from deltas, or the lifetime one without them.
+// Returns 0 or -1.
+int filter_rows(struct filter_view *view, struct proc_scanner *scanner, const struct proc_snapshot *snap,
+                const long long *deltas, double per_tick, double uptime, int fresh) {
+    const struct proc_filter *filter = filter_slot >= 0 ? &filters[filter_slot] : NULL;
+    int cmdlines = filter != NULL && filter->has_cmdline;
+
+    if (fresh || view->index.count != snap->count || (cmdlines && !view->index.have_cmdlines && scanner != NULL)) {
+        if (snap->count > view->capacity) {
+            size_t words = PROC_FILTER_WORDS(snap->count);
+            double *cpu = realloc(view->cpu, snap->count * sizeof(*cpu));
+            uint64_t *bits = realloc(view->matched, 2 * words * sizeof(*bits));
+            if (cpu != NULL) {
+                view->cpu = cpu;
+            }
+            if (bits != NULL) {
+                view->matched = bits;
+            }
+            if (cpu == NULL || bits == NULL) {
+                return -1;
+            }
+            view->capacity = snap->count;
+        }
+        long ticks_per_sec = sysconf(_SC_CLK_TCK);
+        for (size_t i = 0; i < snap->count; i++) {
+            const struct proc_entry *entry = &snap->entries[i];
+            double elapsed = uptime - (double) entry->start_time / ticks_per_sec;
+            double cpu = (double) (entry->utime + entry->stime) / ticks_per_sec;
+            view->cpu[i] = deltas != NULL ? deltas[i] * per_tick : elapsed > 0 ? 100.0 * cpu / elapsed : 0;
+        }
+        if (proc_filter_index_update(&view->index, scanner, snap, view->cpu, cmdlines) < 0) {
+            return -1;
+        }
+    }
+    view->words = PROC_FILTER_WORDS(snap->count);
+    view->shown = view->matched + view->words;
+    view->matches = filter != NULL ? proc_filter_match(&view->index, filter, view->matched, view->shown) : 0;
+    return 0;
+}
+
+// Function to free what a filter view holds
+void filter_view_free(struct filter_view *view) {
+    proc_filter_index_destroy(&view->index);
+    free(view->matched);
+    free(view->cpu);
+}
+
+// Function to write the status line: the filter being typed, or the view's own status
+// after what the active filter matched
+void format_status(char *out, size_t size, const char *status, size_t matches) {
+    if (filter_editing) {
+        snprintf(out, size, " Filter: %s_ | %s%sEnter keeps, Esc clears ", filter_text, filter_error,
+                 filter_error[0] ? " | " : "");
+    } else if (filtering()) {
+        snprintf(out, size, " %zu match \"%s\" |%s", matches, filter_text, status);
+    } else {
+        snprintf(out, size, "%s", status);
+    }
+}
+
+// Function to read /proc/proc_info_bin straight into an array of records
+struct proc_info_record *read_binary_records(const char *filename, size_t *count) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
         perror("Error opening file");
-        return;
+        return NULL;
     }
 
-    unsigned long total_mem = get_total_memory();  // Get total system memory in kB
-    char line[256];
+    size_t capacity = 1024 * sizeof(struct proc_info_record);
+    size_t used = 0;
+    char *buf = malloc(capacity);
+
+    while (buf != NULL) {
+        if (capacity - used < 64 * sizeof(struct proc_info_record)) {
+            char *bigger = realloc(buf, capacity * 2);
+            if (bigger == NULL) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = bigger;
+            capacity *= 2;
+        }
+
+        ssize_t n = read(fd, buf + used, capacity - used);
+        if (n < 0) {
+            perror("Error reading file");
+            free(buf);
+            buf = NULL;
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        used += n;
+    }
+    close(fd);
+    if (buf == NULL) {
+        return NULL;
+    }
 
-    // Terminal size variables
-    int rows, cols;
-    get_terminal_size(&rows, &cols);  // Get current terminal size
+    struct proc_info_record *records = (struct proc_info_record *) buf;
+    *count = used / sizeof(struct proc_info_record);
 
-    int current_line = 0;  // Keep track of how many lines we've printed
-    int lines_per_page = rows - 5;  // Subtract 5 for the header and borders
+    // Refuse records from a module that speaks a different format
+    if (*count > 0 && (records[0].version != PROC_INFO_BIN_VERSION ||
+                       records[0].size != sizeof(struct proc_info_record))) {
+        fprintf(stderr, "Unsupported record format: version %u, size %u\n",
+                records[0].version, records[0].size);
+        free(buf);
+        return NULL;
+    }
+    return records;
+}
 
-    // Read each line from the file and print it
-    while (fgets(line, sizeof(line), file)) {
-        // Strip any trailing newline character
-        line[strcspn(line, "\n")] = 0;
+// Function to print one thread under its process's row; cpu_usage is already formatted
+void print_thread_row(FILE *out, const struct proc_thread *thread, const char *cpu_usage, long ticks_per_sec) {
+    char tid[24];
+    char formatted_time[20];
+    snprintf(tid, sizeof(tid), "  `- %d", thread->tid);
+    format_time((double) thread->ticks / ticks_per_sec, formatted_time);
+    fprintf(out, "| %-12s | %-22s | %-15d | %-13s | %-10s | %-22s | %-25s |",
+           tid, "", thread->prio, cpu_usage, "", formatted_time, thread->comm);
+    print_extra_cells(out, NULL, 0);
+}
 
-        // Split line by '|' to get the columns
-        char *pid_str = strtok(line, "|");
-        char *user = strtok(NULL, "|");
-        char *priority = strtok(NULL, "|");
-        char *cpu_usage = strtok(NULL, "|");
-        char *mem_usage_str = strtok(NULL, "|");
-        char *command = strtok(NULL, "|");
+// Function to pick the busiest threads of a process by their last delta, busiest first;
+// returns how many indexes it put in top
+size_t busiest_threads(const struct proc_thread_group *group, size_t *top, size_t max) {
+    size_t n = 0;
 
-        pid_t pid = atoi(pid_str);
-        
-        // Get the UID from /proc/[pid]/status and fetch the corresponding username
-        uid_t uid = get_process_uid(pid);
-        const char *username = get_username_by_uid(uid);
+    // A process on the last row of the screen leaves no room for its threads
+    if (max == 0) {
+        return 0;
+    }
 
-        unsigned long mem_usage = get_process_memory(pid);  // Get memory usage in kB
-        unsigned long cpu_time = get_process_time(pid);  // Get total CPU time (user + system)
+    // An insertion into a short sorted list; max is a handful of rows, the list can be thousands
+    for (size_t i = 0; i < group->count; i++) {
+        long long delta = group->threads[i].delta;
+        if (n == max && delta <= group->threads[top[n - 1]].delta) {
+            continue;
+        }
+        size_t j = n < max ? n++ : n - 1;
+        while (j > 0 && group->threads[top[j - 1]].delta < delta) {
+            top[j] = top[j - 1];
+            j--;
+        }
+        top[j] = i;
+    }
+    return n;
+}
 
-        // Convert clock ticks to seconds (assuming 100 Hz clock)
-        double cpu_time_seconds = (double)cpu_time / sysconf(_SC_CLK_TCK);
+// Function to turn /proc/proc_info_bin into a snapshot, converted the way proc_scan_module
+// converts the text table. The module writes both in PID order. Returns 0 or -1.
+int read_binary_snapshot(const char *filename, struct proc_snapshot *snap) {
+    size_t count = 0;
+    struct proc_info_record *records = read_binary_records(filename, &count);
+    if (records == NULL) {
+        return -1;
+    }
+    if (proc_snapshot_reserve(snap, count) < 0) {
+        perror("Error reading the records");
+        free(records);
+        return -1;
+    }
 
-        // Format the time with unit and limitation
-        char formatted_time[20];
-        format_time(cpu_time_seconds, formatted_time);
+    long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    unsigned long long ns_per_tick = 1000000000ULL / (unsigned long long) sysconf(_SC_CLK_TCK);
+    for (size_t i = 0; i < count; i++) {
+        const struct proc_info_record *rec = &records[i];
+        struct proc_entry *entry = &snap->entries[i];
+        entry->pid = rec->pid;
+        entry->ppid = rec->ppid;
+        entry->uid = rec->uid;
+        entry->prio = rec->prio - PROC_INFO_PRIO_OFFSET;
+        entry->state = rec->state;
+        entry->threads = rec->threads;
+        entry->rss_kb = (unsigned long) rec->rss_pages * page_kb;
+        entry->utime = (unsigned long) (rec->utime_ns / ns_per_tick);
+        entry->stime = (unsigned long) (rec->stime_ns / ns_per_tick);
+        entry->start_time = rec->start_time_ns / ns_per_tick;
 
-        // Print the row in the formatted table
-        printf("| %-10s | %-22s | %-13s | %-13s | %-10lu | %-22s | %-25s |\n", 
-               pid_str, username, priority, cpu_usage, mem_usage, formatted_time, command);
+        size_t comm_len = strnlen(rec->comm, PROC_INFO_COMM_LEN);
+        if (comm_len >= PROC_COMM_LEN) {
+            comm_len = PROC_COMM_LEN - 1;
+        }
+        memcpy(entry->comm, rec->comm, comm_len);
+        entry->comm[comm_len] = '\0';
+    }
+    snap->count = count;
+
+    free(records);
+    return 0;
+}
+
+// Function to borrow the newest snapshot of proc_snapd, waiting for its first one and
+// subscribing again when it has moved to a bigger segment; returns 0 or -1
+int read_attached(struct proc_shm *shm, int interval_ms, struct proc_snapshot *snap, struct proc_shm_sample *sample) {
+    // Drain the notifications that piled up meanwhile; this also notices a daemon that went away
+    if (proc_shm_wait(shm, 0) < 0) {
+        return -1;
+    }
+    while (proc_shm_read(shm, snap, sample) < 0) {
+        if (errno == ESTALE) {
+            proc_shm_close(shm);
+            if (proc_shm_attach(shm, attach_socket, (unsigned int) interval_ms) < 0) {
+                return -1;
+            }
+        } else if (errno != EAGAIN || proc_shm_wait(shm, interval_ms) < 0) {
+            return -1;
+        } else if (!keep_running) {
+            errno = EINTR;
+            return -1;
+        }
+    }
+    return 0;
+}
 
-        current_line++;
+// Function to copy the newest snapshot of proc_snapd. The paged table can be held on
+// screen for longer than the daemon keeps a slot, so it gets its own copy.
+int copy_attached(struct proc_snapshot *copy) {
+    struct proc_shm shm;
+    struct proc_snapshot snap;
+    struct proc_shm_sample sample;
+    int rc;
 
-        // If we've printed enough lines, wait for the user to press Enter
-        if (current_line >= lines_per_page) {
-            printf("\nPress Enter to continue or Ctrl+C to exit...\n");
-            current_line = 0;
+    if (proc_shm_attach(&shm, attach_socket, 0) < 0) {
+        return -1;
+    }
+    do {
+        rc = read_attached(&shm, 1000, &snap, &sample);
+        if (rc == 0 && (rc = proc_snapshot_reserve(copy, snap.count)) == 0) {
+            memcpy(copy->entries, snap.entries, snap.count * sizeof(*snap.entries));
+            copy->count = snap.count;
+            copy->generation = snap.generation;
+        }
+    } while (rc == 0 && !proc_shm_valid(&shm, &snap, sample.seq));
+    proc_shm_close(&shm);
+    return rc;
+}
 
-            // Wait for user to press Enter
-            while (1) {
-                char ch = getchar();
-                if (ch == '\n' || ch == EOF) {
-                    break;
+// Function to turn the --at time of a replay into ms since the epoch: seconds since the
+// epoch, "YYYY-MM-DD HH:MM[:SS]" in local time, or -N for N seconds before the last sample.
+// Returns 0 if it is none of those.
+uint64_t parse_replay_time(const char *s, const struct proc_replay *replay) {
+    struct tm tm;
+    char *end;
+
+    if (s[0] == '-') {
+        unsigned long long back = strtoull(s + 1, &end, 10);
+        return *end == '\0' && back * 1000 <= replay->last_ms ? replay->last_ms - back * 1000 : 0;
+    }
+    unsigned long long secs = strtoull(s, &end, 10);
+    if (*end == '\0') {
+        return secs * 1000;
+    }
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_isdst = -1;
+    end = strptime(s, "%Y-%m-%d %H:%M", &tm);
+    if (end != NULL && *end == ':') {
+        end = strptime(end, ":%S", &tm);
+    }
+    return end != NULL && *end == '\0' ? (uint64_t) mktime(&tm) * 1000 : 0;
+}
+
+// Function to open the --replay file at the --at time. Without --at, the table starts at
+// the last sample and the other views before the first. *primed tells whether the
+// current snapshot is the first one to show. Returns 0 or -1.
+int open_replay(struct proc_replay *replay, int at_end, int *primed) {
+    if (proc_replay_open(replay, replay_file) < 0) {
+        perror(replay_file);
+        return -1;
+    }
+    *primed = 0;
+    if (replay_at == NULL && !at_end) {
+        return 0;
+    }
+
+    uint64_t time_ms = replay_at != NULL ? parse_replay_time(replay_at, replay) : replay->last_ms;
+    if (time_ms == 0) {
+        fprintf(stderr, "Cannot read the time %s: expected seconds since the epoch, \"YYYY-MM-DD HH:MM[:SS]\" or -SECONDS\n",
+                replay_at);
+        proc_replay_close(replay);
+        return -1;
+    }
+    if (proc_replay_seek(replay, time_ms) < 0) {
+        perror(replay_file);
+        proc_replay_close(replay);
+        return -1;
+    }
+    *primed = replay->frames > 0;
+    return 0;
+}
+
+// Function to format the time of a replayed sample as local time
+void format_replay_time(uint64_t time_ms, char *out, size_t size) {
+    time_t t = (time_t) (time_ms / 1000);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(out, size, "%Y-%m-%d %H:%M:%S", &tm);
+}
+
+// One row of the --rollup summary
+struct rollup_row {
+    char name[48];
+    struct proc_rollup_totals totals;
+};
+
+// Function to order rollup rows busiest first, then by memory
+int compare_rollup_rows(const void *a, const void *b) {
+    const struct rollup_row *x = a;
+    const struct rollup_row *y = b;
+    if (x->totals.cpu_delta != y->totals.cpu_delta) {
+        return x->totals.cpu_delta < y->totals.cpu_delta ? 1 : -1;
+    }
+    if (x->totals.rss_kb != y->totals.rss_kb) {
+        return x->totals.rss_kb < y->totals.rss_kb ? 1 : -1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+// Function to tell whether a process has no parent in the snapshot
+int is_top_level(const struct proc_snapshot *snap, const struct proc_entry *entry) {
+    return entry->ppid == 0 || entry->ppid == entry->pid || proc_snapshot_find(snap, entry->ppid) == NULL;
+}
+
+// Function to list the non-empty groups of a rollup. For PROC_ROLLUP_TREE these are the
+// subtrees of the top-level processes and of their children (init's children are the
+// services and sessions). Returns the row count, or -1 if out of memory.
+long collect_rollup_rows(const struct proc_rollup *rollup, const struct proc_snapshot *snap,
+                         struct rollup_row **rows, size_t *capacity) {
+    size_t n = 0;
+    size_t total = rollup->kind == PROC_ROLLUP_TREE ? snap->count : rollup->group_count;
+
+    for (size_t i = 0; i < total; i++) {
+        struct rollup_row row;
+        if (rollup->kind == PROC_ROLLUP_TREE) {
+            const struct proc_entry *entry = &snap->entries[i];
+            if (!is_top_level(snap, entry) && !is_top_level(snap, proc_snapshot_find(snap, entry->ppid))) {
+                continue;
+            }
+            if (proc_rollup_subtree(rollup, entry->pid, &row.totals) < 0) {
+                continue;
+            }
+            snprintf(row.name, sizeof(row.name), "%d %s", entry->pid, entry->comm);
+        } else {
+            const struct proc_rollup_group *group = &rollup->groups[i];
+            if (group->totals.processes == 0) {
+                continue;
+            }
+            row.totals = group->totals;
+            snprintf(row.name, sizeof(row.name), "%s", rollup->kind == PROC_ROLLUP_USER
+                     ? get_username_by_uid(group->uid) : group->comm);
+        }
+
+        if (n == *capacity) {
+            size_t bigger = *capacity ? *capacity * 2 : 64;
+            struct rollup_row *grown = realloc(*rows, bigger * sizeof(*grown));
+            if (grown == NULL) {
+                return -1;
+            }
+            *rows = grown;
+            *capacity = bigger;
+        }
+        (*rows)[n++] = row;
+    }
+    qsort(*rows, n, sizeof(**rows), compare_rollup_rows);
+    return (long) n;
+}
+
+// Function to print one row of the --rollup summary; per_tick < 0 means no CPU% yet
+void print_rollup_row(FILE *out, const struct rollup_row *row, double per_tick, long ticks_per_sec) {
+    char formatted_time[20];
+    char cpu_usage[20];
+    format_time((double) row->totals.cpu_ticks / ticks_per_sec, formatted_time);
+    if (per_tick < 0) {
+        snprintf(cpu_usage, sizeof(cpu_usage), "-");
+    } else {
+        snprintf(cpu_usage, sizeof(cpu_usage), "%.1f %%", (double) row->totals.cpu_delta * per_tick);
+    }
+    fprintf(out, "| %-31s | %-9lu | %-8lu | %-13s | %-12llu | %-22s |\n", row->name, row->totals.processes,
+           row->totals.threads, cpu_usage, row->totals.rss_kb, formatted_time);
+}
+
+// Function to give a process its place in the current sort order, biggest first; cpu is its
+// CPU use in whatever unit the view shows
+double sort_value(const struct proc_entry *entry, double cpu) {
+    switch (sort_by) {
+    case 'm':
+        return (double) entry->rss_kb;
+    case 'p':
+        return -(double) entry->pid;
+    case 't':
+        return (double) (entry->utime + entry->stime);
+    default:
+        return cpu;
+    }
+}
+
+// Function to name the sort order on the status line
+const char *sort_name(void) {
+    return sort_by == 'm' ? "memory" : sort_by == 'p' ? "PID" : sort_by == 't' ? "time" : "CPU";
+}
+
+// Function to apply a key to the sort order, the filter and the first of total rows shown,
+// page of them at a time; returns 1 if the view changed, 0 if not, -1 to quit
+int handle_view_key(int key, size_t *scroll, size_t page, size_t total) {
+    size_t last = total > page ? total - page : 0;
+    size_t before = *scroll;
+
+    // While a filter is typed every key goes to it, and the view starts over at the top
+    if (filter_editing) {
+        unsigned int changes = filter_changes;
+        int changed = edit_filter(key);
+        if (filter_changes != changes) {
+            *scroll = 0;
+        }
+        return changed;
+    }
+    switch (key) {
+    case 'q':
+    case 'Q':
+        return -1;
+    case '/':
+        if (rollup_kind >= 0) {
+            return 0;
+        }
+        filter_editing = 1;
+        return 1;
+    case 'c':
+    case 'm':
+    case 'p':
+    case 't':
+        if (key == sort_by) {
+            return 0;
+        }
+        sort_by = key;
+        *scroll = 0;
+        return 1;
+    case PROC_KEY_UP:
+        if (*scroll > 0) {
+            (*scroll)--;
+        }
+        break;
+    case PROC_KEY_DOWN:
+        (*scroll)++;
+        break;
+    case PROC_KEY_PAGE_UP:
+        *scroll = *scroll > page ? *scroll - page : 0;
+        break;
+    case PROC_KEY_PAGE_DOWN:
+        *scroll += page;
+        break;
+    case PROC_KEY_HOME:
+        *scroll = 0;
+        break;
+    case PROC_KEY_END:
+        *scroll = last;
+        break;
+    case PROC_KEY_RESIZE:
+        break;
+    default:
+        return 0;
+    }
+    if (*scroll > last) {
+        *scroll = last;
+    }
+    return *scroll != before || key == PROC_KEY_RESIZE;
+}
+
+// Function to put a frame written to a memory stream on the screen, with a status line under
+// it. Only what changed since the last frame is sent; the stream is emptied for the next one.
+int show_frame(struct proc_screen *screen, FILE *frame, char **text, size_t *len, const char *status) {
+    fflush(frame);
+    proc_screen_begin(screen);
+    proc_screen_write(screen, *text, *len);
+    proc_screen_attr(screen, PROC_SCREEN_REVERSE);
+    proc_screen_write(screen, status, strlen(status));
+    proc_screen_attr(screen, PROC_SCREEN_NORMAL);
+    rewind(frame);
+    return proc_screen_flush(screen);
+}
+
+// One line of the one-shot table at a terminal: a process, or one of its threads
+struct page_line {
+    size_t entry;                       // Index in the snapshot
+    const struct proc_thread *thread;   // NULL for the process itself
+};
+
+// What the one-shot table is ordered by
+struct page_order {
+    const struct proc_snapshot *snap;
+    const double *keys;                 // sort_value of each entry
+};
+
+// Function to order snapshot indexes by their sort keys, then by PID
+int compare_page_entries(const void *a, const void *b, void *arg) {
+    const struct page_order *order = arg;
+    size_t x = *(const size_t *) a;
+    size_t y = *(const size_t *) b;
+    if (order->keys[x] != order->keys[y]) {
+        return order->keys[x] < order->keys[y] ? 1 : -1;
+    }
+    return order->snap->entries[x].pid - order->snap->entries[y].pid;
+}
+
+// Function to show the one-shot table at a terminal a screen at a time. Keys scroll it, sort it
+// again and filter it, all from the snapshot already read (the scanner only reads command lines
+// for a filter on them), and each redraw sends only the cells that changed.
+void page_table(const struct proc_snapshot *snap, const struct proc_extra_table *extra, uint64_t now_ms,
+                const struct proc_threads *threads, double uptime, long ticks_per_sec, struct proc_scanner *scanner) {
+    size_t thread_count = 0;
+    for (size_t i = 0; i < threads->count; i++) {
+        thread_count += threads->groups[i].count;
+    }
+    size_t *order = malloc((snap->count + 1) * sizeof(*order));
+    double *keys = malloc((snap->count + 1) * sizeof(*keys));
+    struct page_line *lines = malloc((snap->count + thread_count + 1) * sizeof(*lines));
+    char *text = NULL;
+    size_t len = 0;
+    FILE *frame = open_memstream(&text, &len);
+    struct proc_screen screen;
+    if (order == NULL || keys == NULL || lines == NULL || frame == NULL ||
+        proc_screen_open(&screen, STDIN_FILENO, STDOUT_FILENO) < 0) {
+        perror("Error setting up the screen");
+        if (frame != NULL) {
+            fclose(frame);
+        }
+        free(text);
+        free(lines);
+        free(keys);
+        free(order);
+        return;
+    }
+
+    struct page_order context = { snap, keys };
+    struct filter_view view = {0};
+    int sorted_by = 0;
+    unsigned int filtered_at = filter_changes - 1;
+    size_t count = 0;
+    size_t scroll = 0;
+    int changed = 1;
+    while (keep_running) {
+        // The lifetime CPU% is the CPU column here, so it is what 'c' sorts by
+        if (sorted_by != sort_by) {
+            for (size_t i = 0; i < snap->count; i++) {
+                const struct proc_entry *entry = &snap->entries[i];
+                double elapsed = uptime - (double) entry->start_time / ticks_per_sec;
+                double cpu = (double) (entry->utime + entry->stime) / ticks_per_sec;
+                keys[i] = sort_value(entry, elapsed > 0 ? cpu / elapsed : 0);
+                order[i] = i;
+            }
+            qsort_r(order, snap->count, sizeof(*order), compare_page_entries, &context);
+            sorted_by = sort_by;
+            filtered_at = filter_changes - 1;
+        }
+
+        // Matching runs on the index, so a keystroke costs the bitmaps and this one pass
+        if (filtered_at != filter_changes) {
+            if (filtering() && filter_rows(&view, scanner, snap, NULL, 0, uptime, 0) < 0) {
+                perror("Error filtering processes");
+                break;
+            }
+            count = 0;
+            for (size_t i = 0; i < snap->count; i++) {
+                if (filtering() && !PROC_FILTER_TEST(view.shown, order[i])) {
+                    continue;
+                }
+                lines[count++] = (struct page_line) { order[i], NULL };
+                const struct proc_thread_group *group = proc_threads_find(threads, snap->entries[order[i]].pid);
+                for (size_t t = 0; group != NULL && t < group->count; t++) {
+                    lines[count++] = (struct page_line) { order[i], &group->threads[t] };
                 }
             }
+            filtered_at = filter_changes;
+        }
 
-            // Exit if Ctrl+C is pressed
-            if (!keep_running) {
+        // The header takes four rows and the status line one
+        size_t page = screen.rows > 6 ? (size_t) screen.rows - 5 : 1;
+        if (changed) {
+            unsigned long long drawn = proc_stats_start();
+            print_table_header(frame);
+            for (size_t l = scroll; l < count && l < scroll + page; l++) {
+                const struct proc_entry *entry = &snap->entries[lines[l].entry];
+                const struct proc_thread *thread = lines[l].thread;
+                char cpu_usage[20];
+                if (thread == NULL) {
+                    format_cpu_usage((double) (entry->utime + entry->stime) / ticks_per_sec,
+                                     uptime - (double) entry->start_time / ticks_per_sec, cpu_usage);
+                    print_process_row(frame, entry, cpu_usage, ticks_per_sec,
+                                      filtering() && !PROC_FILTER_TEST(view.matched, lines[l].entry));
+                    print_extra_cells(frame, extra->count > lines[l].entry ? &extra->rows[lines[l].entry] : NULL,
+                                      now_ms);
+                } else {
+                    format_cpu_usage((double) thread->ticks / ticks_per_sec,
+                                     uptime - (double) thread->start_time / ticks_per_sec, cpu_usage);
+                    print_thread_row(frame, thread, cpu_usage, ticks_per_sec);
+                }
+            }
+            char rows_status[160];
+            char status[480];
+            snprintf(rows_status, sizeof(rows_status),
+                     " Rows %zu-%zu of %zu by %s | c/m/p/t sort, / filter, arrows/PgUp/PgDn scroll, q quits ",
+                     count ? scroll + 1 : 0, scroll + page < count ? scroll + page : count, count, sort_name());
+            format_status(status, sizeof(status), rows_status, view.matches);
+            if (show_frame(&screen, frame, &text, &len, status) < 0) {
                 break;
-            } else {
-                print_table_header();
             }
+            proc_stats_stop(PROC_STATS_VIEW, drawn);
+        }
+
+        int key = proc_screen_read_key(&screen, -1);
+        if (key < 0) {
+            break;
+        }
+        changed = handle_view_key(key, &scroll, page, count);
+        if (changed < 0) {
+            break;
         }
     }
 
-    fclose(file);
+    proc_screen_close(&screen);
+    fclose(frame);
+    free(text);
+    filter_view_free(&view);
+    free(lines);
+    free(keys);
+    free(order);
 }
 
-int main() {
-    // Set up the signal handler for Ctrl+C
-    signal(SIGINT, handle_sigint);
+// Function to show the --rollup summary at a terminal a screen at a time, scrolled by the
+// same keys as the process table
+void page_rollup(const struct rollup_row *rows, size_t count, int kind, long ticks_per_sec) {
+    char *text = NULL;
+    size_t len = 0;
+    FILE *frame = open_memstream(&text, &len);
+    struct proc_screen screen;
+    if (frame == NULL || proc_screen_open(&screen, STDIN_FILENO, STDOUT_FILENO) < 0) {
+        perror("Error setting up the screen");
+        if (frame != NULL) {
+            fclose(frame);
+        }
+        free(text);
+        return;
+    }
 
-    // Path to the /proc/proc_info file
-    const char *filename = "/proc/proc_info";  // Your file with process information
-    
-    print_table_header();
-    
-    // Print the file contents with the header
-    print_file_with_header(filename);
+    size_t scroll = 0;
+    int changed = 1;
+    while (keep_running) {
+        // The header takes four rows and the status line one
+        size_t page = screen.rows > 6 ? (size_t) screen.rows - 5 : 1;
+        if (changed) {
+            print_rollup_header(frame, kind);
+            for (size_t i = scroll; i < count && i < scroll + page; i++) {
+                print_rollup_row(frame, &rows[i], -1, ticks_per_sec);
+            }
+            char status[160];
+            snprintf(status, sizeof(status), " Rows %zu-%zu of %zu | arrows/PgUp/PgDn scroll, q quits ",
+                     count ? scroll + 1 : 0, scroll + page < count ? scroll + page : count, count);
+            if (show_frame(&screen, frame, &text, &len, status) < 0) {
+                break;
+            }
+        }
+
+        int key = proc_screen_read_key(&screen, -1);
+        if (key < 0) {
+            break;
+        }
+        changed = handle_view_key(key, &scroll, page, count);
+        if (changed < 0) {
+            break;
+        }
+    }
+
+    proc_screen_close(&screen);
+    fclose(frame);
+    free(text);
+}
+
+// Function to print the rollup of one snapshot; at a terminal it is paged like the process table
+void print_rollup_summary(const struct proc_snapshot *snap, int kind, long ticks_per_sec) {
+    static const struct proc_snapshot empty;
+    struct proc_rollup rollup;
+    struct proc_diff diff = {0};
+    struct rollup_row *rows = NULL;
+    size_t capacity = 0;
+    long n = -1;
+
+    // A single snapshot is one update from nothing
+    if (proc_rollup_init(&rollup, kind) == 0) {
+        if (proc_diff_snapshots(&empty, snap, &diff) == 0 && proc_rollup_apply(&rollup, &empty, snap, &diff) == 0) {
+            n = collect_rollup_rows(&rollup, snap, &rows, &capacity);
+        }
+        proc_rollup_destroy(&rollup);
+    }
+    if (n < 0) {
+        perror("Error summing up processes");
+        n = 0;
+    }
+
+    if (at_terminal()) {
+        page_rollup(rows, (size_t) n, kind, ticks_per_sec);
+    } else {
+        print_rollup_header(stdout, kind);
+        for (long i = 0; i < n && keep_running; i++) {
+            print_rollup_row(stdout, &rows[i], -1, ticks_per_sec);
+        }
+    }
+    free(rows);
+    proc_diff_free(&diff);
+}
+
+// Function to print the table from the binary records; at a terminal it goes through the same
+// pager as the text table. Returns 0, or 1 if the records could not be read.
+int print_binary_records(const char *filename) {
+    struct proc_snapshot snap = {0};
+    if (read_binary_snapshot(filename, &snap) < 0) {
+        proc_snapshot_free(&snap);
+        return 1;
+    }
+
+    // The records carry every column, so there are no threads or extra columns to read
+    long ticks_per_sec = sysconf(_SC_CLK_TCK);
+    double uptime = get_uptime();
+    unsigned long long drawn = proc_stats_start();
+    if (at_terminal()) {
+        struct proc_extra_table extra;
+        struct proc_threads threads;
+        proc_extra_init(&extra, 0, 0, 0);
+        proc_threads_init(&threads, NULL);
+        page_table(&snap, &extra, 0, &threads, uptime, ticks_per_sec, NULL);
+        proc_threads_destroy(&threads);
+        proc_extra_destroy(&extra);
+    } else {
+        for (size_t i = 0; i < snap.count && keep_running; i++) {
+            const struct proc_entry *entry = &snap.entries[i];
+            char cpu_usage[20];
+            format_cpu_usage((double) (entry->utime + entry->stime) / ticks_per_sec,
+                             uptime - (double) entry->start_time / ticks_per_sec, cpu_usage);
+            print_process_row(stdout, entry, cpu_usage, ticks_per_sec, 0);
+            print_extra_cells(stdout, NULL, 0);
+        }
+    }
+    proc_stats_stop(PROC_STATS_VIEW, drawn);
 
+    proc_snapshot_free(&snap);
     return 0;
 }
+
+// Function to print the table rows from the module table, optionally filtered by the module.
+// With --rollup, print the per-user, per-command or per-subtree summary instead. Returns 0,
+// or 1 if nothing could be read or the module could not apply the filter.
+int print_file_with_header(const char *filename, const char *filter) {
+    struct proc_scanner scanner;
+    struct proc_snapshot snap = {0};
+    int from_module = replay_file == NULL && attach_socket == NULL;
+    if (proc_scanner_init(&scanner, proc_root) < 0) {
+        perror("Error opening /proc");
+        return 1;
+    }
+    proc_scanner_set_threads(&scanner, scan_threads);
+
+    // Fast path: the module table carries every column, so one read builds the whole table.
+    // Without the module, fall back to scanning /proc directly.
+    if (replay_file != NULL) {
+        struct proc_replay replay;
+        int primed;
+        if (open_replay(&replay, 1, &primed) < 0) {
+            proc_scanner_destroy(&scanner);
+            return 1;
+        }
+        const struct proc_snapshot *replayed = proc_replay_snapshot(&replay);
+        if (primed && proc_snapshot_reserve(&snap, replayed->count) == 0) {
+            memcpy(snap.entries, replayed->entries, replayed->count * sizeof(*replayed->entries));
+            snap.count = replayed->count;
+        }
+        proc_replay_close(&replay);
+    } else if (attach_socket != NULL) {
+        if (copy_attached(&snap) < 0) {
+            perror(attach_socket);
+            proc_snapshot_free(&snap);
+            proc_scanner_destroy(&scanner);
+            return 1;
+        }
+    } else if (proc_scan_module(&scanner, filename, filter, &snap) < 0) {
+        // Scanning /proc instead would show the processes the filter was meant to leave out
+        if (filter != NULL) {
+            perror("Error reading the module table with --module-filter");
+            proc_scanner_destroy(&scanner);
+            return 1;
+        }
+        perror("Error opening file");
+        fprintf(stderr, "Falling back to scanning /proc\n");
+        from_module = 0;
+        if (proc_scan_snapshot(&scanner, &snap) < 0) {
+            perror("Error scanning /proc");
+            proc_scanner_destroy(&scanner);
+            return 1;
+        }
+    }
+
+    // The uptime at a replayed sample is unknown, so its lifetime CPU% is left out
+    long ticks_per_sec = sysconf(_SC_CLK_TCK);
+    double uptime = replay_file != NULL ? 0 : get_uptime();
+
+    // One pass over the budget is all a one-shot table gets, so it shows the biggest processes first
+    struct proc_extra_table extra;
+    proc_extra_init(&extra, extra_want, extra_budget_us, extra_max_age_ms);
+    uint64_t now_ms = proc_extra_now_ms();
+    if (extra_want && proc_extra_update(&extra, &scanner, &snap, now_ms) < 0) {
+        perror("Error reading the extra columns");
+    }
+
+    // Threads only of the processes asked for, from the module when the table came from it
+    struct proc_threads threads;
+    proc_threads_init(&threads, from_module ? filename : NULL);
+    for (size_t i = 0; i < expand_count; i++) {
+        proc_threads_expand(&threads, expand_pids[i]);
+    }
+    if (expand_count > 0 && proc_threads_refresh(&threads, &scanner, &snap) < 0) {
+        perror("Error reading threads");
+    }
+
+    unsigned long long drawn = proc_stats_start();
+    if (rollup_kind >= 0) {
+        print_rollup_summary(&snap, rollup_kind, ticks_per_sec);
+        proc_stats_stop(PROC_STATS_VIEW, drawn);
+        proc_threads_destroy(&threads);
+        proc_extra_destroy(&extra);
+        proc_snapshot_free(&snap);
+        proc_scanner_destroy(&scanner);
+        return 0;
+    }
+
+    // A person at the terminal gets a pager that scrolls and sorts without reading /proc again
+    // The live command lines of recorded PIDs would belong to other processes
+    struct proc_scanner *cmdline_scanner = replay_file != NULL ? NULL : &scanner;
+    if (at_terminal()) {
+        page_table(&snap, &extra, now_ms, &threads, uptime, ticks_per_sec, cmdline_scanner);
+        proc_threads_destroy(&threads);
+        proc_extra_destroy(&extra);
+        proc_snapshot_free(&snap);
+        proc_scanner_destroy(&scanner);
+        return 0;
+    }
+
+    // A filter keeps the matching processes and, for context, their ancestors
+    struct filter_view view = {0};
+    if (filtering() && filter_rows(&view, cmdline_scanner, &snap, NULL, 0, uptime, 1) < 0) {
+        perror("Error filtering processes");
+        snap.count = 0;
+    }
+    for (size_t i = 0; i < snap.count && keep_running; i++) {
+        const struct proc_entry *entry = &snap.entries[i];
+        if (filtering() && !PROC_FILTER_TEST(view.shown, i)) {
+            continue;
+        }
+
+        // Convert clock ticks to seconds
+        double cpu_time_seconds = (double) (entry->utime + entry->stime) / ticks_per_sec;
+        double elapsed = uptime - (double) entry->start_time / ticks_per_sec;
+
+        char cpu_usage[20];
+        format_cpu_usage(cpu_time_seconds, elapsed, cpu_usage);
+
+        // Print the row in the formatted table
+        print_process_row(stdout, entry, cpu_usage, ticks_per_sec, filtering() && !PROC_FILTER_TEST(view.matched, i));
+        print_extra_cells(stdout, extra.count > i ? &extra.rows[i] : NULL, now_ms);
+
+        // An expanded process lists every thread, in TID order, with its lifetime CPU%
+        const struct proc_thread_group *group = proc_threads_find(&threads, entry->pid);
+        for (size_t t = 0; group != NULL && t < group->count && keep_running; t++) {
+            const struct proc_thread *thread = &group->threads[t];
+            format_cpu_usage((double) thread->ticks / ticks_per_sec,
+                             uptime - (double) thread->start_time / ticks_per_sec, cpu_usage);
+            print_thread_row(stdout, thread, cpu_usage, ticks_per_sec);
+        }
+    }
+    proc_stats_stop(PROC_STATS_VIEW, drawn);
+
+    filter_view_free(&view);
+    proc_threads_destroy(&threads);
+    proc_extra_destroy(&extra);
+    proc_snapshot_free(&snap);
+    proc_scanner_destroy(&scanner);
+    return 0;
+}
+
+// One candidate row of the live view
+struct live_row {
+    const struct proc_entry *entry;
+    long long delta;            // CPU ticks used during the last interval
+    double key;                 // sort_value of the row
+};
+
+// Function to keep the first n processes of the sort order in a min-heap, so the last one is at the root
+void push_top_n(struct live_row *heap, size_t *size, size_t n, struct live_row row) {
+    size_t i;
+
+    if (*size < n) {
+        // Sift up
+        i = (*size)++;
+        while (i > 0 && heap[(i - 1) / 2].key > row.key) {
+            heap[i] = heap[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        heap[i] = row;
+        return;
+    }
+    if (n == 0 || row.key <= heap[0].key) {
+        return;
+    }
+
+    // Replace the root and sift down
+    i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= n) {
+            break;
+        }
+        if (child + 1 < n && heap[child + 1].key < heap[child].key) {
+            child++;
+        }
+        if (heap[child].key >= row.key) {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = row;
+}
+
+// Function to order live rows by their sort keys (only used on the final top N)
+int compare_live_rows(const void *a, const void *b) {
+    const struct live_row *x = a;
+    const struct live_row *y = b;
+    if (x->key != y->key) {
+        return x->key < y->key ? 1 : -1;
+    }
+    return x->entry->pid - y->entry->pid;
+}
+
+// Function to sleep for the refresh interval; returns early on Ctrl+C
+void sleep_interval(int interval_ms) {
+    struct timespec ts = { interval_ms / 1000, (long) (interval_ms % 1000) * 1000000L };
+    while (keep_running && nanosleep(&ts, &ts) < 0) {
+        // Interrupted by a signal; keep_running tells whether to stop
+    }
+}
+
+// Function to take the next replayed sample. At the end of the file it waits for the
+// recorder to append more when follow is set. Returns 1, 0 at the end (or on Ctrl+C), -1 on error.
+int read_replayed(struct proc_replay *replay, int *primed, int follow, int interval_ms) {
+    if (*primed) {
+        *primed = 0;
+        return 1;
+    }
+    int rc;
+    while ((rc = proc_replay_next(replay)) == 0 && follow && keep_running) {
+        sleep_interval(interval_ms);
+    }
+    return rc;
+}
+
+// Function to work out the CPU count of a recording's machine from how many ticks passed per second
+long replayed_cpus(const struct proc_cpu_totals *prev, const struct proc_cpu_totals *cur, uint64_t prev_ms,
+                   uint64_t time_ms, long fallback) {
+    if (time_ms <= prev_ms || cur->total <= prev->total) {
+        return fallback;
+    }
+    double ticks = (double) (cur->total - prev->total) * 1000 / (double) (time_ms - prev_ms);
+    long ticks_per_sec = sysconf(_SC_CLK_TCK);
+    return ticks >= ticks_per_sec ? (long) (ticks / ticks_per_sec + 0.5) : 1;
+}
+
+// Function to wait for the refresh interval while recording process events; returns early on Ctrl+C
+void wait_for_events(struct proc_events *events, struct proc_scanner *scanner, int interval_ms) {
+    struct timespec now, end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    end.tv_sec += interval_ms / 1000;
+    end.tv_nsec += (long) (interval_ms % 1000) * 1000000L;
+    if (end.tv_nsec >= 1000000000L) {
+        end.tv_sec++;
+        end.tv_nsec -= 1000000000L;
+    }
+
+    while (keep_running) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long left_ms = (end.tv_sec - now.tv_sec) * 1000 + (end.tv_nsec - now.tv_nsec) / 1000000;
+        if (left_ms <= 0 || proc_events_wait(events, scanner, (int) left_ms) < 0) {
+            break;
+        }
+    }
+}
+
+// Function to wait at a terminal until deadline_ms (proc_extra_now_ms time) while handling keys,
+// recording process events meanwhile when events is set. Returns 1 as soon as a key changes
+// the view, 0 when the time is up, -1 to quit.
+int wait_for_keys(struct proc_screen *screen, struct proc_events *events, struct proc_scanner *scanner,
+                  uint64_t deadline_ms, size_t *scroll, size_t page, size_t total) {
+    while (keep_running) {
+        uint64_t now_ms = proc_extra_now_ms();
+        if (now_ms >= deadline_ms) {
+            return 0;
+        }
+        int left_ms = (int) (deadline_ms - now_ms);
+
+        // Events and keys come on different descriptors, so they take turns in short slices
+        if (events != NULL) {
+            if (proc_events_wait(events, scanner, left_ms < 50 ? left_ms : 50) < 0) {
+                return 0;
+            }
+            left_ms = 0;
+        }
+        int key = proc_screen_read_key(screen, left_ms);
+        if (key < 0) {
+            return -1;
+        }
+        int changed = handle_view_key(key, scroll, page, total);
+        if (changed != 0) {
+            return changed;
+        }
+    }
+    return 0;
+}
+
+// Function to redraw a top-style view with real CPU% computed from sample deltas. At a
+// terminal the frames go through a screen buffer that sends only what changed, and keys
+// sort and scroll the last sample without waiting for the next one.
+void run_live(const char *filename, int interval_ms, int top_n, int want_events) {
+    struct proc_scanner scanner;
+    struct proc_snapshot snaps[2] = {{0}};
+    int cur = 0;
+    struct proc_events events;
+    int use_events = 0;
+    struct proc_cpu_table table = {0};
+    struct proc_cpu_totals prev_totals = {0}, totals;
+    struct proc_shm shm;
+    struct proc_shm_sample sample;
+    int attached = attach_socket != NULL;
+    struct proc_replay replay;
+    int replaying = replay_file != NULL;
+    int primed = 0;
+    uint64_t prev_ms = 0;
+    struct proc_rollup rollup = {0};
+    struct proc_snapshot rolled = {0};  // The snapshot the rollup is up to date with
+    struct proc_diff diff = {0};
+    struct rollup_row *rollup_rows = NULL;
+    size_t rollup_capacity = 0;
+    struct proc_extra_table extra;
+    struct proc_threads threads;
+    int want_threads = expand_count > 0 || hot_threads_pct >= 0;
+    struct proc_screen screen;
+    int use_screen = 0;
+    FILE *frame = stdout;
+    char *text = NULL;
+    size_t len = 0;
+    struct live_row *heap = NULL;
+    size_t heap_capacity = 0;
+    long long *deltas = NULL;           // CPU ticks of each process of snap in the last interval
+    size_t deltas_capacity = 0;
+    struct filter_view view = {0};
+
+    if (proc_scanner_init(&scanner, proc_root) < 0) {
+        perror("Error opening /proc");
+        return;
+    }
+    proc_scanner_set_threads(&scanner, scan_threads);
+    proc_extra_init(&extra, extra_want, extra_budget_us, extra_max_age_ms);
+
+    // Use the daemon's snapshots or the module table when there, otherwise scan /proc
+    int use_module = !attached && !replaying && access(filename, R_OK) == 0;
+    proc_threads_init(&threads, use_module ? filename : NULL);
+    for (size_t i = 0; i < expand_count; i++) {
+        proc_threads_expand(&threads, expand_pids[i]);
+    }
+
+    // From here on everything can be freed, so a failure goes to out
+    if (proc_rollup_init(&rollup, rollup_kind >= 0 ? rollup_kind : PROC_ROLLUP_USER) < 0) {
+        perror("Error allocating the rollup");
+        goto out;
+    }
+    if (proc_cpu_table_init(&table, 4096) < 0) {
+        perror("Error allocating the CPU table");
+        goto out;
+    }
+    if (attached && proc_shm_attach(&shm, attach_socket, (unsigned int) interval_ms) < 0) {
+        perror(attach_socket);
+        attached = 0;
+        goto out;
+    }
+    if (replaying && open_replay(&replay, 0, &primed) < 0) {
+        replaying = 0;
+        goto out;
+    }
+
+    // Without the module, process events spare the directory walk and catch short-lived
+    // processes. Every process is still re-read each refresh, since all of them need a CPU%.
+    if (want_events && !use_module && !attached && !replaying) {
+        use_events = proc_events_open(&events, 1) == 0;
+        if (!use_events) {
+            perror("Process events unavailable, rescanning /proc");
+        }
+    }
+
+    // Frames are written to memory and diffed against the screen; without a terminal they go out as they are
+    if (at_terminal()) {
+        frame = open_memstream(&text, &len);
+        use_screen = frame != NULL && proc_screen_open(&screen, STDIN_FILENO, STDOUT_FILENO) == 0;
+        if (!use_screen) {
+            if (frame != NULL) {
+                fclose(frame);
+            }
+            frame = stdout;
+        }
+    }
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long ticks_per_sec = sysconf(_SC_CLK_TCK);
+    const struct proc_snapshot *snap = NULL;
+    int first = 1;
+    int have_rates = 0;                 // Two samples were taken, so total_pct and per_tick are set
+    double total_pct = 0;
+    double per_tick = 0;
+    uint64_t now_ms = 0;
+    uint64_t deadline_ms = 0;           // When the next sample is due
+    size_t scroll = 0;                  // First row shown
+    size_t total_rows = 0;              // Rows there are to scroll through
+    int redraw = 0;                     // A key changed the view: draw the last sample again
+    int indexed = 0;                    // The filter index is up to date with snap
+
+    while (keep_running) {
+        if (!redraw) {
+            struct proc_snapshot *prev = &snaps[cur];
+            cur = 1 - cur;
+            snap = &snaps[cur];
+            int rc;
+            if (replaying) {
+                // Plays one recorded sample per interval, then follows the file as it grows
+                rc = read_replayed(&replay, &primed, 1, interval_ms) > 0 ? 0 : -1;
+                snap = proc_replay_snapshot(&replay);
+                totals = replay.totals;
+            } else {
+                rc = attached ? read_attached(&shm, interval_ms, &snaps[cur], &sample)
+                   : use_module ? proc_scan_module(&scanner, filename, NULL, &snaps[cur])
+                   : use_events ? proc_events_refresh(&events, &scanner, prev, &snaps[cur])
+                                : proc_scan_snapshot(&scanner, &snaps[cur]);
+            }
+            if (rc == 0 && attached) {
+                totals = sample.totals;
+            } else if (rc == 0 && !replaying) {
+                rc = proc_read_cpu_totals(&scanner, &totals);
+            }
+            if (rc < 0) {
+                if (keep_running) {
+                    perror("Error sampling processes");
+                }
+                break;
+            }
+
+            // The daemon has not published since the last refresh (its scan is slower than our interval)
+            if (attached && snap->generation == prev->generation) {
+                cur = 1 - cur;
+                snap = prev;
+                proc_shm_wait(&shm, interval_ms);
+                continue;
+            }
+
+            // Update the per-PID table; the deltas are kept so keys can sort this sample again
+            if (snap->count > deltas_capacity) {
+                long long *bigger = realloc(deltas, snap->count * sizeof(*deltas));
+                if (bigger == NULL) {
+                    perror("Error allocating rows");
+                    break;
+                }
+                deltas = bigger;
+                deltas_capacity = snap->count;
+            }
+            proc_cpu_table_begin(&table);
+            for (size_t i = 0; i < snap->count; i++) {
+                long long delta = proc_cpu_table_update(&table, &snap->entries[i]);
+                deltas[i] = delta > 0 ? delta : 0;
+            }
+            proc_cpu_table_sweep(&table);
+            indexed = 0;
+
+            // Only the processes that changed since the last refresh move between groups
+            if (rollup_kind >= 0) {
+                if (proc_diff_snapshots(&rolled, snap, &diff) < 0 ||
+                    proc_rollup_apply(&rollup, &rolled, snap, &diff) < 0 ||
+                    proc_snapshot_reserve(&rolled, snap->count) < 0) {
+                    perror("Error summing up processes");
+                    break;
+                }
+                memcpy(rolled.entries, snap->entries, snap->count * sizeof(*snap->entries));
+                rolled.count = snap->count;
+            }
+
+            // The daemon lapped us and rewrote the slot while we read it; start over from the next one
+            if (attached && !proc_shm_valid(&shm, snap, sample.seq)) {
+                proc_rollup_clear(&rollup);
+                rolled.count = 0;
+                first = 1;
+                have_rates = 0;
+                continue;
+            }
+
+            // Spend this refresh's budget on the extra columns; the rows line up with snap
+            now_ms = proc_extra_now_ms();
+            deadline_ms = now_ms + (uint64_t) interval_ms;
+            if (extra_want && proc_extra_update(&extra, &scanner, snap, now_ms) < 0) {
+                perror("Error reading the extra columns");
+                break;
+            }
+
+            if (replaying && !first) {
+                ncpus = replayed_cpus(&prev_totals, &totals, prev_ms, replay.time_ms, ncpus);
+            }
+            if (!first) {
+                unsigned long long dt = totals.total - prev_totals.total;
+                unsigned long long didle = totals.idle - prev_totals.idle;
+                total_pct = dt ? 100.0 * (double) (dt - didle) / dt : 0;
+                // dt counts ticks of every CPU, so per-process figures are scaled to one CPU (top's convention)
+                per_tick = dt ? 100.0 * ncpus / dt : 0;
+            }
+            have_rates = !first;
+            prev_totals = totals;
+            prev_ms = replaying ? replay.time_ms : 0;
+            first = 0;
+        }
+
+        // How many rows fit on the screen, unless --top said otherwise
+        size_t n = top_n > 0 ? (size_t) top_n : 20;
+        if (top_n <= 0 && isatty(STDOUT_FILENO)) {
+            int rows, cols;
+            if (use_screen) {
+                rows = screen.rows;
+            } else {
+                get_terminal_size(&rows, &cols);
+            }
+            int reserved = show_stats + (extra_want != 0) + want_threads + use_screen;
+            n = rows > 8 + reserved ? (size_t) (rows - 7 - reserved) : 1;
+        }
+        if (scroll + n > heap_capacity) {
+            struct live_row *bigger = realloc(heap, (scroll + n) * sizeof(*heap));
+            if (bigger == NULL) {
+                perror("Error allocating rows");
+                break;
+            }
+            heap = bigger;
+            heap_capacity = scroll + n;
+        }
+
+        // The index follows the samples only while a filter is on; a live view shows just the matches
+        int filtered = filtering() && rollup_kind < 0;
+        if (filtered) {
+            if (filter_rows(&view, replaying ? NULL : &scanner, snap, deltas, per_tick, 0, !indexed) < 0) {
+                perror("Error filtering processes");
+                break;
+            }
+            indexed = 1;
+        }
+
+        // Keep the rows up to the bottom of the screen in the current order; a key repeats only this
+        size_t size = 0;
+        for (size_t i = 0; i < snap->count && rollup_kind < 0; i++) {
+            if (filtered && !PROC_FILTER_TEST(view.matched, i)) {
+                continue;
+            }
+            struct live_row row = { &snap->entries[i], deltas[i], sort_value(&snap->entries[i], (double) deltas[i]) };
+            push_top_n(heap, &size, scroll + n, row);
+        }
+
+        if (have_rates) {
+            qsort(heap, size, sizeof(*heap), compare_live_rows);
+
+            // Threads are read only for the processes on screen that are expanded or busy, and
+            // only with a new sample
+            if (want_threads && !redraw) {
+                for (size_t i = scroll; i < size && hot_threads_pct >= 0; i++) {
+                    if (heap[i].delta * per_tick >= hot_threads_pct) {
+                        proc_threads_mark_hot(&threads, heap[i].entry->pid);
+                    }
+                }
+                if (proc_threads_refresh(&threads, &scanner, snap) < 0) {
+                    perror("Error reading threads");
+                    break;
+                }
+            }
+
+            unsigned long long drawn = proc_stats_start();
+            if (!use_screen) {
+                printf("\033[H\033[2J");
+            }
+            char source[40] = "replay ";
+            if (replaying) {
+                format_replay_time(replay.time_ms, source + 7, sizeof(source) - 7);
+            }
+            fprintf(frame, "%zu processes, CPU %.1f %% of %ld CPUs, refresh %d ms (%s)\n",
+                    snap->count, total_pct, ncpus, interval_ms,
+                    replaying ? source : attached ? "proc_snapd" : use_module ? "proc_info"
+                    : use_events ? "/proc + events" : "/proc");
+            if (use_events && events.short_lived_count > 0) {
+                fprintf(frame, "%zu short-lived since the last refresh:", events.short_lived_count);
+                for (size_t i = 0; i < events.short_lived_count && i < 8; i++) {
+                    fprintf(frame, " %d(%s)", events.short_lived[i].pid,
+                            events.short_lived[i].comm[0] ? events.short_lived[i].comm : "?");
+                }
+                fputc('\n', frame);
+            }
+            if (extra_want) {
+                fprintf(frame, "Extra columns: %zu of %zu fresh, %zu read in this refresh (about %.0f us each)\n",
+                        extra.last_valid, snap->count, extra.last_read, extra.cost_us);
+            }
+            if (want_threads) {
+                fprintf(frame, "Threads: %zu listed processes, %zu threads read in this refresh\n",
+                        threads.count, threads.last_threads);
+            }
+            long groups = rollup_kind >= 0 ? collect_rollup_rows(&rollup, snap, &rollup_rows, &rollup_capacity) : 0;
+            if (rollup_kind >= 0) {
+                print_rollup_header(frame, rollup_kind);
+                total_rows = groups > 0 ? (size_t) groups : 0;
+            } else {
+                print_table_header(frame);
+                total_rows = filtered ? view.matches : snap->count;
+            }
+            for (long i = (long) scroll; i < groups && (size_t) i < scroll + n; i++) {
+                print_rollup_row(frame, &rollup_rows[i], per_tick, ticks_per_sec);
+            }
+            size_t lines = 0;
+            for (size_t i = scroll; i < size && lines < n; i++, lines++) {
+                const struct proc_entry *entry = heap[i].entry;
+                char cpu_usage[20];
+                snprintf(cpu_usage, sizeof(cpu_usage), "%.1f %%", heap[i].delta * per_tick);
+                print_process_row(frame, entry, cpu_usage, ticks_per_sec, 0);
+                size_t row = (size_t) (entry - snap->entries);
+                print_extra_cells(frame, extra.count > row ? &extra.rows[row] : NULL, now_ms);
+
+                // The busiest threads, as far as the screen allows; a first load has no delta yet
+                const struct proc_thread_group *group = want_threads ? proc_threads_find(&threads, entry->pid) : NULL;
+                if (group != NULL && group->loaded) {
+                    size_t top[HOT_THREAD_ROWS];
+                    size_t room = n - lines - 1;
+                    size_t shown = busiest_threads(group, top, room < HOT_THREAD_ROWS ? room : HOT_THREAD_ROWS);
+                    for (size_t t = 0; t < shown; t++) {
+                        const struct proc_thread *thread = &group->threads[top[t]];
+                        if (thread->delta >= 0) {
+                            snprintf(cpu_usage, sizeof(cpu_usage), "%.1f %%", thread->delta * per_tick);
+                        } else {
+                            strcpy(cpu_usage, "-");
+                        }
+                        print_thread_row(frame, thread, cpu_usage, ticks_per_sec);
+                    }
+                    lines += shown;
+                }
+            }
+            if (show_stats) {
+                char digest[512];
+                proc_stats_format_line(digest, sizeof(digest));
+                fprintf(frame, "self: %s\n", digest);
+            }
+            if (use_screen) {
+                char rows_status[192];
+                char status[512];
+                snprintf(rows_status, sizeof(rows_status),
+                         " By %s from row %zu | c/m/p/t sort,%s arrows/PgUp/PgDn scroll, q quits | last frame %zu bytes ",
+                         rollup_kind >= 0 ? "CPU" : sort_name(), scroll + 1, rollup_kind >= 0 ? "" : " / filter,",
+                         screen.last_bytes);
+                format_status(status, sizeof(status), rows_status, view.matches);
+                if (show_frame(&screen, frame, &text, &len, status) < 0) {
+                    break;
+                }
+            } else {
+                fflush(stdout);
+            }
+            proc_stats_stop(PROC_STATS_VIEW, drawn);
+        }
+
+        redraw = 0;
+        if (use_screen) {
+            int rc = wait_for_keys(&screen, use_events ? &events : NULL, &scanner, deadline_ms, &scroll, n,
+                                   total_rows);
+            if (rc < 0) {
+                break;
+            }
+            redraw = rc > 0;
+        } else if (use_events) {
+            wait_for_events(&events, &scanner, interval_ms);
+        } else {
+            sleep_interval(interval_ms);
+        }
+    }
+
+out:
+    if (use_screen) {
+        proc_screen_close(&screen);
+        fclose(frame);
+        free(text);
+    }
+    if (use_events) {
+        proc_events_close(&events);
+    }
+    if (attached) {
+        proc_shm_close(&shm);
+    }
+    if (replaying) {
+        proc_replay_close(&replay);
+    }
+    filter_view_free(&view);
+    free(heap);
+    free(deltas);
+    free(rollup_rows);
+    proc_extra_destroy(&extra);
+    proc_threads_destroy(&threads);
+    proc_diff_free(&diff);
+    proc_snapshot_free(&rolled);
+    proc_rollup_destroy(&rollup);
+    proc_cpu_table_destroy(&table);
+    proc_snapshot_free(&snaps[0]);
+    proc_snapshot_free(&snaps[1]);
+    proc_scanner_destroy(&scanner);
+}
+
+// Function to return the wall-clock time in nanoseconds
+unsigned long long wall_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+// Function to move the since= term of a module filter up to a generation, keeping the other
+// terms; returns 1 if the filter has one, 0 if not, or -1 if out is too small
+int advance_since(char *out, size_t size, const char *filter, unsigned long long generation) {
+    size_t len = 0;
+    int found = 0;
+
+    for (const char *p = filter; *p != '\0';) {
+        size_t skip = strspn(p, " ,\t\n");
+        size_t word = strcspn(p + skip, " ,\t\n");
+        const char *term = p + skip;
+        p = term + word;
+        if (word == 0) {
+            continue;
+        }
+        if (word >= 6 && memcmp(term, "since=", 6) == 0) {
+            found = 1;
+            continue;
+        }
+        int n = snprintf(out + len, size - len, "%.*s ", (int) word, term);
+        if (n < 0 || (size_t) n >= size - len) {
+            return -1;
+        }
+        len += (size_t) n;
+    }
+    int n = snprintf(out + len, size - len, "since=%llu", generation);
+    return n < 0 || (size_t) n >= size - len ? -1 : found;
+}
+
+// Function to write every process in a machine-readable format, every interval, until
+// count samples are written (0 = until Ctrl+C) or the reader at the other end goes away
+int run_stream(const char *filename, const char *filter, int format, int compress, const char *output,
+               int interval_ms, int count) {
+    struct proc_scanner scanner;
+    struct proc_snapshot snap = {0};
+    struct proc_cpu_table table = {0};
+    struct proc_cpu_totals prev_totals = {0}, totals;
+    struct proc_output out;
+    int opened = 0;                     // out has buffers to flush and free
+    struct proc_shm shm;
+    struct proc_shm_sample sample;
+    int attached = attach_socket != NULL;
+    struct proc_replay replay;
+    int replaying = replay_file != NULL;
+    int primed = 0;
+    uint64_t prev_ms = 0;
+    int fd = STDOUT_FILENO;
+    int rc = 1;
+
+    if (proc_scanner_init(&scanner, proc_root) < 0) {
+        perror("Error opening /proc");
+        return 1;
+    }
+    proc_scanner_set_threads(&scanner, scan_threads);
+
+    // From here on everything can be freed, so a failure goes to out
+    if (output != NULL && (fd = open(output, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0) {
+        perror(output);
+        fd = STDOUT_FILENO;
+        goto out;
+    }
+    if (proc_cpu_table_init(&table, 4096) < 0 || proc_output_open(&out, fd, format, compress) < 0) {
+        perror("Error allocating output buffers");
+        goto out;
+    }
+    opened = 1;
+    if (attached && proc_shm_attach(&shm, attach_socket, (unsigned int) interval_ms) < 0) {
+        perror(attach_socket);
+        attached = 0;
+        goto out;
+    }
+    if (replaying && open_replay(&replay, 0, &primed) < 0) {
+        replaying = 0;
+        goto out;
+    }
+
+    // A collector that closes the pipe shows up as a failed write instead of killing us
+    signal(SIGPIPE, SIG_IGN);
+
+    // Probing by reading the table would spend the first delta of mincpu= and since=. A
+    // filter the module cannot apply is an error: scanning /proc instead would ignore it.
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int use_module = !attached && !replaying && access(filename, R_OK) == 0;
+    if (filter != NULL && !use_module && !attached && !replaying) {
+        perror(filename);
+        fprintf(stderr, "--module-filter needs the proc_info module\n");
+        goto out;
+    }
+
+    // since=N is moved to the generation of each pass, so every sample has only what changed after the last
+    char moved[4096];
+    const char *module_filter = filter;
+    for (int n = 0; keep_running && (count <= 0 || n < count); n++) {
+        const struct proc_snapshot *view = &snap;
+        unsigned long long time_ns;
+        int scanned;
+        if (replaying) {
+            // A replay is written out as fast as it decodes, up to the end of the file
+            scanned = read_replayed(&replay, &primed, 0, 0);
+            if (scanned == 0) {
+                rc = 0;
+                break;
+            }
+            view = proc_replay_snapshot(&replay);
+            totals = replay.totals;
+            time_ns = replay.time_ms * 1000000ULL;
+            if (n > 0) {
+                ncpus = replayed_cpus(&prev_totals, &totals, prev_ms, replay.time_ms, ncpus);
+            }
+            prev_ms = replay.time_ms;
+        } else {
+            scanned = attached ? read_attached(&shm, interval_ms, &snap, &sample)
+                    : use_module ? proc_scan_module(&scanner, filename, module_filter, &snap)
+                                 : proc_scan_snapshot(&scanner, &snap);
+            if (scanned == 0 && use_module && filter != NULL) {
+                int since = advance_since(moved, sizeof(moved), filter, snap.generation);
+                if (since < 0) {
+                    errno = E2BIG;
+                    scanned = -1;
+                }
+                module_filter = since > 0 ? moved : filter;
+            }
+            if (scanned == 0 && attached) {
+                totals = sample.totals;
+            } else if (scanned == 0) {
+                scanned = proc_read_cpu_totals(&scanner, &totals);
+            }
+            time_ns = attached ? sample.time_ns : wall_time_ns();
+        }
+        if (scanned < 0) {
+            perror(use_module && filter != NULL ? "Error reading the module table with --module-filter"
+                                                : "Error sampling processes");
+            break;
+        }
+
+        // Scale per-process ticks to one CPU, as in the live view
+        unsigned long long dt = totals.total - prev_totals.total;
+        double per_tick = n > 0 && dt ? 100.0 * ncpus / dt : -1;
+
+        int failed = proc_output_begin(&out, time_ns, view->count) < 0;
+        proc_cpu_table_begin(&table);
+        for (size_t i = 0; i < view->count && !failed; i++) {
+            const struct proc_entry *entry = &view->entries[i];
+            long long delta = proc_cpu_table_update(&table, entry);
+            double cpu_pct = per_tick >= 0 && delta >= 0 ? delta * per_tick : -1;
+            const char *user = format == PROC_OUTPUT_BINARY ? "" : get_username_by_uid(entry->uid);
+            failed = proc_output_row(&out, entry, user, cpu_pct) < 0;
+        }
+        proc_cpu_table_sweep(&table);
+        if (attached && !proc_shm_valid(&shm, &snap, sample.seq)) {
+            fprintf(stderr, "Sample %d was overwritten while being written; the daemon samples too fast for this output\n", n);
+        }
+        if (failed || proc_output_end(&out) < 0) {
+            // The collector closing its end of the pipe is a normal way to stop
+            if (errno != EPIPE) {
+                perror("Error writing output");
+            }
+            break;
+        }
+
+        prev_totals = totals;
+        if (!replaying && (count <= 0 || n + 1 < count)) {
+            sleep_interval(interval_ms);
+        }
+        rc = 0;
+    }
+
+out:
+    if (opened && proc_output_close(&out) < 0) {
+        rc = 1;
+    }
+    if (fd != STDOUT_FILENO) {
+        close(fd);
+    }
+    if (attached) {
+        proc_shm_close(&shm);
+    }
+    if (replaying) {
+        proc_replay_close(&replay);
+    }
+    proc_cpu_table_destroy(&table);
+    proc_snapshot_free(&snap);
+    proc_scanner_destroy(&scanner);
+    return rc;
+}
+
+// Function to append a sample to a history file every interval, until count samples are
+// recorded (0 = until Ctrl+C)
+int run_record(const char *filename, const char *path, unsigned int keyframe, int interval_ms, int count) {
+    struct proc_scanner scanner;
+    struct proc_snapshot snap = {0};
+    struct proc_snapshot copy = {0};
+    struct proc_cpu_totals totals;
+    struct proc_recorder rec;
+    struct proc_shm shm;
+    struct proc_shm_sample sample;
+    int attached = attach_socket != NULL;
+    int rc = 0;
+
+    if (proc_scanner_init(&scanner, proc_root) < 0) {
+        perror("Error opening /proc");
+        return 1;
+    }
+    proc_scanner_set_threads(&scanner, scan_threads);
+    if (proc_recorder_open(&rec, path, keyframe) < 0) {
+        perror(path);
+        proc_scanner_destroy(&scanner);
+        return 1;
+    }
+    if (attached && proc_shm_attach(&shm, attach_socket, (unsigned int) interval_ms) < 0) {
+        perror(attach_socket);
+        proc_recorder_close(&rec);
+        proc_scanner_destroy(&scanner);
+        return 1;
+    }
+
+    int use_module = !attached && access(filename, R_OK) == 0;
+    for (int n = 0; keep_running && (count <= 0 || n < count); n++) {
+        int scanned = attached ? read_attached(&shm, interval_ms, &snap, &sample)
+                    : use_module ? proc_scan_module(&scanner, filename, NULL, &snap)
+                                 : proc_scan_snapshot(&scanner, &snap);
+        if (scanned == 0 && attached) {
+            totals = sample.totals;
+        } else if (scanned == 0) {
+            scanned = proc_read_cpu_totals(&scanner, &totals);
+        }
+        if (scanned < 0) {
+            perror("Error sampling processes");
+            rc = 1;
+            break;
+        }
+
+        // The recorder keeps the last sample to encode the next one against, so a borrowed
+        // one is copied first; a slot the daemon overwrote meanwhile is read again
+        const struct proc_snapshot *recorded = &snap;
+        if (attached) {
+            if (proc_snapshot_reserve(&copy, snap.count) < 0) {
+                perror("Error sampling processes");
+                rc = 1;
+                break;
+            }
+            memcpy(copy.entries, snap.entries, snap.count * sizeof(*snap.entries));
+            copy.count = snap.count;
+            if (!proc_shm_valid(&shm, &snap, sample.seq)) {
+                n--;
+                continue;
+            }
+            recorded = &copy;
+        }
+        if (proc_recorder_append(&rec, recorded, attached ? sample.time_ns : wall_time_ns(), &totals) < 0) {
+            perror(path);
+            rc = 1;
+            break;
+        }
+        if (count <= 0 || n + 1 < count) {
+            sleep_interval(interval_ms);
+        }
+    }
+
+    if (attached) {
+        proc_shm_close(&shm);
+    }
+    proc_recorder_close(&rec);
+    proc_snapshot_free(&copy);
+    proc_snapshot_free(&snap);
+    proc_scanner_destroy(&scanner);
+    return rc;
+}
+
+int main(int argc, char *argv[]) {
+    int binary = 0;
+    int live = 0;
+    int events = 0;
+    int interval_ms = 1000;
+    int top_n = 0;
+    int prewarm_users = 0;
+    int format = -1;
+    int compress = 0;
+    int count = 0;
+    const char *output = NULL;
+    const char *module_filter = NULL;
+    const char *record_file = NULL;
+    const char *filter = NULL;
+    unsigned int keyframe = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--binary") == 0) {
+            binary = 1;  // Read the fixed-size records from /proc/proc_info_bin
+        } else if (strcmp(argv[i], "--module-filter") == 0 && i + 1 < argc) {
+            module_filter = argv[++i];  // e.g. "uid=1000 pid=100-200 mincpu=1000000 since=42"
+        } else if (strcmp(argv[i], "--live") == 0) {
+            live = 1;  // Redraw the busiest processes every interval, like top
+        } else if (strcmp(argv[i], "--events") == 0) {
+            events = 1;  // Follow the kernel proc connector instead of walking /proc
+        } else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+            interval_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+            top_n = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            scan_threads = (size_t) atoi(argv[++i]);  // 0 = one per online CPU
+        } else if (strcmp(argv[i], "--proc-root") == 0 && i + 1 < argc) {
+            proc_root = argv[++i];
+        } else if (strcmp(argv[i], "--prewarm-users") == 0) {
+            prewarm_users = 1;  // Load the whole passwd database up front
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            // Stream every process as csv, ndjson or binary instead of printing the table
+            if ((format = proc_output_parse_format(argv[++i])) < 0) {
+                fprintf(stderr, "Unknown format %s, expected csv, ndjson or binary\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            compress = 1;  // gzip the stream
+        } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            count = atoi(argv[++i]);  // Samples to write, 0 = until interrupted
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];  // Append to this file instead of stdout
+        } else if (strcmp(argv[i], "--attach") == 0 && i + 1 < argc) {
+            attach_socket = argv[++i];  // Map proc_snapd's snapshots instead of scanning
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_file = argv[++i];  // Append every sample to this history file
+        } else if (strcmp(argv[i], "--keyframe") == 0 && i + 1 < argc) {
+            keyframe = (unsigned int) atoi(argv[++i]);  // Samples between full frames of the history
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_file = argv[++i];  // Show a recorded history instead of the running system
+        } else if (strcmp(argv[i], "--rollup") == 0 && i + 1 < argc) {
+            // Sum up processes by user, command or subtree instead of listing them
+            if ((rollup_kind = proc_rollup_parse_kind(argv[++i])) < 0) {
+                fprintf(stderr, "Unknown rollup %s, expected user, comm or tree\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--at") == 0 && i + 1 < argc) {
+            replay_at = argv[++i];  // Epoch seconds, "YYYY-MM-DD HH:MM[:SS]" or -SECONDS from the end
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            show_stats = 1;  // Report per-stage times and counters on stderr at exit
+        } else if (strcmp(argv[i], "--extra") == 0 && i + 1 < argc) {
+            // PSS/USS/swap from smaps_rollup, open descriptor counts, or both
+            i++;
+            extra_want = strcmp(argv[i], "mem") == 0 ? PROC_EXTRA_MEM
+                       : strcmp(argv[i], "fds") == 0 ? PROC_EXTRA_FDS
+                       : strcmp(argv[i], "all") == 0 ? PROC_EXTRA_MEM | PROC_EXTRA_FDS : 0;
+            if (extra_want == 0) {
+                fprintf(stderr, "Unknown extra columns %s, expected mem, fds or all\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--expand") == 0 && i + 1 < argc) {
+            // List the threads of this process under it; may be given several times
+            if (expand_count == MAX_EXPANDED) {
+                fprintf(stderr, "At most %d processes can be expanded\n", MAX_EXPANDED);
+                return 1;
+            }
+            expand_pids[expand_count++] = (pid_t) atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--hot-threads") == 0 && i + 1 < argc) {
+            hot_threads_pct = atof(argv[++i]);  // --live: list the threads of processes above this CPU%
+        } else if (strcmp(argv[i], "--extra-budget") == 0 && i + 1 < argc) {
+            extra_budget_us = (unsigned int) (atof(argv[++i]) * 1000);  // Milliseconds per refresh
+        } else if (strcmp(argv[i], "--extra-age") == 0 && i + 1 < argc) {
+            extra_max_age_ms = (unsigned int) atoi(argv[++i]) * 1000;  // Seconds before a value is dropped
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];  // e.g. "ssh user=root mincpu=5"; '/' edits it at a terminal
+        } else {
+            fprintf(stderr, "Usage: %s [--binary] [--module-filter FILTER] [--threads N] [--proc-root DIR] [--prewarm-users] [--attach SOCKET] [--rollup user|comm|tree] [--stats] [--extra mem|fds|all [--extra-budget MS] [--extra-age SEC]] [--expand PID ...] [--filter EXPR] [--live [--interval MS] [--top N] [--events] [--hot-threads PCT]]\n"
+                            "       %s --format csv|ndjson|binary [--interval MS] [--count N] [--compress] [--output FILE] [--module-filter FILTER] [--attach SOCKET]\n"
+                            "       %s --record FILE [--keyframe N] [--interval MS] [--count N] [--attach SOCKET]\n"
+                            "       %s --replay FILE [--at TIME] [--live [--interval MS] [--top N] | --format csv|ndjson|binary ...]\n",
+                    argv[0], argv[0], argv[0], argv[0]);
+            return 1;
+        }
+    }
+
+    // Set up the signal handler for Ctrl+C
+    signal(SIGINT, handle_sigint);
+    if (show_stats) {
+        proc_stats_enable();
+    }
+
+    if (proc_users_init(&users, prewarm_users) < 0) {
+        perror("Error allocating the user cache");
+        return 1;
+    }
+
+    // Path to the /proc/proc_info file
+    char filename[4096];
+    char bin_filename[4096];
+    snprintf(filename, sizeof(filename), "%s/proc_info", proc_root);
+    snprintf(bin_filename, sizeof(bin_filename), "%s/" PROC_INFO_BIN_NAME, proc_root);
+
+    if (record_file != NULL && replay_file != NULL) {
+        fprintf(stderr, "--record and --replay cannot be combined\n");
+        return 1;
+    }
+    if (replay_file != NULL && (attach_socket != NULL || events || binary)) {
+        fprintf(stderr, "--replay cannot be combined with --attach, --events or --binary\n");
+        return 1;
+    }
+    if (rollup_kind >= 0 && (binary || format >= 0 || record_file != NULL)) {
+        fprintf(stderr, "--rollup works with the table and --live views\n");
+        return 1;
+    }
+    if (extra_want && (binary || format >= 0 || record_file != NULL || replay_file != NULL || rollup_kind >= 0)) {
+        fprintf(stderr, "--extra works with the table and --live views of the running system\n");
+        return 1;
+    }
+    if ((expand_count > 0 || hot_threads_pct >= 0) &&
+        (binary || format >= 0 || record_file != NULL || replay_file != NULL || rollup_kind >= 0)) {
+        fprintf(stderr, "--expand and --hot-threads work with the table and --live views of the running system\n");
+        return 1;
+    }
+    if (filter != NULL && (binary || format >= 0 || record_file != NULL || rollup_kind >= 0)) {
+        fprintf(stderr, "--filter works with the table and --live views\n");
+        return 1;
+    }
+
+    // --live diffs whole samples, so a since= sample would look as if every idle process had exited;
+    // --filter narrows it instead
+    if (module_filter != NULL && (live || binary || record_file != NULL || replay_file != NULL)) {
+        fprintf(stderr, "--module-filter works with the table and --format views; use --filter with --live\n");
+        return 1;
+    }
+    if (filter != NULL) {
+        if (strlen(filter) >= sizeof(filter_text)) {
+            fprintf(stderr, "--filter: at most %d characters\n", PROC_FILTER_LEN - 1);
+            return 1;
+        }
+        strcpy(filter_text, filter);
+        if (set_filter() < 0) {
+            fprintf(stderr, "--filter: %s\n", filter_error);
+            return 1;
+        }
+    }
+    int rc = 0;
+    if (record_file != NULL) {
+        rc = run_record(filename, record_file, keyframe, interval_ms > 0 ? interval_ms : 1000, count);
+    } else if (format >= 0) {
+        rc = run_stream(filename, module_filter, format, compress, output, interval_ms > 0 ? interval_ms : 1000, count);
+    } else if (live) {
+        run_live(filename, interval_ms > 0 ? interval_ms : 1000, top_n, events);
+    } else {
+        // At a terminal the pager draws its own header
+        if (rollup_kind < 0 && !at_terminal()) {
+            print_table_header(stdout);
+        }
+
+        // Print the file contents with the header
+        if (binary) {
+            rc = print_binary_records(bin_filename);
+        } else {
+            rc = print_file_with_header(filename, module_filter);
+        }
+    }
+
+    if (show_stats) {
+        print_self_stats();
+    }
+    if (filter_slot >= 0) {
+        proc_filter_free(&filters[filter_slot]);
+    }
+    return rc;
+}
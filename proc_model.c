@@ -0,0 +1,483 @@
+#include "proc_model.h"
+
+#include <stdlib.h>
+
+struct _ProcModel {
+    GObject parent_instance;
+    const struct proc_columns *cols;
+    const uint32_t *parent;         // The tree shown: the columns' own, or a filtered one
+    const uint32_t *sibling_index;
+    const uint32_t *child_start;
+    const uint32_t *children;
+    struct proc_fetcher *fetcher;   // Source of user names and command lines, or NULL
+    gint stamp;
+};
+
+// What the model shows before the first sample: no rows, an empty top level
+static const uint32_t empty_child_start[2];
+static const struct proc_columns empty_columns = { .child_start = (uint32_t *) empty_child_start };
+
+static void proc_model_tree_model_init(GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(ProcModel, proc_model, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL, proc_model_tree_model_init))
+
+// Row index stored in an iter
+#define ITER_ROW(iter) GPOINTER_TO_UINT((iter)->user_data)
+
+// Fill in an iter for a row
+static gboolean set_iter(ProcModel *model, GtkTreeIter *iter, uint32_t row) {
+    iter->stamp = model->stamp;
+    iter->user_data = GUINT_TO_POINTER(row);
+    iter->user_data2 = NULL;
+    iter->user_data3 = NULL;
+    return TRUE;
+}
+
+// Rows are not stable across proc_model_set_columns, so no GTK_TREE_MODEL_ITERS_PERSIST
+static GtkTreeModelFlags proc_model_get_flags(GtkTreeModel *tree_model) {
+    return 0;
+}
+
+static gint proc_model_get_n_columns(GtkTreeModel *tree_model) {
+    return PROC_MODEL_N_COLUMNS;
+}
+
+static GType proc_model_get_column_type(GtkTreeModel *tree_model, gint column) {
+    switch (column) {
+    case PROC_MODEL_COL_PID:
+        return G_TYPE_INT;
+    case PROC_MODEL_COL_USER:
+    case PROC_MODEL_COL_COMM:
+    case PROC_MODEL_COL_CMDLINE:
+    case PROC_MODEL_COL_PSS:
+    case PROC_MODEL_COL_SWAP:
+    case PROC_MODEL_COL_FDS:
+        return G_TYPE_STRING;
+    default:
+        return G_TYPE_UINT;
+    }
+}
+
+// Walk a path down from the top level
+static gboolean proc_model_get_iter(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreePath *path) {
+    ProcModel *model = PROC_MODEL(tree_model);
+    gint depth;
+    gint *indices = gtk_tree_path_get_indices_with_depth(path, &depth);
+    uint32_t row = (uint32_t) model->cols->count;
+
+    for (gint d = 0; d < depth; d++) {
+        uint32_t first = model->child_start[row];
+        if (indices[d] < 0 || (uint32_t) indices[d] >= model->child_start[row + 1] - first) {
+            return FALSE;
+        }
+        row = model->children[first + (uint32_t) indices[d]];
+    }
+    return depth > 0 && set_iter(model, iter, row);
+}
+
+// Walk up to the top level, collecting the sibling positions
+static GtkTreePath *proc_model_get_path(GtkTreeModel *tree_model, GtkTreeIter *iter) {
+    ProcModel *model = PROC_MODEL(tree_model);
+    GtkTreePath *path = gtk_tree_path_new();
+
+    for (uint32_t row = ITER_ROW(iter); row != model->cols->count; row = model->parent[row]) {
+        gtk_tree_path_prepend_index(path, (gint) model->sibling_index[row]);
+    }
+    return path;
+}
+
+// Get the fetched details of a row; the view only asks for rows it draws
+static gboolean get_details(ProcModel *model, uint32_t row, struct proc_details *details) {
+    const struct proc_columns *cols = model->cols;
+    return model->fetcher != NULL &&
+           proc_fetch_get(model->fetcher, cols->pids[row], cols->start_times[row], PROC_FETCH_VISIBLE, details);
+}
+
+// Show a budgeted metric with how long ago it was read, "" if it never was
+static void set_extra_value(GValue *value, const struct proc_columns *cols, uint32_t row, uint32_t flag,
+                            const uint32_t *values) {
+    if (cols->extra_flags == NULL || !(cols->extra_flags[row] & (flag | PROC_EXTRA_DENIED))) {
+        g_value_set_static_string(value, "");
+    } else if (!(cols->extra_flags[row] & flag)) {
+        g_value_set_static_string(value, "n/a");
+    } else if (cols->extra_age_s[row] < 100) {
+        g_value_take_string(value, g_strdup_printf("%u (%us)", values[row], cols->extra_age_s[row]));
+    } else {
+        g_value_take_string(value, g_strdup_printf("%u (%um)", values[row], cols->extra_age_s[row] / 60));
+    }
+}
+
+static void proc_model_get_value(GtkTreeModel *tree_model, GtkTreeIter *iter, gint column, GValue *value) {
+    ProcModel *model = PROC_MODEL(tree_model);
+    const struct proc_columns *cols = model->cols;
+    uint32_t row = ITER_ROW(iter);
+    struct proc_details details;
+
+    g_value_init(value, proc_model_get_column_type(tree_model, column));
+    switch (column) {
+    case PROC_MODEL_COL_PID:
+        g_value_set_int(value, cols->pids[row]);
+        break;
+    case PROC_MODEL_COL_USER:
+        if (cols->uids[row] != (uid_t) -1 || model->fetcher == NULL) {
+            g_value_set_static_string(value, cols->strings + cols->user[row]);
+        } else if (get_details(model, row, &details)) {
+            g_value_set_string(value, details.user);
+        } else {
+            g_value_set_static_string(value, "...");
+        }
+        break;
+    case PROC_MODEL_COL_CMDLINE:
+        if (!get_details(model, row, &details)) {
+            g_value_set_static_string(value, model->fetcher != NULL ? "..." : "");
+        } else if (details.cmdline[0] != '\0') {
+            g_value_set_string(value, details.cmdline);
+        } else {
+            // Kernel threads have no command line; show the name the way ps does
+            g_value_take_string(value, g_strdup_printf("[%s]", cols->strings + cols->comm[row]));
+        }
+        break;
+    case PROC_MODEL_COL_COMM:
+        g_value_set_static_string(value, cols->strings + cols->comm[row]);
+        break;
+    case PROC_MODEL_COL_RSS:
+        // In the subtree grouping every row shows itself plus its descendants
+        g_value_set_uint(value, cols->subtree_rss_kb != NULL ? cols->subtree_rss_kb[row] : cols->rss_kb[row]);
+        break;
+    case PROC_MODEL_COL_CPU:
+        g_value_set_uint(value, cols->subtree_cpu_ticks != NULL ? cols->subtree_cpu_ticks[row] : cols->cpu_ticks[row]);
+        break;
+    case PROC_MODEL_COL_PSS:
+        set_extra_value(value, cols, row, PROC_EXTRA_MEM, cols->pss_kb);
+        break;
+    case PROC_MODEL_COL_SWAP:
+        set_extra_value(value, cols, row, PROC_EXTRA_MEM, cols->swap_kb);
+        break;
+    case PROC_MODEL_COL_FDS:
+        set_extra_value(value, cols, row, PROC_EXTRA_FDS, cols->fds);
+        break;
+    }
+}
+
+static gboolean proc_model_iter_next(GtkTreeModel *tree_model, GtkTreeIter *iter) {
+    ProcModel *model = PROC_MODEL(tree_model);
+    uint32_t row = ITER_ROW(iter);
+    uint32_t parent = model->parent[row];
+    uint32_t k = model->child_start[parent] + model->sibling_index[row] + 1;
+
+    if (k >= model->child_start[parent + 1]) {
+        return FALSE;
+    }
+    iter->user_data = GUINT_TO_POINTER(model->children[k]);
+    return TRUE;
+}
+
+static gboolean proc_model_iter_previous(GtkTreeModel *tree_model, GtkTreeIter *iter) {
+    ProcModel *model = PROC_MODEL(tree_model);
+    uint32_t row = ITER_ROW(iter);
+
+    if (model->sibling_index[row] == 0) {
+        return FALSE;
+    }
+    uint32_t parent = model->parent[row];
+    iter->user_data = GUINT_TO_POINTER(model->children[model->child_start[parent] + model->sibling_index[row] - 1]);
+    return TRUE;
+}
+
+static gboolean proc_model_iter_nth_child(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent, gint n) {
+    ProcModel *model = PROC_MODEL(tree_model);
+    uint32_t row = parent != NULL ? ITER_ROW(parent) : (uint32_t) model->cols->count;
+    uint32_t first = model->child_start[row];
+
+    if (n < 0 || (uint32_t) n >= model->child_start[row + 1] - first) {
+        return FALSE;
+    }
+    return set_iter(model, iter, model->children[first + (uint32_t) n]);
+}
+
+static gboolean proc_model_iter_children(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent) {
+    return proc_model_iter_nth_child(tree_model, iter, parent, 0);
+}
+
+static gint proc_model_iter_n_children(GtkTreeModel *tree_model, GtkTreeIter *iter) {
+    ProcModel *model = PROC_MODEL(tree_model);
+    uint32_t row = iter != NULL ? ITER_ROW(iter) : (uint32_t) model->cols->count;
+    return (gint) (model->child_start[row + 1] - model->child_start[row]);
+}
+
+static gboolean proc_model_iter_has_child(GtkTreeModel *tree_model, GtkTreeIter *iter) {
+    return proc_model_iter_n_children(tree_model, iter) > 0;
+}
+
+static gboolean proc_model_iter_parent(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *child) {
+    ProcModel *model = PROC_MODEL(tree_model);
+    uint32_t parent = model->parent[ITER_ROW(child)];
+
+    if (parent == model->cols->count) {
+        return FALSE;
+    }
+    return set_iter(model, iter, parent);
+}
+
+static void proc_model_tree_model_init(GtkTreeModelIface *iface) {
+    iface->get_flags = proc_model_get_flags;
+    iface->get_n_columns = proc_model_get_n_columns;
+    iface->get_column_type = proc_model_get_column_type;
+    iface->get_iter = proc_model_get_iter;
+    iface->get_path = proc_model_get_path;
+    iface->get_value = proc_model_get_value;
+    iface->iter_next = proc_model_iter_next;
+    iface->iter_previous = proc_model_iter_previous;
+    iface->iter_children = proc_model_iter_children;
+    iface->iter_has_child = proc_model_iter_has_child;
+    iface->iter_n_children = proc_model_iter_n_children;
+    iface->iter_nth_child = proc_model_iter_nth_child;
+    iface->iter_parent = proc_model_iter_parent;
+}
+
+static void proc_model_class_init(ProcModelClass *klass) {
+}
+
+static void proc_model_init(ProcModel *model) {
+    proc_model_set_columns(model, &empty_columns, NULL);
+    model->stamp = g_random_int();
+}
+
+// Create an empty model
+ProcModel *proc_model_new(void) {
+    return g_object_new(PROC_TYPE_MODEL, NULL);
+}
+
+// Show other columns, all of their rows or those of a filtered tree
+void proc_model_set_columns(ProcModel *model, const struct proc_columns *cols, const struct proc_columns_tree *tree) {
+    model->cols = cols->child_start != NULL ? cols : &empty_columns;
+    if (tree != NULL && model->cols != &empty_columns) {
+        model->parent = tree->parent;
+        model->sibling_index = tree->sibling_index;
+        model->child_start = tree->child_start;
+        model->children = tree->children;
+    } else {
+        model->parent = model->cols->parent;
+        model->sibling_index = model->cols->sibling_index;
+        model->child_start = model->cols->child_start;
+        model->children = model->cols->children;
+    }
+    model->stamp++;
+}
+
+// A row of an update and where it is in its tree
+struct row_path {
+    GtkTreePath *path;
+    uint32_t row;
+};
+
+// Path of a row in the unfiltered tree of some columns
+static GtkTreePath *row_path_new(const struct proc_columns *cols, uint32_t row) {
+    GtkTreePath *path = gtk_tree_path_new();
+    for (; row != cols->count; row = cols->parent[row]) {
+        gtk_tree_path_prepend_index(path, (gint) cols->sibling_index[row]);
+    }
+    return path;
+}
+
+static void add_row_path(GArray *rows, const struct proc_columns *cols, uint32_t row) {
+    struct row_path entry = { row_path_new(cols, row), row };
+    g_array_append_val(rows, entry);
+}
+
+static gint compare_row_paths(gconstpointer a, gconstpointer b) {
+    return gtk_tree_path_compare(((const struct row_path *) a)->path, ((const struct row_path *) b)->path);
+}
+
+static gint compare_rows(gconstpointer a, gconstpointer b) {
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// Sort row indexes and drop the repeats
+static void sort_rows(GArray *rows) {
+    guint kept = 0;
+    g_array_sort(rows, compare_rows);
+    for (guint i = 0; i < rows->len; i++) {
+        if (kept == 0 || g_array_index(rows, uint32_t, i) != g_array_index(rows, uint32_t, kept - 1)) {
+            g_array_index(rows, uint32_t, kept++) = g_array_index(rows, uint32_t, i);
+        }
+    }
+    g_array_set_size(rows, kept);
+}
+
+static gboolean has_row(GArray *sorted, uint32_t row) {
+    return bsearch(&row, sorted->data, sorted->len, sizeof(uint32_t),
+                   (int (*)(const void *, const void *)) compare_rows) != NULL;
+}
+
+// PID of a row's parent row, 0 at the top level
+static pid_t parent_pid(const struct proc_columns *cols, uint32_t row) {
+    return cols->parent[row] != cols->count ? cols->pids[cols->parent[row]] : 0;
+}
+
+// Row of the same process in other columns, or -1 if it is not there or another one has its PID
+static long same_process(const struct proc_columns *from, uint32_t row, const struct proc_columns *to) {
+    long other = proc_columns_find(to, from->pids[row]);
+    return other >= 0 && to->start_times[other] == from->start_times[row] ? other : -1;
+}
+
+// Add a row of cols to moved if its process was in old_cols under another parent row
+static void check_moved(const struct proc_columns *old_cols, const struct proc_columns *cols, uint32_t row,
+                        GArray *moved) {
+    long old_row = same_process(cols, row, old_cols);
+    if (old_row >= 0 && parent_pid(old_cols, (uint32_t) old_row) != parent_pid(cols, row)) {
+        g_array_append_val(moved, row);
+    }
+}
+
+// Show the next sample's columns and replay the diff to the views as row signals
+void proc_model_update_columns(ProcModel *model, const struct proc_columns *cols, const struct proc_diff *diff) {
+    GtkTreeModel *tree_model = GTK_TREE_MODEL(model);
+    const struct proc_columns *old_cols = model->cols;
+    GArray *moved = g_array_new(FALSE, FALSE, sizeof(uint32_t));           // Rows of cols
+    GArray *parents = g_array_new(FALSE, FALSE, sizeof(uint32_t));         // Rows of cols
+    GArray *gone = g_array_new(FALSE, FALSE, sizeof(struct row_path));     // In old_cols
+    GArray *came = g_array_new(FALSE, FALSE, sizeof(struct row_path));     // In cols
+    GtkTreeIter iter;
+
+    g_return_if_fail(model->parent == old_cols->parent);
+    proc_model_set_columns(model, cols, NULL);
+    cols = model->cols;
+
+    // A process moves when its parent row is another process. Besides a new ppid,
+    // that happens when the parent left or arrived and the ppid did not follow yet.
+    for (size_t i = 0; i < diff->count; i++) {
+        const struct proc_change *change = &diff->changes[i];
+        if (change->flags & PROC_CHANGE_REPARENTED) {
+            check_moved(old_cols, cols, (uint32_t) change->new_index, moved);
+        } else if (change->flags & PROC_CHANGE_REMOVED) {
+            uint32_t row = (uint32_t) change->old_index;
+            for (uint32_t k = old_cols->child_start[row]; k < old_cols->child_start[row + 1]; k++) {
+                long child = same_process(old_cols, old_cols->children[k], cols);
+                if (child >= 0) {
+                    check_moved(old_cols, cols, (uint32_t) child, moved);
+                }
+            }
+        } else if (change->flags & PROC_CHANGE_ADDED) {
+            uint32_t row = (uint32_t) change->new_index;
+            for (uint32_t k = cols->child_start[row]; k < cols->child_start[row + 1]; k++) {
+                check_moved(old_cols, cols, cols->children[k], moved);
+            }
+        }
+    }
+
+    // The columns put a row whose parents loop back to it at the top level, which may be another row of the loop now
+    for (uint32_t k = old_cols->child_start[old_cols->count]; k < old_cols->child_start[old_cols->count + 1]; k++) {
+        uint32_t row = old_cols->children[k];
+        long child = old_cols->ppids[row] > 0 ? same_process(old_cols, row, cols) : -1;
+        if (child >= 0) {
+            check_moved(old_cols, cols, (uint32_t) child, moved);
+        }
+    }
+    for (uint32_t k = cols->child_start[cols->count]; k < cols->child_start[cols->count + 1]; k++) {
+        if (cols->ppids[cols->children[k]] > 0) {
+            check_moved(old_cols, cols, cols->children[k], moved);
+        }
+    }
+    sort_rows(moved);
+
+    // Moved rows leave their old place and come back at the new one
+    for (size_t i = 0; i < diff->count; i++) {
+        const struct proc_change *change = &diff->changes[i];
+        if (change->flags & PROC_CHANGE_REMOVED) {
+            add_row_path(gone, old_cols, (uint32_t) change->old_index);
+        } else if (change->flags & PROC_CHANGE_ADDED) {
+            add_row_path(came, cols, (uint32_t) change->new_index);
+        }
+    }
+    for (guint i = 0; i < moved->len; i++) {
+        uint32_t row = g_array_index(moved, uint32_t, i);
+        add_row_path(gone, old_cols, (uint32_t) same_process(cols, row, old_cols));
+        add_row_path(came, cols, row);
+    }
+
+    // The views only know the old rows by their paths. Removing the last one first
+    // keeps the paths of the others; the view drops a removed row's subtree with it.
+    g_array_sort(gone, compare_row_paths);
+    for (guint i = gone->len; i-- > 0;) {
+        const struct row_path *entry = &g_array_index(gone, struct row_path, i);
+        uint32_t parent = old_cols->parent[entry->row];
+        long row = parent != old_cols->count ? same_process(old_cols, parent, cols) : -1;
+        if (row >= 0) {
+            g_array_append_val(parents, row);
+        }
+        gtk_tree_model_row_deleted(tree_model, entry->path);
+        gtk_tree_path_free(entry->path);
+    }
+
+    // What is left keeps its PID order, so inserting in path order puts every
+    // earlier sibling and every ancestor in place first
+    g_array_sort(came, compare_row_paths);
+    for (guint i = 0; i < came->len; i++) {
+        const struct row_path *entry = &g_array_index(came, struct row_path, i);
+        if (cols->parent[entry->row] != cols->count) {
+            g_array_append_val(parents, cols->parent[entry->row]);
+        }
+        set_iter(model, &iter, entry->row);
+        gtk_tree_model_row_inserted(tree_model, entry->path, &iter);
+        gtk_tree_path_free(entry->path);
+    }
+
+    // Inserted rows were asked whether they have children; the parents that stayed were not
+    sort_rows(parents);
+    for (guint i = 0; i < parents->len; i++) {
+        uint32_t row = g_array_index(parents, uint32_t, i);
+        long old_row = same_process(cols, row, old_cols);
+        if (old_row < 0 || has_row(moved, row) ||
+            (old_cols->child_start[old_row + 1] > old_cols->child_start[old_row]) ==
+                (cols->child_start[row + 1] > cols->child_start[row])) {
+            continue;
+        }
+        GtkTreePath *path = row_path_new(cols, row);
+        set_iter(model, &iter, row);
+        gtk_tree_model_row_has_child_toggled(tree_model, path, &iter);
+        gtk_tree_path_free(path);
+    }
+
+    for (size_t i = 0; i < diff->count; i++) {
+        const struct proc_change *change = &diff->changes[i];
+        if ((change->flags & PROC_CHANGE_UPDATED) && !has_row(moved, (uint32_t) change->new_index)) {
+            GtkTreePath *path = row_path_new(cols, (uint32_t) change->new_index);
+            set_iter(model, &iter, (uint32_t) change->new_index);
+            gtk_tree_model_row_changed(tree_model, path, &iter);
+            gtk_tree_path_free(path);
+        }
+    }
+
+    g_array_free(moved, TRUE);
+    g_array_free(parents, TRUE);
+    g_array_free(gone, TRUE);
+    g_array_free(came, TRUE);
+}
+
+// Take the user name and command line from a fetcher
+void proc_model_set_fetcher(ProcModel *model, struct proc_fetcher *fetcher) {
+    model->fetcher = fetcher;
+}
+
+// Queue fetches for the children of an expanded row, behind the rows on screen
+void proc_model_prefetch_children(ProcModel *model, GtkTreeIter *iter) {
+    const struct proc_columns *cols = model->cols;
+    uint32_t row = ITER_ROW(iter);
+
+    if (model->fetcher == NULL || iter->stamp != model->stamp) {
+        return;
+    }
+    for (uint32_t k = model->child_start[row]; k < model->child_start[row + 1]; k++) {
+        uint32_t child = model->children[k];
+        proc_fetch_request(model->fetcher, cols->pids[child], cols->start_times[child], PROC_FETCH_EXPANDED);
+    }
+}
+
+// Point iter at the row of a PID, unless the filter hides it
+gboolean proc_model_find_pid(ProcModel *model, pid_t pid, GtkTreeIter *iter) {
+    long row = proc_columns_find(model->cols, pid);
+    return row >= 0 && model->sibling_index[row] != UINT32_MAX && set_iter(model, iter, (uint32_t) row);
+}
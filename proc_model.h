@@ -0,0 +1,53 @@
+#ifndef PROC_MODEL_H
+#define PROC_MODEL_H
+
+#include <gtk/gtk.h>
+#include "proc_columns.h"
+#include "proc_fetch.h"
+#include "proc_diff.h"
+
+// Columns of the process model
+enum {
+    PROC_MODEL_COL_PID,         // gint
+    PROC_MODEL_COL_USER,        // string
+    PROC_MODEL_COL_COMM,        // string
+    PROC_MODEL_COL_RSS,         // guint, kB
+    PROC_MODEL_COL_CPU,         // guint, user + system clock ticks
+    PROC_MODEL_COL_CMDLINE,     // string, fetched on demand
+    PROC_MODEL_COL_PSS,         // string, "kB (age)" when the columns carry the budgeted metrics
+    PROC_MODEL_COL_SWAP,        // string, likewise
+    PROC_MODEL_COL_FDS,         // string, likewise
+    PROC_MODEL_N_COLUMNS
+};
+
+// GtkTreeModel that reads straight from a struct proc_columns; iters are row indexes
+G_BEGIN_DECLS
+#define PROC_TYPE_MODEL (proc_model_get_type())
+G_DECLARE_FINAL_TYPE(ProcModel, proc_model, PROC, MODEL, GObject)
+G_END_DECLS
+
+ProcModel *proc_model_new(void);
+
+// Show other columns: all of their rows, or with a tree only the rows a filter
+// kept. Iters from before the call become invalid. If rows were added, removed,
+// moved, hidden or shown, detach the model from its views around the call. The
+// columns and the tree must stay untouched until the next call.
+void proc_model_set_columns(ProcModel *model, const struct proc_columns *cols, const struct proc_columns_tree *tree);
+
+// Show the columns of the next sample without a filter, telling the views which
+// rows went, came, moved, gained or lost children, or changed. The model must show
+// the unfiltered columns diff starts from, and those must stay readable during the
+// call. Iters from before the call become invalid.
+void proc_model_update_columns(ProcModel *model, const struct proc_columns *cols, const struct proc_diff *diff);
+
+// Take the user name and command line from a fetcher, for rows whose uid the
+// scan left unknown. The values of rows the view draws are fetched first.
+void proc_model_set_fetcher(ProcModel *model, struct proc_fetcher *fetcher);
+
+// Queue fetches for the children of an expanded row
+void proc_model_prefetch_children(ProcModel *model, GtkTreeIter *iter);
+
+// Point iter at the row of a PID; returns FALSE if there is none or it is filtered out
+gboolean proc_model_find_pid(ProcModel *model, pid_t pid, GtkTreeIter *iter);
+
+#endif
@@ -0,0 +1,287 @@
+#include "proc_output.h"
+#include "proc_info_abi.h"
+#include "proc_stats.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OUTPUT_BUF_SIZE (256 * 1024)
+#define ZBUF_SIZE (64 * 1024)
+#define MAX_ROW_LEN 1024        // Longest row any format produces, with every byte escaped
+
+// Write all of len bytes, retrying short writes
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        proc_stats_count(PROC_STATS_OUTPUT, PROC_STATS_SYSCALLS, 1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        proc_stats_count(PROC_STATS_OUTPUT, PROC_STATS_BYTES, (unsigned long long) n);
+        data += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+// Hand the buffered bytes to the fd, through deflate with the given flush mode when compressing
+static int drain(struct proc_output *out, int flush) {
+    if (!out->compress) {
+        int rc = write_all(out->fd, out->buf, out->used);
+        out->used = 0;
+        return rc;
+    }
+
+    out->zs.next_in = (Bytef *) out->buf;
+    out->zs.avail_in = (uInt) out->used;
+    for (;;) {
+        out->zs.next_out = (Bytef *) out->zbuf;
+        out->zs.avail_out = (uInt) out->zsize;
+        int ret = deflate(&out->zs, flush);
+        if (ret == Z_STREAM_ERROR ||
+            write_all(out->fd, out->zbuf, out->zsize - out->zs.avail_out) < 0) {
+            out->used = 0;
+            return -1;
+        }
+        // A full output buffer means deflate may have more; Z_FINISH runs to the end of the stream
+        if (flush == Z_FINISH ? ret == Z_STREAM_END : out->zs.avail_out != 0) {
+            break;
+        }
+    }
+    out->used = 0;
+    return 0;
+}
+
+// Make sure one more row fits in the buffer
+static int reserve_row(struct proc_output *out) {
+    return out->size - out->used < MAX_ROW_LEN ? drain(out, Z_NO_FLUSH) : 0;
+}
+
+// Append formatted text; the caller has reserved room for it
+static void append_printf(struct proc_output *out, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void append_printf(struct proc_output *out, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(out->buf + out->used, out->size - out->used, fmt, ap);
+    va_end(ap);
+    if (n > 0 && (size_t) n < out->size - out->used) {
+        out->used += (size_t) n;
+    }
+}
+
+// Append a CSV field in double quotes, doubling the quotes inside
+static void append_csv_string(struct proc_output *out, const char *s) {
+    char *p = out->buf + out->used;
+    *p++ = '"';
+    for (; *s; s++) {
+        if (*s == '"') {
+            *p++ = '"';
+        }
+        *p++ = *s;
+    }
+    *p++ = '"';
+    out->used = (size_t) (p - out->buf);
+}
+
+// Append a JSON string. Bytes outside printable ASCII are written as \u00XX, so
+// the output stays valid UTF-8 whatever a process named itself.
+static void append_json_string(struct proc_output *out, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    char *p = out->buf + out->used;
+
+    *p++ = '"';
+    for (; *s; s++) {
+        unsigned char c = (unsigned char) *s;
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = (char) c;
+        } else if (c < 0x20 || c >= 0x7f) {
+            memcpy(p, "\\u00", 4);
+            p[4] = hex[c >> 4];
+            p[5] = hex[c & 15];
+            p += 6;
+        } else {
+            *p++ = (char) c;
+        }
+    }
+    *p++ = '"';
+    out->used = (size_t) (p - out->buf);
+}
+
+// Set up a stream on fd
+int proc_output_open(struct proc_output *out, int fd, int format, int compress) {
+    memset(out, 0, sizeof(*out));
+    out->fd = fd;
+    out->format = format;
+    out->compress = compress;
+    out->page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    out->ticks_per_sec = sysconf(_SC_CLK_TCK);
+    out->size = OUTPUT_BUF_SIZE;
+    out->buf = malloc(out->size);
+    if (out->buf == NULL) {
+        return -1;
+    }
+
+    if (compress) {
+        out->zsize = ZBUF_SIZE;
+        out->zbuf = malloc(out->zsize);
+        // 15 + 16 asks for a gzip header and trailer instead of a raw zlib stream
+        if (out->zbuf == NULL || deflateInit2(&out->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                                              Z_DEFAULT_STRATEGY) != Z_OK) {
+            free(out->zbuf);
+            free(out->buf);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Finish the stream and free the buffers
+int proc_output_close(struct proc_output *out) {
+    int rc = 0;
+    if (out->compress) {
+        rc = drain(out, Z_FINISH);
+        deflateEnd(&out->zs);
+    } else {
+        rc = drain(out, Z_NO_FLUSH);
+    }
+    free(out->zbuf);
+    free(out->buf);
+    out->buf = out->zbuf = NULL;
+    return rc;
+}
+
+// Start a sample
+int proc_output_begin(struct proc_output *out, unsigned long long time_ns, size_t count) {
+    out->time_ms = time_ns / 1000000ULL;
+    out->started = proc_stats_start();
+    proc_stats_count(PROC_STATS_OUTPUT, PROC_STATS_ROWS, count);
+    if (reserve_row(out) < 0) {
+        return -1;
+    }
+
+    if (out->format == PROC_OUTPUT_CSV && !out->header_done) {
+        append_printf(out, "time_ms,pid,ppid,uid,user,prio,state,threads,rss_kb,utime_ms,stime_ms,start_time_ms,"
+                           "cpu_pct,comm\n");
+        out->header_done = 1;
+    } else if (out->format == PROC_OUTPUT_BINARY) {
+        struct proc_output_frame frame = {
+            .magic = PROC_OUTPUT_MAGIC,
+            .version = PROC_OUTPUT_VERSION,
+            .record_size = sizeof(struct proc_info_record),
+            .count = (uint32_t) count,
+            .page_kb = (uint32_t) out->page_kb,
+            .time_ns = time_ns,
+        };
+        memcpy(out->buf + out->used, &frame, sizeof(frame));
+        out->used += sizeof(frame);
+    }
+    return 0;
+}
+
+// Add one process
+int proc_output_row(struct proc_output *out, const struct proc_entry *entry, const char *user, double cpu_pct) {
+    long ticks_per_sec = out->ticks_per_sec;
+    if (reserve_row(out) < 0) {
+        return -1;
+    }
+
+    unsigned long long utime_ms = (unsigned long long) entry->utime * 1000 / ticks_per_sec;
+    unsigned long long stime_ms = (unsigned long long) entry->stime * 1000 / ticks_per_sec;
+    unsigned long long start_ms = entry->start_time * 1000 / ticks_per_sec;
+    char state[2] = { entry->state, '\0' };
+
+    switch (out->format) {
+    case PROC_OUTPUT_CSV:
+        append_printf(out, "%llu,%d,%d,", out->time_ms, entry->pid, entry->ppid);
+        if (entry->uid != (uid_t) -1) {
+            append_printf(out, "%u", (unsigned int) entry->uid);
+        }
+        append_printf(out, ",");
+        append_csv_string(out, user);
+        append_printf(out, ",%d,%s,%d,%lu,%llu,%llu,%llu,", entry->prio, state, entry->threads, entry->rss_kb,
+                      utime_ms, stime_ms, start_ms);
+        if (cpu_pct >= 0) {
+            append_printf(out, "%.1f", cpu_pct);
+        }
+        append_printf(out, ",");
+        append_csv_string(out, entry->comm);
+        append_printf(out, "\n");
+        break;
+
+    case PROC_OUTPUT_NDJSON:
+        append_printf(out, "{\"time_ms\":%llu,\"pid\":%d,\"ppid\":%d,\"uid\":", out->time_ms, entry->pid, entry->ppid);
+        if (entry->uid != (uid_t) -1) {
+            append_printf(out, "%u", (unsigned int) entry->uid);
+        } else {
+            append_printf(out, "null");
+        }
+        append_printf(out, ",\"user\":");
+        append_json_string(out, user);
+        append_printf(out, ",\"prio\":%d,\"state\":", entry->prio);
+        append_json_string(out, state);
+        append_printf(out, ",\"threads\":%d,\"rss_kb\":%lu,\"utime_ms\":%llu,\"stime_ms\":%llu,\"start_time_ms\":%llu,"
+                           "\"cpu_pct\":", entry->threads, entry->rss_kb, utime_ms, stime_ms, start_ms);
+        if (cpu_pct >= 0) {
+            append_printf(out, "%.1f", cpu_pct);
+        } else {
+            append_printf(out, "null");
+        }
+        append_printf(out, ",\"comm\":");
+        append_json_string(out, entry->comm);
+        append_printf(out, "}\n");
+        break;
+
+    case PROC_OUTPUT_BINARY: {
+        unsigned long long ns_per_tick = 1000000000ULL / (unsigned long long) ticks_per_sec;
+        struct proc_info_record rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.version = PROC_INFO_BIN_VERSION;
+        rec.size = sizeof(rec);
+        rec.pid = entry->pid;
+        rec.ppid = entry->ppid;
+        rec.uid = entry->uid;
+        rec.prio = entry->prio + PROC_INFO_PRIO_OFFSET;
+        rec.threads = entry->threads;
+        rec.rss_pages = entry->rss_kb / (unsigned long) out->page_kb;
+        rec.utime_ns = (unsigned long long) entry->utime * ns_per_tick;
+        rec.stime_ns = (unsigned long long) entry->stime * ns_per_tick;
+        rec.start_time_ns = entry->start_time * ns_per_tick;
+        strncpy(rec.comm, entry->comm, sizeof(rec.comm));
+        rec.state = entry->state;
+        memcpy(out->buf + out->used, &rec, sizeof(rec));
+        out->used += sizeof(rec);
+        break;
+    }
+    }
+    return 0;
+}
+
+// End a sample and write out everything buffered
+int proc_output_end(struct proc_output *out) {
+    int rc = drain(out, Z_SYNC_FLUSH);
+    proc_stats_stop(PROC_STATS_OUTPUT, out->started);
+    return rc;
+}
+
+// Parse a format name
+int proc_output_parse_format(const char *name) {
+    if (strcmp(name, "csv") == 0) {
+        return PROC_OUTPUT_CSV;
+    }
+    if (strcmp(name, "ndjson") == 0) {
+        return PROC_OUTPUT_NDJSON;
+    }
+    if (strcmp(name, "binary") == 0) {
+        return PROC_OUTPUT_BINARY;
+    }
+    return -1;
+}
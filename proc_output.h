@@ -0,0 +1,73 @@
+#ifndef PROC_OUTPUT_H
+#define PROC_OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib.h>
+#include "proc_scan.h"
+
+// Machine-readable output formats
+enum {
+    PROC_OUTPUT_CSV,            // One header line, then one line per process
+    PROC_OUTPUT_NDJSON,         // One JSON object per process and line
+    PROC_OUTPUT_BINARY,         // Per sample: a struct proc_output_frame, then count proc_info_records
+};
+
+#define PROC_OUTPUT_MAGIC 0x534f4950u  // "PIOS" in little-endian byte order
+#define PROC_OUTPUT_VERSION 1
+
+// Starts every sample of the binary format. The records that follow use the
+// proc_info module's own layout (proc_info_abi.h), with RSS in pages and times
+// in nanoseconds.
+struct proc_output_frame {
+    uint32_t magic;             // PROC_OUTPUT_MAGIC
+    uint16_t version;           // PROC_OUTPUT_VERSION
+    uint16_t record_size;       // sizeof(struct proc_info_record)
+    uint32_t count;             // Records in this sample
+    uint32_t page_kb;           // Page size in kB, to turn rss_pages into kB
+    uint64_t time_ns;           // Wall-clock time of the sample, since the epoch
+};
+
+// A stream of samples written to one fd. Rows are formatted into one large
+// buffer and written out when it fills up and at the end of every sample, so a
+// sample of thousands of processes costs a handful of write calls. With
+// compression the stream is gzip, flushed at the end of every sample so a
+// reader can decompress each sample as it arrives.
+struct proc_output {
+    int fd;
+    int format;
+    int compress;
+    int header_done;            // The CSV header line has been written
+    long page_kb;
+    long ticks_per_sec;
+    unsigned long long time_ms; // Time of the current sample
+    unsigned long long started; // proc_stats_start() at the beginning of the sample
+    char *buf;                  // Formatted, uncompressed bytes
+    size_t used;
+    size_t size;
+    z_stream zs;
+    char *zbuf;                 // Compressed bytes waiting to be written
+    size_t zsize;
+};
+
+// Set up a stream on fd; returns 0 or -1
+int proc_output_open(struct proc_output *out, int fd, int format, int compress);
+
+// Finish the stream (the gzip trailer, with compression) and free the buffers; returns 0 or -1
+int proc_output_close(struct proc_output *out);
+
+// Start a sample of count processes taken at time_ns (CLOCK_REALTIME); returns 0 or -1
+int proc_output_begin(struct proc_output *out, unsigned long long time_ns, size_t count);
+
+// Add one process. cpu_pct is its CPU usage over the last interval, or negative
+// if unknown (the first sample). The binary format leaves out user and cpu_pct.
+// Returns 0 or -1 once a write has failed.
+int proc_output_row(struct proc_output *out, const struct proc_entry *entry, const char *user, double cpu_pct);
+
+// End a sample and write out everything buffered; returns 0 or -1
+int proc_output_end(struct proc_output *out);
+
+// Parse "csv", "ndjson" or "binary"; returns the format or -1
+int proc_output_parse_format(const char *name);
+
+#endif
@@ -0,0 +1,430 @@
+#include "proc_rollup.h"
+#include "proc_stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Fibonacci hashing for uids and PIDs
+static size_t hash_id(unsigned int id) {
+    return (size_t) ((id * 2654435769u) >> 7);
+}
+
+// FNV-1a over a command name
+static size_t hash_comm(const char *comm) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < PROC_COMM_LEN && comm[i] != '\0'; i++) {
+        h = (h ^ (unsigned char) comm[i]) * 16777619u;
+    }
+    return h;
+}
+
+// Home slot of a group or node index
+static size_t home_of(const struct proc_rollup *rollup, uint32_t index) {
+    switch (rollup->kind) {
+    case PROC_ROLLUP_USER:
+        return hash_id((unsigned int) rollup->groups[index].uid) & rollup->mask;
+    case PROC_ROLLUP_COMM:
+        return hash_comm(rollup->groups[index].comm) & rollup->mask;
+    default:
+        return hash_id((unsigned int) rollup->nodes[index].pid) & rollup->mask;
+    }
+}
+
+// Find the slot holding the group of a process, or the empty slot where it would go
+static size_t find_group_slot(const struct proc_rollup *rollup, const struct proc_entry *entry) {
+    int by_user = rollup->kind == PROC_ROLLUP_USER;
+    size_t i = (by_user ? hash_id((unsigned int) entry->uid) : hash_comm(entry->comm)) & rollup->mask;
+    for (; rollup->slots[i] != 0; i = (i + 1) & rollup->mask) {
+        const struct proc_rollup_group *group = &rollup->groups[rollup->slots[i] - 1];
+        if (by_user ? group->uid == entry->uid : strncmp(group->comm, entry->comm, PROC_COMM_LEN) == 0) {
+            break;
+        }
+    }
+    return i;
+}
+
+// Find the slot holding the node of a PID, or the empty slot where it would go
+static size_t find_node_slot(const struct proc_rollup *rollup, pid_t pid) {
+    size_t i = hash_id((unsigned int) pid) & rollup->mask;
+    while (rollup->slots[i] != 0 && rollup->nodes[rollup->slots[i] - 1].pid != pid) {
+        i = (i + 1) & rollup->mask;
+    }
+    return i;
+}
+
+// Node of a PID, or PROC_ROLLUP_NONE
+static uint32_t find_node(const struct proc_rollup *rollup, pid_t pid) {
+    uint32_t slot = rollup->slots[find_node_slot(rollup, pid)];
+    return slot != 0 ? slot - 1 : PROC_ROLLUP_NONE;
+}
+
+// Double the table, keeping every entry
+static int grow_slots(struct proc_rollup *rollup) {
+    size_t old_count = rollup->mask + 1;
+    uint32_t *old = rollup->slots;
+    uint32_t *slots = calloc(old_count * 2, sizeof(*slots));
+    if (slots == NULL) {
+        return -1;
+    }
+
+    rollup->slots = slots;
+    rollup->mask = old_count * 2 - 1;
+    proc_stats_count(PROC_STATS_ROLLUP, PROC_STATS_ALLOCS, 1);
+    for (size_t i = 0; i < old_count; i++) {
+        if (old[i] != 0) {
+            size_t j = home_of(rollup, old[i] - 1);
+            while (slots[j] != 0) {
+                j = (j + 1) & rollup->mask;
+            }
+            slots[j] = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+// Empty slot i, moving later entries of its probe chain back so lookups still find them
+static void delete_slot(struct proc_rollup *rollup, size_t i) {
+    rollup->slots[i] = 0;
+    rollup->used--;
+    for (size_t j = (i + 1) & rollup->mask; rollup->slots[j] != 0; j = (j + 1) & rollup->mask) {
+        size_t home = home_of(rollup, rollup->slots[j] - 1);
+        // The entry at j may move to i unless its home lies cyclically in (i, j]
+        int stays = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+        if (!stays) {
+            rollup->slots[i] = rollup->slots[j];
+            rollup->slots[j] = 0;
+            i = j;
+        }
+    }
+}
+
+// Group of a process, created on first sight; returns its index or PROC_ROLLUP_NONE
+static uint32_t get_group(struct proc_rollup *rollup, const struct proc_entry *entry) {
+    size_t i = find_group_slot(rollup, entry);
+    if (rollup->slots[i] != 0) {
+        return rollup->slots[i] - 1;
+    }
+
+    if ((rollup->used + 1) * 2 > rollup->mask + 1) {
+        if (grow_slots(rollup) < 0) {
+            return PROC_ROLLUP_NONE;
+        }
+        i = find_group_slot(rollup, entry);
+    }
+    if (rollup->group_count == rollup->group_capacity) {
+        size_t capacity = rollup->group_capacity ? rollup->group_capacity * 2 : 64;
+        struct proc_rollup_group *groups = realloc(rollup->groups, capacity * sizeof(*groups));
+        if (groups == NULL) {
+            return PROC_ROLLUP_NONE;
+        }
+        rollup->groups = groups;
+        rollup->group_capacity = capacity;
+        proc_stats_count(PROC_STATS_ROLLUP, PROC_STATS_ALLOCS, 1);
+    }
+
+    struct proc_rollup_group *group = &rollup->groups[rollup->group_count];
+    memset(group, 0, sizeof(*group));
+    group->uid = entry->uid;
+    memcpy(group->comm, entry->comm, PROC_COMM_LEN);
+    rollup->slots[i] = (uint32_t) ++rollup->group_count;
+    rollup->used++;
+    return (uint32_t) (rollup->group_count - 1);
+}
+
+// New unlinked node for a PID, or PROC_ROLLUP_NONE
+static uint32_t add_node(struct proc_rollup *rollup, pid_t pid) {
+    if ((rollup->used + 1) * 2 > rollup->mask + 1 && grow_slots(rollup) < 0) {
+        return PROC_ROLLUP_NONE;
+    }
+
+    uint32_t index = rollup->free_node;
+    if (index != PROC_ROLLUP_NONE) {
+        rollup->free_node = rollup->nodes[index].next_sibling;
+    } else {
+        if (rollup->node_count == rollup->node_capacity) {
+            size_t capacity = rollup->node_capacity ? rollup->node_capacity * 2 : 1024;
+            struct proc_rollup_node *nodes = realloc(rollup->nodes, capacity * sizeof(*nodes));
+            if (nodes == NULL) {
+                return PROC_ROLLUP_NONE;
+            }
+            rollup->nodes = nodes;
+            rollup->node_capacity = capacity;
+            proc_stats_count(PROC_STATS_ROLLUP, PROC_STATS_ALLOCS, 1);
+        }
+        index = (uint32_t) rollup->node_count++;
+    }
+
+    struct proc_rollup_node *node = &rollup->nodes[index];
+    memset(node, 0, sizeof(*node));
+    node->pid = pid;
+    node->parent = node->first_child = node->next_sibling = node->prev_sibling = PROC_ROLLUP_NONE;
+    rollup->slots[find_node_slot(rollup, pid)] = index + 1;
+    rollup->used++;
+    return index;
+}
+
+// What one process contributes to its group or subtree
+static void entry_totals(const struct proc_entry *entry, struct proc_rollup_totals *totals) {
+    totals->processes = 1;
+    totals->threads = (unsigned long) (entry->threads > 0 ? entry->threads : 0);
+    totals->rss_kb = entry->rss_kb;
+    totals->cpu_ticks = (unsigned long long) entry->utime + entry->stime;
+    totals->cpu_delta = 0;
+}
+
+// Add (sign 1) or subtract (sign -1) everything but cpu_delta
+static void add_totals(struct proc_rollup_totals *to, const struct proc_rollup_totals *from, int sign) {
+    if (sign > 0) {
+        to->processes += from->processes;
+        to->threads += from->threads;
+        to->rss_kb += from->rss_kb;
+        to->cpu_ticks += from->cpu_ticks;
+    } else {
+        to->processes -= from->processes;
+        to->threads -= from->threads;
+        to->rss_kb -= from->rss_kb;
+        to->cpu_ticks -= from->cpu_ticks;
+    }
+}
+
+// Add totals to a node and every ancestor, along with the CPU ticks used in this update
+static void add_to_chain(struct proc_rollup *rollup, uint32_t index, const struct proc_rollup_totals *totals,
+                         int sign, unsigned long long cpu_delta) {
+    for (; index != PROC_ROLLUP_NONE; index = rollup->nodes[index].parent) {
+        struct proc_rollup_node *node = &rollup->nodes[index];
+        add_totals(&node->subtree, totals, sign);
+        if (node->delta_update != rollup->update) {
+            node->delta_update = rollup->update;
+            node->subtree.cpu_delta = 0;
+        }
+        node->subtree.cpu_delta += cpu_delta;
+    }
+}
+
+// Take a node out of its parent's child list, along with its subtree's totals
+static void unlink_node(struct proc_rollup *rollup, uint32_t index) {
+    struct proc_rollup_node *node = &rollup->nodes[index];
+    if (node->parent == PROC_ROLLUP_NONE) {
+        return;
+    }
+    add_to_chain(rollup, node->parent, &node->subtree, -1, 0);
+    if (node->prev_sibling != PROC_ROLLUP_NONE) {
+        rollup->nodes[node->prev_sibling].next_sibling = node->next_sibling;
+    } else {
+        rollup->nodes[node->parent].first_child = node->next_sibling;
+    }
+    if (node->next_sibling != PROC_ROLLUP_NONE) {
+        rollup->nodes[node->next_sibling].prev_sibling = node->prev_sibling;
+    }
+    node->parent = node->next_sibling = node->prev_sibling = PROC_ROLLUP_NONE;
+}
+
+// Hang an unlinked node under the process ppid, if it is there and not below the node itself
+static void link_node(struct proc_rollup *rollup, uint32_t index, pid_t ppid) {
+    uint32_t parent = find_node(rollup, ppid);
+    for (uint32_t up = parent; up != PROC_ROLLUP_NONE; up = rollup->nodes[up].parent) {
+        if (up == index) {
+            return;     // A cycle in a torn snapshot; leave it at the top level
+        }
+    }
+    if (parent == PROC_ROLLUP_NONE) {
+        return;
+    }
+
+    struct proc_rollup_node *node = &rollup->nodes[index];
+    node->parent = parent;
+    node->next_sibling = rollup->nodes[parent].first_child;
+    if (node->next_sibling != PROC_ROLLUP_NONE) {
+        rollup->nodes[node->next_sibling].prev_sibling = index;
+    }
+    rollup->nodes[parent].first_child = index;
+    add_to_chain(rollup, parent, &node->subtree, 1, 0);
+}
+
+// Drop the node of an exited process. Its own totals are already gone; the
+// children it still has become top-level until a diff reparents them.
+static void remove_node(struct proc_rollup *rollup, uint32_t index) {
+    struct proc_rollup_node *node = &rollup->nodes[index];
+    while (node->first_child != PROC_ROLLUP_NONE) {
+        unlink_node(rollup, node->first_child);
+    }
+    unlink_node(rollup, index);
+    delete_slot(rollup, find_node_slot(rollup, node->pid));
+    node->next_sibling = rollup->free_node;
+    rollup->free_node = index;
+}
+
+// Create an empty rollup of the given kind
+int proc_rollup_init(struct proc_rollup *rollup, int kind) {
+    memset(rollup, 0, sizeof(*rollup));
+    rollup->kind = kind;
+    rollup->free_node = PROC_ROLLUP_NONE;
+    rollup->slots = calloc(256, sizeof(*rollup->slots));
+    if (rollup->slots == NULL) {
+        return -1;
+    }
+    rollup->mask = 255;
+    return 0;
+}
+
+// Free the rollup
+void proc_rollup_destroy(struct proc_rollup *rollup) {
+    free(rollup->groups);
+    free(rollup->nodes);
+    free(rollup->slots);
+    memset(rollup, 0, sizeof(*rollup));
+}
+
+// Forget every process
+void proc_rollup_clear(struct proc_rollup *rollup) {
+    memset(rollup->slots, 0, (rollup->mask + 1) * sizeof(*rollup->slots));
+    rollup->used = 0;
+    rollup->group_count = 0;
+    rollup->node_count = 0;
+    rollup->free_node = PROC_ROLLUP_NONE;
+}
+
+// Move every changed process between groups
+static int apply_groups(struct proc_rollup *rollup, const struct proc_snapshot *old_snap,
+                        const struct proc_snapshot *new_snap, const struct proc_diff *diff) {
+    struct proc_rollup_totals totals;
+
+    // The last update's CPU usage no longer counts; there are few groups next to processes
+    for (size_t i = 0; i < rollup->group_count; i++) {
+        if (rollup->groups[i].totals.cpu_delta != 0) {
+            rollup->groups[i].totals.cpu_delta = 0;
+            rollup->groups[i].changed = rollup->update;
+        }
+    }
+
+    for (size_t i = 0; i < diff->count; i++) {
+        const struct proc_change *change = &diff->changes[i];
+        const struct proc_entry *old_entry = change->old_index != PROC_NO_INDEX ? &old_snap->entries[change->old_index] : NULL;
+        unsigned long long old_ticks = 0;
+
+        if (old_entry != NULL) {
+            uint32_t g = get_group(rollup, old_entry);
+            if (g == PROC_ROLLUP_NONE) {
+                return -1;
+            }
+            entry_totals(old_entry, &totals);
+            add_totals(&rollup->groups[g].totals, &totals, -1);
+            rollup->groups[g].changed = rollup->update;
+            old_ticks = totals.cpu_ticks;
+        }
+        if (change->new_index != PROC_NO_INDEX) {
+            uint32_t g = get_group(rollup, &new_snap->entries[change->new_index]);
+            if (g == PROC_ROLLUP_NONE) {
+                return -1;
+            }
+            // A process that just appeared used all of its time since the last snapshot
+            entry_totals(&new_snap->entries[change->new_index], &totals);
+            add_totals(&rollup->groups[g].totals, &totals, 1);
+            rollup->groups[g].totals.cpu_delta += totals.cpu_ticks > old_ticks ? totals.cpu_ticks - old_ticks : 0;
+            rollup->groups[g].changed = rollup->update;
+        }
+    }
+    return 0;
+}
+
+// Update the subtree totals: take the old values of every changed process out
+// of its ancestors, fix up the tree, then add the new values along the new ancestors
+static int apply_tree(struct proc_rollup *rollup, const struct proc_snapshot *old_snap,
+                      const struct proc_snapshot *new_snap, const struct proc_diff *diff) {
+    static const struct proc_rollup_totals zero;
+
+    for (size_t i = 0; i < diff->count; i++) {
+        const struct proc_change *change = &diff->changes[i];
+        uint32_t index = change->old_index != PROC_NO_INDEX ? find_node(rollup, change->pid) : PROC_ROLLUP_NONE;
+        if (index != PROC_ROLLUP_NONE) {
+            add_to_chain(rollup, index, &rollup->nodes[index].self, -1, 0);
+            rollup->nodes[index].self = zero;
+        }
+    }
+
+    // Exits first, so a reused PID gets a node of its own
+    for (size_t i = 0; i < diff->count; i++) {
+        const struct proc_change *change = &diff->changes[i];
+        uint32_t index = change->new_index == PROC_NO_INDEX ? find_node(rollup, change->pid) : PROC_ROLLUP_NONE;
+        if (index != PROC_ROLLUP_NONE) {
+            remove_node(rollup, index);
+        }
+    }
+    for (size_t i = 0; i < diff->count; i++) {
+        if (diff->changes[i].flags & PROC_CHANGE_ADDED && add_node(rollup, diff->changes[i].pid) == PROC_ROLLUP_NONE) {
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < diff->count; i++) {
+        const struct proc_change *change = &diff->changes[i];
+        if (change->flags & (PROC_CHANGE_ADDED | PROC_CHANGE_REPARENTED)) {
+            uint32_t index = find_node(rollup, change->pid);
+            if (index != PROC_ROLLUP_NONE) {
+                unlink_node(rollup, index);
+                link_node(rollup, index, new_snap->entries[change->new_index].ppid);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < diff->count; i++) {
+        const struct proc_change *change = &diff->changes[i];
+        if (change->new_index == PROC_NO_INDEX) {
+            continue;
+        }
+        uint32_t index = find_node(rollup, change->pid);
+        if (index == PROC_ROLLUP_NONE) {
+            continue;
+        }
+        struct proc_rollup_totals totals;
+        entry_totals(&new_snap->entries[change->new_index], &totals);
+        unsigned long long old_ticks = 0;
+        if (change->old_index != PROC_NO_INDEX) {
+            const struct proc_entry *old_entry = &old_snap->entries[change->old_index];
+            old_ticks = (unsigned long long) old_entry->utime + old_entry->stime;
+        }
+        rollup->nodes[index].self = totals;
+        add_to_chain(rollup, index, &totals, 1, totals.cpu_ticks > old_ticks ? totals.cpu_ticks - old_ticks : 0);
+    }
+    return 0;
+}
+
+// Apply the changes from old_snap to new_snap
+int proc_rollup_apply(struct proc_rollup *rollup, const struct proc_snapshot *old_snap,
+                      const struct proc_snapshot *new_snap, const struct proc_diff *diff) {
+    unsigned long long start = proc_stats_start();
+    rollup->update++;
+    int rc = rollup->kind == PROC_ROLLUP_TREE ? apply_tree(rollup, old_snap, new_snap, diff)
+                                              : apply_groups(rollup, old_snap, new_snap, diff);
+    proc_stats_count(PROC_STATS_ROLLUP, PROC_STATS_ROWS, diff->count);
+    proc_stats_stop(PROC_STATS_ROLLUP, start);
+    return rc;
+}
+
+// Totals of a process and its descendants
+int proc_rollup_subtree(const struct proc_rollup *rollup, pid_t pid, struct proc_rollup_totals *totals) {
+    uint32_t index = find_node(rollup, pid);
+    if (index == PROC_ROLLUP_NONE) {
+        return -1;
+    }
+    const struct proc_rollup_node *node = &rollup->nodes[index];
+    *totals = node->subtree;
+    if (node->delta_update != rollup->update) {
+        totals->cpu_delta = 0;  // Nothing below it ran in the last update
+    }
+    return 0;
+}
+
+// Parse the name of a rollup kind
+int proc_rollup_parse_kind(const char *name) {
+    if (strcmp(name, "user") == 0) {
+        return PROC_ROLLUP_USER;
+    }
+    if (strcmp(name, "comm") == 0) {
+        return PROC_ROLLUP_COMM;
+    }
+    if (strcmp(name, "tree") == 0) {
+        return PROC_ROLLUP_TREE;
+    }
+    return -1;
+}
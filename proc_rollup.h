@@ -0,0 +1,85 @@
+#ifndef PROC_ROLLUP_H
+#define PROC_ROLLUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "proc_diff.h"
+#include "proc_scan.h"
+
+// Aggregates of many processes, kept up to date from snapshot diffs: only the
+// processes in a diff are subtracted from their old group and added to their
+// new one, so an update costs O(changes), not O(processes).
+#define PROC_ROLLUP_USER    0   // One group per uid
+#define PROC_ROLLUP_COMM    1   // One group per command name
+#define PROC_ROLLUP_TREE    2   // Totals of every process and all of its descendants
+
+#define PROC_ROLLUP_NONE UINT32_MAX
+
+// What a group or subtree adds up to
+struct proc_rollup_totals {
+    unsigned long processes;
+    unsigned long threads;
+    unsigned long long rss_kb;
+    unsigned long long cpu_ticks;   // utime + stime of the processes in it now
+    unsigned long long cpu_delta;   // Ticks they used since the previous snapshot
+};
+
+// One user or command
+struct proc_rollup_group {
+    uid_t uid;                      // PROC_ROLLUP_USER
+    char comm[PROC_COMM_LEN];       // PROC_ROLLUP_COMM
+    struct proc_rollup_totals totals;
+    unsigned long long changed;     // Update in which the totals last changed
+};
+
+// One process of a PROC_ROLLUP_TREE, linked to its parent and children
+struct proc_rollup_node {
+    pid_t pid;
+    uint32_t parent;                // Node indexes, or PROC_ROLLUP_NONE
+    uint32_t first_child;
+    uint32_t next_sibling;          // Also links the free list
+    uint32_t prev_sibling;
+    unsigned long long delta_update;    // Update subtree.cpu_delta belongs to
+    struct proc_rollup_totals self;
+    struct proc_rollup_totals subtree;  // self plus every descendant
+};
+
+struct proc_rollup {
+    int kind;
+    unsigned long long update;      // Diffs applied so far
+    struct proc_rollup_group *groups;   // In order of first appearance; emptied groups stay
+    size_t group_count;
+    size_t group_capacity;
+    struct proc_rollup_node *nodes;
+    size_t node_count;              // Slots of nodes in use or on the free list
+    size_t node_capacity;
+    uint32_t free_node;
+    uint32_t *slots;                // Open-addressing table of group or node index + 1, 0 if empty
+    size_t mask;                    // Slot count - 1; the count is a power of two
+    size_t used;
+};
+
+// Create an empty rollup of the given kind; returns 0 or -1
+int proc_rollup_init(struct proc_rollup *rollup, int kind);
+
+// Free the rollup
+void proc_rollup_destroy(struct proc_rollup *rollup);
+
+// Forget every process, e.g. before applying a diff against an empty snapshot
+void proc_rollup_clear(struct proc_rollup *rollup);
+
+// Move the processes in diff from what they were in old_snap to what they are in
+// new_snap. The rollup must hold old_snap, i.e. be empty or have been updated
+// up to it. Returns 0 or -1 (out of memory; clear it and start over).
+int proc_rollup_apply(struct proc_rollup *rollup, const struct proc_snapshot *old_snap,
+                      const struct proc_snapshot *new_snap, const struct proc_diff *diff);
+
+// PROC_ROLLUP_TREE: the totals of a process and its descendants; returns 0, or
+// -1 if the process is not in the rollup
+int proc_rollup_subtree(const struct proc_rollup *rollup, pid_t pid, struct proc_rollup_totals *totals);
+
+// Parse "user", "comm" or "tree"; returns the kind or -1
+int proc_rollup_parse_kind(const char *name);
+
+#endif
@@ -0,0 +1,1049 @@
+#define _GNU_SOURCE
+#include "proc_scan.h"
+#include "proc_info_abi.h"
+#include "proc_stats.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+
+#define SCAN_BUF_SIZE 4096
+#define DENT_BUF_SIZE 32768
+#define TABLE_BUF_SIZE (1024 * 1024)
+#define MODULE_COLUMNS 11
+#define SCAN_CHUNK 64           // PIDs per unit of work for the worker pool
+#define MAX_SCAN_THREADS 64
+
+// Write "<pid>/<name>" into path without going through snprintf
+static void format_pid_path(char *path, pid_t pid, const char *name) {
+    char digits[16];
+    int n = 0;
+    unsigned int v = (unsigned int) pid;
+
+    do {
+        digits[n++] = (char) ('0' + v % 10);
+        v /= 10;
+    } while (v);
+
+    while (n) {
+        *path++ = digits[--n];
+    }
+    *path++ = '/';
+    while (*name) {
+        *path++ = *name++;
+    }
+    *path = '\0';
+}
+
+// Read a file below the proc root into buf; returns its length or -1
+static ssize_t read_proc_file(int proc_fd, char *buf, size_t buf_size, const char *path) {
+    unsigned long long start = proc_stats_start();
+    int fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        proc_stats_count(PROC_STATS_READ, PROC_STATS_SYSCALLS, 1);
+        return -1;
+    }
+
+    ssize_t len = pread(fd, buf, buf_size - 1, 0);
+    close(fd);
+    proc_stats_count(PROC_STATS_READ, PROC_STATS_SYSCALLS, 3);
+    proc_stats_stop(PROC_STATS_READ, start);
+    if (len < 0) {
+        return -1;
+    }
+
+    proc_stats_count(PROC_STATS_READ, PROC_STATS_BYTES, (unsigned long long) len);
+    buf[len] = '\0';
+    return len;
+}
+
+// Skip one space-separated field
+static const char *skip_field(const char *p, const char *end) {
+    while (p < end && *p != ' ') {
+        p++;
+    }
+    return p < end ? p + 1 : end;
+}
+
+// Parse an unsigned decimal number and advance past the separator that follows it
+static unsigned long long parse_ull(const char **pp, const char *end) {
+    const char *p = *pp;
+    unsigned long long v = 0;
+
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (unsigned long long) (*p - '0');
+        p++;
+    }
+    *pp = p < end ? p + 1 : end;
+    return v;
+}
+
+// Parse a signed decimal number and advance past the separator that follows it
+static long long parse_ll(const char **pp, const char *end) {
+    if (*pp < end && **pp == '-') {
+        (*pp)++;
+        return -(long long) parse_ull(pp, end);
+    }
+    return (long long) parse_ull(pp, end);
+}
+
+// Parse the interesting fields of /proc/[pid]/stat
+static int parse_stat(const char *buf, size_t len, struct proc_entry *entry, long page_kb) {
+    const char *end = buf + len;
+    const char *open = memchr(buf, '(', len);
+    const char *close = memrchr(buf, ')', len);
+    if (open == NULL || close == NULL || close < open || close + 2 >= end) {
+        return -1;
+    }
+
+    // The command name may contain spaces and parentheses, so it runs to the last ')'
+    size_t comm_len = (size_t) (close - open - 1);
+    if (comm_len >= PROC_COMM_LEN) {
+        comm_len = PROC_COMM_LEN - 1;
+    }
+    memcpy(entry->comm, open + 1, comm_len);
+    entry->comm[comm_len] = '\0';
+
+    const char *p = close + 2;
+    entry->state = *p;
+    p = skip_field(p, end);                         // 3 state
+    entry->ppid = (pid_t) parse_ll(&p, end);        // 4 ppid
+    for (int field = 5; field <= 13; field++) {     // 5 pgrp .. 13 cmajflt
+        p = skip_field(p, end);
+    }
+    entry->utime = (unsigned long) parse_ull(&p, end);     // 14 utime
+    entry->stime = (unsigned long) parse_ull(&p, end);     // 15 stime
+    p = skip_field(p, end);                                 // 16 cutime
+    p = skip_field(p, end);                                 // 17 cstime
+    entry->prio = (int) parse_ll(&p, end);                  // 18 priority
+    p = skip_field(p, end);                                 // 19 nice
+    entry->threads = (int) parse_ll(&p, end);               // 20 num_threads
+    p = skip_field(p, end);                                 // 21 itrealvalue
+    entry->start_time = parse_ull(&p, end);                 // 22 starttime
+    p = skip_field(p, end);                                 // 23 vsize
+    entry->rss_kb = (unsigned long) parse_ll(&p, end) * page_kb;  // 24 rss (pages)
+    return 0;
+}
+
+// Pull the real UID out of /proc/[pid]/status
+static uid_t parse_status_uid(const char *buf, size_t len) {
+    const char *line = memmem(buf, len, "\nUid:", 5);
+    if (line == NULL) {
+        return (uid_t) -1;
+    }
+
+    const char *end = buf + len;
+    const char *p = line + 5;
+    while (p < end && (*p == '\t' || *p == ' ')) {
+        p++;
+    }
+    return (uid_t) parse_ull(&p, end);
+}
+
+// Read a single process using the given buffer, so several threads can scan at once
+static int scan_pid_into(const struct proc_scanner *scanner, char *buf, pid_t pid, struct proc_entry *entry) {
+    char path[32];
+
+    entry->pid = pid;
+
+    format_pid_path(path, pid, "stat");
+    ssize_t len = read_proc_file(scanner->proc_fd, buf, SCAN_BUF_SIZE, path);
+    if (len <= 0) {
+        return -1;
+    }
+    unsigned long long start = proc_stats_start();
+    int rc = parse_stat(buf, (size_t) len, entry, scanner->page_kb);
+    proc_stats_stop(PROC_STATS_PARSE, start);
+    if (rc < 0) {
+        return -1;
+    }
+
+    entry->uid = (uid_t) -1;
+    if (scanner->skip_status) {
+        return 0;
+    }
+
+    format_pid_path(path, pid, "status");
+    len = read_proc_file(scanner->proc_fd, buf, SCAN_BUF_SIZE, path);
+    if (len <= 0) {
+        return -1;
+    }
+    start = proc_stats_start();
+    entry->uid = parse_status_uid(buf, (size_t) len);
+    proc_stats_stop(PROC_STATS_PARSE, start);
+    return 0;
+}
+
+// Read a single process from its stat and status files
+int proc_scan_pid(struct proc_scanner *scanner, pid_t pid, struct proc_entry *entry) {
+    return scan_pid_into(scanner, scanner->buf, pid, entry);
+}
+
+// Read the real UID of a process from its status file
+int proc_read_uid(struct proc_scanner *scanner, pid_t pid, uid_t *uid) {
+    char path[32];
+
+    format_pid_path(path, pid, "status");
+    ssize_t len = read_proc_file(scanner->proc_fd, scanner->buf, SCAN_BUF_SIZE, path);
+    if (len <= 0) {
+        return -1;
+    }
+    *uid = parse_status_uid(scanner->buf, (size_t) len);
+    return 0;
+}
+
+// Read the command line of a process with its arguments joined by spaces
+ssize_t proc_read_cmdline(struct proc_scanner *scanner, pid_t pid, char *out, size_t size) {
+    char path[32];
+
+    format_pid_path(path, pid, "cmdline");
+    ssize_t len = read_proc_file(scanner->proc_fd, out, size, path);
+    if (len < 0) {
+        return -1;
+    }
+
+    // The arguments are NUL-separated, usually with a trailing NUL
+    while (len > 0 && (out[len - 1] == '\0' || out[len - 1] == ' ')) {
+        len--;
+    }
+    for (ssize_t i = 0; i < len; i++) {
+        if (out[i] == '\0') {
+            out[i] = ' ';
+        }
+    }
+    out[len] = '\0';
+    return len;
+}
+
+// Value in kB of a "Name:   123 kB" line of smaps_rollup, or 0 if it is missing
+static unsigned long smaps_field(const char *buf, size_t len, const char *name) {
+    size_t name_len = strlen(name);
+    const char *p = buf;
+    const char *end = buf + len;
+
+    while ((p = memmem(p, (size_t) (end - p), name, name_len)) != NULL) {
+        // Only at the start of a line, so "Pss:" does not match "SwapPss:"
+        if (p == buf || p[-1] == '\n') {
+            p += name_len;
+            while (p < end && *p == ' ') {
+                p++;
+            }
+            return (unsigned long) parse_ull(&p, end);
+        }
+        p += name_len;
+    }
+    return 0;
+}
+
+// Read the memory totals of a process from its smaps_rollup file
+int proc_read_mem(struct proc_scanner *scanner, pid_t pid, struct proc_mem *mem) {
+    char path[32];
+
+    format_pid_path(path, pid, "smaps_rollup");
+    ssize_t len = read_proc_file(scanner->proc_fd, scanner->buf, SCAN_BUF_SIZE, path);
+    if (len < 0) {
+        return -1;
+    }
+
+    // Kernel threads have no mm, and an empty file
+    mem->pss_kb = smaps_field(scanner->buf, (size_t) len, "Pss:");
+    mem->uss_kb = smaps_field(scanner->buf, (size_t) len, "Private_Clean:") +
+                  smaps_field(scanner->buf, (size_t) len, "Private_Dirty:");
+    mem->swap_kb = smaps_field(scanner->buf, (size_t) len, "Swap:");
+    return 0;
+}
+
+// Count the open file descriptors of a process
+long proc_count_fds(struct proc_scanner *scanner, pid_t pid) {
+    char path[32];
+    struct stat st;
+
+    // Since Linux 6.2 the size of the fd directory is the descriptor count, so one stat does
+    format_pid_path(path, pid, "fd");
+    proc_stats_count(PROC_STATS_READ, PROC_STATS_SYSCALLS, 1);
+    if (fstatat(scanner->proc_fd, path, &st, 0) < 0) {
+        return -1;
+    }
+    if (scanner->procfs && st.st_size > 0) {
+        return (long) st.st_size;
+    }
+
+    // Older kernels report 0, and other file systems (a fixture) a size in bytes: list it
+    int fd = openat(scanner->proc_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    proc_stats_count(PROC_STATS_READ, PROC_STATS_SYSCALLS, 1);
+    if (fd < 0) {
+        return -1;
+    }
+    long count = 0;
+    for (;;) {
+        ssize_t n = getdents64(fd, scanner->dent_buf, scanner->dent_size);
+        proc_stats_count(PROC_STATS_READ, PROC_STATS_SYSCALLS, 1);
+        if (n <= 0) {
+            if (n < 0) {
+                count = -1;
+            }
+            break;
+        }
+        for (ssize_t off = 0; off < n;) {
+            struct dirent64 *d = (struct dirent64 *) (scanner->dent_buf + off);
+            off += d->d_reclen;
+            count += d->d_name[0] != '.';
+        }
+    }
+    close(fd);
+    proc_stats_count(PROC_STATS_READ, PROC_STATS_SYSCALLS, 1);
+    return count;
+}
+
+// Read /proc/[pid]/task/[tid]/stat of one thread
+static int scan_task(struct proc_scanner *scanner, pid_t pid, pid_t tid, struct proc_entry *entry) {
+    char path[64];
+
+    format_pid_path(path, pid, "task/");
+    format_pid_path(path + strlen(path), tid, "stat");
+    ssize_t len = read_proc_file(scanner->proc_fd, scanner->buf, SCAN_BUF_SIZE, path);
+    if (len <= 0) {
+        return -1;
+    }
+    unsigned long long start = proc_stats_start();
+    int rc = parse_stat(scanner->buf, (size_t) len, entry, scanner->page_kb);
+    proc_stats_stop(PROC_STATS_PARSE, start);
+
+    // A thread's stat carries the process's parent; what matters here is the process
+    entry->pid = tid;
+    entry->ppid = pid;
+    entry->uid = (uid_t) -1;
+    return rc;
+}
+
+// Read every thread of a process, in TID order
+int proc_scan_tasks(struct proc_scanner *scanner, pid_t pid, struct proc_snapshot *snap) {
+    char path[32];
+
+    snap->count = 0;
+    snap->generation++;
+    format_pid_path(path, pid, "task");
+    int fd = openat(scanner->proc_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    proc_stats_count(PROC_STATS_READDIR, PROC_STATS_SYSCALLS, 1);
+    if (fd < 0) {
+        return -1;
+    }
+
+    int rc = 0;
+    for (;;) {
+        ssize_t n = getdents64(fd, scanner->dent_buf, scanner->dent_size);
+        proc_stats_count(PROC_STATS_READDIR, PROC_STATS_SYSCALLS, 1);
+        if (n <= 0) {
+            rc = n < 0 ? -1 : 0;
+            break;
+        }
+        for (ssize_t off = 0; off < n && rc == 0;) {
+            struct dirent64 *d = (struct dirent64 *) (scanner->dent_buf + off);
+            off += d->d_reclen;
+
+            const char *p = d->d_name;
+            pid_t tid = 0;
+            while (*p >= '0' && *p <= '9') {
+                tid = tid * 10 + (*p - '0');
+                p++;
+            }
+            if (*p != '\0' || tid <= 0) {
+                continue;
+            }
+            if (proc_snapshot_reserve(snap, snap->count + 1) < 0) {
+                rc = -1;
+                break;
+            }
+
+            // Threads that exit meanwhile are dropped; the list comes in creation order,
+            // which is nearly TID order, so an insertion sort costs next to nothing
+            struct proc_entry entry;
+            if (scan_task(scanner, pid, tid, &entry) == 0) {
+                size_t i = snap->count++;
+                while (i > 0 && snap->entries[i - 1].pid > tid) {
+                    snap->entries[i] = snap->entries[i - 1];
+                    i--;
+                }
+                snap->entries[i] = entry;
+            }
+        }
+        if (rc < 0) {
+            break;
+        }
+    }
+    close(fd);
+    proc_stats_count(PROC_STATS_READDIR, PROC_STATS_SYSCALLS, 1);
+    proc_stats_count(PROC_STATS_READDIR, PROC_STATS_ROWS, snap->count);
+    return rc;
+}
+
+// One scan thread. Its chunks form a deque packed into one word: the owner
+// takes chunks from the front, idle workers steal from the back.
+struct scan_worker {
+    struct proc_scan_pool *pool;
+    pthread_t thread;
+    char *buf;                  // Private read buffer
+    _Atomic uint64_t range;     // (first chunk << 32) | end chunk
+};
+
+// Worker pool shared by all scans of one scanner; worker 0 is the calling thread
+struct proc_scan_pool {
+    struct proc_scanner *scanner;
+    size_t nworkers;
+    struct scan_worker *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned long job;          // Bumped for every scan
+    size_t running;             // Helper threads still busy with the current job
+    unsigned long long helper_cpu_ns;   // CPU time the helpers spent on the current job
+    int stop;
+    struct proc_snapshot *snap; // Output of the current job
+    size_t *chunk_counts;       // Entries found in each chunk
+    size_t chunk_capacity;
+};
+
+// Take the next chunk from the front of a worker's own deque, or return -1
+static long take_chunk(struct scan_worker *worker) {
+    uint64_t range = atomic_load(&worker->range);
+    for (;;) {
+        uint32_t first = (uint32_t) (range >> 32);
+        uint32_t end = (uint32_t) range;
+        if (first >= end) {
+            return -1;
+        }
+        if (atomic_compare_exchange_weak(&worker->range, &range, ((uint64_t) (first + 1) << 32) | end)) {
+            return first;
+        }
+    }
+}
+
+// Steal a chunk from the back of another worker's deque, or return -1
+static long steal_chunk(struct scan_worker *victim) {
+    uint64_t range = atomic_load(&victim->range);
+    for (;;) {
+        uint32_t first = (uint32_t) (range >> 32);
+        uint32_t end = (uint32_t) range;
+        if (first >= end) {
+            return -1;
+        }
+        if (atomic_compare_exchange_weak(&victim->range, &range, ((uint64_t) first << 32) | (end - 1))) {
+            return end - 1;
+        }
+    }
+}
+
+// Scan one chunk of PIDs into its own slice of the snapshot
+static void scan_chunk(struct proc_scan_pool *pool, struct scan_worker *worker, size_t chunk) {
+    struct proc_scanner *scanner = pool->scanner;
+    size_t first = chunk * SCAN_CHUNK;
+    size_t last = first + SCAN_CHUNK < scanner->pid_count ? first + SCAN_CHUNK : scanner->pid_count;
+    struct proc_entry *out = &pool->snap->entries[first];
+    size_t n = 0;
+
+    for (size_t i = first; i < last; i++) {
+        if (scan_pid_into(scanner, worker->buf, scanner->pids[i], &out[n]) == 0) {
+            n++;
+        }
+    }
+    pool->chunk_counts[chunk] = n;
+}
+
+// Work through our own chunks, then help the others until nothing is left
+static void run_worker(struct proc_scan_pool *pool, size_t index) {
+    struct scan_worker *worker = &pool->workers[index];
+    long chunk;
+
+    while ((chunk = take_chunk(worker)) >= 0) {
+        scan_chunk(pool, worker, (size_t) chunk);
+    }
+    for (size_t k = 1; k < pool->nworkers; k++) {
+        struct scan_worker *victim = &pool->workers[(index + k) % pool->nworkers];
+        while ((chunk = steal_chunk(victim)) >= 0) {
+            scan_chunk(pool, worker, (size_t) chunk);
+        }
+    }
+}
+
+// Helper thread: wait for a job, run it, report back
+static void *pool_thread(void *arg) {
+    struct scan_worker *worker = arg;
+    struct proc_scan_pool *pool = worker->pool;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && pool->job == seen) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->stop) {
+            break;
+        }
+        seen = pool->job;
+        pthread_mutex_unlock(&pool->lock);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+        run_worker(pool, (size_t) (worker - pool->workers));
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->helper_cpu_ns += (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+        if (--pool->running == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Stop and free the worker pool, if there is one
+static void stop_pool(struct proc_scanner *scanner) {
+    struct proc_scan_pool *pool = scanner->pool;
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 1; i < pool->nworkers; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (size_t i = 1; i < pool->nworkers; i++) {
+        free(pool->workers[i].buf);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool->chunk_counts);
+    free(pool);
+    scanner->pool = NULL;
+}
+
+// Start nworkers - 1 helper threads; returns NULL if they cannot be started
+static struct proc_scan_pool *start_pool(struct proc_scanner *scanner, size_t nworkers) {
+    struct proc_scan_pool *pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->workers = calloc(nworkers, sizeof(*pool->workers));
+    if (pool->workers == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    pool->scanner = scanner;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->workers[0].pool = pool;
+    pool->workers[0].buf = scanner->buf;
+    pool->nworkers = 1;
+    scanner->pool = pool;
+
+    for (size_t i = 1; i < nworkers; i++) {
+        struct scan_worker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->buf = malloc(SCAN_BUF_SIZE);
+        if (worker->buf == NULL || pthread_create(&worker->thread, NULL, pool_thread, worker) != 0) {
+            free(worker->buf);
+            worker->buf = NULL;
+            break;
+        }
+        pool->nworkers++;
+    }
+
+    // Not even one helper: scanning stays on the calling thread
+    if (pool->nworkers == 1) {
+        stop_pool(scanner);
+        return NULL;
+    }
+    return pool;
+}
+
+// Set the number of scan threads
+void proc_scanner_set_threads(struct proc_scanner *scanner, size_t threads) {
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (size_t) cpus : 1;
+    }
+    if (threads > MAX_SCAN_THREADS) {
+        threads = MAX_SCAN_THREADS;
+    }
+    if (scanner->pool != NULL && scanner->pool->nworkers != threads) {
+        stop_pool(scanner);
+    }
+    scanner->threads = threads;
+}
+
+// Scan scanner->pids with the worker pool; returns 0, or -1 to fall back to one thread
+static int scan_parallel(struct proc_scanner *scanner, struct proc_snapshot *snap) {
+    size_t nchunks = (scanner->pid_count + SCAN_CHUNK - 1) / SCAN_CHUNK;
+    struct proc_scan_pool *pool = scanner->pool;
+
+    if (pool == NULL && (pool = start_pool(scanner, scanner->threads)) == NULL) {
+        scanner->threads = 1;   // Do not retry on every refresh
+        return -1;
+    }
+    if (pool->chunk_capacity < nchunks) {
+        size_t *counts = realloc(pool->chunk_counts, nchunks * sizeof(*counts));
+        if (counts == NULL) {
+            return -1;
+        }
+        pool->chunk_counts = counts;
+        pool->chunk_capacity = nchunks;
+    }
+
+    // Hand every worker an even, contiguous share of the chunks to start with
+    for (size_t w = 0; w < pool->nworkers; w++) {
+        uint64_t first = nchunks * w / pool->nworkers;
+        uint64_t end = nchunks * (w + 1) / pool->nworkers;
+        atomic_store(&pool->workers[w].range, (first << 32) | end);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->snap = snap;
+    pool->running = pool->nworkers - 1;
+    pool->helper_cpu_ns = 0;
+    pool->job++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_worker(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    scanner->helper_cpu_ns = pool->helper_cpu_ns;
+    pthread_mutex_unlock(&pool->lock);
+
+    // Merge the slices in chunk order, so the result does not depend on who scanned what
+    size_t count = 0;
+    for (size_t chunk = 0; chunk < nchunks; chunk++) {
+        size_t n = pool->chunk_counts[chunk];
+        if (n > 0 && count != chunk * SCAN_CHUNK) {
+            memmove(&snap->entries[count], &snap->entries[chunk * SCAN_CHUNK], n * sizeof(*snap->entries));
+        }
+        count += n;
+    }
+    snap->count = count;
+    return 0;
+}
+
+// Open the proc root and allocate the scan buffers
+int proc_scanner_init(struct proc_scanner *scanner, const char *root) {
+    memset(scanner, 0, sizeof(*scanner));
+    scanner->module_fd = -1;
+
+    scanner->proc_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (scanner->proc_fd < 0) {
+        return -1;
+    }
+
+    struct statfs fs;
+    scanner->procfs = fstatfs(scanner->proc_fd, &fs) == 0 && fs.f_type == PROC_SUPER_MAGIC;
+    scanner->page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    scanner->threads = 1;
+    scanner->buf_size = SCAN_BUF_SIZE;
+    scanner->buf = malloc(scanner->buf_size);
+    scanner->dent_size = DENT_BUF_SIZE;
+    scanner->dent_buf = malloc(scanner->dent_size);
+    if (scanner->buf == NULL || scanner->dent_buf == NULL) {
+        proc_scanner_destroy(scanner);
+        errno = ENOMEM;
+        return -1;
+    }
+    return 0;
+}
+
+// Close the proc root and free the scan buffers
+void proc_scanner_destroy(struct proc_scanner *scanner) {
+    stop_pool(scanner);
+    if (scanner->proc_fd >= 0) {
+        close(scanner->proc_fd);
+    }
+    if (scanner->module_fd >= 0) {
+        close(scanner->module_fd);
+    }
+    free(scanner->buf);
+    free(scanner->dent_buf);
+    free(scanner->pids);
+    free(scanner->pid_scratch);
+    free(scanner->table_buf);
+    memset(scanner, 0, sizeof(*scanner));
+    scanner->proc_fd = -1;
+    scanner->module_fd = -1;
+}
+
+// Sort PIDs with a bottom-up merge sort through a scratch array of the same size.
+// Unlike qsort, which allocates its own temporary, this reuses scanner memory.
+static void sort_pids(pid_t *pids, pid_t *scratch, size_t count) {
+    pid_t *from = pids;
+    pid_t *to = scratch;
+
+    for (size_t width = 1; width < count; width *= 2) {
+        for (size_t lo = 0; lo < count; lo += 2 * width) {
+            size_t mid = lo + width < count ? lo + width : count;
+            size_t hi = mid + width < count ? mid + width : count;
+            size_t i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) {
+                to[k++] = from[j] < from[i] ? from[j++] : from[i++];
+            }
+            while (i < mid) {
+                to[k++] = from[i++];
+            }
+            while (j < hi) {
+                to[k++] = from[j++];
+            }
+        }
+        pid_t *tmp = from;
+        from = to;
+        to = tmp;
+    }
+    if (from != pids) {
+        memcpy(pids, from, count * sizeof(*pids));
+    }
+}
+
+// Collect the numeric entries of the proc root into scanner->pids
+static int collect_pids(struct proc_scanner *scanner) {
+    int sorted = 1;
+
+    scanner->pid_count = 0;
+    proc_stats_count(PROC_STATS_READDIR, PROC_STATS_SYSCALLS, 1);
+    if (lseek(scanner->proc_fd, 0, SEEK_SET) < 0) {
+        return -1;
+    }
+
+    for (;;) {
+        ssize_t n = getdents64(scanner->proc_fd, scanner->dent_buf, scanner->dent_size);
+        proc_stats_count(PROC_STATS_READDIR, PROC_STATS_SYSCALLS, 1);
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        proc_stats_count(PROC_STATS_READDIR, PROC_STATS_BYTES, (unsigned long long) n);
+
+        for (ssize_t off = 0; off < n;) {
+            struct dirent64 *d = (struct dirent64 *) (scanner->dent_buf + off);
+            off += d->d_reclen;
+
+            if (d->d_type != DT_DIR && d->d_type != DT_UNKNOWN) {
+                continue;
+            }
+
+            const char *p = d->d_name;
+            pid_t pid = 0;
+            while (*p >= '0' && *p <= '9') {
+                pid = pid * 10 + (*p - '0');
+                p++;
+            }
+            if (*p != '\0' || pid <= 0) {
+                continue;
+            }
+
+            if (scanner->pid_count == scanner->pid_capacity) {
+                size_t capacity = scanner->pid_capacity ? scanner->pid_capacity * 2 : 1024;
+                pid_t *pids = realloc(scanner->pids, capacity * sizeof(*pids));
+                if (pids == NULL) {
+                    return -1;
+                }
+                scanner->pids = pids;
+                pid_t *scratch = realloc(scanner->pid_scratch, capacity * sizeof(*scratch));
+                if (scratch == NULL) {
+                    return -1;
+                }
+                scanner->pid_scratch = scratch;
+                scanner->pid_capacity = capacity;
+                proc_stats_count(PROC_STATS_READDIR, PROC_STATS_ALLOCS, 2);
+            }
+            if (scanner->pid_count > 0 && scanner->pids[scanner->pid_count - 1] > pid) {
+                sorted = 0;
+            }
+            scanner->pids[scanner->pid_count++] = pid;
+        }
+    }
+
+    // The kernel hands out PIDs in ascending order, but lookups rely on it, so make sure
+    if (!sorted) {
+        sort_pids(scanner->pids, scanner->pid_scratch, scanner->pid_count);
+    }
+    proc_stats_count(PROC_STATS_READDIR, PROC_STATS_ROWS, scanner->pid_count);
+    return 0;
+}
+
+// Make room for at least count entries in the snapshot
+int proc_snapshot_reserve(struct proc_snapshot *snap, size_t count) {
+    if (snap->capacity >= count) {
+        return 0;
+    }
+    if (snap->borrowed) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    size_t capacity = snap->capacity ? snap->capacity : 1024;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    struct proc_entry *entries = realloc(snap->entries, capacity * sizeof(*entries));
+    if (entries == NULL) {
+        return -1;
+    }
+    snap->entries = entries;
+    snap->capacity = capacity;
+    proc_stats_count(PROC_STATS_SCAN, PROC_STATS_ALLOCS, 1);
+    return 0;
+}
+
+// Read every process into the snapshot
+int proc_scan_snapshot(struct proc_scanner *scanner, struct proc_snapshot *snap) {
+    unsigned long long start = proc_stats_start();
+
+    snap->count = 0;
+    snap->generation++;
+
+    unsigned long long walk = proc_stats_start();
+    if (collect_pids(scanner) < 0) {
+        return -1;
+    }
+    proc_stats_stop(PROC_STATS_READDIR, walk);
+    if (proc_snapshot_reserve(snap, scanner->pid_count) < 0) {
+        return -1;
+    }
+
+    scanner->helper_cpu_ns = 0;
+
+    // Only worth waking the pool when every thread gets a couple of chunks
+    if (!(scanner->threads > 1 && scanner->pid_count >= scanner->threads * SCAN_CHUNK * 2 &&
+          scan_parallel(scanner, snap) == 0)) {
+        for (size_t i = 0; i < scanner->pid_count; i++) {
+            struct proc_entry *entry = &snap->entries[snap->count];
+            // Processes that exit between readdir and the read are simply dropped
+            if (proc_scan_pid(scanner, scanner->pids[i], entry) == 0) {
+                snap->count++;
+            }
+        }
+    }
+    proc_stats_count(PROC_STATS_SCAN, PROC_STATS_ROWS, snap->count);
+    proc_stats_stop(PROC_STATS_SCAN, start);
+    return 0;
+}
+
+// Close the module table after a failed read, forgetting it if it was the filtered one; returns -1
+static ssize_t close_module_table(struct proc_scanner *scanner, int fd) {
+    int saved = errno;
+    if (fd == scanner->module_fd) {
+        scanner->module_fd = -1;
+    }
+    close(fd);
+    errno = saved;
+    return -1;
+}
+
+// Read the whole module table into scanner->table_buf; returns its length or -1
+static ssize_t read_module_table(struct proc_scanner *scanner, const char *path, const char *filter) {
+    // A filtered read rewinds the file the last one used: the module keeps the CPU
+    // baseline of mincpu= and since= per open file
+    int fd = filter != NULL ? scanner->module_fd : -1;
+    if (fd >= 0) {
+        if (lseek(fd, 0, SEEK_SET) < 0) {
+            return close_module_table(scanner, fd);
+        }
+    } else {
+        fd = open(path, (filter ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+        if (fd < 0) {
+            proc_stats_count(PROC_STATS_MODULE, PROC_STATS_SYSCALLS, 1);
+            return -1;
+        }
+        if (filter != NULL) {
+            scanner->module_fd = fd;
+        }
+    }
+
+    // Opening or rewinding the file, then writing the filter or closing an unfiltered file
+    proc_stats_count(PROC_STATS_MODULE, PROC_STATS_SYSCALLS, 2);
+
+    // Each read writes the filter again, which replaces the last one but keeps the baseline
+    if (filter && write(fd, filter, strlen(filter)) < 0) {
+        return close_module_table(scanner, fd);
+    }
+
+    size_t used = 0;
+    for (;;) {
+        // Keep room for the terminating NUL and a decent read size
+        if (scanner->table_size - used < 65536) {
+            size_t size = scanner->table_size ? scanner->table_size * 2 : TABLE_BUF_SIZE;
+            char *buf = realloc(scanner->table_buf, size);
+            if (buf == NULL) {
+                return close_module_table(scanner, fd);
+            }
+            scanner->table_buf = buf;
+            scanner->table_size = size;
+            proc_stats_count(PROC_STATS_MODULE, PROC_STATS_ALLOCS, 1);
+        }
+
+        ssize_t n = read(fd, scanner->table_buf + used, scanner->table_size - used - 1);
+        proc_stats_count(PROC_STATS_MODULE, PROC_STATS_SYSCALLS, 1);
+        if (n < 0) {
+            return close_module_table(scanner, fd);
+        }
+        if (n == 0) {
+            break;
+        }
+        used += (size_t) n;
+    }
+
+    if (fd != scanner->module_fd) {
+        close(fd);
+    }
+    proc_stats_count(PROC_STATS_MODULE, PROC_STATS_BYTES, used);
+    scanner->table_buf[used] = '\0';
+    return (ssize_t) used;
+}
+
+// Split one "| a | b | ... |" row into its columns; returns the column count
+static int split_module_row(const char *line, const char *end, const char **cols, const char **col_ends) {
+    int n = 0;
+    const char *p = line;
+
+    while (p < end && n < MODULE_COLUMNS) {
+        if (*p != '|') {
+            return n;
+        }
+        p++;
+        while (p < end && *p == ' ') {
+            p++;
+        }
+
+        // The command is the last column and may itself contain '|', so it runs to the final one
+        const char *stop = n == MODULE_COLUMNS - 1 ? memrchr(p, '|', (size_t) (end - p)) : memchr(p, '|', (size_t) (end - p));
+        if (stop == NULL) {
+            return n;
+        }
+
+        const char *col_end = stop;
+        while (col_end > p && col_end[-1] == ' ') {
+            col_end--;
+        }
+        cols[n] = p;
+        col_ends[n] = col_end;
+        n++;
+        p = stop;
+    }
+    return n;
+}
+
+// Build the snapshot from one read of the proc_info module table
+int proc_scan_module(struct proc_scanner *scanner, const char *path, const char *filter,
+                     struct proc_snapshot *snap) {
+    unsigned long long start = proc_stats_start();
+    snap->count = 0;
+
+    ssize_t len = read_module_table(scanner, path, filter);
+    if (len < 0) {
+        return -1;
+    }
+    proc_stats_stop(PROC_STATS_MODULE, start);
+    unsigned long long parse = proc_stats_start();
+
+    long ticks_per_sec = sysconf(_SC_CLK_TCK);
+    unsigned long long ns_per_tick = 1000000000ULL / (unsigned long long) ticks_per_sec;
+    const char *p = scanner->table_buf;
+    const char *end = p + len;
+
+    while (p < end) {
+        const char *eol = memchr(p, '\n', (size_t) (end - p));
+        if (eol == NULL) {
+            eol = end;
+        }
+
+        if (eol - p > 13 && memcmp(p, "# generation ", 13) == 0) {
+            const char *q = p + 13;
+            snap->generation = parse_ull(&q, eol);
+            p = eol + 1;
+            continue;
+        }
+
+        const char *cols[MODULE_COLUMNS];
+        const char *col_ends[MODULE_COLUMNS];
+        if (split_module_row(p, eol, cols, col_ends) == MODULE_COLUMNS) {
+            if (proc_snapshot_reserve(snap, snap->count + 1) < 0) {
+                return -1;
+            }
+
+            struct proc_entry *entry = &snap->entries[snap->count];
+            const char *q;
+
+            q = cols[0]; entry->pid = (pid_t) parse_ll(&q, col_ends[0]);
+            q = cols[1]; entry->ppid = (pid_t) parse_ll(&q, col_ends[1]);
+            q = cols[2]; entry->uid = (uid_t) parse_ull(&q, col_ends[2]);
+            q = cols[3]; entry->prio = (int) parse_ll(&q, col_ends[3]) - PROC_INFO_PRIO_OFFSET;
+            entry->state = *cols[4];
+            q = cols[5]; entry->threads = (int) parse_ll(&q, col_ends[5]);
+            q = cols[6]; entry->rss_kb = (unsigned long) parse_ull(&q, col_ends[6]);
+            q = cols[7]; entry->utime = (unsigned long) (parse_ull(&q, col_ends[7]) / ns_per_tick);
+            q = cols[8]; entry->stime = (unsigned long) (parse_ull(&q, col_ends[8]) / ns_per_tick);
+            q = cols[9]; entry->start_time = parse_ull(&q, col_ends[9]) / ns_per_tick;
+
+            size_t comm_len = (size_t) (col_ends[10] - cols[10]);
+            if (comm_len >= PROC_COMM_LEN) {
+                comm_len = PROC_COMM_LEN - 1;
+            }
+            memcpy(entry->comm, cols[10], comm_len);
+            entry->comm[comm_len] = '\0';
+
+            snap->count++;
+        }
+        p = eol + 1;
+    }
+    proc_stats_stop(PROC_STATS_PARSE, parse);
+    proc_stats_count(PROC_STATS_SCAN, PROC_STATS_ROWS, snap->count);
+    proc_stats_stop(PROC_STATS_SCAN, start);
+    return 0;
+}
+
+// Find a process in a snapshot by PID
+struct proc_entry *proc_snapshot_find(const struct proc_snapshot *snap, pid_t pid) {
+    size_t lo = 0;
+    size_t hi = snap->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        pid_t cur = snap->entries[mid].pid;
+        if (cur == pid) {
+            return &snap->entries[mid];
+        }
+        if (cur < pid) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+// Free the snapshot storage
+void proc_snapshot_free(struct proc_snapshot *snap) {
+    if (!snap->borrowed) {
+        free(snap->entries);
+    }
+    memset(snap, 0, sizeof(*snap));
+}
@@ -0,0 +1,116 @@
+#ifndef PROC_SCAN_H
+#define PROC_SCAN_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define PROC_COMM_LEN 16
+
+// One process as read from /proc/[pid]/stat and /proc/[pid]/status
+struct proc_entry {
+    pid_t pid;
+    pid_t ppid;
+    uid_t uid;                      // Real UID, (uid_t) -1 if unknown
+    int prio;                       // Priority field of /proc/[pid]/stat
+    char state;                     // R, S, D, Z, ...
+    int threads;
+    unsigned long rss_kb;           // Resident set size in kB
+    unsigned long utime;            // User time in clock ticks
+    unsigned long stime;            // System time in clock ticks
+    unsigned long long start_time;  // Start time in clock ticks since boot
+    char comm[PROC_COMM_LEN];
+};
+
+// Memory of a process from /proc/[pid]/smaps_rollup, in kB
+struct proc_mem {
+    unsigned long pss_kb;           // Proportional set size: shared pages divided among their users
+    unsigned long uss_kb;           // Unique set size: Private_Clean + Private_Dirty
+    unsigned long swap_kb;
+};
+
+// A flat array of processes sorted by PID
+struct proc_snapshot {
+    struct proc_entry *entries;
+    size_t count;
+    size_t capacity;
+    unsigned long long generation;  // Module generation, or a scan counter without the module
+    int borrowed;                   // entries belong to someone else (a shared segment): never grown or freed
+};
+
+struct proc_scan_pool;
+
+// Scanner state; all buffers are reused between scans
+struct proc_scanner {
+    int proc_fd;            // Directory fd of the proc root
+    long page_kb;           // Page size in kB, for the RSS field of stat
+    char *buf;              // Read buffer for stat/status files
+    size_t buf_size;
+    char *dent_buf;         // getdents64 buffer
+    size_t dent_size;
+    pid_t *pids;            // PIDs found by the last directory walk
+    pid_t *pid_scratch;     // Same capacity as pids, for sorting them
+    size_t pid_count;
+    size_t pid_capacity;
+    char *table_buf;        // Whole contents of the module table
+    size_t table_size;
+    int module_fd;          // The module table opened for filtered reads, kept open so its CPU baseline lasts; -1 until then
+    size_t threads;         // Scan threads; 1 scans on the calling thread only
+    int skip_status;        // Read stat only and leave uid unknown: a cheaper skeleton scan
+    int procfs;             // The root is a real procfs, not a directory tree like proc_fixture's
+    struct proc_scan_pool *pool;    // Worker threads, started on the first parallel scan
+    unsigned long long helper_cpu_ns;   // CPU time the worker threads spent on the last scan
+};
+
+// Open the proc root (normally "/proc") and allocate the scan buffers
+int proc_scanner_init(struct proc_scanner *scanner, const char *root);
+
+// Close the proc root and free the scan buffers
+void proc_scanner_destroy(struct proc_scanner *scanner);
+
+// Set the number of scan threads: 0 means one per online CPU, 1 disables the worker pool
+void proc_scanner_set_threads(struct proc_scanner *scanner, size_t threads);
+
+// Read a single process; returns 0 on success, -1 if it is gone or unreadable
+int proc_scan_pid(struct proc_scanner *scanner, pid_t pid, struct proc_entry *entry);
+
+// Read the real UID of a process from /proc/[pid]/status; returns 0 or -1
+int proc_read_uid(struct proc_scanner *scanner, pid_t pid, uid_t *uid);
+
+// Read /proc/[pid]/cmdline into out (at most size - 1 bytes) with the arguments
+// joined by spaces; returns its length (0 for kernel threads) or -1
+ssize_t proc_read_cmdline(struct proc_scanner *scanner, pid_t pid, char *out, size_t size);
+
+// Read /proc/[pid]/smaps_rollup; returns 0 or -1 (gone, or another user's process
+// without CAP_SYS_PTRACE). The kernel walks the page tables for this, so it costs
+// far more than stat.
+int proc_read_mem(struct proc_scanner *scanner, pid_t pid, struct proc_mem *mem);
+
+// Count the open file descriptors of a process; returns the count or -1
+long proc_count_fds(struct proc_scanner *scanner, pid_t pid);
+
+// Read every thread of a process from /proc/[pid]/task into the snapshot, sorted
+// by TID. Each entry's pid is the thread ID and its ppid the process; uid is left
+// unknown. Returns 0 or -1 (the process is gone).
+int proc_scan_tasks(struct proc_scanner *scanner, pid_t pid, struct proc_snapshot *snap);
+
+// Read every process into the snapshot, reusing its storage; returns 0 or -1
+int proc_scan_snapshot(struct proc_scanner *scanner, struct proc_snapshot *snap);
+
+// Build the snapshot from one read of the proc_info module table at path; returns 0 or -1.
+// A non-NULL filter (e.g. "uid=1000 since=42") is written to the file first so the
+// module only emits matching tasks. Filtered reads share one open file, because the
+// module measures mincpu= and since= against the previous pass of the same file.
+int proc_scan_module(struct proc_scanner *scanner, const char *path, const char *filter,
+                     struct proc_snapshot *snap);
+
+// Make room for at least count entries in the snapshot; returns 0 or -1
+// (ENOSPC for a borrowed snapshot that is too small)
+int proc_snapshot_reserve(struct proc_snapshot *snap, size_t count);
+
+// Find a process in a snapshot by PID (binary search), or NULL
+struct proc_entry *proc_snapshot_find(const struct proc_snapshot *snap, pid_t pid);
+
+// Free the snapshot storage
+void proc_snapshot_free(struct proc_snapshot *snap);
+
+#endif
@@ -0,0 +1,283 @@
+#include "proc_screen.h"
+#include "proc_stats.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#define RUN_GAP 6       // Unchanged cells worth resending rather than moving the cursor over
+
+static volatile sig_atomic_t resized = 0;
+
+// SIGWINCH: only note it; the next read_key or flush picks the new size up
+static void handle_sigwinch(int sig) {
+    (void) sig;
+    resized = 1;
+}
+
+// Size the grids to the terminal; everything has to be drawn again afterwards
+static int update_size(struct proc_screen *screen) {
+    struct winsize ws;
+    int rows = 24, cols = 80;
+
+    if (ioctl(screen->out_fd, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+        rows = ws.ws_row;
+        cols = ws.ws_col;
+    }
+    size_t cells = (size_t) rows * (size_t) cols;
+    char *grid = realloc(screen->cells, cells * 2);
+    if (grid == NULL) {
+        return -1;
+    }
+    screen->cells = grid;
+    screen->shown = grid + cells;
+    unsigned char *attrs = realloc(screen->attrs, cells * 2);
+    if (attrs == NULL) {
+        return -1;
+    }
+    screen->attrs = attrs;
+    screen->shown_attrs = attrs + cells;
+
+    // Worst case of one flush: a move and an attribute change per cell
+    size_t out_size = cells * 16 + 64;
+    char *out = realloc(screen->out, out_size);
+    if (out == NULL) {
+        return -1;
+    }
+    screen->out = out;
+    screen->out_size = out_size;
+    screen->rows = rows;
+    screen->cols = cols;
+    screen->valid = 0;
+    proc_stats_count(PROC_STATS_VIEW, PROC_STATS_ALLOCS, 3);
+    return 0;
+}
+
+// Write all of buf, retrying short writes
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        proc_stats_count(PROC_STATS_VIEW, PROC_STATS_SYSCALLS, 1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+// Take over the terminal
+int proc_screen_open(struct proc_screen *screen, int in_fd, int out_fd) {
+    memset(screen, 0, sizeof(*screen));
+    screen->in_fd = in_fd;
+    screen->out_fd = out_fd;
+    if (tcgetattr(in_fd, &screen->saved) < 0 || update_size(screen) < 0) {
+        proc_screen_close(screen);
+        return -1;
+    }
+
+    // Keys arrive one at a time without echo; signals keep working
+    struct termios raw = screen->saved;
+    raw.c_lflag &= ~(tcflag_t) (ICANON | ECHO);
+    raw.c_cc[VMIN] = 0;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(in_fd, TCSANOW, &raw);
+
+    // No SA_RESTART, so a resize wakes up a poll in proc_screen_read_key
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_sigwinch;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGWINCH, &sa, NULL);
+
+    static const char enter[] = "\033[?1049h\033[?25l\033[0m";
+    return write_all(out_fd, enter, sizeof(enter) - 1);
+}
+
+// Give the terminal back as it was
+void proc_screen_close(struct proc_screen *screen) {
+    static const char leave[] = "\033[0m\033[?25h\033[?1049l";
+
+    if (screen->cells != NULL) {
+        signal(SIGWINCH, SIG_DFL);
+        write_all(screen->out_fd, leave, sizeof(leave) - 1);
+        tcsetattr(screen->in_fd, TCSANOW, &screen->saved);
+    }
+    free(screen->cells);
+    free(screen->attrs);
+    free(screen->out);
+    memset(screen, 0, sizeof(*screen));
+}
+
+// Blank the frame
+void proc_screen_begin(struct proc_screen *screen) {
+    // A resize noticed by a signal that arrived while drawing takes effect here
+    if (resized) {
+        resized = 0;
+        update_size(screen);
+    }
+    size_t cells = (size_t) screen->rows * (size_t) screen->cols;
+    memset(screen->cells, ' ', cells);
+    memset(screen->attrs, PROC_SCREEN_NORMAL, cells);
+    screen->row = 0;
+    screen->col = 0;
+    screen->attr = PROC_SCREEN_NORMAL;
+}
+
+// Set the attribute of the next text
+void proc_screen_attr(struct proc_screen *screen, unsigned char attr) {
+    screen->attr = attr;
+}
+
+// Put text into the frame, clipped to the window
+void proc_screen_write(struct proc_screen *screen, const char *text, size_t len) {
+    for (size_t i = 0; i < len && screen->row < screen->rows; i++) {
+        unsigned char c = (unsigned char) text[i];
+        if (c == '\n') {
+            screen->row++;
+            screen->col = 0;
+            continue;
+        }
+        if (screen->col < screen->cols) {
+            // One byte is one cell, so anything else than printable ASCII is shown as '?'
+            size_t cell = (size_t) screen->row * (size_t) screen->cols + (size_t) screen->col;
+            screen->cells[cell] = c >= 0x20 && c < 0x7f ? (char) c : '?';
+            screen->attrs[cell] = screen->attr;
+        }
+        screen->col++;
+    }
+}
+
+// Append a cursor move to row, col (both from 0)
+static size_t put_move(char *out, int row, int col) {
+    return (size_t) sprintf(out, "\033[%d;%dH", row + 1, col + 1);
+}
+
+// Send what differs from the shown frame
+int proc_screen_flush(struct proc_screen *screen) {
+    int cols = screen->cols;
+    size_t len = 0;
+
+    // After a resize the terminal's contents are unknown: clear it and diff against blank
+    if (!screen->valid) {
+        size_t cells = (size_t) screen->rows * (size_t) cols;
+        memset(screen->shown, ' ', cells);
+        memset(screen->shown_attrs, PROC_SCREEN_NORMAL, cells);
+        len += (size_t) sprintf(screen->out + len, "\033[0m\033[2J");
+        screen->pen = PROC_SCREEN_NORMAL;
+        screen->valid = 1;
+    }
+
+    int cur_row = -1, cur_col = -1;
+    for (int r = 0; r < screen->rows; r++) {
+        size_t base = (size_t) r * (size_t) cols;
+        const char *cells = screen->cells + base;
+        const unsigned char *attrs = screen->attrs + base;
+        const char *shown = screen->shown + base;
+        const unsigned char *shown_attrs = screen->shown_attrs + base;
+        if (memcmp(cells, shown, (size_t) cols) == 0 && memcmp(attrs, shown_attrs, (size_t) cols) == 0) {
+            continue;
+        }
+
+        int c = 0;
+        while (c < cols) {
+            if (cells[c] == shown[c] && attrs[c] == shown_attrs[c]) {
+                c++;
+                continue;
+            }
+
+            // Extend the run over short stretches of unchanged cells, which cost less than a move
+            int end = c + 1;
+            for (int j = end, gap = 0; j < cols && gap <= RUN_GAP; j++) {
+                if (cells[j] != shown[j] || attrs[j] != shown_attrs[j]) {
+                    end = j + 1;
+                    gap = 0;
+                } else {
+                    gap++;
+                }
+            }
+
+            if (cur_row != r || cur_col != c) {
+                len += put_move(screen->out + len, r, c);
+            }
+            for (int k = c; k < end; k++) {
+                if (attrs[k] != screen->pen) {
+                    len += (size_t) sprintf(screen->out + len, attrs[k] == PROC_SCREEN_REVERSE ? "\033[7m" : "\033[0m");
+                    screen->pen = attrs[k];
+                }
+                screen->out[len++] = cells[k];
+            }
+            cur_row = r;
+            cur_col = end;
+            c = end;
+        }
+    }
+
+    size_t cells = (size_t) screen->rows * (size_t) cols;
+    memcpy(screen->shown, screen->cells, cells);
+    memcpy(screen->shown_attrs, screen->attrs, cells);
+    screen->last_bytes = len;
+    proc_stats_count(PROC_STATS_VIEW, PROC_STATS_BYTES, len);
+    return len > 0 ? write_all(screen->out_fd, screen->out, len) : 0;
+}
+
+// Wait for a key and decode the escape sequences of the arrow and paging keys
+int proc_screen_read_key(struct proc_screen *screen, int timeout_ms) {
+    struct pollfd pfd = { .fd = screen->in_fd, .events = POLLIN };
+
+    if (resized) {
+        return PROC_KEY_RESIZE;
+    }
+    if (screen->in_len == 0) {
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready < 0) {
+            return errno == EINTR ? (resized ? PROC_KEY_RESIZE : PROC_KEY_NONE) : -1;
+        }
+        if (ready == 0) {
+            return PROC_KEY_NONE;
+        }
+        ssize_t n = read(screen->in_fd, screen->in, sizeof(screen->in));
+        if (n <= 0) {
+            return n < 0 && errno != EINTR && errno != EAGAIN ? -1 : PROC_KEY_NONE;
+        }
+        screen->in_len = (size_t) n;
+    }
+
+    // One key per call; the rest of what a read returned waits for the next calls
+    const unsigned char *buf = screen->in;
+    size_t n = screen->in_len;
+    size_t used = 1;
+    int key = buf[0];
+
+    // ESC [ A, ESC [ 5 ~, ESC O H and the like; a lone ESC is a key of its own
+    if (buf[0] == '\033' && n >= 3 && (buf[1] == '[' || buf[1] == 'O')) {
+        used = 2;
+        while (used < n && (buf[used] < 0x40 || buf[used] > 0x7e)) {
+            used++;
+        }
+        used = used < n ? used + 1 : n;
+        switch (buf[2]) {
+        case 'A': key = PROC_KEY_UP; break;
+        case 'B': key = PROC_KEY_DOWN; break;
+        case 'H': key = PROC_KEY_HOME; break;
+        case 'F': key = PROC_KEY_END; break;
+        case '1': key = n >= 4 && buf[3] == '~' ? PROC_KEY_HOME : PROC_KEY_NONE; break;
+        case '4': key = n >= 4 && buf[3] == '~' ? PROC_KEY_END : PROC_KEY_NONE; break;
+        case '5': key = PROC_KEY_PAGE_UP; break;
+        case '6': key = PROC_KEY_PAGE_DOWN; break;
+        default: key = PROC_KEY_NONE; break;
+        }
+    }
+    memmove(screen->in, screen->in + used, n - used);
+    screen->in_len = n - used;
+    return key;
+}
@@ -0,0 +1,73 @@
+#ifndef PROC_SCREEN_H
+#define PROC_SCREEN_H
+
+#include <stddef.h>
+#include <termios.h>
+
+// A terminal screen kept as a grid of cells. Each frame is drawn into the grid
+// from scratch, and proc_screen_flush sends only the cells that differ from what
+// the terminal already shows, with a cursor move before each changed run, in one
+// write. An unchanged frame costs a memcmp per row and no output at all, so the
+// bytes per frame follow what changed, not the size of the window.
+#define PROC_SCREEN_NORMAL  0
+#define PROC_SCREEN_REVERSE 1   // Headers and the status line
+
+// Keys proc_screen_read_key returns besides plain characters
+enum {
+    PROC_KEY_NONE = 0,          // Timeout or a signal
+    PROC_KEY_UP = 0x100,
+    PROC_KEY_DOWN,
+    PROC_KEY_PAGE_UP,
+    PROC_KEY_PAGE_DOWN,
+    PROC_KEY_HOME,
+    PROC_KEY_END,
+    PROC_KEY_RESIZE,            // The window changed size; the next frame is drawn in full
+};
+
+struct proc_screen {
+    int in_fd;
+    int out_fd;
+    int rows;
+    int cols;
+    char *cells;                // The frame being drawn, rows * cols
+    unsigned char *attrs;
+    char *shown;                // What the terminal shows
+    unsigned char *shown_attrs;
+    int valid;                  // shown matches the terminal; cleared by a resize
+    int row;                    // Where the next text goes
+    int col;
+    unsigned char attr;         // PROC_SCREEN_* of the next text
+    unsigned char pen;          // Attribute the terminal is set to
+    char *out;                  // Escape sequences and text of one flush
+    size_t out_size;
+    size_t last_bytes;          // Bytes the last flush wrote
+    unsigned char in[64];       // Bytes read but not yet returned as keys, so typed or pasted text is kept
+    size_t in_len;
+    struct termios saved;       // Terminal settings to restore
+};
+
+// Switch the terminal to the alternate screen with the cursor hidden and keys
+// read one at a time (Ctrl+C still raises SIGINT); returns 0 or -1
+int proc_screen_open(struct proc_screen *screen, int in_fd, int out_fd);
+
+// Restore the terminal and free the grids
+void proc_screen_close(struct proc_screen *screen);
+
+// Start a frame: every cell blank, text goes to the top left
+void proc_screen_begin(struct proc_screen *screen);
+
+// Set the attribute of the text written next
+void proc_screen_attr(struct proc_screen *screen, unsigned char attr);
+
+// Write text at the current position; '\n' moves to the start of the next row.
+// Text beyond the right edge or the last row is dropped.
+void proc_screen_write(struct proc_screen *screen, const char *text, size_t len);
+
+// Send the differences to the terminal in one write; returns 0 or -1
+int proc_screen_flush(struct proc_screen *screen);
+
+// Wait up to timeout_ms (-1 forever) for a key; returns the key, PROC_KEY_NONE on
+// timeout or a signal, PROC_KEY_RESIZE after the window was resized, or -1
+int proc_screen_read_key(struct proc_screen *screen, int timeout_ms);
+
+#endif
@@ -0,0 +1,261 @@
+#define _GNU_SOURCE
+#include "proc_shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// Bytes needed for a segment with capacity entries per slot
+static size_t segment_size(size_t capacity, size_t *entries_offset) {
+    size_t offset = (sizeof(struct proc_shm_header) + 63) & ~(size_t) 63;
+    *entries_offset = offset;
+    return offset + PROC_SHM_SLOTS * capacity * sizeof(struct proc_entry);
+}
+
+// Entries of a slot
+static struct proc_entry *slot_entries(const struct proc_shm *shm, size_t slot) {
+    return (struct proc_entry *) ((char *) shm->hdr + shm->hdr->entries_offset) + slot * shm->hdr->capacity;
+}
+
+// Create a segment with room for capacity entries per slot
+int proc_shm_create(struct proc_shm *shm, size_t capacity) {
+    size_t entries_offset;
+
+    memset(shm, 0, sizeof(*shm));
+    shm->sock = -1;
+    shm->size = segment_size(capacity, &entries_offset);
+
+    // Pages are only allocated once a slot is written
+    shm->fd = memfd_create("proc_snapd", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (shm->fd < 0) {
+        return -1;
+    }
+    if (ftruncate(shm->fd, (off_t) shm->size) < 0 ||
+        fcntl(shm->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        close(shm->fd);
+        return -1;
+    }
+    shm->hdr = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+    if (shm->hdr == MAP_FAILED) {
+        close(shm->fd);
+        return -1;
+    }
+
+    shm->hdr->magic = PROC_SHM_MAGIC;
+    shm->hdr->version = PROC_SHM_VERSION;
+    shm->hdr->entry_size = sizeof(struct proc_entry);
+    shm->hdr->capacity = capacity;
+    shm->hdr->entries_offset = entries_offset;
+    return 0;
+}
+
+// Receive the reply to a subscription along with the segment's fd; returns the fd or -1
+static int receive_fd(int sock) {
+    char reply[64];
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov = { reply, sizeof(reply) - 1 };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                          .msg_controllen = sizeof(control.buf) };
+
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0) {
+        errno = n == 0 ? ECONNRESET : errno;
+        return -1;
+    }
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+    return fd;
+}
+
+// Subscribe through the daemon's control socket and map the segment read-only
+int proc_shm_attach(struct proc_shm *shm, const char *socket_path, unsigned int interval_ms) {
+    struct sockaddr_un addr;
+    struct stat st;
+    char request[64];
+
+    memset(shm, 0, sizeof(*shm));
+    shm->fd = -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    shm->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (shm->sock < 0) {
+        return -1;
+    }
+    int len = snprintf(request, sizeof(request), "subscribe %u", interval_ms);
+    if (connect(shm->sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        send(shm->sock, request, (size_t) len, 0) < 0 || (shm->fd = receive_fd(shm->sock)) < 0 ||
+        fstat(shm->fd, &st) < 0) {
+        proc_shm_close(shm);
+        return -1;
+    }
+
+    shm->size = (size_t) st.st_size;
+    shm->hdr = shm->size >= sizeof(*shm->hdr) ? mmap(NULL, shm->size, PROT_READ, MAP_SHARED, shm->fd, 0) : MAP_FAILED;
+    if (shm->hdr == MAP_FAILED) {
+        shm->hdr = NULL;
+        proc_shm_close(shm);
+        return -1;
+    }
+
+    // Refuse a daemon built with a different entry layout
+    size_t entries_offset;
+    if (shm->hdr->magic != PROC_SHM_MAGIC || shm->hdr->version != PROC_SHM_VERSION ||
+        shm->hdr->entry_size != sizeof(struct proc_entry) ||
+        segment_size(shm->hdr->capacity, &entries_offset) > shm->size ||
+        shm->hdr->entries_offset != entries_offset) {
+        proc_shm_close(shm);
+        errno = EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+// Unmap the segment and unsubscribe
+void proc_shm_close(struct proc_shm *shm) {
+    if (shm->hdr != NULL) {
+        munmap(shm->hdr, shm->size);
+    }
+    if (shm->fd >= 0) {
+        close(shm->fd);
+    }
+    if (shm->sock >= 0) {
+        close(shm->sock);
+    }
+    memset(shm, 0, sizeof(*shm));
+    shm->fd = shm->sock = -1;
+}
+
+// Point snap at the next free slot and mark it as being written
+void proc_shm_write_begin(struct proc_shm *shm, struct proc_snapshot *snap) {
+    uint64_t generation = shm->generation + 1;
+    size_t slot = generation % PROC_SHM_SLOTS;
+
+    // Odd: readers that still hold this slot will see that it changed. It already
+    // is if the last attempt at this generation failed.
+    if ((atomic_load_explicit(&shm->hdr->slots[slot].seq, memory_order_relaxed) & 1) == 0) {
+        atomic_fetch_add_explicit(&shm->hdr->slots[slot].seq, 1, memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_release);
+
+    memset(snap, 0, sizeof(*snap));
+    snap->entries = slot_entries(shm, slot);
+    snap->capacity = shm->hdr->capacity;
+    snap->generation = generation;
+    snap->borrowed = 1;
+}
+
+// Finish the slot and make it the latest
+void proc_shm_write_end(struct proc_shm *shm, const struct proc_snapshot *snap, const struct proc_cpu_totals *totals) {
+    uint64_t generation = shm->generation + 1;
+    struct proc_shm_slot *slot = &shm->hdr->slots[generation % PROC_SHM_SLOTS];
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    slot->generation = generation;
+    slot->count = snap->count;
+    slot->time_ns = (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+    slot->cpu_total = totals->total;
+    slot->cpu_idle = totals->idle;
+    atomic_fetch_add_explicit(&slot->seq, 1, memory_order_release);
+    atomic_store_explicit(&shm->hdr->latest, generation, memory_order_release);
+    shm->generation = generation;
+}
+
+// Point snap at the newest complete snapshot without copying it
+int proc_shm_read(struct proc_shm *shm, struct proc_snapshot *snap, struct proc_shm_sample *sample) {
+    int oversized = 0;
+
+    for (;;) {
+        if (atomic_load_explicit(&shm->hdr->replaced, memory_order_acquire)) {
+            errno = ESTALE;
+            return -1;
+        }
+        uint64_t generation = atomic_load_explicit(&shm->hdr->latest, memory_order_acquire);
+        if (generation == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+
+        size_t index = generation % PROC_SHM_SLOTS;
+        const struct proc_shm_slot *slot = &shm->hdr->slots[index];
+        uint64_t before = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        uint64_t count = slot->count;
+        uint64_t slot_generation = slot->generation;
+        sample->time_ns = slot->time_ns;
+        sample->totals.total = slot->cpu_total;
+        sample->totals.idle = slot->cpu_idle;
+        atomic_thread_fence(memory_order_acquire);
+
+        // Retry if the daemon lapped us and is rewriting the slot right now
+        if ((before & 1) == 0 && slot_generation == generation && count <= shm->hdr->capacity &&
+            atomic_load_explicit(&slot->seq, memory_order_relaxed) == before) {
+            memset(snap, 0, sizeof(*snap));
+            snap->entries = slot_entries(shm, index);
+            snap->count = (size_t) count;
+            snap->capacity = (size_t) count;
+            snap->generation = generation;
+            snap->borrowed = 1;
+            sample->seq = before;
+            return 0;
+        }
+
+        // A write in progress settles; a settled slot that still does not fit never will
+        if ((before & 1) == 0 && count > shm->hdr->capacity &&
+            atomic_load_explicit(&slot->seq, memory_order_relaxed) == before && ++oversized >= PROC_SHM_READ_RETRIES) {
+            errno = EPROTO;
+            return -1;
+        }
+    }
+}
+
+// Whether snap was left intact until now
+int proc_shm_valid(struct proc_shm *shm, const struct proc_snapshot *snap, uint64_t seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&shm->hdr->slots[snap->generation % PROC_SHM_SLOTS].seq, memory_order_relaxed) == seq;
+}
+
+// Wait up to timeout_ms for the daemon to publish a snapshot
+int proc_shm_wait(struct proc_shm *shm, int timeout_ms) {
+    struct pollfd pfd = { shm->sock, POLLIN, 0 };
+    char buf[64];
+
+    int n = poll(&pfd, 1, timeout_ms);
+    if (n <= 0) {
+        return n < 0 && errno != EINTR ? -1 : 0;
+    }
+
+    // Several notifications may have piled up; one is as good as all of them
+    for (;;) {
+        ssize_t len = recv(shm->sock, buf, sizeof(buf), MSG_DONTWAIT);
+        if (len == 0) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        if (len < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 1 : -1;
+        }
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef PROC_SHM_H
+#define PROC_SHM_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "proc_cpu.h"
+#include "proc_scan.h"
+
+#define PROC_SHM_MAGIC 0x4d485350u     // "PSHM" in little-endian byte order
+#define PROC_SHM_VERSION 1
+#define PROC_SHM_SLOTS 8                // Snapshots kept; a reader has SLOTS - 1 intervals to use one
+#define PROC_SHM_DEFAULT_SOCKET "/tmp/proc_snapd.sock"
+#define PROC_SHM_READ_RETRIES 64        // Reads of a settled slot that does not fit before giving up
+
+// One published snapshot. seq is a seqlock: odd while the daemon writes the
+// slot, and bumped again once the slot is complete.
+struct proc_shm_slot {
+    _Atomic uint64_t seq;
+    uint64_t generation;
+    uint64_t count;
+    uint64_t time_ns;               // CLOCK_REALTIME when the scan finished
+    uint64_t cpu_total;             // Machine-wide CPU ticks (struct proc_cpu_totals) at that time
+    uint64_t cpu_idle;
+};
+
+// Start of the shared segment. The entries of slot i follow the header at
+// entries_offset + i * capacity * entry_size.
+struct proc_shm_header {
+    uint32_t magic;                 // PROC_SHM_MAGIC
+    uint16_t version;               // PROC_SHM_VERSION
+    uint16_t entry_size;            // sizeof(struct proc_entry)
+    uint64_t capacity;              // Entries per slot
+    uint64_t entries_offset;
+    _Atomic uint64_t latest;        // Generation of the newest complete slot, 0 before the first
+    _Atomic uint32_t replaced;      // The daemon moved to a bigger segment; subscribe again
+    _Atomic uint32_t interval_ms;   // Current sampling interval
+    struct proc_shm_slot slots[PROC_SHM_SLOTS];
+};
+
+// A mapped segment, on the daemon's side (read-write) or a client's (read-only).
+// Clients also hold the control socket: while it is open they are subscribed,
+// and the daemon sends a message on it after every new snapshot.
+struct proc_shm {
+    int fd;                         // memfd of the segment
+    int sock;                       // Control socket (clients only), or -1
+    size_t size;
+    struct proc_shm_header *hdr;
+    uint64_t generation;            // Daemon: last published generation
+};
+
+// What a client learns about a snapshot besides its entries
+struct proc_shm_sample {
+    uint64_t seq;                   // Seqlock value of the slot, for proc_shm_valid
+    unsigned long long time_ns;
+    struct proc_cpu_totals totals;
+};
+
+// Daemon: create a segment with room for capacity entries per slot; returns 0 or -1
+int proc_shm_create(struct proc_shm *shm, size_t capacity);
+
+// Client: subscribe through the daemon's control socket, asking for snapshots
+// every interval_ms (0 keeps the daemon's), and map the segment read-only.
+// Returns 0 or -1.
+int proc_shm_attach(struct proc_shm *shm, const char *socket_path, unsigned int interval_ms);
+
+// Unmap the segment and, for clients, unsubscribe
+void proc_shm_close(struct proc_shm *shm);
+
+// Daemon: point snap at the next free slot (it is borrowed; see struct proc_snapshot)
+// and mark that slot as being written
+void proc_shm_write_begin(struct proc_shm *shm, struct proc_snapshot *snap);
+
+// Daemon: finish the slot snap was written into, along with the CPU totals read
+// with it, and make it the latest. A slot left unfinished after a failed scan is
+// simply written again by the next proc_shm_write_begin.
+void proc_shm_write_end(struct proc_shm *shm, const struct proc_snapshot *snap, const struct proc_cpu_totals *totals);
+
+// Client: point snap at the newest complete snapshot, without copying it, and
+// fill in sample. Returns 0, or -1 with errno set to EAGAIN before the first
+// snapshot, ESTALE once the daemon has moved to a new segment (attach again), or
+// EPROTO if the newest slot keeps claiming more entries than the segment holds.
+int proc_shm_read(struct proc_shm *shm, struct proc_snapshot *snap, struct proc_shm_sample *sample);
+
+// Client: whether snap, read with proc_shm_read, was left intact until now.
+// Check after using the entries; if not, they were overwritten meanwhile.
+int proc_shm_valid(struct proc_shm *shm, const struct proc_snapshot *snap, uint64_t seq);
+
+// Client: wait up to timeout_ms for the daemon to publish a snapshot. Returns
+// 1 if one was published, 0 on timeout, -1 if the daemon went away.
+int proc_shm_wait(struct proc_shm *shm, int timeout_ms);
+
+#endif
@@ -0,0 +1,326 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "proc_cpu.h"
+#include "proc_scan.h"
+#include "proc_shm.h"
+
+// Snapshot daemon: scans once per interval into a shared segment that any number
+// of proc_info_reader and GUI instances map read-only (--attach), so N viewers
+// cost one scan instead of N. It only scans while someone is subscribed.
+
+#define MAX_CLIENTS 64
+#define DEFAULT_INTERVAL_MS 1000
+#define MIN_INTERVAL_MS 100     // Shortest interval a client can ask for
+#define INITIAL_CAPACITY 4096
+
+// A connection on the control socket
+struct client {
+    int fd;
+    int subscribed;
+    unsigned int interval_ms;       // Requested interval, 0 for no preference
+};
+
+static struct client clients[MAX_CLIENTS];
+static size_t client_count;
+static volatile sig_atomic_t keep_running = 1;
+
+// Stop on SIGINT or SIGTERM
+static void handle_signal(int sig) {
+    keep_running = 0;
+}
+
+// Get CLOCK_MONOTONIC in milliseconds
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Open the control socket, replacing a stale one; returns the fd, or -1 with errno
+// EADDRINUSE if another daemon is listening on it
+static int listen_on(const char *path) {
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (sock < 0) {
+        return -1;
+    }
+
+    // Only a socket nobody listens on is stale; a live daemon keeps its own
+    int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (probe < 0) {
+        close(sock);
+        return -1;
+    }
+    int in_use = connect(probe, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+    int stale = !in_use && errno == ECONNREFUSED;
+    close(probe);
+    if (in_use) {
+        close(sock);
+        errno = EADDRINUSE;
+        return -1;
+    }
+    if (stale) {
+        unlink(path);
+    }
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(sock, 16) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Send a reply with the segment's fd attached
+static int send_fd(int sock, int fd, const char *reply) {
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov = { (void *) reply, strlen(reply) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                          .msg_controllen = sizeof(control.buf) };
+
+    memset(&control, 0, sizeof(control));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) < 0 ? -1 : 0;
+}
+
+// Drop a client; the last slot moves into its place
+static void drop_client(size_t i) {
+    close(clients[i].fd);
+    clients[i] = clients[--client_count];
+}
+
+// Handle one message from a client: "subscribe [MS]" or "interval MS". Intervals below
+// MIN_INTERVAL_MS are raised to it, so no client can make the daemon scan back to back.
+// Returns 0, or -1 if the client is gone or misbehaved.
+static int handle_message(struct client *client, const struct proc_shm *shm) {
+    char msg[64];
+    unsigned int ms = 0;
+
+    ssize_t len = recv(client->fd, msg, sizeof(msg) - 1, MSG_DONTWAIT);
+    if (len <= 0) {
+        return len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    msg[len] = '\0';
+
+    if (strncmp(msg, "subscribe", 9) == 0) {
+        sscanf(msg + 9, "%u", &ms);
+        client->interval_ms = ms > 0 ? MAX(ms, MIN_INTERVAL_MS) : 0;
+        client->subscribed = 1;
+        return send_fd(client->fd, shm->fd, "ok");
+    }
+    if (sscanf(msg, "interval %u", &ms) == 1) {
+        client->interval_ms = ms > 0 ? MAX(ms, MIN_INTERVAL_MS) : 0;
+        return send(client->fd, "ok", 2, MSG_NOSIGNAL) < 0 ? -1 : 0;
+    }
+    return -1;
+}
+
+// Number of subscribers and the shortest interval any of them asked for
+static size_t subscribers(unsigned int default_ms, unsigned int *interval_ms) {
+    size_t n = 0;
+    *interval_ms = 0;
+    for (size_t i = 0; i < client_count; i++) {
+        if (clients[i].subscribed) {
+            n++;
+            if (clients[i].interval_ms > 0 && (*interval_ms == 0 || clients[i].interval_ms < *interval_ms)) {
+                *interval_ms = clients[i].interval_ms;
+            }
+        }
+    }
+    if (*interval_ms == 0) {
+        *interval_ms = default_ms;
+    }
+    return n;
+}
+
+// Move to a segment with room for at least count entries per slot. Clients find
+// the old segment marked replaced and subscribe again.
+static int grow_segment(struct proc_shm *shm, size_t count) {
+    struct proc_shm bigger;
+    size_t capacity = shm->hdr->capacity * 2;
+    while (capacity < count + count / 4) {
+        capacity *= 2;
+    }
+    if (proc_shm_create(&bigger, capacity) < 0) {
+        return -1;
+    }
+
+    // Generations keep counting, so a client never mistakes a new snapshot for one it has
+    bigger.generation = shm->generation;
+    atomic_store_explicit(&bigger.hdr->interval_ms, atomic_load(&shm->hdr->interval_ms), memory_order_relaxed);
+    atomic_store_explicit(&shm->hdr->replaced, 1, memory_order_release);
+    proc_shm_close(shm);
+    *shm = bigger;
+    return 0;
+}
+
+// Scan into the next slot, growing the segment when the scan does not fit, and
+// tell every subscriber. Returns 0 or -1.
+static int publish(struct proc_shm *shm, struct proc_scanner *scanner, const char *module_path) {
+    struct proc_snapshot snap;
+    struct proc_cpu_totals totals;
+
+    for (;;) {
+        proc_shm_write_begin(shm, &snap);
+        int rc = module_path ? proc_scan_module(scanner, module_path, NULL, &snap)
+                             : proc_scan_snapshot(scanner, &snap);
+        if (rc == 0) {
+            break;
+        }
+        // The directory walk knows how many there are; the module table only that there are more
+        if (errno != ENOSPC || grow_segment(shm, module_path ? shm->hdr->capacity + 1 : scanner->pid_count) < 0) {
+            return -1;
+        }
+    }
+    if (proc_read_cpu_totals(scanner, &totals) < 0) {
+        return -1;
+    }
+    proc_shm_write_end(shm, &snap, &totals);
+
+    // A client that is behind on notifications just misses some; it reads the latest anyway
+    char note[32];
+    int len = snprintf(note, sizeof(note), "published %llu", (unsigned long long) shm->generation);
+    for (size_t i = 0; i < client_count; i++) {
+        if (clients[i].subscribed) {
+            send(clients[i].fd, note, (size_t) len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *socket_path = PROC_SHM_DEFAULT_SOCKET;
+    const char *proc_root = "/proc";
+    unsigned int default_ms = DEFAULT_INTERVAL_MS;
+    size_t threads = 1;
+    int always = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+            default_ms = (unsigned int) atoi(argv[++i]);  // Used when no subscriber asks for one
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = (size_t) atoi(argv[++i]);  // Scan threads, 0 = one per online CPU
+        } else if (strcmp(argv[i], "--proc-root") == 0 && i + 1 < argc) {
+            proc_root = argv[++i];
+        } else if (strcmp(argv[i], "--always") == 0) {
+            always = 1;  // Keep sampling with no subscribers
+        } else {
+            fprintf(stderr, "Usage: %s [--socket PATH] [--interval MS] [--threads N] [--proc-root DIR] [--always]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (default_ms == 0) {
+        default_ms = DEFAULT_INTERVAL_MS;
+    }
+
+    struct proc_scanner scanner;
+    struct proc_shm shm;
+    if (proc_scanner_init(&scanner, proc_root) < 0) {
+        perror("Error opening /proc");
+        return 1;
+    }
+    proc_scanner_set_threads(&scanner, threads);
+    if (proc_shm_create(&shm, INITIAL_CAPACITY) < 0) {
+        perror("Error creating the shared segment");
+        return 1;
+    }
+    int listener = listen_on(socket_path);
+    if (listener < 0) {
+        perror(socket_path);
+        return 1;
+    }
+
+    // The module table is one read for every process; without it, walk /proc
+    char module_path[4096];
+    snprintf(module_path, sizeof(module_path), "%s/proc_info", proc_root);
+    int use_module = access(module_path, R_OK) == 0;
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    long long next_due = 0;
+    while (keep_running) {
+        unsigned int interval_ms;
+        size_t n = subscribers(default_ms, &interval_ms);
+        atomic_store_explicit(&shm.hdr->interval_ms, interval_ms, memory_order_relaxed);
+
+        if (n == 0 && !always) {
+            // Nobody watches, so the last snapshot goes stale: the next subscriber waits for a fresh one
+            atomic_store_explicit(&shm.hdr->latest, 0, memory_order_release);
+        } else {
+            long long now = now_ms();
+            if (now >= next_due) {
+                if (publish(&shm, &scanner, use_module ? module_path : NULL) < 0) {
+                    perror("Error sampling processes");
+                }
+                // A slow scan delays the next one instead of queueing them up
+                next_due = MAX(next_due + interval_ms, now_ms());
+            }
+        }
+
+        struct pollfd pfds[MAX_CLIENTS + 1];
+        pfds[0] = (struct pollfd) { listener, POLLIN, 0 };
+        for (size_t i = 0; i < client_count; i++) {
+            pfds[i + 1] = (struct pollfd) { clients[i].fd, POLLIN, 0 };
+        }
+        int timeout = n > 0 || always ? (int) MAX(next_due - now_ms(), 0) : -1;
+        if (poll(pfds, client_count + 1, timeout) < 0) {
+            continue;   // EINTR: a signal, check keep_running
+        }
+
+        // Walk backwards so dropping a client does not skip the one moved into its place
+        for (size_t i = client_count; i > 0; i--) {
+            if (pfds[i].revents && handle_message(&clients[i - 1], &shm) < 0) {
+                drop_client(i - 1);
+            }
+        }
+        if (pfds[0].revents & POLLIN) {
+            int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (fd >= 0 && client_count < MAX_CLIENTS) {
+                clients[client_count++] = (struct client) { fd, 0, 0 };
+                // The first subscriber after an idle spell gets a fresh snapshot right away
+                if (n == 0) {
+                    next_due = 0;
+                }
+            } else if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    for (size_t i = client_count; i > 0; i--) {
+        drop_client(i - 1);
+    }
+    close(listener);
+    unlink(socket_path);
+    proc_shm_close(&shm);
+    proc_scanner_destroy(&scanner);
+    return 0;
+}
@@ -0,0 +1,195 @@
+#include "proc_stats.h"
+
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#define STATS_BUCKETS 252       // 4 per power of two up to 2^63 ns
+
+// One stage; everything is updated with relaxed atomics
+struct stats_stage {
+    atomic_ullong calls;
+    atomic_ullong total_ns;
+    atomic_ullong last_ns;
+    atomic_ullong max_ns;
+    atomic_ullong counters[PROC_STATS_COUNTERS];
+    atomic_ullong buckets[STATS_BUCKETS];
+};
+
+static const char *const stage_names[PROC_STATS_STAGES] = {
+    "scan", "readdir", "read", "parse", "module", "nss", "extra", "diff", "rollup", "filter", "columns", "output", "view",
+};
+
+static struct stats_stage stages[PROC_STATS_STAGES];
+
+int proc_stats_enabled = 0;
+
+// Histogram bucket of a duration: values below 4 get their own, above that
+// each power of two is split into four by the two bits below the top one
+static size_t bucket_of(unsigned long long ns) {
+    if (ns < 4) {
+        return (size_t) ns;
+    }
+    int msb = 63 - __builtin_clzll(ns);
+    return (size_t) (msb - 1) * 4 + ((ns >> (msb - 2)) & 3);
+}
+
+// Middle of the range of durations a bucket holds
+static unsigned long long bucket_value(size_t bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+    int shift = (int) (bucket / 4) - 1;
+    unsigned long long low = (4ULL + bucket % 4) << shift;
+    return low + (1ULL << shift) / 2;
+}
+
+// Start recording
+void proc_stats_enable(void) {
+    proc_stats_enabled = 1;
+}
+
+// Monotonic clock in nanoseconds, or 0 when not recording
+unsigned long long proc_stats_start(void) {
+    struct timespec ts;
+
+    if (!proc_stats_enabled) {
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+// Record one call of a stage
+void proc_stats_stop(int stage, unsigned long long start) {
+    if (start == 0) {
+        return;
+    }
+    struct stats_stage *s = &stages[stage];
+    unsigned long long ns = proc_stats_start() - start;
+    unsigned long long max = atomic_load_explicit(&s->max_ns, memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&s->calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->total_ns, ns, memory_order_relaxed);
+    atomic_store_explicit(&s->last_ns, ns, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak_explicit(&s->max_ns, &max, ns, memory_order_relaxed,
+                                                              memory_order_relaxed)) {
+    }
+    atomic_fetch_add_explicit(&s->buckets[bucket_of(ns)], 1, memory_order_relaxed);
+}
+
+// Add to a counter of a stage
+void proc_stats_count(int stage, int counter, unsigned long long n) {
+    if (proc_stats_enabled) {
+        atomic_fetch_add_explicit(&stages[stage].counters[counter], n, memory_order_relaxed);
+    }
+}
+
+// Copy out one stage; the percentiles come from the histogram
+void proc_stats_read(int stage, struct proc_stats_summary *summary) {
+    const struct stats_stage *s = &stages[stage];
+    unsigned long long counts[STATS_BUCKETS];
+    unsigned long long total = 0;
+
+    memset(summary, 0, sizeof(*summary));
+    summary->name = stage_names[stage];
+    summary->calls = atomic_load_explicit(&s->calls, memory_order_relaxed);
+    summary->total_ns = atomic_load_explicit(&s->total_ns, memory_order_relaxed);
+    summary->last_ns = atomic_load_explicit(&s->last_ns, memory_order_relaxed);
+    summary->max_ns = atomic_load_explicit(&s->max_ns, memory_order_relaxed);
+    for (int i = 0; i < PROC_STATS_COUNTERS; i++) {
+        summary->counters[i] = atomic_load_explicit(&s->counters[i], memory_order_relaxed);
+    }
+
+    // Other threads may still be recording, so the buckets are summed rather than trusting calls
+    for (size_t i = 0; i < STATS_BUCKETS; i++) {
+        counts[i] = atomic_load_explicit(&s->buckets[i], memory_order_relaxed);
+        total += counts[i];
+    }
+    unsigned long long seen = 0;
+    for (size_t i = 0; i < STATS_BUCKETS && total > 0; i++) {
+        seen += counts[i];
+        if (summary->p50_ns == 0 && seen * 2 >= total) {
+            summary->p50_ns = bucket_value(i);
+        }
+        if (seen * 100 >= total * 99) {
+            summary->p99_ns = bucket_value(i);
+            break;
+        }
+    }
+
+    // A bucket stands for a range, so keep the estimates within what was actually seen
+    if (summary->p50_ns > summary->max_ns) {
+        summary->p50_ns = summary->max_ns;
+    }
+    if (summary->p99_ns > summary->max_ns) {
+        summary->p99_ns = summary->max_ns;
+    }
+}
+
+// Print a duration in the unit that keeps it short
+static void print_ns(FILE *out, unsigned long long ns) {
+    if (ns >= 10000000ULL) {
+        fprintf(out, " %9.1fms", ns / 1e6);
+    } else if (ns >= 10000ULL) {
+        fprintf(out, " %9.1fus", ns / 1e3);
+    } else {
+        fprintf(out, " %9lluns", ns);
+    }
+}
+
+// Print a table of every stage that has run
+void proc_stats_print(FILE *out) {
+    fprintf(out, "%-8s %10s %11s %11s %11s %11s %11s %10s %12s %10s %8s\n", "stage", "calls", "total", "mean", "p50",
+            "p99", "max", "syscalls", "bytes", "rows", "allocs");
+    for (int stage = 0; stage < PROC_STATS_STAGES; stage++) {
+        struct proc_stats_summary s;
+        proc_stats_read(stage, &s);
+        if (s.calls == 0 && s.counters[PROC_STATS_SYSCALLS] == 0 && s.counters[PROC_STATS_ALLOCS] == 0) {
+            continue;
+        }
+        fprintf(out, "%-8s %10llu", s.name, s.calls);
+        print_ns(out, s.total_ns);
+        print_ns(out, s.calls ? s.total_ns / s.calls : 0);
+        print_ns(out, s.p50_ns);
+        print_ns(out, s.p99_ns);
+        print_ns(out, s.max_ns);
+        fprintf(out, " %10llu %12llu %10llu %8llu\n", s.counters[PROC_STATS_SYSCALLS], s.counters[PROC_STATS_BYTES],
+                s.counters[PROC_STATS_ROWS], s.counters[PROC_STATS_ALLOCS]);
+    }
+}
+
+// One-line digest: the per-sample stages, each as its last time and p99
+void proc_stats_format_line(char *out, size_t size) {
+    static const int shown[] = { PROC_STATS_SCAN, PROC_STATS_USERS, PROC_STATS_EXTRA, PROC_STATS_DIFF,
+                                 PROC_STATS_ROLLUP, PROC_STATS_FILTER, PROC_STATS_COLUMNS, PROC_STATS_OUTPUT, PROC_STATS_VIEW };
+    size_t used = 0;
+
+    out[0] = '\0';
+    for (size_t i = 0; i < sizeof(shown) / sizeof(shown[0]) && used < size; i++) {
+        struct proc_stats_summary s;
+        proc_stats_read(shown[i], &s);
+        if (s.calls == 0) {
+            continue;
+        }
+        int n = snprintf(out + used, size - used, "%s%s %.2f ms (p99 %.2f)", used ? ", " : "", s.name,
+                         s.last_ns / 1e6, s.p99_ns / 1e6);
+        if (n < 0) {
+            break;
+        }
+        used += (size_t) n;
+    }
+
+    // What one scan costs in syscalls is the number worth watching when tuning the interval
+    static const int io[] = { PROC_STATS_READDIR, PROC_STATS_READ, PROC_STATS_MODULE };
+    struct proc_stats_summary s;
+    unsigned long long syscalls = 0;
+    for (size_t i = 0; i < sizeof(io) / sizeof(io[0]); i++) {
+        proc_stats_read(io[i], &s);
+        syscalls += s.counters[PROC_STATS_SYSCALLS];
+    }
+    proc_stats_read(PROC_STATS_SCAN, &s);
+    if (s.calls > 0 && used < size) {
+        snprintf(out + used, size - used, ", %llu syscalls/scan", syscalls / s.calls);
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef PROC_STATS_H
+#define PROC_STATS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// What the tools spend their own time on. Every stage keeps call counts and a
+// latency histogram (4 buckets per power of two, so p50/p99 are within 19 %),
+// plus counters of syscalls, bytes, rows and heap allocations. Updates are
+// relaxed atomics, so the scan worker threads can record without a lock.
+// Nothing is recorded until proc_stats_enable() is called.
+enum {
+    PROC_STATS_SCAN,        // One whole sample: /proc walk, module table or events refresh
+    PROC_STATS_READDIR,     // getdents64 walk of the proc root
+    PROC_STATS_READ,        // open + pread + close of one /proc/[pid] file
+    PROC_STATS_PARSE,       // Parsing stat/status of one process, or the whole module table
+    PROC_STATS_MODULE,      // Reading /proc/proc_info
+    PROC_STATS_USERS,       // NSS lookups that missed the uid cache
+    PROC_STATS_EXTRA,       // Budgeted reads of smaps_rollup and fd counts
+    PROC_STATS_DIFF,
+    PROC_STATS_ROLLUP,
+    PROC_STATS_FILTER,      // Updating the search index and matching a filter
+    PROC_STATS_COLUMNS,     // Building the view columns
+    PROC_STATS_OUTPUT,      // Writing one sample of a stream or history
+    PROC_STATS_VIEW,        // Drawing: the terminal table or the GTK model update
+    PROC_STATS_STAGES
+};
+
+// Counters of a stage
+enum {
+    PROC_STATS_SYSCALLS,
+    PROC_STATS_BYTES,
+    PROC_STATS_ROWS,
+    PROC_STATS_ALLOCS,
+    PROC_STATS_COUNTERS
+};
+
+// A consistent enough copy of one stage, for printing
+struct proc_stats_summary {
+    const char *name;
+    unsigned long long calls;
+    unsigned long long total_ns;
+    unsigned long long last_ns;
+    unsigned long long max_ns;
+    unsigned long long p50_ns;
+    unsigned long long p99_ns;
+    unsigned long long counters[PROC_STATS_COUNTERS];
+};
+
+// Non-zero once recording is on; read on every hot path
+extern int proc_stats_enabled;
+
+// Start recording (for the rest of the process)
+void proc_stats_enable(void);
+
+// Monotonic clock in nanoseconds if recording, otherwise 0 without reading the clock
+unsigned long long proc_stats_start(void);
+
+// Record one call of a stage that began at start (from proc_stats_start)
+void proc_stats_stop(int stage, unsigned long long start);
+
+// Add n to a counter of a stage
+void proc_stats_count(int stage, int counter, unsigned long long n);
+
+// Copy out one stage with its percentiles
+void proc_stats_read(int stage, struct proc_stats_summary *summary);
+
+// Print a table of every stage that has run
+void proc_stats_print(FILE *out);
+
+// Write a one-line digest of the busiest stages (last and p99 time) into out
+void proc_stats_format_line(char *out, size_t size);
+
+#endif
@@ -0,0 +1,229 @@
+#include "proc_threads.h"
+#include "proc_stats.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Set up an empty set
+void proc_threads_init(struct proc_threads *threads, const char *module_path) {
+    memset(threads, 0, sizeof(*threads));
+    threads->module_path = module_path;
+}
+
+// Free every list
+void proc_threads_destroy(struct proc_threads *threads) {
+    for (size_t i = 0; i < threads->count; i++) {
+        free(threads->groups[i].threads);
+    }
+    free(threads->groups);
+    free(threads->spare);
+    proc_snapshot_free(&threads->scratch);
+    memset(threads, 0, sizeof(*threads));
+}
+
+// Index of the group of pid, or where it would go
+static size_t find_index(const struct proc_threads *threads, pid_t pid) {
+    size_t lo = 0, hi = threads->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (threads->groups[mid].pid < pid) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Loaded threads of a process
+const struct proc_thread_group *proc_threads_find(const struct proc_threads *threads, pid_t pid) {
+    size_t i = find_index(threads, pid);
+    return i < threads->count && threads->groups[i].pid == pid ? &threads->groups[i] : NULL;
+}
+
+// The group of pid, added empty if there is none; NULL if out of memory
+static struct proc_thread_group *get_group(struct proc_threads *threads, pid_t pid) {
+    size_t i = find_index(threads, pid);
+    if (i < threads->count && threads->groups[i].pid == pid) {
+        return &threads->groups[i];
+    }
+
+    if (threads->count == threads->capacity) {
+        size_t capacity = threads->capacity ? threads->capacity * 2 : 16;
+        struct proc_thread_group *groups = realloc(threads->groups, capacity * sizeof(*groups));
+        if (groups == NULL) {
+            return NULL;
+        }
+        threads->groups = groups;
+        threads->capacity = capacity;
+    }
+    memmove(&threads->groups[i + 1], &threads->groups[i], (threads->count - i) * sizeof(*threads->groups));
+    threads->count++;
+    memset(&threads->groups[i], 0, sizeof(threads->groups[i]));
+    threads->groups[i].pid = pid;
+    return &threads->groups[i];
+}
+
+// Keep a process's threads loaded
+int proc_threads_expand(struct proc_threads *threads, pid_t pid) {
+    struct proc_thread_group *group = get_group(threads, pid);
+    if (group == NULL) {
+        return -1;
+    }
+    group->flags |= PROC_THREADS_EXPANDED;
+    return 0;
+}
+
+// Stop keeping them; the list goes at the next refresh unless the process is hot
+void proc_threads_collapse(struct proc_threads *threads, pid_t pid) {
+    size_t i = find_index(threads, pid);
+    if (i < threads->count && threads->groups[i].pid == pid) {
+        threads->groups[i].flags &= ~PROC_THREADS_EXPANDED;
+    }
+}
+
+// Load a process's threads in the next refresh
+int proc_threads_mark_hot(struct proc_threads *threads, pid_t pid) {
+    struct proc_thread_group *group = get_group(threads, pid);
+    if (group == NULL) {
+        return -1;
+    }
+    group->flags |= PROC_THREADS_HOT;
+    return 0;
+}
+
+// Merge a fresh list (sorted by TID) into a group, updating the running sums
+static int merge_threads(struct proc_threads *threads, struct proc_thread_group *group,
+                         const struct proc_snapshot *fresh) {
+    if (threads->spare_capacity < fresh->count) {
+        size_t capacity = threads->spare_capacity ? threads->spare_capacity : 64;
+        while (capacity < fresh->count) {
+            capacity *= 2;
+        }
+        struct proc_thread *spare = realloc(threads->spare, capacity * sizeof(*spare));
+        if (spare == NULL) {
+            return -1;
+        }
+        threads->spare = spare;
+        threads->spare_capacity = capacity;
+        proc_stats_count(PROC_STATS_SCAN, PROC_STATS_ALLOCS, 1);
+    }
+
+    size_t i = 0;
+    long long delta = 0;
+    for (size_t j = 0; j < fresh->count; j++) {
+        const struct proc_entry *entry = &fresh->entries[j];
+        struct proc_thread *thread = &threads->spare[j];
+        unsigned long long ticks = (unsigned long long) entry->utime + entry->stime;
+
+        // Threads that exited take their time out of the sum
+        while (i < group->count && group->threads[i].tid < entry->pid) {
+            group->ticks -= group->threads[i++].ticks;
+        }
+        thread->tid = entry->pid;
+        thread->state = entry->state;
+        thread->prio = entry->prio;
+        thread->start_time = entry->start_time;
+        thread->ticks = ticks;
+        thread->delta = -1;
+        memcpy(thread->comm, entry->comm, sizeof(thread->comm));
+        if (i < group->count && group->threads[i].tid == entry->pid) {
+            const struct proc_thread *old = &group->threads[i++];
+            if (old->start_time == entry->start_time) {
+                thread->delta = ticks >= old->ticks ? (long long) (ticks - old->ticks) : 0;
+                delta += thread->delta;
+            }
+            group->ticks -= old->ticks;
+        }
+        group->ticks += ticks;
+    }
+    while (i < group->count) {
+        group->ticks -= group->threads[i++].ticks;
+    }
+
+    // The merged list becomes the group's, and its old storage the next spare
+    struct proc_thread *old = group->threads;
+    size_t old_capacity = group->capacity;
+    group->threads = threads->spare;
+    group->capacity = threads->spare_capacity;
+    group->count = fresh->count;
+    group->delta = delta;
+    threads->spare = old;
+    threads->spare_capacity = old_capacity;
+    return 0;
+}
+
+// Read the threads of one process, from the module when it is there and lets us write its filter
+static int load_threads(struct proc_threads *threads, struct proc_scanner *scanner, pid_t pid) {
+    if (threads->module_path != NULL) {
+        char filter[32];
+        snprintf(filter, sizeof(filter), "tgid=%d", pid);
+        if (proc_scan_module(scanner, threads->module_path, filter, &threads->scratch) == 0) {
+            // The module lists threads in creation order, which is nearly TID order
+            struct proc_snapshot *list = &threads->scratch;
+            for (size_t j = 1; j < list->count; j++) {
+                struct proc_entry entry = list->entries[j];
+                size_t i = j;
+                while (i > 0 && list->entries[i - 1].pid > entry.pid) {
+                    list->entries[i] = list->entries[i - 1];
+                    i--;
+                }
+                list->entries[i] = entry;
+            }
+            return 0;
+        }
+
+        // Only root may write filters; everyone else lists /proc/[pid]/task
+        if (errno != EACCES && errno != EPERM) {
+            return -1;
+        }
+        threads->module_path = NULL;
+    }
+    return proc_scan_tasks(scanner, pid, &threads->scratch);
+}
+
+// Reload what is wanted, drop the rest
+int proc_threads_refresh(struct proc_threads *threads, struct proc_scanner *scanner, const struct proc_snapshot *snap) {
+    size_t kept = 0;
+    int rc = 0;
+
+    threads->last_threads = 0;
+    for (size_t i = 0; i < threads->count; i++) {
+        struct proc_thread_group group = threads->groups[i];
+        const struct proc_entry *entry = proc_snapshot_find(snap, group.pid);
+
+        // A new process behind the same PID is not the one that was expanded
+        if (entry != NULL && group.start_time != 0 && entry->start_time != group.start_time) {
+            group.flags &= PROC_THREADS_HOT;
+            group.count = 0;
+            group.ticks = 0;
+        }
+
+        group.loaded = 0;
+        if (entry != NULL && (group.flags & (PROC_THREADS_EXPANDED | PROC_THREADS_HOT)) && rc == 0) {
+            // errno only means something when the load failed; an empty list leaves it as it was
+            int loaded = load_threads(threads, scanner, group.pid);
+            if (loaded == 0 && threads->scratch.count > 0) {
+                rc = merge_threads(threads, &group, &threads->scratch);
+                group.loaded = rc == 0;
+                group.start_time = entry->start_time;
+                threads->last_threads += threads->scratch.count;
+            } else if (loaded < 0 && errno == ENOMEM) {
+                rc = -1;
+            }
+        }
+
+        // Expanded processes stay listed even when a load failed, so they are retried
+        group.flags &= ~PROC_THREADS_HOT;
+        if (entry != NULL && (group.loaded || (group.flags & PROC_THREADS_EXPANDED))) {
+            threads->groups[kept++] = group;
+        } else {
+            free(group.threads);
+        }
+    }
+    threads->count = kept;
+    proc_stats_count(PROC_STATS_SCAN, PROC_STATS_ROWS, threads->last_threads);
+    return rc;
+}
@@ -0,0 +1,79 @@
+#ifndef PROC_THREADS_H
+#define PROC_THREADS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "proc_scan.h"
+
+// Thread lists, loaded only for the processes that need them: the ones the user
+// expanded and the ones that were busy in the last interval. A process with
+// 2,000 threads costs 2,000 reads only while someone looks at it, so a host
+// with hundreds of thousands of threads refreshes as fast as its process list.
+//
+// Each refresh merges the new list into the old one by TID and start time. The
+// per-thread CPU deltas and the per-process sums fall out of that merge, so the
+// totals are kept as running sums and never re-added from scratch.
+#define PROC_THREADS_EXPANDED   0x1     // Stays loaded until collapsed
+#define PROC_THREADS_HOT        0x2     // Loaded for this refresh only
+
+// One thread of a loaded process
+struct proc_thread {
+    pid_t tid;
+    char state;
+    int prio;
+    unsigned long long start_time;  // Clock ticks since boot; tells a reused TID apart
+    unsigned long long ticks;       // User + system time in clock ticks
+    long long delta;                // Ticks used since the previous load, -1 on the first
+    char comm[PROC_COMM_LEN];
+};
+
+// The threads of one process
+struct proc_thread_group {
+    pid_t pid;
+    unsigned long long start_time;  // Of the process, 0 until the first load
+    unsigned int flags;             // PROC_THREADS_*
+    struct proc_thread *threads;    // Sorted by TID
+    size_t count;
+    size_t capacity;
+    unsigned long long ticks;       // Sum of the live threads' ticks
+    long long delta;                // Sum of their deltas; threads seen for the first time add nothing
+    int loaded;                     // The list is from the last refresh
+};
+
+// Every loaded process, sorted by PID
+struct proc_threads {
+    struct proc_thread_group *groups;
+    size_t count;
+    size_t capacity;
+    const char *module_path;        // Read the module's tgid= view instead of /proc/[pid]/task, or NULL
+    struct proc_snapshot scratch;   // The list being merged
+    struct proc_thread *spare;      // The merged list, swapped with the group's
+    size_t spare_capacity;
+    size_t last_threads;            // Threads read by the last refresh
+};
+
+// Set up an empty set; with a module_path, threads come from the proc_info module
+// unless it refuses the filter (writing one needs root)
+void proc_threads_init(struct proc_threads *threads, const char *module_path);
+
+// Free every list
+void proc_threads_destroy(struct proc_threads *threads);
+
+// Keep the threads of a process loaded until it is collapsed; returns 0 or -1
+int proc_threads_expand(struct proc_threads *threads, pid_t pid);
+
+// Stop loading the threads of an expanded process
+void proc_threads_collapse(struct proc_threads *threads, pid_t pid);
+
+// Load the threads of a process in the next refresh only, e.g. because it was
+// busy; returns 0 or -1
+int proc_threads_mark_hot(struct proc_threads *threads, pid_t pid);
+
+// Reload every expanded or hot process that is still in snap, and drop the
+// rest. Hot marks are cleared for the next refresh. Returns 0 or -1.
+int proc_threads_refresh(struct proc_threads *threads, struct proc_scanner *scanner, const struct proc_snapshot *snap);
+
+// Loaded threads of a process, or NULL
+const struct proc_thread_group *proc_threads_find(const struct proc_threads *threads, pid_t pid);
+
+#endif
@@ -0,0 +1,164 @@
+#include "proc_users.h"
+#include "proc_stats.h"
+
+#include <pwd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define PWD_BUF_SIZE 1024
+#define PASSWD_PATH "/etc/passwd"
+
+// Seconds on the monotonic clock
+static time_t now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+// Hash a uid into the table (Fibonacci hashing)
+static size_t slot_of(const struct proc_users *users, uid_t uid) {
+    return (size_t) (((unsigned int) uid * 2654435769u) >> 7) & users->mask;
+}
+
+// Find the slot of a uid, or the empty slot where it would go. Lock held.
+static struct proc_user_slot *find_slot(struct proc_users *users, uid_t uid) {
+    size_t i = slot_of(users, uid);
+    while (users->slots[i].used && users->slots[i].uid != uid) {
+        i = (i + 1) & users->mask;
+    }
+    return &users->slots[i];
+}
+
+// Double the capacity, keeping every slot. Lock held.
+static int grow(struct proc_users *users) {
+    size_t old_capacity = users->mask + 1;
+    struct proc_user_slot *old = users->slots;
+    struct proc_user_slot *slots = calloc(old_capacity * 2, sizeof(*slots));
+    if (slots == NULL) {
+        return -1;
+    }
+    proc_stats_count(PROC_STATS_USERS, PROC_STATS_ALLOCS, 1);
+
+    users->slots = slots;
+    users->mask = old_capacity * 2 - 1;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].used) {
+            *find_slot(users, old[i].uid) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+// Store a lookup result. Lock held.
+static void store(struct proc_users *users, uid_t uid, const char *name, time_t now) {
+    // Keep the load factor at or below one half so probe chains stay short
+    if ((users->used + 1) * 2 > users->mask + 1 && grow(users) < 0) {
+        return;     // Just not cached
+    }
+
+    struct proc_user_slot *slot = find_slot(users, uid);
+    if (!slot->used) {
+        slot->used = 1;
+        slot->uid = uid;
+        users->used++;
+    }
+    slot->found = name != NULL;
+    slot->epoch = users->epoch;
+    slot->expires = now + (name != NULL ? PROC_USERS_TTL : PROC_USERS_NEGATIVE_TTL);
+    strncpy(slot->name, name != NULL ? name : "Unknown", sizeof(slot->name) - 1);
+    slot->name[sizeof(slot->name) - 1] = '\0';
+}
+
+// Drop every cached name once /etc/passwd has changed. Lock held.
+static void check_passwd(struct proc_users *users, time_t now) {
+    struct stat st;
+
+    if (now == users->checked) {
+        return;
+    }
+    users->checked = now;
+    if (stat(PASSWD_PATH, &st) < 0) {
+        return;
+    }
+    if (st.st_mtim.tv_sec != users->passwd_mtime.tv_sec || st.st_mtim.tv_nsec != users->passwd_mtime.tv_nsec) {
+        users->passwd_mtime = st.st_mtim;
+        users->epoch++;
+    }
+}
+
+// Create an empty cache, optionally loading the passwd database up front
+int proc_users_init(struct proc_users *users, int prewarm) {
+    memset(users, 0, sizeof(*users));
+    users->slots = calloc(256, sizeof(*users->slots));
+    if (users->slots == NULL) {
+        return -1;
+    }
+    users->mask = 255;
+    pthread_mutex_init(&users->lock, NULL);
+
+    time_t now = now_sec();
+    check_passwd(users, now);
+    if (prewarm) {
+        // getpwent is not thread-safe, which is why this only happens here
+        struct passwd *pw;
+        setpwent();
+        while ((pw = getpwent()) != NULL) {
+            store(users, pw->pw_uid, pw->pw_name, now);
+        }
+        endpwent();
+    }
+    return 0;
+}
+
+// Free the cache
+void proc_users_destroy(struct proc_users *users) {
+    pthread_mutex_destroy(&users->lock);
+    free(users->slots);
+    memset(users, 0, sizeof(*users));
+}
+
+// Copy the user name of uid into out
+int proc_users_name(struct proc_users *users, uid_t uid, char *out, size_t size) {
+    if (uid == (uid_t) -1) {
+        strncpy(out, "Unknown", size - 1);
+        out[size - 1] = '\0';
+        return -1;
+    }
+
+    time_t now = now_sec();
+    pthread_mutex_lock(&users->lock);
+    check_passwd(users, now);
+    const struct proc_user_slot *slot = find_slot(users, uid);
+    if (slot->used && slot->epoch == users->epoch && slot->expires > now) {
+        int found = slot->found;
+        strncpy(out, slot->name, size - 1);
+        out[size - 1] = '\0';
+        pthread_mutex_unlock(&users->lock);
+        return found ? 0 : -1;
+    }
+    users->lookups++;
+    pthread_mutex_unlock(&users->lock);
+
+    // NSS may go over the network, so other threads keep using the cache meanwhile
+    struct passwd pw, *result = NULL;
+    char buf[PWD_BUF_SIZE];
+    unsigned long long start = proc_stats_start();
+    int err = getpwuid_r(uid, &pw, buf, sizeof(buf), &result);
+    proc_stats_stop(PROC_STATS_USERS, start);
+    proc_stats_count(PROC_STATS_USERS, PROC_STATS_ROWS, 1);
+
+    // A failed lookup (as opposed to no such user) is not cached, so the next call retries
+    if (err == 0) {
+        pthread_mutex_lock(&users->lock);
+        store(users, uid, result != NULL ? result->pw_name : NULL, now);
+        pthread_mutex_unlock(&users->lock);
+    } else {
+        result = NULL;
+    }
+
+    strncpy(out, result != NULL ? result->pw_name : "Unknown", size - 1);
+    out[size - 1] = '\0';
+    return result != NULL ? 0 : -1;
+}
@@ -0,0 +1,52 @@
+#ifndef PROC_USERS_H
+#define PROC_USERS_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define PROC_USER_LEN 32
+
+// Cached names are looked up again after this many seconds; uids without an
+// account after PROC_USERS_NEGATIVE_TTL, so a newly added user shows up soon
+#define PROC_USERS_TTL 600
+#define PROC_USERS_NEGATIVE_TTL 60
+
+// One cached uid
+struct proc_user_slot {
+    uid_t uid;
+    int used;                   // The slot holds a uid
+    int found;                  // name is the account's; otherwise the uid has none
+    unsigned int epoch;         // Stale unless it matches proc_users.epoch
+    time_t expires;             // CLOCK_MONOTONIC seconds
+    char name[PROC_USER_LEN];
+};
+
+// uid -> user name cache shared by every thread of a program. Lookups that miss
+// go to NSS (getpwuid_r), which may be sssd or LDAP, so a refresh only pays for
+// uids it has not seen recently. The whole cache is dropped when the mtime of
+// /etc/passwd changes; that is checked at most once a second.
+struct proc_users {
+    pthread_mutex_t lock;
+    struct proc_user_slot *slots;
+    size_t mask;                // Capacity - 1; the capacity is a power of two
+    size_t used;
+    unsigned int epoch;
+    time_t checked;             // When /etc/passwd was last stat'ed
+    struct timespec passwd_mtime;
+    unsigned long lookups;      // getpwuid_r calls so far
+};
+
+// Create an empty cache. With prewarm, load the whole passwd database up front
+// with getpwent, before any other thread uses NSS. Returns 0 or -1.
+int proc_users_init(struct proc_users *users, int prewarm);
+
+// Free the cache
+void proc_users_destroy(struct proc_users *users);
+
+// Copy the user name of uid into out, or "Unknown" if the uid has no account;
+// returns 0 if the uid has a name, -1 if not. Safe to call from any thread.
+int proc_users_name(struct proc_users *users, uid_t uid, char *out, size_t size);
+
+#endif
@@ -1,4 +1,6 @@
 #include <gtk/gtk.h>
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
@@ -9,20 +11,135 @@
 #include <pwd.h>
 #include <glib.h>
 #include <execinfo.h>  // Include this header for backtrace functions
+#include <time.h>
+#include "proc_scan.h"
+#include "proc_diff.h"
+#include "proc_events.h"
+#include "proc_model.h"
+#include "proc_fetch.h"
+#include "proc_users.h"
+#include "proc_shm.h"
+#include "proc_history.h"
+#include "proc_rollup.h"
+#include "proc_stats.h"
+#include "proc_extra.h"
+#include "proc_threads.h"
+#include "proc_filter.h"
 
 // Declare global variables
-GtkTreeStore *store;
-GHashTable *seen_pids;  // To track seen PIDs
+ProcModel *model;  // Reads the columns of the shown sample (owned by the sampler)
+struct proc_fetcher fetcher;  // Reads user names and command lines for the rows on screen
+struct proc_users users;  // uid -> user name cache shared by the sampler and the fetcher
+
+// Background sampler: scans /proc on its own thread and hands finished columns to the main loop
+struct sampler {
+    GThread *thread;
+    GMutex lock;
+    GCond cond;
+    gboolean stop;
+    gboolean pending;               // A diff is waiting for the main loop; the sampler must not touch it
+    gboolean refresh_now;           // The Refresh button was pressed
+    guint interval_ms;              // Requested sampling interval
+    guint cpu_budget_pct;           // Share of one CPU the sampler may use
+    guint effective_interval_ms;    // Interval after backoff
+    double scan_cost_ms;            // Smoothed CPU time per sample
+    GtkTreeView *view;
+    struct proc_scanner scanner;    // Only used by the sampler thread
+    struct proc_snapshot bufs[2];   // Double buffer: the shown snapshot and the one being filled
+    int current;                    // Index of the snapshot the main loop shows or is about to
+    struct proc_diff diff;          // Changes from the previous snapshot to bufs[current]
+    gboolean diff_restarted;        // ... or from nothing, after the daemon lapped or replaced the shown one
+    struct proc_columns cols[2];    // bufs[i] laid out for the model
+    struct proc_intern strings;     // Command and user names of both column sets
+    gboolean use_events;            // Refresh from proc connector events instead of rescanning
+    struct proc_events events;
+    const char *attach_socket;      // Borrow proc_snapd's snapshots instead of scanning, or NULL
+    struct proc_shm shm;
+    uint64_t seqs[2];               // Seqlock values of bufs[i] when attached
+    const char *replay_file;        // Play back a recorded history instead of sampling, or NULL
+    struct proc_replay replay;
+    gint64 seek_ms;                 // Time the slider was moved to, or -1
+    uint64_t times_ms[2];           // Recorded time of bufs[i] when replaying
+    uint64_t first_ms;              // Time span of the recording, which grows while it is followed
+    uint64_t last_ms;
+    int group_by;                   // PROC_ROLLUP_* chosen in the window, or -1 for plain processes
+    struct proc_rollup rollup;      // Up to date with bufs[current] while rollup_synced
+    gboolean rollup_synced;
+    guint rollup_resets;            // Bumped whenever the rollup starts over
+    struct proc_diff rollup_diff;   // For starting over from an empty snapshot
+    gint64 times_us[2];             // When bufs[i] was sampled, for the CPU% of groups
+    struct proc_extra_table extra;  // Budgeted PSS, swap and descriptor counts, lined up with bufs[next]
+    pid_t thread_pid;               // Process selected in the window, whose threads are listed, or 0
+    pid_t loaded_pid;               // The one the sampler loads (sampler thread only)
+    struct proc_threads threads;    // Its threads, read by the main loop only while a sample is pending
+    struct proc_filter_index index[2];  // Search index of bufs[i], for the filter bar
+    double *cpu_pct;                // CPU% of each row of bufs[next] since the shown sample, for the index
+    size_t cpu_pct_capacity;
+    gboolean filter_cmdlines;       // The filter needs command lines, which the index then reads
+    gboolean filter_uids;           // ... or every process's uid, which the scan then reads
+};
+
+struct sampler sampler;
+
+// Shows what the last sample cost, stage by stage
+GtkWidget *status_bar;
+
+// Time slider of --replay, and its value-changed handler
+GtkWidget *time_slider;
+gulong time_slider_handler;
+
+// The per-user or per-command view and what it currently shows
+enum { GROUP_COL_NAME, GROUP_COL_PROCESSES, GROUP_COL_THREADS, GROUP_COL_RSS, GROUP_COL_CPU_PCT, GROUP_COL_CPU,
+       GROUP_N_COLUMNS };
+GtkListStore *group_store;
+GArray *group_rows;                 // struct group_row per rollup group
+guint shown_resets = G_MAXUINT;
+unsigned long long shown_update;
+
+// Filter bar: the last filter that parsed (of two, so a new one is parsed before
+// the old one is freed) and the rows it keeps of the shown sample
+struct proc_filter filters[2];
+int filter_slot = -1;               // Index of the active filter in filters, or -1
+int shown_sample = -1;              // Index of the sampler's cols and index the model shows
+gboolean filter_active;             // The model shows filter_tree instead of every row
+struct proc_columns_tree filter_tree;
+uint64_t *filter_bits;              // Matched, shown and last shown rows, filter_words each
+size_t filter_words;
+size_t filter_matches;
+
+// Filter matches that are all expanded, rather than restored from the expansion by PID
+#define FILTER_EXPAND_ROWS 5000
+
+// Threads of the selected process
+enum { THREAD_COL_TID, THREAD_COL_COMM, THREAD_COL_STATE, THREAD_COL_CPU_PCT, THREAD_COL_CPU, THREAD_N_COLUMNS };
+GtkListStore *thread_store;
+
+// Row of a rollup group in group_store
+struct group_row {
+    gboolean present;
+    GtkTreeIter iter;
+};
+
+// Sampling defaults, overridable with --interval MS and --cpu-budget PCT
+#define DEFAULT_INTERVAL_MS 2000
+#define DEFAULT_CPU_BUDGET_PCT 5
+
+// With --events, every process is re-read once per this many samples (--resample N)
+#define DEFAULT_RESAMPLE 10
+
+// With --extra, time each sample may spend on PSS, swap and descriptor counts, and
+// how long a value is shown before it counts as unknown again
+#define DEFAULT_EXTRA_BUDGET_US 20000
+#define DEFAULT_EXTRA_MAX_AGE_MS 60000
+
+// Longest the sampler listens for events before checking for stop or Refresh
+#define EVENT_POLL_MS 100
 
 // Function prototypes
-void populate_treeview(GtkTreeStore *store, GtkTreeIter *parent);
 void refresh_data(GtkWidget *widget, gpointer data);
 void collapse_treeview(GtkWidget *widget, gpointer data);
 void expand_all(GtkWidget *widget, gpointer data);
 void kill_process(GtkWidget *widget, gpointer data);
-unsigned long get_process_memory(pid_t pid);
-const char* get_username_by_uid(uid_t uid);
-unsigned long get_process_cpu_time(pid_t pid);
 void handle_segfault(int sig, siginfo_t *info, void *context);
 
 // Signal handler to capture segmentation faults
@@ -37,173 +154,762 @@ void handle_segfault(int sig, siginfo_t *info, void *context) {
     exit(1);
 }
 
-// Function to get process memory usage
-unsigned long get_process_memory(pid_t pid) {
-    char path[256];
-    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+// Remember the PID of every expanded row
+static void save_expanded_row(GtkTreeView *view, GtkTreePath *path, gpointer data) {
+    GtkTreeIter iter;
+    pid_t pid;
 
-    FILE *file = fopen(path, "r");
-    if (file == NULL) {
-        return 0;
+    if (gtk_tree_model_get_iter(GTK_TREE_MODEL(model), &iter, path)) {
+        gtk_tree_model_get(GTK_TREE_MODEL(model), &iter, PROC_MODEL_COL_PID, &pid, -1);
+        g_array_append_val((GArray *) data, pid);
     }
+}
 
-    unsigned long mem_usage = 0;
-    char buffer[256];
-    while (fgets(buffer, sizeof(buffer), file)) {
-        if (strncmp(buffer, "VmRSS:", 6) == 0) {
-            sscanf(buffer, "VmRSS: %lu kB", &mem_usage);
-            break;
-        }
+// Expand the row of a process again, if it still has one
+static void restore_expanded_row(GtkTreeView *view, pid_t pid) {
+    GtkTreeIter iter;
+    if (proc_model_find_pid(model, pid, &iter)) {
+        GtkTreePath *path = gtk_tree_model_get_path(GTK_TREE_MODEL(model), &iter);
+        gtk_tree_view_expand_row(view, path, FALSE);
+        gtk_tree_path_free(path);
     }
+}
 
-    fclose(file);
-    return mem_usage;
+// Get the PID of the row at path, or 0
+static pid_t pid_at_path(GtkTreePath *path) {
+    GtkTreeIter iter;
+    pid_t pid = 0;
+    if (path != NULL && gtk_tree_model_get_iter(GTK_TREE_MODEL(model), &iter, path)) {
+        gtk_tree_model_get(GTK_TREE_MODEL(model), &iter, PROC_MODEL_COL_PID, &pid, -1);
+    }
+    return pid;
 }
 
-// Function to get process CPU time
-unsigned long get_process_cpu_time(pid_t pid) {
-    char path[256];
-    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+// Match the filter against a sample's index and lay out the rows it keeps; the
+// model then shows filter_tree while filter_active. Returns TRUE if the kept rows
+// differ from the last call's, which reshapes the view even without a diff.
+static gboolean filter_columns(const struct proc_columns *cols, const struct proc_filter_index *index) {
+    gboolean was_active = filter_active;
+    size_t words = PROC_FILTER_WORDS(cols->count);
 
-    FILE *file = fopen(path, "r");
-    if (file == NULL) {
-        return 0;
+    filter_active = FALSE;
+    if (filter_slot < 0 || filters[filter_slot].empty || index->count != cols->count) {
+        return was_active;
+    }
+    if (words > filter_words || filter_bits == NULL) {
+        filter_bits = g_realloc(filter_bits, 3 * MAX(words, 1) * sizeof(*filter_bits));
+    }
+    uint64_t *matched = filter_bits, *shown = filter_bits + words, *last = filter_bits + 2 * words;
+    filter_matches = proc_filter_match(index, &filters[filter_slot], matched, shown);
+    gboolean changed = !was_active || words != filter_words || memcmp(shown, last, words * sizeof(*shown)) != 0;
+    memcpy(last, shown, words * sizeof(*shown));
+    filter_words = words;
+    if (proc_columns_filter(cols, shown, &filter_tree) < 0) {
+        return was_active;
     }
+    filter_active = TRUE;
+    return changed;
+}
 
-    unsigned long utime, stime;
-    char buffer[256];
-    fgets(buffer, sizeof(buffer), file);
+// Show a filter's few matches with every ancestor expanded, so none of them is folded away
+static void expand_matches(GtkTreeView *view) {
+    if (filter_active && filter_tree.shown <= FILTER_EXPAND_ROWS) {
+        gtk_tree_view_expand_all(view);
+    }
+}
 
-    sscanf(buffer, "%*d %*s %*c %*d %*d %*d %*d %*d %*d %*d %lu %lu", &utime, &stime);
+// Diffs beyond this many changes rebuild the view rather than reaching it row by row
+#define VIEW_UPDATE_CHANGES 2000
 
-    fclose(file);
-    return utime + stime;
-}
+// Show the columns of a new sample. Without a filter, a diff from the shown sample
+// of up to VIEW_UPDATE_CHANGES changes reaches the view as row signals, and the
+// view keeps expansion, selection and scroll position by itself. Otherwise, if only
+// values changed, the rows keep their paths and a redraw re-reads the visible ones.
+// If processes came, went or moved, or the filter keeps other rows, the view is
+// rebuilt, and expansion, selection and scroll position are restored by PID.
+static void show_columns(GtkTreeView *view, const struct proc_columns *cols, const struct proc_filter_index *index,
+                         const struct proc_diff *diff, gboolean diff_restarted) {
+    gboolean reshaped = filter_columns(cols, index);
+    const struct proc_columns_tree *tree = filter_active ? &filter_tree : NULL;
 
-// Function to get the username of a process by UID
-const char* get_username_by_uid(uid_t uid) {
-    struct passwd *pw = getpwuid(uid);
-    if (pw) {
-        return pw->pw_name;
-    } else {
-        return "Unknown";
+    // Subtree totals and the ages of budgeted metrics change without a diff entry, hence the redraw
+    if (!reshaped && !filter_active && !diff_restarted && diff->count <= VIEW_UPDATE_CHANGES) {
+        proc_model_update_columns(model, cols, diff);
+        gtk_widget_queue_draw(GTK_WIDGET(view));
+        return;
+    }
+    for (size_t i = 0; i < diff->count && !reshaped; i++) {
+        reshaped = (diff->changes[i].flags & (PROC_CHANGE_ADDED | PROC_CHANGE_REMOVED | PROC_CHANGE_REPARENTED)) != 0;
+    }
+    if (!reshaped && !diff_restarted) {
+        proc_model_set_columns(model, cols, tree);
+        gtk_widget_queue_draw(GTK_WIDGET(view));
+        return;
     }
-}
 
-// Helper function to get the parent of a process
-GtkTreeIter get_parent_iter(GtkTreeStore *store, pid_t ppid, GtkTreeIter *parent_iter) {
+    GtkTreeModel *selected_model;
     GtkTreeIter iter;
-    gboolean found = FALSE;
+    pid_t selected_pid = 0;
+    pid_t top_pid = 0;
+    GtkTreePath *top = NULL;
 
-    // Iterate through the tree to find the parent with matching PPID
-    GtkTreeModel *model = GTK_TREE_MODEL(store);
-    if (gtk_tree_model_get_iter_first(model, &iter)) {
-        do {
-            pid_t pid;
-            gtk_tree_model_get(model, &iter, 0, &pid, -1);
-            if (pid == ppid) {
-                *parent_iter = iter;
-                found = TRUE;
-                break;
-            }
-        } while (gtk_tree_model_iter_next(model, &iter));
+    if (gtk_tree_selection_get_selected(gtk_tree_view_get_selection(view), &selected_model, &iter)) {
+        gtk_tree_model_get(selected_model, &iter, PROC_MODEL_COL_PID, &selected_pid, -1);
     }
+    if (gtk_tree_view_get_visible_range(view, &top, NULL)) {
+        top_pid = pid_at_path(top);
+        gtk_tree_path_free(top);
+    }
+    GArray *expanded = g_array_new(FALSE, FALSE, sizeof(pid_t));
+    gtk_tree_view_map_expanded_rows(view, save_expanded_row, expanded);
+
+    // The view drops everything it knew about the old rows; it only reads the
+    // top level and the expanded rows back
+    g_object_ref(model);
+    gtk_tree_view_set_model(view, NULL);
+    proc_model_set_columns(model, cols, tree);
+    gtk_tree_view_set_model(view, GTK_TREE_MODEL(model));
+    g_object_unref(model);
+
+    // Parents come before their children, so each expansion finds its parent expanded
+    for (guint i = 0; i < expanded->len; i++) {
+        restore_expanded_row(view, g_array_index(expanded, pid_t, i));
+    }
+    g_array_free(expanded, TRUE);
+    expand_matches(view);
 
-    if (found) {
-        return *parent_iter;
-    } else {
-        // Return an empty iter if no parent is found
-        gtk_tree_store_append(store, &iter, NULL);
-        return iter;
+    if (selected_pid != 0 && proc_model_find_pid(model, selected_pid, &iter)) {
+        gtk_tree_selection_select_iter(gtk_tree_view_get_selection(view), &iter);
+    }
+    if (top_pid != 0 && proc_model_find_pid(model, top_pid, &iter)) {
+        GtkTreePath *path = gtk_tree_model_get_path(GTK_TREE_MODEL(model), &iter);
+        gtk_tree_view_scroll_to_cell(view, path, NULL, TRUE, 0, 0);
+        gtk_tree_path_free(path);
     }
 }
 
-// Populate treeview with process information
-void populate_treeview(GtkTreeStore *store, GtkTreeIter *parent) {
-    DIR *dir = opendir("/proc");
-    if (dir == NULL) {
-        perror("opendir");
-        return;
+// Get the CPU time used by the calling thread in milliseconds
+static double thread_cpu_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// Show the groups of a per-user or per-command rollup, touching only the rows of
+// groups that changed since the last sample. Main loop, while the sampler waits.
+static void show_groups(const struct proc_rollup *rollup, guint resets, double elapsed_s) {
+    gboolean full = resets != shown_resets;
+    if (full) {
+        gtk_list_store_clear(group_store);
+        g_array_set_size(group_rows, 0);
+        shown_resets = resets;
     }
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (entry->d_type == DT_DIR && atoi(entry->d_name) > 0) {
-            pid_t pid = atoi(entry->d_name);
+    long ticks_per_sec = sysconf(_SC_CLK_TCK);
+    for (size_t i = 0; i < rollup->group_count; i++) {
+        const struct proc_rollup_group *group = &rollup->groups[i];
+        if (i >= group_rows->len) {
+            g_array_set_size(group_rows, i + 1);
+        } else if (!full && group->changed <= shown_update) {
+            continue;
+        }
 
-            // Skip already processed PIDs
-            if (g_hash_table_contains(seen_pids, &pid)) {
-                continue;
+        struct group_row *row = &g_array_index(group_rows, struct group_row, i);
+        if (group->totals.processes == 0) {
+            if (row->present) {
+                gtk_list_store_remove(group_store, &row->iter);
+                row->present = FALSE;
             }
+            continue;
+        }
+        if (!row->present) {
+            gtk_list_store_append(group_store, &row->iter);
+            row->present = TRUE;
+        }
 
-            // Add the PID to the seen_pids table
-            g_hash_table_insert(seen_pids, g_malloc(sizeof(int)), &pid);
+        char name[PROC_USER_LEN];
+        if (rollup->kind == PROC_ROLLUP_USER) {
+            proc_users_name(&users, group->uid, name, sizeof(name));
+        } else {
+            g_strlcpy(name, group->comm, sizeof(name));
+        }
+        double cpu_pct = elapsed_s > 0 ? 100.0 * group->totals.cpu_delta / ticks_per_sec / elapsed_s : 0;
+        gtk_list_store_set(group_store, &row->iter, GROUP_COL_NAME, name,
+                           GROUP_COL_PROCESSES, (guint) group->totals.processes,
+                           GROUP_COL_THREADS, (guint) group->totals.threads,
+                           GROUP_COL_RSS, (guint64) group->totals.rss_kb, GROUP_COL_CPU_PCT, cpu_pct,
+                           GROUP_COL_CPU, (guint64) group->totals.cpu_ticks, -1);
+    }
+    shown_update = rollup->update;
+}
+
+// List the threads of the selected process, busiest first; only a handful of rows
+// change order between samples, but a list of a few thousand is cheap to refill
+static void show_threads(const struct proc_threads *threads, pid_t pid, double elapsed_s) {
+    const struct proc_thread_group *group = proc_threads_find(threads, pid);
+    long ticks_per_sec = sysconf(_SC_CLK_TCK);
+
+    gtk_list_store_clear(thread_store);
+    if (group == NULL || !group->loaded) {
+        return;
+    }
+    for (size_t i = 0; i < group->count; i++) {
+        const struct proc_thread *thread = &group->threads[i];
+        char state[2] = { thread->state, '\0' };
+        double pct = thread->delta >= 0 && elapsed_s > 0 ? 100.0 * thread->delta / ticks_per_sec / elapsed_s : 0;
+        gtk_list_store_insert_with_values(thread_store, NULL, -1, THREAD_COL_TID, thread->tid,
+                                          THREAD_COL_COMM, thread->comm, THREAD_COL_STATE, state,
+                                          THREAD_COL_CPU_PCT, pct, THREAD_COL_CPU, (guint64) thread->ticks, -1);
+    }
+}
+
+// Runs on the main loop: show the sample the sampler just finished
+static gboolean deliver_sample(gpointer data) {
+    struct sampler *s = data;
+
+    g_mutex_lock(&s->lock);
+    const struct proc_columns *cols = &s->cols[s->current];
+    guint interval_ms = s->effective_interval_ms;
+    shown_sample = s->current;
+    g_mutex_unlock(&s->lock);
+
+    unsigned long long start = proc_stats_start();
+    show_columns(s->view, cols, &s->index[s->current], &s->diff, s->diff_restarted);
+    s->diff_restarted = FALSE;
+    proc_fetch_new_sample(&fetcher, &s->bufs[s->current]);
+
+    // The sampler leaves the rollup alone until this sample is handed back
+    if (s->rollup_synced && (s->rollup.kind == PROC_ROLLUP_USER || s->rollup.kind == PROC_ROLLUP_COMM)) {
+        double elapsed_s = (double) (s->times_us[s->current] - s->times_us[1 - s->current]) / 1e6;
+        show_groups(&s->rollup, s->rollup_resets, elapsed_s);
+    }
+    show_threads(&s->threads, s->thread_pid, (double) (s->times_us[s->current] - s->times_us[1 - s->current]) / 1e6);
+    proc_stats_stop(PROC_STATS_VIEW, start);
+
+    char digest[512];
+    proc_stats_format_line(digest, sizeof(digest));
+    gchar *status = filter_active ? g_strdup_printf("%zu of %zu processes match, every %u ms: %s", filter_matches,
+                                                    cols->count, interval_ms, digest)
+                                  : g_strdup_printf("%zu processes every %u ms: %s", cols->count, interval_ms, digest);
+    gtk_statusbar_remove_all(GTK_STATUSBAR(status_bar), 0);
+    gtk_statusbar_push(GTK_STATUSBAR(status_bar), 0, status);
+    g_free(status);
 
-            char path[256];
-            snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    // Follow playback with the slider without it asking for a seek
+    if (s->replay_file != NULL) {
+        g_mutex_lock(&s->lock);
+        double span = (double) (s->last_ms - s->first_ms) / 1000;
+        double at = (double) (s->times_ms[s->current] - s->first_ms) / 1000;
+        g_mutex_unlock(&s->lock);
+        g_signal_handler_block(time_slider, time_slider_handler);
+        gtk_range_set_range(GTK_RANGE(time_slider), 0, MAX(span, 1));
+        gtk_range_set_value(GTK_RANGE(time_slider), at);
+        g_signal_handler_unblock(time_slider, time_slider_handler);
+    }
+
+    // Hand the diff buffer and the old snapshot and columns back to the sampler
+    g_mutex_lock(&s->lock);
+    s->pending = FALSE;
+    g_cond_signal(&s->cond);
+    g_mutex_unlock(&s->lock);
+    return G_SOURCE_REMOVE;
+}
+
+// Borrow proc_snapd's newest snapshot into bufs[next], then diff it and build its
+// columns. Returns 1 with a new sample, 0 if there is none yet, -1 on error.
+static int sampler_borrow(struct sampler *s, int next) {
+    static const struct proc_snapshot empty;
+    struct proc_snapshot *shown = &s->bufs[s->current];
+    struct proc_snapshot *snap = &s->bufs[next];
+    struct proc_shm_sample sample;
+
+    // Drain the notifications that piled up meanwhile; this also notices a daemon that went away
+    if (proc_shm_wait(&s->shm, 0) < 0) {
+        return -1;
+    }
+    while (proc_shm_read(&s->shm, snap, &sample) < 0) {
+        if (errno != ESTALE) {
+            return errno == EAGAIN ? 0 : -1;
+        }
+        // The daemon moved to a bigger segment; the shown snapshot goes with the old one
+        proc_shm_close(&s->shm);
+        *shown = empty;
+        s->rollup_synced = FALSE;
+        s->diff_restarted = TRUE;
+        if (proc_shm_attach(&s->shm, s->attach_socket, s->interval_ms) < 0) {
+            return -1;
+        }
+    }
+    if (snap->generation == shown->generation) {
+        return 0;
+    }
+    s->seqs[next] = sample.seq;
+
+    // If the daemon lapped the shown snapshot, the diff against it is worthless; diffing
+    // against nothing instead makes show_columns rebuild the view, and the rollup starts over
+    if (proc_diff_snapshots(shown, snap, &s->diff) < 0) {
+        return -1;
+    }
+    if (shown->count > 0 && !proc_shm_valid(&s->shm, shown, s->seqs[s->current])) {
+        s->rollup_synced = FALSE;
+        s->diff_restarted = TRUE;
+        if (proc_diff_snapshots(&empty, snap, &s->diff) < 0) {
+            return -1;
+        }
+    }
+    if (proc_columns_build(&s->cols[next], snap, &s->strings, &users) < 0) {
+        return -1;
+    }
+    // Columns built from a slot that was rewritten meanwhile are dropped; the next interval retries
+    return proc_shm_valid(&s->shm, snap, sample.seq) ? 1 : 0;
+}
+
+// Decode the next recorded frame, or the one at seek_ms, into bufs[next], then diff
+// it and build its columns. Returns 1 with a new sample, 0 at the end of the
+// recording, -1 on error.
+static int sampler_replay(struct sampler *s, int next, gint64 seek_ms) {
+    int rc = seek_ms >= 0 ? (proc_replay_seek(&s->replay, (uint64_t) seek_ms) == 0 ? 1 : -1)
+                          : proc_replay_next(&s->replay);
+    if (rc <= 0) {
+        return rc;
+    }
+
+    // The replay reuses its snapshots, and bufs[next] must outlive the next frame
+    const struct proc_snapshot *frame = proc_replay_snapshot(&s->replay);
+    struct proc_snapshot *snap = &s->bufs[next];
+    if (proc_snapshot_reserve(snap, frame->count) < 0) {
+        return -1;
+    }
+    memcpy(snap->entries, frame->entries, frame->count * sizeof(*frame->entries));
+    snap->count = frame->count;
+    snap->generation = frame->generation;
+    s->times_ms[next] = s->replay.time_ms;
+
+    if (proc_diff_snapshots(&s->bufs[s->current], snap, &s->diff) < 0 ||
+        proc_columns_build(&s->cols[next], snap, &s->strings, &users) < 0) {
+        return -1;
+    }
+    return 1;
+}
+
+// Bring the rollup from bufs[current] to bufs[next] with the diff between them, or
+// start it over when the grouping changed. Grouping by subtree puts the totals in
+// the columns. Returns 0 or -1.
+static int sampler_roll(struct sampler *s, int next, int group_by) {
+    static const struct proc_snapshot empty;
+
+    if (group_by < 0) {
+        s->rollup_synced = FALSE;
+        return 0;
+    }
+    if (!s->rollup_synced || s->rollup.kind != group_by) {
+        proc_rollup_destroy(&s->rollup);
+        s->rollup_resets++;
+        if (proc_rollup_init(&s->rollup, group_by) < 0 ||
+            proc_diff_snapshots(&empty, &s->bufs[next], &s->rollup_diff) < 0 ||
+            proc_rollup_apply(&s->rollup, &empty, &s->bufs[next], &s->rollup_diff) < 0) {
+            return -1;
+        }
+    } else if (proc_rollup_apply(&s->rollup, &s->bufs[s->current], &s->bufs[next], &s->diff) < 0) {
+        s->rollup_synced = FALSE;
+        return -1;
+    }
+    s->rollup_synced = TRUE;
+    return group_by == PROC_ROLLUP_TREE ? proc_columns_set_subtrees(&s->cols[next], &s->rollup) : 0;
+}
+
+// Index bufs[next] for the filter bar, with each process's CPU% since the shown
+// sample. Each index carries its command lines over from its own last update, so
+// a command line is read at most once for each of the two. Returns 0 or -1.
+static int sampler_index(struct sampler *s, int next, gboolean cmdlines) {
+    const struct proc_snapshot *old = &s->bufs[s->current];
+    const struct proc_snapshot *snap = &s->bufs[next];
+    double elapsed_s = (double) (s->times_us[next] - s->times_us[s->current]) / 1e6;
+    long ticks_per_sec = sysconf(_SC_CLK_TCK);
+
+    if (snap->count > s->cpu_pct_capacity) {
+        s->cpu_pct = g_realloc(s->cpu_pct, snap->count * sizeof(*s->cpu_pct));
+        s->cpu_pct_capacity = snap->count;
+    }
+    // Both are sorted by PID; a reused PID starts from nothing
+    size_t j = 0;
+    for (size_t i = 0; i < snap->count; i++) {
+        const struct proc_entry *entry = &snap->entries[i];
+        while (j < old->count && old->entries[j].pid < entry->pid) {
+            j++;
+        }
+        double delta = 0;
+        if (j < old->count && old->entries[j].pid == entry->pid && old->entries[j].start_time == entry->start_time) {
+            delta = (double) (entry->utime + entry->stime) - (double) (old->entries[j].utime + old->entries[j].stime);
+        }
+        s->cpu_pct[i] = elapsed_s > 0 && delta > 0 ? 100.0 * delta / ticks_per_sec / elapsed_s : 0;
+    }
+    // The live command lines of recorded PIDs would belong to other processes
+    return proc_filter_index_update(&s->index[next], s->replay_file == NULL ? &s->scanner : NULL, snap, s->cpu_pct,
+                                    cmdlines);
+}
 
-            FILE *file = fopen(path, "r");
-            if (!file) {
-                continue;
+// Sampler thread: scan, diff against the shown snapshot, hand over, sleep
+static gpointer sampler_thread(gpointer data) {
+    struct sampler *s = data;
+    gint64 next_due = 0;
+
+    g_mutex_lock(&s->lock);
+    while (!s->stop) {
+        // Wait until the main loop has taken the last sample and the next one is due
+        while (!s->stop && (s->pending || (!s->refresh_now && g_get_monotonic_time() < next_due))) {
+            if (s->pending) {
+                g_cond_wait(&s->cond, &s->lock);
+            } else if (s->use_events) {
+                // Read forked processes while they are still there
+                gint64 wait_ms = (next_due - g_get_monotonic_time()) / 1000;
+                g_mutex_unlock(&s->lock);
+                proc_events_wait(&s->events, &s->scanner, (int) CLAMP(wait_ms, 0, EVENT_POLL_MS));
+                g_mutex_lock(&s->lock);
+            } else {
+                g_cond_wait_until(&s->cond, &s->lock, next_due);
             }
+        }
+        if (s->stop) {
+            break;
+        }
+        s->refresh_now = FALSE;
+        int next = 1 - s->current;
+        gint64 seek_ms = s->seek_ms;
+        s->seek_ms = -1;
+        int group_by = s->group_by;
+        pid_t thread_pid = s->thread_pid;
+        gboolean filter_cmdlines = s->filter_cmdlines;
+        gboolean filter_uids = s->filter_uids;
+        g_mutex_unlock(&s->lock);
 
-            char comm[256] = {0};
-            uid_t uid = 0;
-            unsigned long mem_usage = 0;
-            unsigned long cpu_time = 0;
-            pid_t ppid = 0;
+        // Only grouping or filtering by user needs every uid; otherwise the fetcher reads the visible ones
+        s->scanner.skip_status = group_by != PROC_ROLLUP_USER && !filter_uids;
 
-            char buffer[256];
-            while (fgets(buffer, sizeof(buffer), file)) {
-                if (strncmp(buffer, "Name:", 5) == 0) {
-                    sscanf(buffer, "Name:\t%s", comm);
-                }
-                if (strncmp(buffer, "Uid:", 4) == 0) {
-                    sscanf(buffer, "Uid:\t%u", &uid);
-                }
-                if (strncmp(buffer, "PPid:", 5) == 0) {
-                    sscanf(buffer, "PPid:\t%d", &ppid);
+        // The main loop only reads bufs[current], so bufs[next] and the diff are ours
+        double start = thread_cpu_ms();
+        int scanned;
+        gboolean ok;
+        if (s->attach_socket != NULL) {
+            scanned = sampler_borrow(s, next);
+            ok = scanned > 0;
+        } else if (s->replay_file != NULL) {
+            scanned = sampler_replay(s, next, seek_ms);
+            ok = scanned > 0;
+        } else {
+            scanned = s->use_events
+                      ? proc_events_refresh(&s->events, &s->scanner, &s->bufs[s->current], &s->bufs[next])
+                      : proc_scan_snapshot(&s->scanner, &s->bufs[next]);
+            ok = scanned == 0 &&
+                 proc_diff_snapshots(&s->bufs[s->current], &s->bufs[next], &s->diff) == 0 &&
+                 proc_columns_build(&s->cols[next], &s->bufs[next], &s->strings, &users) == 0;
+        }
+        if (ok) {
+            s->times_us[next] = s->replay_file != NULL ? (gint64) s->times_ms[next] * 1000 : g_get_monotonic_time();
+            if (sampler_roll(s, next, group_by) < 0) {
+                s->rollup_synced = FALSE;
+                perror("proc_rollup_apply");
+            }
+            // Counted in the scan cost below, so the CPU budget covers these reads too
+            uint64_t now_ms = proc_extra_now_ms();
+            if (s->extra.want && (proc_extra_update(&s->extra, &s->scanner, &s->bufs[next], now_ms) < 0 ||
+                                  proc_columns_set_extra(&s->cols[next], &s->extra, now_ms) < 0)) {
+                perror("proc_extra_update");
+            }
+            if (sampler_index(s, next, filter_cmdlines) < 0) {
+                perror("proc_filter_index_update");
+            }
+
+            // Only the selected process's threads are read; a recording has none
+            if (thread_pid != s->loaded_pid) {
+                proc_threads_collapse(&s->threads, s->loaded_pid);
+                if (thread_pid != 0 && proc_threads_expand(&s->threads, thread_pid) < 0) {
+                    perror("proc_threads_expand");
                 }
+                s->loaded_pid = thread_pid;
+            }
+            if (s->replay_file == NULL && proc_threads_refresh(&s->threads, &s->scanner, &s->bufs[next]) < 0) {
+                perror("proc_threads_refresh");
             }
-            fclose(file);
+        }
+        double cost = thread_cpu_ms() - start + s->scanner.helper_cpu_ns / 1e6;
 
-            mem_usage = get_process_memory(pid);
-            cpu_time = get_process_cpu_time(pid);
+        g_mutex_lock(&s->lock);
 
-            GtkTreeIter iter;
-            // Find the parent first
-            GtkTreeIter parent_iter;
-            if (ppid > 0) {
-                parent_iter = get_parent_iter(store, ppid, &parent_iter);
-                gtk_tree_store_append(store, &iter, &parent_iter);  // Add as child
-            } else {
-                // For system processes with no parent (e.g., PID 1), append at the root level
-                gtk_tree_store_append(store, &iter, parent);
-            }
+        // Back off so that scanning stays within the CPU budget
+        s->scan_cost_ms = s->scan_cost_ms > 0 ? 0.7 * s->scan_cost_ms + 0.3 * cost : cost;
+        double budget_interval = s->scan_cost_ms * 100.0 / s->cpu_budget_pct;
+        s->effective_interval_ms = MAX(s->interval_ms, (guint) budget_interval);
+        next_due = g_get_monotonic_time() + (gint64) s->effective_interval_ms * 1000;
 
-            gtk_tree_store_set(store, &iter,
-                               0, pid,
-                               1, get_username_by_uid(uid),
-                               2, comm,
-                               3, mem_usage,
-                               4, cpu_time,
-                               -1);
+        if (s->replay_file != NULL) {
+            s->first_ms = s->replay.first_ms;
+            s->last_ms = s->replay.last_ms;
+        }
+        if (ok) {
+            s->current = next;
+            s->pending = TRUE;
+            g_idle_add(deliver_sample, s);
+        } else if (scanned < 0 || (s->attach_socket == NULL && s->replay_file == NULL)) {
+            // Attached or replaying, 0 just means nothing new yet
+            perror(s->attach_socket != NULL ? s->attach_socket
+                   : s->replay_file != NULL ? s->replay_file : "proc_scan_snapshot");
         }
     }
+    g_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+// Start sampling /proc in the background for the given tree view. With an
+// attach_socket, the snapshots come from proc_snapd instead; with a replay_file,
+// from a recorded history, one frame per interval.
+static int sampler_start(struct sampler *s, GtkTreeView *view, const char *proc_root, const char *attach_socket,
+                         const char *replay_file, guint interval_ms, guint cpu_budget_pct, guint threads,
+                         guint resample, unsigned int extra_want) {
+    if (proc_scanner_init(&s->scanner, proc_root) < 0) {
+        return -1;
+    }
+    proc_extra_init(&s->extra, replay_file == NULL ? extra_want : 0, DEFAULT_EXTRA_BUDGET_US,
+                    DEFAULT_EXTRA_MAX_AGE_MS);
+    proc_threads_init(&s->threads, NULL);
+    proc_filter_index_init(&s->index[0]);
+    proc_filter_index_init(&s->index[1]);
+    if (proc_intern_init(&s->strings) < 0) {
+        proc_scanner_destroy(&s->scanner);
+        return -1;
+    }
+    proc_scanner_set_threads(&s->scanner, threads);
+    s->scanner.skip_status = 1;  // The uid comes from the fetcher, for the rows on screen only
+
+    s->attach_socket = attach_socket;
+    if (attach_socket != NULL && proc_shm_attach(&s->shm, attach_socket, interval_ms) < 0) {
+        proc_intern_destroy(&s->strings);
+        proc_scanner_destroy(&s->scanner);
+        return -1;
+    }
+    s->replay_file = replay_file;
+    s->seek_ms = -1;
+    s->group_by = -1;
+    if (replay_file != NULL && proc_replay_open(&s->replay, replay_file) < 0) {
+        proc_intern_destroy(&s->strings);
+        proc_scanner_destroy(&s->scanner);
+        return -1;
+    }
+
+    // resample 0 means no event mode; without the connector we keep rescanning
+    if (resample > 0 && attach_socket == NULL && replay_file == NULL) {
+        if (proc_events_open(&s->events, resample) == 0) {
+            s->use_events = TRUE;
+        } else {
+            g_printerr("Process events unavailable (%s), rescanning every interval\n", g_strerror(errno));
+        }
+    }
+
+    g_mutex_init(&s->lock);
+    g_cond_init(&s->cond);
+    s->view = view;
+    s->interval_ms = interval_ms;
+    s->cpu_budget_pct = cpu_budget_pct ? cpu_budget_pct : 1;
+    s->effective_interval_ms = interval_ms;
+    s->thread = g_thread_new("sampler", sampler_thread, s);
+    return 0;
+}
+
+// Stop the sampler thread and free its buffers
+static void sampler_stop(struct sampler *s) {
+    g_mutex_lock(&s->lock);
+    s->stop = TRUE;
+    g_cond_signal(&s->cond);
+    g_mutex_unlock(&s->lock);
+    g_thread_join(s->thread);
+
+    g_mutex_clear(&s->lock);
+    g_cond_clear(&s->cond);
+    if (s->use_events) {
+        proc_events_close(&s->events);
+    }
+    if (s->attach_socket != NULL) {
+        proc_shm_close(&s->shm);
+    }
+    if (s->replay_file != NULL) {
+        proc_replay_close(&s->replay);
+    }
+    proc_diff_free(&s->diff);
+    proc_diff_free(&s->rollup_diff);
+    proc_rollup_destroy(&s->rollup);
+    proc_extra_destroy(&s->extra);
+    proc_threads_destroy(&s->threads);
+    proc_filter_index_destroy(&s->index[0]);
+    proc_filter_index_destroy(&s->index[1]);
+    g_free(s->cpu_pct);
+    proc_columns_free(&s->cols[0]);
+    proc_columns_free(&s->cols[1]);
+    proc_intern_destroy(&s->strings);
+    proc_snapshot_free(&s->bufs[0]);
+    proc_snapshot_free(&s->bufs[1]);
+    proc_scanner_destroy(&s->scanner);
+}
+
+// Redraw the rows once the fetcher has their details
+static void redraw_fetched(gpointer data) {
+    gtk_widget_queue_draw(GTK_WIDGET(data));
+}
+
+// Fetch the details of an expanded row's children before they are scrolled to
+static void prefetch_expanded(GtkTreeView *view, GtkTreeIter *iter, GtkTreePath *path, gpointer data) {
+    proc_model_prefetch_children(model, iter);
+}
+
+// Switch between the process tree and the per-user, per-command or per-subtree rollup
+static void change_grouping(GtkComboBox *combo, gpointer data) {
+    GtkWidget **windows = data;     // The process tree's and the group list's scrolled windows
+    const char *id = gtk_combo_box_get_active_id(combo);
+    int group_by = id != NULL ? proc_rollup_parse_kind(id) : -1;
+    gboolean groups = group_by == PROC_ROLLUP_USER || group_by == PROC_ROLLUP_COMM;
+
+    GtkTreeView *view = GTK_TREE_VIEW(gtk_bin_get_child(GTK_BIN(windows[0])));
+    gtk_tree_view_column_set_title(gtk_tree_view_get_column(view, 3),
+                                   group_by == PROC_ROLLUP_TREE ? "Memory (subtree)" : "Memory");
+    gtk_tree_view_column_set_title(gtk_tree_view_get_column(view, 4),
+                                   group_by == PROC_ROLLUP_TREE ? "CPU Time (subtree)" : "CPU Time");
+    gtk_widget_set_visible(windows[0], !groups);
+    gtk_widget_set_visible(windows[1], groups);
+
+    g_mutex_lock(&sampler.lock);
+    sampler.group_by = group_by;
+    sampler.refresh_now = TRUE;
+    g_cond_signal(&sampler.cond);
+    g_mutex_unlock(&sampler.lock);
+}
+
+// Show a CPU% column of a list with one decimal; data is the column
+static void format_list_cpu(GtkTreeViewColumn *column, GtkCellRenderer *renderer, GtkTreeModel *store,
+                            GtkTreeIter *iter, gpointer data) {
+    gdouble pct;
+    char text[32];
+    gtk_tree_model_get(store, iter, GPOINTER_TO_INT(data), &pct, -1);
+    snprintf(text, sizeof(text), "%.1f %%", pct);
+    g_object_set(renderer, "text", text, NULL);
+}
+
+// Add a sortable column to the group or thread list; a percent column shows one decimal
+static void append_list_column(GtkTreeView *view, const char *title, gint store_column, gboolean percent) {
+    GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
+    GtkTreeViewColumn *column = gtk_tree_view_column_new_with_attributes(title, renderer, "text", store_column, NULL);
+    if (percent) {
+        gtk_tree_view_column_set_cell_data_func(column, renderer, format_list_cpu, GINT_TO_POINTER(store_column), NULL);
+    }
+    gtk_tree_view_column_set_sort_column_id(column, store_column);
+    gtk_tree_view_column_set_resizable(column, TRUE);
+    gtk_tree_view_append_column(view, column);
+}
+
+// Jump the replay to the time the slider was moved to
+static void seek_replay(GtkRange *range, gpointer data) {
+    g_mutex_lock(&sampler.lock);
+    sampler.seek_ms = (gint64) (sampler.first_ms + (uint64_t) (gtk_range_get_value(range) * 1000));
+    sampler.refresh_now = TRUE;
+    g_cond_signal(&sampler.cond);
+    g_mutex_unlock(&sampler.lock);
+}
+
+// Label the slider with the recorded date and time instead of its offset
+static gchar *format_replay_time(GtkScale *scale, gdouble value, gpointer data) {
+    g_mutex_lock(&sampler.lock);
+    time_t t = (time_t) ((sampler.first_ms + (uint64_t) (value * 1000)) / 1000);
+    g_mutex_unlock(&sampler.lock);
+
+    struct tm tm;
+    char text[32];
+    strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm));
+    return g_strdup(text);
+}
+
+// List the threads of the process selected in the tree, from the next sample on
+static void select_threads(GtkTreeSelection *selection, gpointer data) {
+    GtkTreeModel *tree_model;
+    GtkTreeIter iter;
+    gint pid = 0;
+
+    if (gtk_tree_selection_get_selected(selection, &tree_model, &iter)) {
+        gtk_tree_model_get(tree_model, &iter, PROC_MODEL_COL_PID, &pid, -1);
+    }
+    g_mutex_lock(&sampler.lock);
+    if (sampler.thread_pid != pid) {
+        sampler.thread_pid = pid;
+        sampler.refresh_now = TRUE;
+        g_cond_signal(&sampler.cond);
+    }
+    g_mutex_unlock(&sampler.lock);
+}
+
+// Filter the tree as the filter bar is typed into: match against the index of the
+// shown sample and rebuild the view from the kept rows. Text that does not parse
+// marks the entry and keeps the last filter.
+static void change_filter(GtkEditable *editable, gpointer data) {
+    GtkTreeView *view = data;
+    GtkWidget *entry = GTK_WIDGET(editable);
+    GtkStyleContext *style = gtk_widget_get_style_context(entry);
+    int slot = filter_slot == 0 ? 1 : 0;
+    char error[128];
+
+    if (proc_filter_parse(&filters[slot], gtk_entry_get_text(GTK_ENTRY(entry)), error, sizeof(error)) < 0) {
+        gtk_style_context_add_class(style, "error");
+        gtk_widget_set_tooltip_text(entry, error);
+        return;
+    }
+    gtk_style_context_remove_class(style, "error");
+    gtk_widget_set_tooltip_text(entry, NULL);
+    if (filter_slot >= 0) {
+        proc_filter_free(&filters[filter_slot]);
+    }
+    filter_slot = slot;
+
+    // Command lines and uids are only read while a filter asks for them; the next sample has them
+    const struct proc_filter *filter = &filters[slot];
+    g_mutex_lock(&sampler.lock);
+    if ((filter->has_cmdline && !sampler.filter_cmdlines) || (filter->has_uid && !sampler.filter_uids)) {
+        sampler.refresh_now = TRUE;
+        g_cond_signal(&sampler.cond);
+    }
+    sampler.filter_cmdlines = filter->has_cmdline;
+    sampler.filter_uids = filter->has_uid;
+    g_mutex_unlock(&sampler.lock);
+
+    // The sampler leaves the shown sample's columns and index alone
+    if (shown_sample < 0) {
+        return;
+    }
+    unsigned long long start = proc_stats_start();
+    const struct proc_columns *cols = &sampler.cols[shown_sample];
+    filter_columns(cols, &sampler.index[shown_sample]);
+    g_object_ref(model);
+    gtk_tree_view_set_model(view, NULL);
+    proc_model_set_columns(model, cols, filter_active ? &filter_tree : NULL);
+    gtk_tree_view_set_model(view, GTK_TREE_MODEL(model));
+    g_object_unref(model);
+    expand_matches(view);
+    proc_stats_stop(PROC_STATS_VIEW, start);
 
-    closedir(dir);
+    gchar *status = filter_active ? g_strdup_printf("%zu of %zu processes match", filter_matches, cols->count)
+                                  : g_strdup_printf("%zu processes", cols->count);
+    gtk_statusbar_remove_all(GTK_STATUSBAR(status_bar), 0);
+    gtk_statusbar_push(GTK_STATUSBAR(status_bar), 0, status);
+    g_free(status);
 }
 
-// Refresh the data in the treeview
+// Refresh the data in the treeview: ask the sampler for a sample right away
 void refresh_data(GtkWidget *widget, gpointer data) {
-    gtk_tree_store_clear(store);
-    populate_treeview(store, NULL);
+    g_mutex_lock(&sampler.lock);
+    sampler.refresh_now = TRUE;
+    g_cond_signal(&sampler.cond);
+    g_mutex_unlock(&sampler.lock);
 }
 
 // Collapse all rows in the treeview
 void collapse_treeview(GtkWidget *widget, gpointer data) {
     GtkTreeIter iter;
-    GtkTreeModel *model = GTK_TREE_MODEL(store);
+    GtkTreeModel *model = gtk_tree_view_get_model(GTK_TREE_VIEW(data));
 
     if (gtk_tree_model_get_iter_first(model, &iter)) {
         do {
@@ -217,7 +923,7 @@ void collapse_treeview(GtkWidget *widget, gpointer data) {
 // Expand all rows in the treeview
 void expand_all(GtkWidget *widget, gpointer data) {
     GtkTreeIter iter;
-    GtkTreeModel *model = GTK_TREE_MODEL(store);
+    GtkTreeModel *model = gtk_tree_view_get_model(GTK_TREE_VIEW(data));
 
     if (gtk_tree_model_get_iter_first(model, &iter)) {
         do {
@@ -228,6 +934,16 @@ void expand_all(GtkWidget *widget, gpointer data) {
     }
 }
 
+// Add a text column with a fixed width, as fixed-height mode requires
+static void append_fixed_column(GtkTreeView *view, GtkCellRenderer *renderer, const char *title, gint model_column,
+                                gint width) {
+    GtkTreeViewColumn *column = gtk_tree_view_column_new_with_attributes(title, renderer, "text", model_column, NULL);
+    gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width(column, width);
+    gtk_tree_view_column_set_resizable(column, TRUE);
+    gtk_tree_view_append_column(view, column);
+}
+
 // Kill a selected process
 void kill_process(GtkWidget *widget, gpointer data) {
     GtkTreeSelection *selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(data));
@@ -253,6 +969,59 @@ void kill_process(GtkWidget *widget, gpointer data) {
 int main(int argc, char *argv[]) {
     gtk_init(&argc, &argv);
 
+    guint interval_ms = DEFAULT_INTERVAL_MS;
+    guint cpu_budget_pct = DEFAULT_CPU_BUDGET_PCT;
+    guint threads = 1;
+    const char *proc_root = "/proc";
+    guint resample = 0;
+    gboolean prewarm_users = FALSE;
+    const char *attach_socket = NULL;
+    const char *replay_file = NULL;
+    unsigned int extra_want = 0;
+    const char *filter_text = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+            interval_ms = (guint) atoi(argv[++i]);  // Milliseconds between samples
+        } else if (strcmp(argv[i], "--cpu-budget") == 0 && i + 1 < argc) {
+            cpu_budget_pct = (guint) atoi(argv[++i]);  // Percent of one CPU the sampler may use
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = (guint) atoi(argv[++i]);  // Scan threads, 0 = one per online CPU
+        } else if (strcmp(argv[i], "--proc-root") == 0 && i + 1 < argc) {
+            proc_root = argv[++i];  // e.g. a tree written by proc_fixture
+        } else if (strcmp(argv[i], "--events") == 0) {
+            resample = resample ? resample : DEFAULT_RESAMPLE;  // Follow the proc connector
+        } else if (strcmp(argv[i], "--resample") == 0 && i + 1 < argc) {
+            resample = (guint) MAX(atoi(argv[++i]), 1);  // Implies --events
+        } else if (strcmp(argv[i], "--prewarm-users") == 0) {
+            prewarm_users = TRUE;  // Load the whole passwd database at startup
+        } else if (strcmp(argv[i], "--attach") == 0 && i + 1 < argc) {
+            attach_socket = argv[++i];  // Map proc_snapd's snapshots instead of scanning
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_file = argv[++i];  // Play back a file written by proc_info_reader --record
+        } else if (strcmp(argv[i], "--extra") == 0) {
+            extra_want = PROC_EXTRA_MEM | PROC_EXTRA_FDS;  // PSS, swap and descriptor columns
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter_text = argv[++i];  // Start with this in the filter bar
+        } else {
+            g_printerr("Usage: %s [--interval MS] [--cpu-budget PCT] [--threads N] [--proc-root DIR] [--events [--resample N]] [--prewarm-users] [--extra] [--filter EXPR] [--attach SOCKET | --replay FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (attach_socket != NULL && replay_file != NULL) {
+        g_printerr("--attach and --replay cannot be combined\n");
+        return 1;
+    }
+    if (filter_text != NULL) {
+        struct proc_filter parsed;
+        char error[128];
+        if (proc_filter_parse(&parsed, filter_text, error, sizeof(error)) < 0) {
+            g_printerr("--filter: %s\n", error);
+            return 1;
+        }
+        proc_filter_free(&parsed);
+    }
+
     // Set GTK to use dark mode (based on the environment theme)
     GtkSettings *settings = gtk_settings_get_default();
     g_object_set(settings, "gtk-theme-name", "Adwaita-dark", NULL);
@@ -263,11 +1032,10 @@ int main(int argc, char *argv[]) {
     sa.sa_flags = SA_SIGINFO;
     sigaction(SIGSEGV, &sa, NULL);
 
-    seen_pids = g_hash_table_new_full(g_int_hash, g_int_equal, g_free, NULL);  // Initialize hash table for seen PIDs
-
     GtkWidget *window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
     gtk_window_set_title(GTK_WINDOW(window), "Process Information");
     gtk_window_set_default_size(GTK_WINDOW(window), 800, 600);
+    g_signal_connect(window, "destroy", G_CALLBACK(gtk_main_quit), NULL);
 
     // Set an application icon (make sure you have a PNG file in your project directory)
     GdkPixbuf *icon = gdk_pixbuf_new_from_file("icon.png", NULL);
@@ -276,36 +1044,70 @@ int main(int argc, char *argv[]) {
     GtkWidget *main_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
     gtk_container_add(GTK_CONTAINER(window), main_box);
 
-    store = gtk_tree_store_new(5, G_TYPE_INT, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_UINT);
+    model = proc_model_new();
 
-    GtkWidget *treeview = gtk_tree_view_new_with_model(GTK_TREE_MODEL(store));
+    // Fixed-height rows let the view size itself without measuring every row
+    GtkWidget *treeview = gtk_tree_view_new_with_model(GTK_TREE_MODEL(model));
     GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
 
-    GtkTreeViewColumn *column = gtk_tree_view_column_new_with_attributes("PID", renderer, "text", 0, NULL);
-    gtk_tree_view_append_column(GTK_TREE_VIEW(treeview), column);
-
-    column = gtk_tree_view_column_new_with_attributes("User", renderer, "text", 1, NULL);
-    gtk_tree_view_append_column(GTK_TREE_VIEW(treeview), column);
-
-    column = gtk_tree_view_column_new_with_attributes("Command", renderer, "text", 2, NULL);
-    gtk_tree_view_append_column(GTK_TREE_VIEW(treeview), column);
-
-    column = gtk_tree_view_column_new_with_attributes("Memory", renderer, "text", 3, NULL);
-    gtk_tree_view_append_column(GTK_TREE_VIEW(treeview), column);
+    append_fixed_column(GTK_TREE_VIEW(treeview), renderer, "PID", PROC_MODEL_COL_PID, 120);
+    append_fixed_column(GTK_TREE_VIEW(treeview), renderer, "User", PROC_MODEL_COL_USER, 120);
+    append_fixed_column(GTK_TREE_VIEW(treeview), renderer, "Command", PROC_MODEL_COL_COMM, 220);
+    append_fixed_column(GTK_TREE_VIEW(treeview), renderer, "Memory", PROC_MODEL_COL_RSS, 100);
+    append_fixed_column(GTK_TREE_VIEW(treeview), renderer, "CPU Time", PROC_MODEL_COL_CPU, 100);
+    append_fixed_column(GTK_TREE_VIEW(treeview), renderer, "Command Line", PROC_MODEL_COL_CMDLINE, 300);
+    if (extra_want && replay_file == NULL) {
+        // Read a few processes per sample, so every value says how old it is
+        append_fixed_column(GTK_TREE_VIEW(treeview), renderer, "PSS", PROC_MODEL_COL_PSS, 110);
+        append_fixed_column(GTK_TREE_VIEW(treeview), renderer, "Swap", PROC_MODEL_COL_SWAP, 100);
+        append_fixed_column(GTK_TREE_VIEW(treeview), renderer, "FDs", PROC_MODEL_COL_FDS, 80);
+    }
+    gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(treeview), TRUE);
 
-    column = gtk_tree_view_column_new_with_attributes("CPU Time", renderer, "text", 4, NULL);
-    gtk_tree_view_append_column(GTK_TREE_VIEW(treeview), column);
+    // Type-ahead search reads every row; keep it on the column the scan fills in
+    gtk_tree_view_set_search_column(GTK_TREE_VIEW(treeview), PROC_MODEL_COL_COMM);
+    g_signal_connect(treeview, "row-expanded", G_CALLBACK(prefetch_expanded), NULL);
 
     GtkWidget *scrolled_window = gtk_scrolled_window_new(NULL, NULL);
     gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled_window), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
     gtk_container_add(GTK_CONTAINER(scrolled_window), treeview);
 
+    // Rollups by user or command replace the tree with a list of groups, busiest first
+    group_store = gtk_list_store_new(GROUP_N_COLUMNS, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_UINT, G_TYPE_UINT64,
+                                     G_TYPE_DOUBLE, G_TYPE_UINT64);
+    group_rows = g_array_new(FALSE, TRUE, sizeof(struct group_row));
+    gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(group_store), GROUP_COL_CPU_PCT, GTK_SORT_DESCENDING);
+    GtkWidget *group_view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(group_store));
+    append_list_column(GTK_TREE_VIEW(group_view), "Name", GROUP_COL_NAME, FALSE);
+    append_list_column(GTK_TREE_VIEW(group_view), "Processes", GROUP_COL_PROCESSES, FALSE);
+    append_list_column(GTK_TREE_VIEW(group_view), "Threads", GROUP_COL_THREADS, FALSE);
+    append_list_column(GTK_TREE_VIEW(group_view), "Memory", GROUP_COL_RSS, FALSE);
+    append_list_column(GTK_TREE_VIEW(group_view), "CPU", GROUP_COL_CPU_PCT, TRUE);
+    append_list_column(GTK_TREE_VIEW(group_view), "CPU Time", GROUP_COL_CPU, FALSE);
+
+    GtkWidget *group_window = gtk_scrolled_window_new(NULL, NULL);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(group_window), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+    gtk_container_add(GTK_CONTAINER(group_window), group_view);
+    gtk_widget_set_no_show_all(group_window, TRUE);
+    gtk_widget_show(group_view);
+
+    static GtkWidget *views[2];
+    views[0] = scrolled_window;
+    views[1] = group_window;
+    GtkWidget *group_combo = gtk_combo_box_text_new();
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(group_combo), "process", "Processes");
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(group_combo), "user", "By user");
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(group_combo), "comm", "By command");
+    gtk_combo_box_text_append(GTK_COMBO_BOX_TEXT(group_combo), "tree", "By subtree");
+    gtk_combo_box_set_active_id(GTK_COMBO_BOX(group_combo), "process");
+    g_signal_connect(group_combo, "changed", G_CALLBACK(change_grouping), views);
+
     GtkWidget *refresh_button = gtk_button_new_with_label("Refresh");
     GtkWidget *collapse_button = gtk_button_new_with_label("Collapse All");
     GtkWidget *expand_button = gtk_button_new_with_label("Expand All");
     GtkWidget *kill_button = gtk_button_new_with_label("Kill Process");
 
-    g_signal_connect(refresh_button, "clicked", G_CALLBACK(refresh_data), NULL);
+    g_signal_connect(refresh_button, "clicked", G_CALLBACK(refresh_data), treeview);
     g_signal_connect(collapse_button, "clicked", G_CALLBACK(collapse_treeview), treeview);
     g_signal_connect(expand_button, "clicked", G_CALLBACK(expand_all), treeview);
     g_signal_connect(kill_button, "clicked", G_CALLBACK(kill_process), treeview);
@@ -315,17 +1117,96 @@ int main(int argc, char *argv[]) {
     gtk_box_pack_start(GTK_BOX(button_box), collapse_button, TRUE, TRUE, 0);
     gtk_box_pack_start(GTK_BOX(button_box), expand_button, TRUE, TRUE, 0);
     gtk_box_pack_start(GTK_BOX(button_box), kill_button, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(button_box), group_combo, FALSE, FALSE, 0);
+
+    // Filters the tree on every keystroke from an index the sampler keeps, not by walking rows
+    GtkWidget *filter_entry = gtk_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(filter_entry),
+                                   "Filter: name, cmd=REGEX, user=NAME, uid=N, minrss=KB, maxrss=KB, mincpu=PCT");
+    gtk_entry_set_max_length(GTK_ENTRY(filter_entry), PROC_FILTER_LEN - 1);
+    g_signal_connect(filter_entry, "changed", G_CALLBACK(change_filter), treeview);
 
     gtk_box_pack_start(GTK_BOX(main_box), button_box, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(main_box), filter_entry, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(main_box), scrolled_window, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(main_box), group_window, TRUE, TRUE, 0);
 
-    populate_treeview(store, NULL);
+    // The threads of the selected process, busiest first; a recording has no threads
+    thread_store = gtk_list_store_new(THREAD_N_COLUMNS, G_TYPE_INT, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_DOUBLE,
+                                      G_TYPE_UINT64);
+    gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(thread_store), THREAD_COL_CPU_PCT, GTK_SORT_DESCENDING);
+    if (replay_file == NULL) {
+        GtkWidget *thread_view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(thread_store));
+        append_list_column(GTK_TREE_VIEW(thread_view), "TID", THREAD_COL_TID, FALSE);
+        append_list_column(GTK_TREE_VIEW(thread_view), "Thread", THREAD_COL_COMM, FALSE);
+        append_list_column(GTK_TREE_VIEW(thread_view), "State", THREAD_COL_STATE, FALSE);
+        append_list_column(GTK_TREE_VIEW(thread_view), "CPU", THREAD_COL_CPU_PCT, TRUE);
+        append_list_column(GTK_TREE_VIEW(thread_view), "CPU Ticks", THREAD_COL_CPU, FALSE);
+        GtkWidget *thread_window = gtk_scrolled_window_new(NULL, NULL);
+        gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(thread_window), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+        gtk_widget_set_size_request(thread_window, -1, 150);
+        gtk_container_add(GTK_CONTAINER(thread_window), thread_view);
+        gtk_box_pack_start(GTK_BOX(main_box), thread_window, FALSE, FALSE, 0);
+        g_signal_connect(gtk_tree_view_get_selection(GTK_TREE_VIEW(treeview)), "changed", G_CALLBACK(select_threads),
+                         NULL);
+    }
+
+    // A replay shows the past: nothing to kill, and a slider to move through time
+    if (replay_file != NULL) {
+        gtk_widget_set_sensitive(kill_button, FALSE);
+        time_slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 0, 1, 1);
+        g_signal_connect(time_slider, "format-value", G_CALLBACK(format_replay_time), NULL);
+        time_slider_handler = g_signal_connect(time_slider, "value-changed", G_CALLBACK(seek_replay), NULL);
+        gtk_box_pack_start(GTK_BOX(main_box), time_slider, FALSE, FALSE, 0);
+    }
+
+    // The tool's own cost per sample, so the interval can be tuned from real numbers
+    status_bar = gtk_statusbar_new();
+    gtk_box_pack_start(GTK_BOX(main_box), status_bar, FALSE, FALSE, 0);
+    proc_stats_enable();
+
+    // Before the sampler and fetcher threads exist, since pre-warming uses getpwent
+    if (proc_users_init(&users, prewarm_users) < 0) {
+        perror("Failed to allocate the user cache");
+        return 1;
+    }
+    if (proc_fetch_start(&fetcher, proc_root, &users, redraw_fetched, treeview) < 0) {
+        perror("Failed to open /proc");
+        return 1;
+    }
+    // The live command lines of recorded PIDs would belong to other processes
+    if (replay_file == NULL) {
+        proc_model_set_fetcher(model, &fetcher);
+    }
+
+    // The first sample arrives through the main loop like every later one
+    if (sampler_start(&sampler, GTK_TREE_VIEW(treeview), proc_root, attach_socket, replay_file, interval_ms,
+                      cpu_budget_pct, threads, resample, extra_want) < 0) {
+        perror(attach_socket != NULL ? attach_socket : replay_file != NULL ? replay_file : "Failed to open /proc");
+        return 1;
+    }
+
+    // Only now: setting the text runs change_filter, which takes the sampler's lock
+    if (filter_text != NULL) {
+        gtk_entry_set_text(GTK_ENTRY(filter_entry), filter_text);
+    }
 
     gtk_widget_show_all(window);
 
     gtk_main();
 
-    g_hash_table_destroy(seen_pids);  // Clean up the hash table
+    sampler_stop(&sampler);
+    proc_fetch_stop(&fetcher);
+    proc_users_destroy(&users);
+    g_object_unref(model);
+    g_object_unref(group_store);
+    g_object_unref(thread_store);
+    g_array_free(group_rows, TRUE);
+    if (filter_slot >= 0) {
+        proc_filter_free(&filters[filter_slot]);
+    }
+    proc_columns_tree_free(&filter_tree);
+    g_free(filter_bits);
 
     return 0;
 }